@@ -1,4 +1,5 @@
 #include "Application.h"
+#include "Profiler.h"
 
 namespace RayTracer
 {
@@ -119,6 +120,11 @@ namespace RayTracer
 
 	Application::~Application()
 	{
+		if (!m_Window)
+		{
+			return;
+		}
+
 		ImGui_ImplOpenGL3_Shutdown();
 		ImGui_ImplGlfw_Shutdown();
 		ImGui::DestroyContext();
@@ -162,7 +168,8 @@ namespace RayTracer
 		glfwSetScrollCallback(m_Window, ScrollCallback);
 		glfwSetCursorPosCallback(m_Window, CursorPosCallback);
 		glfwSetFramebufferSizeCallback(m_Window, FramebufferSizeCallback);
-		glfwSetWindowUserPointer(m_Window, (void*)&m_EventQueue);
+		glfwSetWindowUserPointer(m_Window, (void*)this);
+		m_MainThread = std::this_thread::get_id();
 		OnUserCreate(glfwGetTime());
 		glfwGetFramebufferSize(m_Window, &m_CurrentWidth, &m_CurrentHeight);
 
@@ -245,6 +252,39 @@ namespace RayTracer
 		glfwSwapBuffers(m_Window);
 
 		m_CurrentFrame += 1;
+		m_StatisticsFrames++;
+
+		const double time = glfwGetTime();
+
+		if (time - m_StatisticsTime >= 1.0)
+		{
+			const uint64_t cpu_time = Profiler::GetThreadCPUTime();
+			const double elapsed = time - m_StatisticsTime;
+
+			m_LoopCPUUsage = static_cast<float>(static_cast<double>(cpu_time - m_StatisticsCPUTime) / 1e9 / elapsed * 100.0);
+			m_FrameRate = static_cast<float>(static_cast<double>(m_StatisticsFrames) / elapsed);
+			m_StatisticsFrames = 0;
+			m_StatisticsTime = time;
+			m_StatisticsCPUTime = cpu_time;
+		}
+	}
+
+	void Application::WaitForEvents(double timeout)
+	{
+		if (m_RedrawFrames > 0)
+		{
+			m_RedrawFrames--;
+			return;
+		}
+
+		if (WantsRedraw() || !m_EventQueue.IsEmpty())
+		{
+			return;
+		}
+
+		// Returns after the first window event, or once PostEvent calls glfwPostEmptyEvent
+		RT_PROFILE_ZONE("Wait For Events");
+		glfwWaitEventsTimeout(timeout);
 	}
 
 	/*
@@ -252,13 +292,28 @@ namespace RayTracer
 	*/
 	void Application::PollEvents()
 	{
-		while (!m_EventQueue.empty())
+		Event e;
+
+		while (m_EventQueue.Pop(e))
 		{
-			OnEvent(m_EventQueue.front());
-			m_EventQueue.pop();
+			OnEvent(e);
+			m_RedrawFrames = 3;
 		}
 	}
 
+	bool Application::PostEvent(const Event& e)
+	{
+		const bool queued = m_EventQueue.Push(e);
+
+		// The main thread may be blocked in WaitForEvents, the GLFW callbacks run on it while it polls
+		if (m_Window && std::this_thread::get_id() != m_MainThread)
+		{
+			glfwPostEmptyEvent();
+		}
+
+		return queued;
+	}
+
 	/*
 	Gets the current time of the program (since glfw was initialized)
 	*/
@@ -313,8 +368,7 @@ namespace RayTracer
 
 		if (ptr)
 		{
-			std::queue<Event>* q = (std::queue<Event>*) ptr;
-			q->push(e);
+			static_cast<Application*>(ptr)->PostEvent(e);
 		}
 	}
 
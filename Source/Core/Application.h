@@ -1,9 +1,9 @@
 #pragma once
 #include <iostream>
 #include <string>
-#include <queue>
 #include <assert.h>
 #include <memory>
+#include <thread>
 
 #include <glad/glad.h>
 #include <imgui.h>
@@ -11,6 +11,8 @@
 #include <imgui_impl_opengl3.h>
 #include <glfw/glfw3.h>
 
+#include "EventQueue.h"
+
 namespace RayTracer
 {
 	enum EventTypes
@@ -22,6 +24,13 @@ namespace RayTracer
 		MouseScroll,
 		MouseMove,
 		WindowResize,
+
+		// Posted by the render threads
+		TileFinished, // New pixels are ready to be uploaded, at most one is queued at a time
+		PassFinished,
+		RenderFinished, // The target sample count was reached
+		JobFailed,
+
 		Undefined
 	};
 
@@ -37,6 +46,11 @@ namespace RayTracer
 		double mx, my; // Mouse X and Mouse Y
 		double msx, msy; // Mouse scroll X and Mouse scroll y (The mouse scroll offset)
 		double ts; // Event Timestep
+
+		uint32_t tile; // The finished tile (UINT32_MAX if the whole image was updated at once), or the first tile of the failed job
+		uint32_t samples; // Samples per pixel after the pass
+		uint32_t generation; // The render generation (camera) that the pass belongs to
+		const char* message; // Why the job failed, a string literal
 	};
 
 	class Application
@@ -54,8 +68,22 @@ namespace RayTracer
 		unsigned int GetHeight();
 		void SetCursorLocked(bool locked);
 
+		// Can be called from any thread, the event is passed to OnEvent on the main thread. Returns false if the queue was full
+		bool PostEvent(const Event& e);
+		inline uint64_t GetDroppedEventCount() const { return m_EventQueue.GetDroppedCount(); }
+
+		/*
+		Called before OnUpdate, blocks until an event arrives (at most timeout seconds) when there is nothing to redraw.
+		The frames right after an event are always drawn so that ImGui can settle, events posted from other threads wake it up
+		*/
+		void WaitForEvents(double timeout);
+
+		// Measured over the last second : the CPU time of the main thread in percent of one core, and the frames drawn
+		inline float GetLoopCPUUsage() const { return m_LoopCPUUsage; }
+		inline float GetFrameRate() const { return m_FrameRate; }
+
 	protected:
-		GLFWwindow* m_Window;
+		GLFWwindow* m_Window = nullptr; // Stays null when the app runs without a window (--render, --sequence)
 		unsigned int m_Width = 800;
 		unsigned int m_Height = 600;
 		std::string m_Appname;
@@ -68,10 +96,21 @@ namespace RayTracer
 		virtual void OnImguiRender(double ts) = 0;
 		virtual void OnEvent(Event e) = 0;
 
+		// Whether frames have to be drawn without new events (eg : the camera is moving)
+		virtual bool WantsRedraw() { return false; }
+
 	private:
 		void PollEvents();
 		uint64_t m_CurrentFrame;
-		std::queue<Event> m_EventQueue;
+		EventQueue<Event> m_EventQueue; // Filled by the GLFW callbacks and the render threads
+		std::thread::id m_MainThread;
+		int m_RedrawFrames = 0; // Frames that are still drawn after the last event
+
+		uint64_t m_StatisticsFrames = 0;
+		double m_StatisticsTime = 0.0;
+		uint64_t m_StatisticsCPUTime = 0;
+		float m_LoopCPUUsage = 0.0f;
+		float m_FrameRate = 0.0f;
 		int m_CurrentWidth = 0;
 		int m_CurrentHeight = 0;
 
@@ -0,0 +1,872 @@
+#include "BVH.h"
+#include "Lights.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+
+RayTracer::BVH g_SceneBVH;
+
+namespace RayTracer
+{
+	// Traversal steps and sphere tests are assumed to cost about the same
+	static const float TRAVERSAL_COST = 1.0f;
+	static const float INTERSECTION_COST = 1.0f;
+
+	// The refit is split in at least this many independent subtrees
+	static const size_t REFIT_SUBTREES = 64;
+
+	/*
+	Size of the traversal stacks, at most one node is pushed per level so no leaf may be deeper than this.
+	SAH can peel off one sphere per level (eg : exponentially spaced spheres), so below BVH_MEDIAN_SPLIT_DEPTH nodes
+	are split at the median instead, which halves the count and reaches single spheres within 32 more levels
+	*/
+	static const int BVH_STACK_SIZE = 64;
+	static const uint32_t BVH_MEDIAN_SPLIT_DEPTH = BVH_STACK_SIZE - 32;
+
+	static inline AABB GetSphereBounds(const Sphere& sphere)
+	{
+		AABB bounds;
+		bounds.Min = sphere.Center - glm::vec3(sphere.Radius);
+		bounds.Max = sphere.Center + glm::vec3(sphere.Radius);
+		return bounds;
+	}
+
+	static inline void SetNodeBounds(BVHNode& node, const AABB& bounds)
+	{
+		node.Min = bounds.Min;
+		node.Max = bounds.Max;
+	}
+
+	static inline AABB GetNodeBounds(const BVHNode& node)
+	{
+		AABB bounds;
+		bounds.Min = node.Min;
+		bounds.Max = node.Max;
+		return bounds;
+	}
+
+	struct BVHBin
+	{
+		AABB Bounds;
+		uint32_t Count = 0;
+	};
+
+	struct BVHSplit
+	{
+		int Axis = -1;
+		int Bin = 0; // Bins below this go to the left child
+		float Cost = std::numeric_limits<float>::max();
+	};
+
+	// Primitive bounds and centroids of the build, indexed by sphere index
+	struct BVHBuildData
+	{
+		std::vector<AABB> Bounds;
+		std::vector<glm::vec3> Centroids;
+		int BinCount = 16;
+		uint32_t MaxLeafSize = 4;
+	};
+
+	// A node of the top of the tree that still has to be split, with the bounds of its primitives' centroids
+	struct BVHBuildTask
+	{
+		uint32_t Node;
+		uint32_t Depth;
+		AABB CentroidBounds;
+	};
+
+	// Primitives are binned and partitioned in chunks of this size, it doesn't depend on the thread count so neither does the tree
+	static const uint32_t BUILD_CHUNK_SIZE = 4096;
+
+	// Runs function(0) to function(count - 1) on up to thread_count threads, without spawning any for a single task
+	template <typename T>
+	static void RunParallel(int count, int thread_count, const T& function)
+	{
+		if (thread_count <= 1 || count <= 1)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				function(i);
+			}
+
+			return;
+		}
+
+		ParallelFor(count, glm::min(count, thread_count), function);
+	}
+
+	static inline int GetBin(const glm::vec3& centroid, int axis, const AABB& centroid_bounds, float scale, int bin_count)
+	{
+		return glm::min(static_cast<int>((centroid[axis] - centroid_bounds.Min[axis]) * scale), bin_count - 1);
+	}
+
+	static inline glm::vec3 GetBinScales(const AABB& centroid_bounds, int bin_count)
+	{
+		const glm::vec3 extent = centroid_bounds.Max - centroid_bounds.Min;
+		glm::vec3 scales;
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			scales[axis] = extent[axis] > 0.0f ? (float)bin_count / extent[axis] : 0.0f;
+		}
+
+		return scales;
+	}
+
+	// Bins count primitives on all three axes, bins has bin_count entries per axis
+	static void BinPrimitives(const BVHBuildData& data, const uint32_t* indices, uint32_t count, const AABB& centroid_bounds, BVHBin* bins)
+	{
+		const int bin_count = data.BinCount;
+		const glm::vec3 scales = GetBinScales(centroid_bounds, bin_count);
+		const AABB* bounds = data.Bounds.data();
+		const glm::vec3* centroids = data.Centroids.data();
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			// FindBestSplit skips the axes where all the centroids are in the same place
+			if (scales[axis] <= 0.0f)
+			{
+				continue;
+			}
+
+			BVHBin* axis_bins = bins + axis * bin_count;
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const uint32_t index = indices[i];
+				const glm::vec3& centroid = centroids[index];
+				BVHBin& bin = axis_bins[GetBin(centroid, axis, centroid_bounds, scales[axis], bin_count)];
+				bin.Bounds.Grow(bounds[index]);
+				bin.Count++;
+			}
+		}
+	}
+
+	// The split with the lowest SAH cost (sum of the children's surface area times their primitive count)
+	static BVHSplit FindBestSplit(const BVHBin* bins, int bin_count, uint32_t count, const AABB& centroid_bounds, std::vector<float>& right_costs)
+	{
+		BVHSplit best;
+		right_costs.resize(bin_count);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (centroid_bounds.Max[axis] - centroid_bounds.Min[axis] <= 0.0f)
+			{
+				continue;
+			}
+
+			const BVHBin* axis_bins = bins + axis * bin_count;
+
+			// Sweep from the right to get the cost of every right side, then from the left to combine them
+			AABB right_bounds;
+			uint32_t right_count = 0;
+
+			for (int b = bin_count - 1; b > 0; b--)
+			{
+				right_bounds.Grow(axis_bins[b].Bounds);
+				right_count += axis_bins[b].Count;
+				right_costs[b] = right_count > 0 ? right_bounds.GetSurfaceArea() * (float)right_count : 0.0f;
+			}
+
+			AABB left_bounds;
+			uint32_t left_count = 0;
+
+			for (int b = 0; b < bin_count - 1; b++)
+			{
+				left_bounds.Grow(axis_bins[b].Bounds);
+				left_count += axis_bins[b].Count;
+
+				if (left_count == 0 || left_count == count)
+				{
+					continue;
+				}
+
+				const float cost = left_bounds.GetSurfaceArea() * (float)left_count + right_costs[b + 1];
+
+				if (cost < best.Cost)
+				{
+					best.Cost = cost;
+					best.Axis = axis;
+					best.Bin = b + 1;
+				}
+			}
+		}
+
+		return best;
+	}
+
+	// Whether a node should stay a leaf instead of being split
+	static inline bool ShouldBeLeaf(const BVHBuildData& data, const AABB& node_bounds, uint32_t count, const BVHSplit& split)
+	{
+		if (count == 1)
+		{
+			return true;
+		}
+
+		const float node_area = node_bounds.GetSurfaceArea();
+		const float leaf_cost = INTERSECTION_COST * node_area * (float)count;
+		const float split_cost = TRAVERSAL_COST * node_area + INTERSECTION_COST * split.Cost;
+
+		return count <= data.MaxLeafSize && (split.Axis < 0 || leaf_cost <= split_cost);
+	}
+
+	// Splits the primitives at the median of the longest axis of their centroids, returns the left count
+	static uint32_t SplitMedian(const BVHBuildData& data, uint32_t* indices, uint32_t count, const AABB& centroid_bounds)
+	{
+		const glm::vec3 extent = centroid_bounds.Max - centroid_bounds.Min;
+		const int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+		const uint32_t left_count = count / 2;
+
+		std::nth_element(indices, indices + left_count, indices + count, [&](uint32_t a, uint32_t b)
+		{
+			return data.Centroids[a][axis] < data.Centroids[b][axis];
+		});
+
+		return left_count;
+	}
+
+	/*
+	Builds the subtree below nodes[0] (whose LeftFirst and Count are the primitive range) on the calling thread.
+	Child indices are relative to nodes, indices are the primitive indices of the whole tree. depth is the depth of nodes[0] in the tree
+	*/
+	static void BuildSubtree(const BVHBuildData& data, std::vector<BVHNode>& nodes, uint32_t* indices, uint32_t depth)
+	{
+		std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, depth } }; // Node and depth
+		std::vector<BVHBin> bins(3 * data.BinCount);
+		std::vector<float> right_costs;
+
+		while (!stack.empty())
+		{
+			const uint32_t node_index = stack.back().first;
+			const uint32_t node_depth = stack.back().second;
+			stack.pop_back();
+
+			const uint32_t first = nodes[node_index].LeftFirst;
+			const uint32_t count = nodes[node_index].Count;
+
+			AABB node_bounds;
+			AABB centroid_bounds;
+
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				node_bounds.Grow(data.Bounds[indices[i]]);
+				centroid_bounds.Grow(data.Centroids[indices[i]]);
+			}
+
+			SetNodeBounds(nodes[node_index], node_bounds);
+
+			if (count == 1)
+			{
+				continue;
+			}
+
+			uint32_t left_count = count / 2;
+
+			if (node_depth >= BVH_MEDIAN_SPLIT_DEPTH)
+			{
+				if (count <= data.MaxLeafSize)
+				{
+					continue;
+				}
+
+				left_count = SplitMedian(data, indices + first, count, centroid_bounds);
+			}
+
+			else
+			{
+				std::fill(bins.begin(), bins.end(), BVHBin());
+				BinPrimitives(data, indices + first, count, centroid_bounds, bins.data());
+				const BVHSplit split = FindBestSplit(bins.data(), data.BinCount, count, centroid_bounds, right_costs);
+
+				if (ShouldBeLeaf(data, node_bounds, count, split))
+				{
+					continue;
+				}
+
+				// Without a split all the centroids are in the same place and any split is as good as another
+				if (split.Axis >= 0)
+				{
+					const float scale = GetBinScales(centroid_bounds, data.BinCount)[split.Axis];
+					auto middle = std::partition(indices + first, indices + first + count, [&](uint32_t index)
+					{
+						return GetBin(data.Centroids[index], split.Axis, centroid_bounds, scale, data.BinCount) < split.Bin;
+					});
+
+					left_count = static_cast<uint32_t>(middle - (indices + first));
+				}
+			}
+
+			const uint32_t left = static_cast<uint32_t>(nodes.size());
+			nodes[node_index].LeftFirst = left;
+			nodes[node_index].Count = 0;
+			nodes.push_back({ glm::vec3(0.0f), first, glm::vec3(0.0f), left_count });
+			nodes.push_back({ glm::vec3(0.0f), first + left_count, glm::vec3(0.0f), count - left_count });
+
+			stack.push_back({ left + 1, node_depth + 1 });
+			stack.push_back({ left, node_depth + 1 });
+		}
+	}
+
+	void BVH::Build(const std::vector<Sphere>& spheres, const BVHSettings& settings, int thread_count)
+	{
+		RT_PROFILE_ZONE("BVH Build");
+
+		auto start = std::chrono::steady_clock::now();
+		const uint32_t count = static_cast<uint32_t>(spheres.size());
+
+		m_Settings = settings;
+		m_Nodes.clear();
+		m_Indices.resize(count);
+
+		if (count == 0)
+		{
+			m_RefitRoots.clear();
+			m_RefitTop.clear();
+			m_BuildCost = 0.0f;
+			m_BuildTime = 0.0f;
+			return;
+		}
+
+		BVHBuildData data;
+		data.BinCount = glm::clamp(settings.Bins, 2, 256);
+		data.MaxLeafSize = static_cast<uint32_t>(glm::max(settings.MaxLeafSize, 1));
+		data.Bounds.resize(count);
+		data.Centroids.resize(count);
+
+		const uint32_t parallel_threshold = glm::max(static_cast<uint32_t>(glm::max(settings.ParallelThreshold, 0)), BUILD_CHUNK_SIZE);
+		const int bins_per_chunk = 3 * data.BinCount;
+		const int chunk_count = static_cast<int>((count + BUILD_CHUNK_SIZE - 1) / BUILD_CHUNK_SIZE);
+
+		RunParallel(chunk_count, thread_count, [&](int chunk)
+		{
+			const uint32_t end = glm::min(count, (chunk + 1) * BUILD_CHUNK_SIZE);
+
+			for (uint32_t i = chunk * BUILD_CHUNK_SIZE; i < end; i++)
+			{
+				data.Bounds[i] = GetSphereBounds(spheres[i]);
+				data.Centroids[i] = spheres[i].Center;
+				m_Indices[i] = i;
+			}
+		});
+
+		AABB root_bounds;
+		AABB root_centroid_bounds;
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			root_bounds.Grow(data.Bounds[i]);
+			root_centroid_bounds.Grow(data.Centroids[i]);
+		}
+
+		m_Nodes.reserve(count * 2);
+		m_Nodes.push_back({ root_bounds.Min, 0, root_bounds.Max, count });
+
+		/*
+		The top of the tree is split one node at a time with every thread binning and partitioning a chunk of the node's primitives.
+		Nodes below the parallel threshold become independent subtrees that are built by one thread each
+		*/
+		std::vector<BVHBuildTask> stack = { { 0, 0, root_centroid_bounds } };
+		std::vector<std::pair<uint32_t, uint32_t>> subtrees; // Root node and depth
+		std::vector<BVHBin> chunk_bins;
+		std::vector<BVHBin> bins(bins_per_chunk);
+		std::vector<float> right_costs;
+		std::vector<uint32_t> scratch;
+		std::vector<AABB> chunk_centroids; // Of the left and the right primitives of every chunk
+
+		while (!stack.empty())
+		{
+			const uint32_t node_index = stack.back().Node;
+			const uint32_t depth = stack.back().Depth;
+			const AABB centroid_bounds = stack.back().CentroidBounds;
+			stack.pop_back();
+
+			const uint32_t first = m_Nodes[node_index].LeftFirst;
+			const uint32_t node_count = m_Nodes[node_index].Count;
+
+			// The sequential build also takes over once the depth calls for median splits
+			if (node_count < parallel_threshold || depth >= BVH_MEDIAN_SPLIT_DEPTH)
+			{
+				subtrees.push_back({ node_index, depth });
+				continue;
+			}
+
+			const int node_chunks = static_cast<int>((node_count + BUILD_CHUNK_SIZE - 1) / BUILD_CHUNK_SIZE);
+			chunk_bins.assign(node_chunks * bins_per_chunk, BVHBin());
+
+			RunParallel(node_chunks, thread_count, [&](int chunk)
+			{
+				const uint32_t offset = chunk * BUILD_CHUNK_SIZE;
+				BinPrimitives(data, m_Indices.data() + first + offset, glm::min(BUILD_CHUNK_SIZE, node_count - offset), centroid_bounds, chunk_bins.data() + chunk * bins_per_chunk);
+			});
+
+			std::fill(bins.begin(), bins.end(), BVHBin());
+
+			for (int chunk = 0; chunk < node_chunks; chunk++)
+			{
+				for (int b = 0; b < bins_per_chunk; b++)
+				{
+					const BVHBin& bin = chunk_bins[chunk * bins_per_chunk + b];
+					bins[b].Bounds.Grow(bin.Bounds);
+					bins[b].Count += bin.Count;
+				}
+			}
+
+			const BVHSplit split = FindBestSplit(bins.data(), data.BinCount, node_count, centroid_bounds, right_costs);
+
+			if (split.Axis < 0)
+			{
+				// The centroids are all in the same place, the sequential build handles that
+				subtrees.push_back({ node_index, depth });
+				continue;
+			}
+
+			// Stable partition: every chunk knows from its bins how many of its primitives go left, so it can scatter them on its own
+			std::vector<uint32_t> left_offsets(node_chunks);
+			std::vector<uint32_t> right_offsets(node_chunks);
+			uint32_t left_count = 0;
+
+			for (int chunk = 0; chunk < node_chunks; chunk++)
+			{
+				left_offsets[chunk] = left_count;
+
+				for (int b = 0; b < split.Bin; b++)
+				{
+					left_count += chunk_bins[chunk * bins_per_chunk + split.Axis * data.BinCount + b].Count;
+				}
+			}
+
+			for (int chunk = 0; chunk < node_chunks; chunk++)
+			{
+				right_offsets[chunk] = left_count + chunk * BUILD_CHUNK_SIZE - left_offsets[chunk];
+			}
+
+			scratch.resize(node_count);
+			chunk_centroids.assign(node_chunks * 2, AABB());
+			const float scale = GetBinScales(centroid_bounds, data.BinCount)[split.Axis];
+
+			RunParallel(node_chunks, thread_count, [&](int chunk)
+			{
+				const uint32_t offset = chunk * BUILD_CHUNK_SIZE;
+				const uint32_t end = glm::min(offset + BUILD_CHUNK_SIZE, node_count);
+				uint32_t left = left_offsets[chunk];
+				uint32_t right = right_offsets[chunk];
+				AABB left_centroids;
+				AABB right_centroids;
+
+				for (uint32_t i = offset; i < end; i++)
+				{
+					const uint32_t index = m_Indices[first + i];
+					const glm::vec3& centroid = data.Centroids[index];
+
+					if (GetBin(centroid, split.Axis, centroid_bounds, scale, data.BinCount) < split.Bin)
+					{
+						scratch[left++] = index;
+						left_centroids.Grow(centroid);
+					}
+
+					else
+					{
+						scratch[right++] = index;
+						right_centroids.Grow(centroid);
+					}
+				}
+
+				chunk_centroids[chunk * 2] = left_centroids;
+				chunk_centroids[chunk * 2 + 1] = right_centroids;
+			});
+
+			RunParallel(node_chunks, thread_count, [&](int chunk)
+			{
+				const uint32_t offset = chunk * BUILD_CHUNK_SIZE;
+				const uint32_t end = glm::min(offset + BUILD_CHUNK_SIZE, node_count);
+				std::copy(scratch.begin() + offset, scratch.begin() + end, m_Indices.begin() + first + offset);
+			});
+
+			// The children's bounds are the union of their bins, their centroid bounds were found while partitioning
+			AABB left_bounds, right_bounds, left_centroids, right_centroids;
+
+			for (int b = 0; b < data.BinCount; b++)
+			{
+				(b < split.Bin ? left_bounds : right_bounds).Grow(bins[split.Axis * data.BinCount + b].Bounds);
+			}
+
+			for (int chunk = 0; chunk < node_chunks; chunk++)
+			{
+				left_centroids.Grow(chunk_centroids[chunk * 2]);
+				right_centroids.Grow(chunk_centroids[chunk * 2 + 1]);
+			}
+
+			const uint32_t left = static_cast<uint32_t>(m_Nodes.size());
+			m_Nodes[node_index].LeftFirst = left;
+			m_Nodes[node_index].Count = 0;
+			m_Nodes.push_back({ left_bounds.Min, first, left_bounds.Max, left_count });
+			m_Nodes.push_back({ right_bounds.Min, first + left_count, right_bounds.Max, node_count - left_count });
+
+			stack.push_back({ left + 1, depth + 1, right_centroids });
+			stack.push_back({ left, depth + 1, left_centroids });
+		}
+
+		// Build the subtrees, the largest ones first so that the small ones fill the gaps at the end
+		std::sort(subtrees.begin(), subtrees.end(), [&](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b)
+		{
+			return m_Nodes[a.first].Count > m_Nodes[b.first].Count;
+		});
+		std::vector<std::vector<BVHNode>> subtree_nodes(subtrees.size());
+
+		for (size_t i = 0; i < subtrees.size(); i++)
+		{
+			subtree_nodes[i].reserve(m_Nodes[subtrees[i].first].Count * 2);
+			subtree_nodes[i].push_back(m_Nodes[subtrees[i].first]);
+		}
+
+		RunParallel(static_cast<int>(subtrees.size()), thread_count, [&](int i)
+		{
+			BuildSubtree(data, subtree_nodes[i], m_Indices.data(), subtrees[i].second);
+		});
+
+		// Append them to the tree, their first node replaces the subtree root and the rest goes after the nodes built so far
+		std::vector<uint32_t> subtree_offsets(subtrees.size());
+		uint32_t node_count = static_cast<uint32_t>(m_Nodes.size());
+
+		for (size_t i = 0; i < subtrees.size(); i++)
+		{
+			subtree_offsets[i] = node_count;
+			node_count += static_cast<uint32_t>(subtree_nodes[i].size()) - 1;
+		}
+
+		m_Nodes.resize(node_count);
+
+		RunParallel(static_cast<int>(subtrees.size()), thread_count, [&](int i)
+		{
+			std::vector<BVHNode>& nodes = subtree_nodes[i];
+
+			for (BVHNode& node : nodes)
+			{
+				if (!node.IsLeaf())
+				{
+					node.LeftFirst += subtree_offsets[i] - 1;
+				}
+			}
+
+			m_Nodes[subtrees[i].first] = nodes[0];
+			std::copy(nodes.begin() + 1, nodes.end(), m_Nodes.begin() + subtree_offsets[i]);
+		});
+
+		// Split the tree in subtrees for the parallel refit, breadth first so that they are about the same size
+		std::vector<uint32_t> level = { 0 };
+		m_RefitTop.clear();
+
+		while (level.size() < REFIT_SUBTREES)
+		{
+			std::vector<uint32_t> next;
+			bool split = false;
+
+			for (uint32_t node : level)
+			{
+				if (m_Nodes[node].IsLeaf())
+				{
+					next.push_back(node);
+					continue;
+				}
+
+				m_RefitTop.push_back(node);
+				next.push_back(m_Nodes[node].LeftFirst);
+				next.push_back(m_Nodes[node].LeftFirst + 1);
+				split = true;
+			}
+
+			level.swap(next);
+
+			if (!split)
+			{
+				break;
+			}
+		}
+
+		m_RefitRoots = level;
+		std::reverse(m_RefitTop.begin(), m_RefitTop.end());
+		m_BuildCost = ComputeSAHCost();
+		m_BuildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	AABB BVH::RefitSubtree(const std::vector<Sphere>& spheres, uint32_t node_index)
+	{
+		BVHNode& node = m_Nodes[node_index];
+		AABB bounds;
+
+		if (node.IsLeaf())
+		{
+			for (uint32_t i = node.LeftFirst; i < node.LeftFirst + node.Count; i++)
+			{
+				bounds.Grow(GetSphereBounds(spheres[m_Indices[i]]));
+			}
+		}
+
+		else
+		{
+			bounds = RefitSubtree(spheres, node.LeftFirst);
+			bounds.Grow(RefitSubtree(spheres, node.LeftFirst + 1));
+		}
+
+		SetNodeBounds(node, bounds);
+		return bounds;
+	}
+
+	void BVH::Refit(const std::vector<Sphere>& spheres, int thread_count)
+	{
+		RT_PROFILE_ZONE("BVH Refit");
+
+		RunParallel(static_cast<int>(m_RefitRoots.size()), thread_count, [&](int i) { RefitSubtree(spheres, m_RefitRoots[i]); });
+
+		for (uint32_t node_index : m_RefitTop)
+		{
+			BVHNode& node = m_Nodes[node_index];
+			AABB bounds = GetNodeBounds(m_Nodes[node.LeftFirst]);
+			bounds.Grow(GetNodeBounds(m_Nodes[node.LeftFirst + 1]));
+			SetNodeBounds(node, bounds);
+		}
+	}
+
+	BVHUpdateStatistics BVH::Update(const std::vector<Sphere>& spheres, int thread_count)
+	{
+		auto start = std::chrono::steady_clock::now();
+		BVHUpdateStatistics stats;
+
+		if (spheres.size() != m_Indices.size() || m_Nodes.empty())
+		{
+			Build(spheres, m_Settings, thread_count);
+			stats.Rebuilt = true;
+		}
+
+		else
+		{
+			Refit(spheres, thread_count);
+			stats.CostRatio = ComputeSAHCost() / glm::max(m_BuildCost, 1e-6f);
+
+			if (stats.CostRatio > m_Settings.RebuildThreshold)
+			{
+				Build(spheres, m_Settings, thread_count);
+				stats.Rebuilt = true;
+			}
+		}
+
+		stats.Cost = stats.Rebuilt ? m_BuildCost : stats.CostRatio * m_BuildCost;
+		stats.CostRatio = stats.Rebuilt ? 1.0f : stats.CostRatio;
+		stats.Time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		return stats;
+	}
+
+	float BVH::ComputeSAHCost() const
+	{
+		if (m_Nodes.empty())
+		{
+			return 0.0f;
+		}
+
+		double cost = 0.0;
+
+		for (const BVHNode& node : m_Nodes)
+		{
+			const double area = GetNodeBounds(node).GetSurfaceArea();
+			cost += node.IsLeaf() ? INTERSECTION_COST * area * node.Count : TRAVERSAL_COST * area;
+		}
+
+		return static_cast<float>(cost / glm::max((double)GetNodeBounds(m_Nodes[0]).GetSurfaceArea(), 1e-12));
+	}
+
+	// Returns the entry distance, or infinity if the box is missed or farther than tmax
+	static inline float IntersectNode(const BVHNode& node, const glm::vec3& origin, const glm::vec3& inverse_direction, float tmin, float tmax)
+	{
+		const glm::vec3 t0 = (node.Min - origin) * inverse_direction;
+		const glm::vec3 t1 = (node.Max - origin) * inverse_direction;
+		const glm::vec3 t_near = glm::min(t0, t1);
+		const glm::vec3 t_far = glm::max(t0, t1);
+
+		const float entry = glm::max(glm::max(t_near.x, t_near.y), glm::max(t_near.z, tmin));
+		const float exit = glm::min(glm::min(t_far.x, t_far.y), glm::min(t_far.z, tmax));
+
+		return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+	}
+
+	bool BVH::Intersect(const std::vector<Sphere>& spheres, const Ray& ray, float tmin, float tmax, RayHitRecord& record, int& index) const
+	{
+		if (m_Nodes.empty())
+		{
+			return false;
+		}
+
+		const glm::vec3 origin = ray.GetOrigin();
+		const glm::vec3 inverse_direction = 1.0f / ray.GetDirection();
+		const float infinity = std::numeric_limits<float>::infinity();
+
+		if (IntersectNode(m_Nodes[0], origin, inverse_direction, tmin, tmax) == infinity)
+		{
+			return false;
+		}
+
+		// Nodes that still have to be visited, the farther child is pushed and the nearer one is visited first
+		uint32_t stack[BVH_STACK_SIZE];
+		float stack_distances[BVH_STACK_SIZE];
+		int stack_size = 0;
+		uint32_t node_index = 0;
+		uint32_t closest = UINT32_MAX; // Only the sphere and distance are kept, the hit record is computed once at the end
+
+		while (true)
+		{
+			const BVHNode& node = m_Nodes[node_index];
+
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = node.LeftFirst; i < node.LeftFirst + node.Count; i++)
+				{
+					float t;
+
+					if (RaySphereIntersectionDistance(spheres[m_Indices[i]], ray, tmin, tmax, t))
+					{
+						tmax = t;
+						closest = m_Indices[i];
+					}
+				}
+
+				// Skip the nodes that are behind the closest hit found since they were pushed
+				while (stack_size > 0 && stack_distances[stack_size - 1] > tmax)
+				{
+					stack_size--;
+				}
+
+				if (stack_size == 0)
+				{
+					break;
+				}
+
+				node_index = stack[--stack_size];
+				continue;
+			}
+
+			uint32_t near_child = node.LeftFirst;
+			uint32_t far_child = node.LeftFirst + 1;
+			float near_child_distance = IntersectNode(m_Nodes[near_child], origin, inverse_direction, tmin, tmax);
+			float far_child_distance = IntersectNode(m_Nodes[far_child], origin, inverse_direction, tmin, tmax);
+
+			if (far_child_distance < near_child_distance)
+			{
+				std::swap(near_child, far_child);
+				std::swap(near_child_distance, far_child_distance);
+			}
+
+			if (near_child_distance == infinity)
+			{
+				if (stack_size == 0)
+				{
+					break;
+				}
+
+				node_index = stack[--stack_size];
+				continue;
+			}
+
+			if (far_child_distance != infinity)
+			{
+				stack[stack_size] = far_child;
+				stack_distances[stack_size++] = far_child_distance;
+			}
+
+			node_index = near_child;
+		}
+
+		if (closest == UINT32_MAX)
+		{
+			return false;
+		}
+
+		GetSphereHitRecord(spheres[closest], ray, tmax, record);
+		index = static_cast<int>(closest);
+		return true;
+	}
+
+	bool BVH::IntersectAny(const std::vector<Sphere>& spheres, const Ray& ray, float tmin, float tmax) const
+	{
+		if (m_Nodes.empty())
+		{
+			return false;
+		}
+
+		const glm::vec3 origin = ray.GetOrigin();
+		const glm::vec3 inverse_direction = 1.0f / ray.GetDirection();
+		const float infinity = std::numeric_limits<float>::infinity();
+
+		if (IntersectNode(m_Nodes[0], origin, inverse_direction, tmin, tmax) == infinity)
+		{
+			return false;
+		}
+
+		// The nearer child is still visited first, it is the more likely one to hold an occluder
+		uint32_t stack[BVH_STACK_SIZE];
+		int stack_size = 0;
+		uint32_t node_index = 0;
+
+		while (true)
+		{
+			const BVHNode& node = m_Nodes[node_index];
+
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = node.LeftFirst; i < node.LeftFirst + node.Count; i++)
+				{
+					float t;
+
+					if (RaySphereIntersectionDistance(spheres[m_Indices[i]], ray, tmin, tmax, t))
+					{
+						return true;
+					}
+				}
+
+				if (stack_size == 0)
+				{
+					return false;
+				}
+
+				node_index = stack[--stack_size];
+				continue;
+			}
+
+			uint32_t near_child = node.LeftFirst;
+			uint32_t far_child = node.LeftFirst + 1;
+			float near_child_distance = IntersectNode(m_Nodes[near_child], origin, inverse_direction, tmin, tmax);
+			float far_child_distance = IntersectNode(m_Nodes[far_child], origin, inverse_direction, tmin, tmax);
+
+			if (far_child_distance < near_child_distance)
+			{
+				std::swap(near_child, far_child);
+				std::swap(near_child_distance, far_child_distance);
+			}
+
+			if (near_child_distance == infinity)
+			{
+				if (stack_size == 0)
+				{
+					return false;
+				}
+
+				node_index = stack[--stack_size];
+				continue;
+			}
+
+			if (far_child_distance != infinity)
+			{
+				stack[stack_size++] = far_child;
+			}
+
+			node_index = near_child;
+		}
+	}
+}
+
+RayTracer::BVHUpdateStatistics UpdateSceneBVH()
+{
+	UpdateSceneLights();
+	return g_SceneBVH.Update(Spheres, THREAD_SPAWN_COUNT);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Tracer.h"
+
+namespace RayTracer
+{
+	struct AABB
+	{
+		glm::vec3 Min = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 Max = glm::vec3(-std::numeric_limits<float>::max());
+
+		inline void Grow(const glm::vec3& point)
+		{
+			Min = glm::min(Min, point);
+			Max = glm::max(Max, point);
+		}
+
+		inline void Grow(const AABB& box)
+		{
+			Min = glm::min(Min, box.Min);
+			Max = glm::max(Max, box.Max);
+		}
+
+		inline float GetSurfaceArea() const
+		{
+			const glm::vec3 extent = glm::max(Max - Min, glm::vec3(0.0f));
+			return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+		}
+	};
+
+	// 32 bytes, two nodes per cache line. Interior nodes have a count of zero and their children at LeftFirst and LeftFirst + 1
+	struct BVHNode
+	{
+		glm::vec3 Min;
+		uint32_t LeftFirst; // The first index into the primitive indices for leaves
+		glm::vec3 Max;
+		uint32_t Count;
+
+		inline bool IsLeaf() const { return Count > 0; }
+	};
+
+	/*
+	Build time against trace speed: fewer bins build faster but find worse splits, larger leaves give a smaller tree
+	that is faster to build and refit but slower to trace
+	*/
+	struct BVHSettings
+	{
+		int Bins = 16; // SAH split candidates per axis
+		int MaxLeafSize = 4;
+		int ParallelThreshold = 16384; // Nodes with at least this many spheres are split by all threads, smaller ones are built by one thread each
+		float RebuildThreshold = 1.5f; // Refitting stops once the SAH cost is this many times the cost after the last build
+	};
+
+	struct BVHUpdateStatistics
+	{
+		bool Rebuilt = false;
+		float Time = 0.0f; // In milliseconds
+		float Cost = 0.0f; // SAH cost after the update
+		float CostRatio = 1.0f; // Relative to the cost after the last build
+	};
+
+	/*
+	Bounding volume hierarchy over spheres, built top down with binned SAH.
+	When only the sphere centers and radii change it can be refit (bounds updated bottom up) instead of rebuilt,
+	Update does that and rebuilds once the refit tree has become too slow to trace according to its SAH cost
+	*/
+	class BVH
+	{
+	public:
+
+		// The tree is the same for any thread count
+		void Build(const std::vector<Sphere>& spheres, const BVHSettings& settings = BVHSettings(), int thread_count = 1);
+
+		// The sphere count and order have to be the same as in the last Build
+		void Refit(const std::vector<Sphere>& spheres, int thread_count);
+
+		BVHUpdateStatistics Update(const std::vector<Sphere>& spheres, int thread_count);
+
+		// Closest hit, index is the hit sphere's index
+		bool Intersect(const std::vector<Sphere>& spheres, const Ray& ray, float tmin, float tmax, RayHitRecord& record, int& index) const;
+
+		// Any hit, returns as soon as one is found
+		bool IntersectAny(const std::vector<Sphere>& spheres, const Ray& ray, float tmin, float tmax) const;
+
+		// Expected traversal cost relative to intersecting one sphere, normalized by the root's surface area
+		float ComputeSAHCost() const;
+
+		inline size_t GetPrimitiveCount() const { return m_Indices.size(); }
+		inline size_t GetNodeCount() const { return m_Nodes.size(); }
+		inline float GetBuildCost() const { return m_BuildCost; }
+		inline float GetBuildTime() const { return m_BuildTime; } // Of the last build in milliseconds
+		inline const BVHSettings& GetSettings() const { return m_Settings; }
+
+	private:
+
+		AABB RefitSubtree(const std::vector<Sphere>& spheres, uint32_t node);
+
+		std::vector<BVHNode> m_Nodes;
+		std::vector<uint32_t> m_Indices; // Sphere indices, leaves reference ranges of this
+
+		// The refit is split in independent subtrees, the nodes above them are refit afterwards (children come before their parents)
+		std::vector<uint32_t> m_RefitRoots;
+		std::vector<uint32_t> m_RefitTop;
+
+		BVHSettings m_Settings;
+		float m_BuildCost = 0.0f;
+		float m_BuildTime = 0.0f;
+	};
+}
+
+// Acceleration structure over Spheres, used by IntersectScene once it is built
+extern RayTracer::BVH g_SceneBVH;
+
+/*
+Call this after changing Spheres (not while rendering). It refits the scene BVH if only the centers or radii changed
+and rebuilds it if spheres were added or removed, or if the refit degraded it too much. It also updates g_SceneLights
+*/
+RayTracer::BVHUpdateStatistics UpdateSceneBVH();
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace RayTracer
+{
+	/*
+	Writes files on a background thread so that the caller can continue rendering. One write is in flight at a time,
+	Submit swaps the data with the writer's buffer so that neither side allocates once both have the same size
+	*/
+	template <typename T>
+	class BackgroundWriter
+	{
+	public:
+
+		typedef std::function<bool(const std::string& path, const T& data)> WriteFunction;
+
+		BackgroundWriter(const WriteFunction& write) : m_Write(write), m_Thread([this]() { WriterFunction(); }) {}
+
+		~BackgroundWriter()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Quit = true;
+			}
+
+			m_Condition.notify_all();
+			m_Thread.join();
+		}
+
+		// Waits until the previous write finished, data gets the buffer of that write
+		void Submit(const std::string& path, T& data)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Condition.wait(lock, [this]() { return !m_Pending; });
+
+			m_Path = path;
+			std::swap(m_Data, data);
+			m_Pending = true;
+			m_Condition.notify_all();
+		}
+
+		void Flush()
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Condition.wait(lock, [this]() { return !m_Pending; });
+		}
+
+		bool IsBusy()
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_Pending;
+		}
+
+		int GetFailedWrites()
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_FailedWrites;
+		}
+
+	private:
+
+		void WriterFunction()
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			while (true)
+			{
+				m_Condition.wait(lock, [this]() { return m_Pending || m_Quit; });
+
+				if (!m_Pending)
+				{
+					return;
+				}
+
+				// Submit doesn't touch the data while a write is pending
+				lock.unlock();
+				const bool written = m_Write(m_Path, m_Data);
+				lock.lock();
+
+				m_FailedWrites += written ? 0 : 1;
+				m_Pending = false;
+				m_Condition.notify_all();
+			}
+		}
+
+		WriteFunction m_Write;
+		std::mutex m_Mutex;
+		std::condition_variable m_Condition;
+		std::string m_Path;
+		T m_Data;
+		bool m_Pending = false;
+		bool m_Quit = false;
+		int m_FailedWrites = 0;
+		std::thread m_Thread;
+	};
+}
@@ -0,0 +1,131 @@
+#include "Checkpoint.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+namespace RayTracer
+{
+	static const char CHECKPOINT_MAGIC[4] = { 'R', 'T', 'C', 'P' };
+	static const uint32_t CHECKPOINT_VERSION = 1;
+
+	template <typename T>
+	static void WriteValue(std::ofstream& file, const T& value)
+	{
+		file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template <typename T>
+	static void ReadValue(std::ifstream& file, T& value)
+	{
+		file.read(reinterpret_cast<char*>(&value), sizeof(T));
+	}
+
+	bool WriteCheckpoint(const std::string& path, const RenderCheckpoint& checkpoint)
+	{
+		const std::string temporary_path = path + ".tmp";
+
+		{
+			std::ofstream file(temporary_path, std::ios::out | std::ios::binary);
+
+			if (!file.good())
+			{
+				std::cout << "\nCOULD NOT OPEN CHECKPOINT FILE FOR WRITING (" << temporary_path << ")\n";
+				return false;
+			}
+
+			file.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+			WriteValue(file, CHECKPOINT_VERSION);
+			WriteValue(file, checkpoint.Width);
+			WriteValue(file, checkpoint.Height);
+			WriteValue(file, checkpoint.TargetSamples);
+			WriteValue(file, checkpoint.Samples);
+			WriteValue(file, checkpoint.Passes);
+			WriteValue(file, checkpoint.FrameSeed);
+			WriteValue(file, checkpoint.DeterministicSampling);
+			WriteValue(file, checkpoint.SceneHash);
+			file.write(reinterpret_cast<const char*>(checkpoint.Accumulation.data()), checkpoint.Accumulation.size() * sizeof(glm::vec3));
+			file.write(reinterpret_cast<const char*>(checkpoint.SampleCounts.data()), checkpoint.SampleCounts.size() * sizeof(uint32_t));
+
+			if (!file.good())
+			{
+				std::cout << "\nCOULD NOT WRITE CHECKPOINT (" << temporary_path << ")\n";
+				return false;
+			}
+		}
+
+		// Replaces the old checkpoint in one step, there is never a moment where neither file is complete
+#ifdef _WIN32
+		const bool renamed = MoveFileExA(temporary_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		const bool renamed = std::rename(temporary_path.c_str(), path.c_str()) == 0;
+#endif
+
+		if (!renamed)
+		{
+			std::cout << "\nCOULD NOT RENAME CHECKPOINT (" << temporary_path << " TO " << path << ")\n";
+			return false;
+		}
+
+		return true;
+	}
+
+	bool ReadCheckpoint(const std::string& path, RenderCheckpoint& checkpoint)
+	{
+		std::ifstream file(path, std::ios::in | std::ios::binary);
+
+		if (!file.good())
+		{
+			std::cout << "\nCOULD NOT OPEN CHECKPOINT FILE FOR READING (" << path << ")\n";
+			return false;
+		}
+
+		char magic[4] = {};
+		uint32_t version = 0;
+		file.read(magic, sizeof(magic));
+		ReadValue(file, version);
+
+		if (!file.good() || std::string(magic, 4) != std::string(CHECKPOINT_MAGIC, 4) || version != CHECKPOINT_VERSION)
+		{
+			std::cout << "\nUNSUPPORTED CHECKPOINT FILE (" << path << ")\n";
+			return false;
+		}
+
+		ReadValue(file, checkpoint.Width);
+		ReadValue(file, checkpoint.Height);
+		ReadValue(file, checkpoint.TargetSamples);
+		ReadValue(file, checkpoint.Samples);
+		ReadValue(file, checkpoint.Passes);
+		ReadValue(file, checkpoint.FrameSeed);
+		ReadValue(file, checkpoint.DeterministicSampling);
+		ReadValue(file, checkpoint.SceneHash);
+
+		const size_t pixels = static_cast<size_t>(checkpoint.Width) * checkpoint.Height;
+
+		if (!file.good() || pixels == 0 || pixels > (1u << 28))
+		{
+			std::cout << "\nUNSUPPORTED CHECKPOINT FILE (" << path << ")\n";
+			return false;
+		}
+
+		checkpoint.Accumulation.resize(pixels);
+		checkpoint.SampleCounts.resize(pixels);
+		file.read(reinterpret_cast<char*>(checkpoint.Accumulation.data()), pixels * sizeof(glm::vec3));
+		file.read(reinterpret_cast<char*>(checkpoint.SampleCounts.data()), pixels * sizeof(uint32_t));
+
+		if (!file.good())
+		{
+			std::cout << "\nTRUNCATED CHECKPOINT FILE (" << path << ")\n";
+			return false;
+		}
+
+		return true;
+	}
+}
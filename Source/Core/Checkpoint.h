@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace RayTracer
+{
+	struct CheckpointSettings
+	{
+		std::string Path; // No checkpoints are written without a path
+		float Interval = 300.0f; // Seconds between checkpoints
+		float TimeLimit = 0.0f; // Seconds, the render stops with a checkpoint after this (0 is no limit) so that it can be resumed later
+		bool Resume = false; // Continue from the checkpoint at Path if there is a matching one
+	};
+
+	/*
+	Everything needed to continue a render. With deterministic sampling the sampler state is the frame seed and the
+	sample count of every pixel, otherwise the threads are seeded from the frame seed and the number of samples
+	*/
+	struct RenderCheckpoint
+	{
+		uint32_t Width = 0;
+		uint32_t Height = 0;
+		uint32_t TargetSamples = 0;
+		uint32_t Samples = 0;
+		uint32_t Passes = 0;
+		uint32_t FrameSeed = 0;
+		uint32_t DeterministicSampling = 1;
+		uint64_t SceneHash = 0; // Of the spheres and the camera, a checkpoint of another scene isn't resumed
+
+		std::vector<glm::vec3> Accumulation;
+		std::vector<uint32_t> SampleCounts;
+	};
+
+	// Written to <path>.tmp first and then renamed over <path> atomically, so a crash while writing doesn't destroy the last checkpoint
+	bool WriteCheckpoint(const std::string& path, const RenderCheckpoint& checkpoint);
+	bool ReadCheckpoint(const std::string& path, RenderCheckpoint& checkpoint);
+}
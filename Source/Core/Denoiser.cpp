@@ -0,0 +1,352 @@
+#include "Denoiser.h"
+#include "Tracer.h"
+#include "Profiler.h"
+
+#include <vector>
+#include <chrono>
+#include <cmath>
+
+// Four neighbouring pixels are filtered at once with SSE2, the pixels near the image border use the scalar path
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RAYTRACER_DENOISER_SSE 1
+#else
+#define RAYTRACER_DENOISER_SSE 0
+#endif
+
+namespace RayTracer
+{
+	// Planar so that the taps of four neighbouring pixels are contiguous, rows are g_Width apart like the tracer's buffers
+	struct FilterBuffer
+	{
+		std::vector<float> R, G, B;
+		std::vector<float> Variance; // Of the luminance
+
+		void Resize(size_t size)
+		{
+			R.resize(size);
+			G.resize(size);
+			B.resize(size);
+			Variance.resize(size);
+		}
+	};
+
+	// Demodulated radiance, ping ponged between the iterations
+	static FilterBuffer s_Buffers[2];
+
+	// The depth guide, negative if the first ray missed. The normals are read directly from g_AOVs
+	static std::vector<float> s_Depth;
+	static std::vector<glm::vec3> s_Albedo;
+	static std::vector<glm::vec3> s_Output; // Remodulated and packed for the tonemapper
+
+	// exp(-27.7) is about 2^-40, smaller weights are skipped since their squares would be denormals
+	static const float MIN_EXPONENT = -27.7f;
+
+	static const float KERNEL[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+	static inline float GetLuminance(float r, float g, float b)
+	{
+		return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+	}
+
+	// Divides the radiance by the albedo so that texture and material detail isn't blurred
+	static void DemodulateRow(int j, int width)
+	{
+		FilterBuffer& buffer = s_Buffers[0];
+
+		for (int i = 0; i < width; i++)
+		{
+			const uint pixel = j * g_Width + i;
+			const uint32_t count = g_SampleCounts[pixel];
+			const bool sky = std::isinf(g_AOVs.Depth[pixel]);
+			const glm::vec3 albedo = sky ? glm::vec3(1.0f) : glm::max(g_AOVs.GetAlbedo(pixel), glm::vec3(0.01f));
+			const glm::vec3 color = (count > 0 ? g_AccumulationBuffer[pixel] / (float)count : glm::vec3(0.0f)) / albedo;
+
+			s_Albedo[pixel] = albedo;
+			buffer.R[pixel] = color.r;
+			buffer.G[pixel] = color.g;
+			buffer.B[pixel] = color.b;
+			s_Depth[pixel] = sky ? -1.0f : g_AOVs.Depth[pixel];
+		}
+	}
+
+	// There is no per pixel variance of the samples, so it is estimated from the 3x3 neighbourhood
+	static void EstimateVarianceRow(int j, int width, int height)
+	{
+		FilterBuffer& buffer = s_Buffers[0];
+
+		for (int i = 0; i < width; i++)
+		{
+			float sum = 0.0f;
+			float sum_squared = 0.0f;
+			int count = 0;
+
+			for (int y = glm::max(j - 1, 0); y <= glm::min(j + 1, height - 1); y++)
+			{
+				for (int x = glm::max(i - 1, 0); x <= glm::min(i + 1, width - 1); x++)
+				{
+					const uint tap = y * g_Width + x;
+					const float luminance = GetLuminance(buffer.R[tap], buffer.G[tap], buffer.B[tap]);
+					sum += luminance;
+					sum_squared += luminance * luminance;
+					count++;
+				}
+			}
+
+			const float mean = sum / (float)count;
+			buffer.Variance[j * g_Width + i] = glm::max(sum_squared / (float)count - mean * mean, 0.0f);
+		}
+	}
+
+	static void FilterPixel(int i, int j, int width, int height, int step, const DenoiserSettings& settings, const FilterBuffer& input, FilterBuffer& output)
+	{
+		const uint pixel = j * g_Width + i;
+		const float depth = s_Depth[pixel];
+		const bool sky = depth < 0.0f;
+		const float luminance = GetLuminance(input.R[pixel], input.G[pixel], input.B[pixel]);
+		const glm::vec3 normal = g_AOVs.GetNormal(pixel);
+
+		// The exponents of the edge stopping functions are summed so that only one exp is needed per tap
+		const float color_scale = -1.0f / (settings.ColorPhi * std::sqrt(input.Variance[pixel]) + 0.01f);
+		const float depth_scale = -1.0f / (settings.DepthPhi * 0.01f * (float)step * depth + 1e-4f);
+
+		glm::vec3 sum = glm::vec3(0.0f);
+		float variance = 0.0f;
+		float weight_sum = 0.0f;
+
+		for (int ky = 0; ky < 5; ky++)
+		{
+			const int y = j + (ky - 2) * step;
+
+			if (y < 0 || y >= height)
+			{
+				continue;
+			}
+
+			for (int kx = 0; kx < 5; kx++)
+			{
+				const int x = i + (kx - 2) * step;
+
+				if (x < 0 || x >= width)
+				{
+					continue;
+				}
+
+				const uint tap = y * g_Width + x;
+
+				// Sky pixels are only filtered with other sky pixels
+				if (sky != (s_Depth[tap] < 0.0f))
+				{
+					continue;
+				}
+
+				float exponent = glm::abs(luminance - GetLuminance(input.R[tap], input.G[tap], input.B[tap])) * color_scale;
+
+				if (!sky)
+				{
+					// log(pow(dot, phi)) is close to phi * (dot - 1) for similar normals
+					const float cosine = normal.x * g_AOVs.NormalX[tap] + normal.y * g_AOVs.NormalY[tap] + normal.z * g_AOVs.NormalZ[tap];
+					exponent += glm::abs(depth - s_Depth[tap]) * depth_scale + settings.NormalPhi * (cosine - 1.0f);
+				}
+
+				if (exponent < MIN_EXPONENT)
+				{
+					continue;
+				}
+
+				const float weight = KERNEL[kx] * KERNEL[ky] * std::exp(exponent);
+
+				sum += weight * glm::vec3(input.R[tap], input.G[tap], input.B[tap]);
+				variance += weight * weight * input.Variance[tap]; // The variance is weighted by the squared weight
+				weight_sum += weight;
+			}
+		}
+
+		output.R[pixel] = sum.r / weight_sum;
+		output.G[pixel] = sum.g / weight_sum;
+		output.B[pixel] = sum.b / weight_sum;
+		output.Variance[pixel] = variance / (weight_sum * weight_sum);
+	}
+
+#if RAYTRACER_DENOISER_SSE
+	/*
+	exp(x) for x <= 0, the relative error is about 1e-5 which is plenty for filter weights.
+	Like the scalar path, results below exp(MIN_EXPONENT) are flushed to zero
+	*/
+	static inline __m128 ExpSSE(__m128 x)
+	{
+		x = _mm_mul_ps(x, _mm_set1_ps(1.44269504f)); // To a power of 2
+		const __m128 valid = _mm_cmpgt_ps(x, _mm_set1_ps(-40.0f));
+		x = _mm_max_ps(x, _mm_set1_ps(-40.0f));
+
+		// floor(x), the truncation rounds up for negative values
+		__m128 floor = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+		floor = _mm_sub_ps(floor, _mm_and_ps(_mm_cmpgt_ps(floor, x), _mm_set1_ps(1.0f)));
+		const __m128 f = _mm_sub_ps(x, floor);
+
+		// 2^f on [0, 1)
+		__m128 p = _mm_set1_ps(1.3333558e-3f);
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.6181291e-3f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.5504109e-2f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4022651e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9314718e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+
+		// 2^floor is built directly in the exponent bits
+		const __m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(floor), _mm_set1_epi32(127)), 23);
+		return _mm_and_ps(valid, _mm_mul_ps(p, _mm_castsi128_ps(exponent)));
+	}
+
+	static inline __m128 AbsSSE(__m128 x)
+	{
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+	}
+
+	// Filters the pixels i to i + 3, all their taps have to be inside the image horizontally
+	static void FilterQuad(int i, int j, int height, int step, const DenoiserSettings& settings, const FilterBuffer& input, FilterBuffer& output)
+	{
+		const uint pixel = j * g_Width + i;
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 luminance_r = _mm_set1_ps(0.2126f);
+		const __m128 luminance_g = _mm_set1_ps(0.7152f);
+		const __m128 luminance_b = _mm_set1_ps(0.0722f);
+		const __m128 normal_phi = _mm_set1_ps(settings.NormalPhi);
+
+		const __m128 depth = _mm_loadu_ps(&s_Depth[pixel]);
+		const __m128 sky = _mm_cmplt_ps(depth, zero);
+		const __m128 normal_x = _mm_loadu_ps(&g_AOVs.NormalX[pixel]);
+		const __m128 normal_y = _mm_loadu_ps(&g_AOVs.NormalY[pixel]);
+		const __m128 normal_z = _mm_loadu_ps(&g_AOVs.NormalZ[pixel]);
+
+		const __m128 luminance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&input.R[pixel]), luminance_r),
+			_mm_mul_ps(_mm_loadu_ps(&input.G[pixel]), luminance_g)), _mm_mul_ps(_mm_loadu_ps(&input.B[pixel]), luminance_b));
+
+		const __m128 color_scale = _mm_div_ps(_mm_set1_ps(-1.0f), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(settings.ColorPhi),
+			_mm_sqrt_ps(_mm_loadu_ps(&input.Variance[pixel]))), _mm_set1_ps(0.01f)));
+
+		// Zero for sky pixels, they only use the luminance weight
+		__m128 depth_scale = _mm_div_ps(_mm_set1_ps(-1.0f), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(settings.DepthPhi * 0.01f * (float)step), depth),
+			_mm_set1_ps(1e-4f)));
+		depth_scale = _mm_andnot_ps(sky, depth_scale);
+
+		__m128 sum_r = zero, sum_g = zero, sum_b = zero, sum_variance = zero, weight_sum = zero;
+
+		for (int ky = 0; ky < 5; ky++)
+		{
+			const int y = j + (ky - 2) * step;
+
+			if (y < 0 || y >= height)
+			{
+				continue;
+			}
+
+			for (int kx = 0; kx < 5; kx++)
+			{
+				const uint tap = y * g_Width + i + (kx - 2) * step;
+
+				const __m128 r = _mm_loadu_ps(&input.R[tap]);
+				const __m128 g = _mm_loadu_ps(&input.G[tap]);
+				const __m128 b = _mm_loadu_ps(&input.B[tap]);
+				const __m128 tap_depth = _mm_loadu_ps(&s_Depth[tap]);
+				const __m128 tap_luminance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, luminance_r), _mm_mul_ps(g, luminance_g)), _mm_mul_ps(b, luminance_b));
+
+				const __m128 cosine = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normal_x, _mm_loadu_ps(&g_AOVs.NormalX[tap])),
+					_mm_mul_ps(normal_y, _mm_loadu_ps(&g_AOVs.NormalY[tap]))), _mm_mul_ps(normal_z, _mm_loadu_ps(&g_AOVs.NormalZ[tap])));
+
+				__m128 exponent = _mm_mul_ps(AbsSSE(_mm_sub_ps(luminance, tap_luminance)), color_scale);
+				exponent = _mm_add_ps(exponent, _mm_mul_ps(AbsSSE(_mm_sub_ps(depth, tap_depth)), depth_scale));
+				exponent = _mm_add_ps(exponent, _mm_andnot_ps(sky, _mm_mul_ps(normal_phi, _mm_sub_ps(cosine, one))));
+
+				// Sky pixels are only filtered with other sky pixels
+				const __m128 same_kind = _mm_cmpeq_ps(_mm_and_ps(sky, one), _mm_and_ps(_mm_cmplt_ps(tap_depth, zero), one));
+				const __m128 weight = _mm_and_ps(same_kind, _mm_mul_ps(_mm_set1_ps(KERNEL[kx] * KERNEL[ky]), ExpSSE(exponent)));
+
+				sum_r = _mm_add_ps(sum_r, _mm_mul_ps(weight, r));
+				sum_g = _mm_add_ps(sum_g, _mm_mul_ps(weight, g));
+				sum_b = _mm_add_ps(sum_b, _mm_mul_ps(weight, b));
+				sum_variance = _mm_add_ps(sum_variance, _mm_mul_ps(_mm_mul_ps(weight, weight), _mm_loadu_ps(&input.Variance[tap])));
+				weight_sum = _mm_add_ps(weight_sum, weight);
+			}
+		}
+
+		// The center tap always has a weight, so the sum is never zero
+		_mm_storeu_ps(&output.R[pixel], _mm_div_ps(sum_r, weight_sum));
+		_mm_storeu_ps(&output.G[pixel], _mm_div_ps(sum_g, weight_sum));
+		_mm_storeu_ps(&output.B[pixel], _mm_div_ps(sum_b, weight_sum));
+		_mm_storeu_ps(&output.Variance[pixel], _mm_div_ps(sum_variance, _mm_mul_ps(weight_sum, weight_sum)));
+	}
+#endif
+
+	static void FilterRow(int j, int width, int height, int step, const DenoiserSettings& settings, const FilterBuffer& input, FilterBuffer& output)
+	{
+		int i = 0;
+
+#if RAYTRACER_DENOISER_SSE
+		// Pixels whose taps are all inside the image
+		const int first = glm::min(2 * step, width);
+		const int last = width - 2 * step;
+
+		for (; i < first; i++)
+		{
+			FilterPixel(i, j, width, height, step, settings, input, output);
+		}
+
+		for (; i + 4 <= last; i += 4)
+		{
+			FilterQuad(i, j, height, step, settings, input, output);
+		}
+#endif
+
+		for (; i < width; i++)
+		{
+			FilterPixel(i, j, width, height, step, settings, input, output);
+		}
+	}
+
+	static void RemodulateRow(int j, int width, const FilterBuffer& input)
+	{
+		for (int i = 0; i < width; i++)
+		{
+			const uint pixel = j * g_Width + i;
+			s_Output[pixel] = glm::vec3(input.R[pixel], input.G[pixel], input.B[pixel]) * s_Albedo[pixel];
+		}
+	}
+
+	float Denoise(const DenoiserSettings& settings, const TonemapSettings& tonemap, int width, int height, int thread_count)
+	{
+		RT_PROFILE_ZONE("Denoise");
+
+		auto start = std::chrono::steady_clock::now();
+		const size_t size = g_Width * g_Height;
+
+		s_Buffers[0].Resize(size);
+		s_Buffers[1].Resize(size);
+		s_Depth.resize(size);
+		s_Albedo.resize(size);
+		s_Output.resize(size);
+
+		ParallelForRows(height, thread_count, [width](int j) { DemodulateRow(j, width); });
+		ParallelForRows(height, thread_count, [width, height](int j) { EstimateVarianceRow(j, width, height); });
+
+		int current = 0;
+
+		for (int iteration = 0; iteration < settings.Iterations; iteration++)
+		{
+			RT_PROFILE_ZONE_ARG("Denoise Iteration", iteration);
+
+			const FilterBuffer& input = s_Buffers[current];
+			FilterBuffer& output = s_Buffers[1 - current];
+			const int step = 1 << iteration;
+
+			ParallelForRows(height, thread_count, [&](int j) { FilterRow(j, width, height, step, settings, input, output); });
+			current = 1 - current;
+		}
+
+		const FilterBuffer& result = s_Buffers[current];
+		ParallelForRows(height, thread_count, [width, &result](int j) { RemodulateRow(j, width, result); });
+		Tonemap(tonemap, s_Output.data(), nullptr, g_PixelData, g_Width, width, height, thread_count);
+
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Tonemap.h"
+
+namespace RayTracer
+{
+	/*
+	Edge-aware a-trous wavelet filter (as in SVGF) for low sample count images.
+	The accumulated radiance is divided by the first hit albedo and filtered with a 5x5 B3 spline kernel whose taps are
+	spaced 1, 2, 4... pixels apart on every iteration. Taps are weighted down by their normal, depth and luminance
+	difference to the center pixel, the luminance weight is scaled by the (filtered) local variance.
+	*/
+	struct DenoiserSettings
+	{
+		bool Enabled = false;
+		int Iterations = 5;
+		float ColorPhi = 4.0f; // Higher values blur more across luminance edges
+		float NormalPhi = 128.0f; // Higher values blur less across normal edges
+		float DepthPhi = 2.0f; // Allowed relative depth difference per pixel of tap distance (in percent)
+	};
+
+	/*
+	Denoises the render area (width x height) of the accumulation buffer into g_PixelData (converted with tonemap) using the tracer's AOVs.
+	Only call this while no trace threads are running. Returns the time taken in milliseconds
+	*/
+	float Denoise(const DenoiserSettings& settings, const TonemapSettings& tonemap, int width, int height, int thread_count);
+}
@@ -0,0 +1,84 @@
+#include "DisplayBuffers.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace RayTracer
+{
+	DisplayBuffers::DisplayBuffers(uint32_t width, uint32_t height, uint32_t tile_size) : m_Width(width), m_Height(height), m_TileSize(tile_size)
+	{
+		m_TileCountX = (width + tile_size - 1) / tile_size;
+		const uint32_t tile_count = m_TileCountX * ((height + tile_size - 1) / tile_size);
+
+		// The buffers start out older than the source, so the first Publish copies every tile
+		m_TileVersions.assign(tile_count, 1);
+
+		for (Buffer& buffer : m_Buffers)
+		{
+			buffer.Pixels.assign(static_cast<size_t>(width) * height * 4, 0);
+			buffer.TileVersions.assign(tile_count, 0);
+		}
+	}
+
+	void DisplayBuffers::MarkTile(uint32_t tile)
+	{
+		m_TileVersions[tile]++;
+	}
+
+	void DisplayBuffers::MarkAll()
+	{
+		for (uint32_t& version : m_TileVersions)
+		{
+			version++;
+		}
+	}
+
+	void DisplayBuffers::Publish(const uint8_t* image, uint32_t render_width, uint32_t render_height)
+	{
+		RT_PROFILE_ZONE("Publish");
+
+		Buffer& back = m_Buffers[m_Back];
+
+		for (uint32_t tile = 0; tile < static_cast<uint32_t>(m_TileVersions.size()); tile++)
+		{
+			if (back.TileVersions[tile] == m_TileVersions[tile])
+			{
+				continue;
+			}
+
+			const uint32_t x = (tile % m_TileCountX) * m_TileSize;
+			const uint32_t y = (tile / m_TileCountX) * m_TileSize;
+			const uint32_t sizex = std::min(m_TileSize, m_Width - x);
+			const uint32_t sizey = std::min(m_TileSize, m_Height - y);
+
+			for (uint32_t j = y; j < y + sizey; j++)
+			{
+				const size_t offset = (static_cast<size_t>(j) * m_Width + x) * 4;
+				memcpy(&back.Pixels[offset], image + offset, sizex * 4);
+			}
+
+			back.TileVersions[tile] = m_TileVersions[tile];
+		}
+
+		back.RenderWidth = render_width;
+		back.RenderHeight = render_height;
+
+		// The release makes the copies visible to the thread that acquires the buffer
+		m_Back = m_Middle.exchange(m_Back | UPDATED, std::memory_order_acq_rel) & ~UPDATED;
+		m_PublishedCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	const uint8_t* DisplayBuffers::Acquire(uint32_t& render_width, uint32_t& render_height)
+	{
+		if (!(m_Middle.load(std::memory_order_relaxed) & UPDATED))
+		{
+			return nullptr;
+		}
+
+		m_Front = m_Middle.exchange(m_Front, std::memory_order_acq_rel) & ~UPDATED;
+		render_width = m_Buffers[m_Front].RenderWidth;
+		render_height = m_Buffers[m_Front].RenderHeight;
+		return m_Buffers[m_Front].Pixels.data();
+	}
+}
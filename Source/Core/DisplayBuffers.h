@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+namespace RayTracer
+{
+	/*
+	The hand-off between the thread that resolves the image and the thread that uploads it : three RGBA8 images, one that
+	the resolving thread copies into, one that the uploading thread reads and one published in between (triple buffering).
+	Publish and Acquire only exchange an index, so neither side ever waits for the other and the upload always gets the
+	newest complete image. Only the tiles that changed since a buffer was last published are copied into it
+	*/
+	class DisplayBuffers
+	{
+	public:
+
+		DisplayBuffers(uint32_t width, uint32_t height, uint32_t tile_size);
+
+		DisplayBuffers(const DisplayBuffers&) = delete;
+		DisplayBuffers& operator=(const DisplayBuffers&) = delete;
+
+		// Resolving thread : the tile (or every tile) of the source image changed since the last Publish
+		void MarkTile(uint32_t tile);
+		void MarkAll();
+
+		/*
+		Resolving thread : copies the changed tiles of image (width x height RGBA8) into the back buffer and publishes it.
+		render_width x render_height is the area of the image that was rendered to, it is published along with the pixels
+		*/
+		void Publish(const uint8_t* image, uint32_t render_width, uint32_t render_height);
+
+		// Uploading thread : the newest published image and its render area, nullptr if nothing was published since the last call
+		const uint8_t* Acquire(uint32_t& render_width, uint32_t& render_height);
+
+		inline uint64_t GetPublishedCount() const { return m_PublishedCount.load(std::memory_order_relaxed); }
+
+	private:
+
+		static const uint32_t UPDATED = 4; // Set in m_Middle when it holds an image that wasn't acquired yet
+
+		struct Buffer
+		{
+			std::vector<uint8_t> Pixels;
+			std::vector<uint32_t> TileVersions; // The version of every tile that was copied into it
+			uint32_t RenderWidth = 0;
+			uint32_t RenderHeight = 0;
+		};
+
+		uint32_t m_Width = 0;
+		uint32_t m_Height = 0;
+		uint32_t m_TileSize = 0;
+		uint32_t m_TileCountX = 0;
+
+		Buffer m_Buffers[3];
+		std::vector<uint32_t> m_TileVersions; // Of the source image, incremented by MarkTile
+
+		uint32_t m_Back = 0; // Owned by the resolving thread
+		uint32_t m_Front = 1; // Owned by the uploading thread
+		std::atomic<uint32_t> m_Middle{ 2 }; // Index of the published buffer, with UPDATED
+		std::atomic<uint64_t> m_PublishedCount{ 0 };
+	};
+}
@@ -0,0 +1,511 @@
+#include "Distributed.h"
+#include "Socket.h"
+#include "BVH.h"
+#include "Profiler.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace RayTracer
+{
+	static const uint32_t PROTOCOL_MAGIC = 0x52544454; // "RTDT"
+	static const uint32_t PROTOCOL_VERSION = 1;
+
+	enum class MessageType : uint32_t
+	{
+		Hello = 1, // Worker to coordinator, HelloMessage
+		Job, // Coordinator to worker, JobMessage, the answer to Hello
+		Tiles, // Coordinator to worker, TilesMessage
+		Result, // Worker to coordinator, ResultMessage and the sums of the tiles' pixels (tile by tile, row by row)
+		Done // Coordinator to worker, no payload
+	};
+
+	struct MessageHeader
+	{
+		uint32_t Magic = PROTOCOL_MAGIC;
+		MessageType Type = MessageType::Done;
+		uint32_t Size = 0; // Of the payload
+	};
+
+	struct HelloMessage
+	{
+		uint32_t Version = PROTOCOL_VERSION;
+		uint32_t Threads = 0;
+		uint64_t SceneHash = 0;
+	};
+
+	struct JobMessage
+	{
+		uint32_t SPP = 0;
+		uint32_t FrameSeed = 0;
+		uint32_t Width = 0;
+		uint32_t Height = 0;
+	};
+
+	struct TilesMessage
+	{
+		uint32_t FirstTile = 0;
+		uint32_t Count = 0;
+	};
+
+	struct ResultMessage
+	{
+		uint32_t FirstTile = 0;
+		uint32_t Count = 0;
+		float RenderTime = 0.0f; // Seconds
+		uint32_t Padding = 0;
+	};
+
+	struct TileRect
+	{
+		int X = 0, Y = 0, Width = 0, Height = 0;
+	};
+
+	static TileRect GetTileRect(uint tile)
+	{
+		TileRect rect;
+		rect.X = (tile % g_TileCountX) * TILE_SIZE;
+		rect.Y = (tile / g_TileCountX) * TILE_SIZE;
+		rect.Width = glm::min(static_cast<int>(TILE_SIZE), static_cast<int>(g_Width) - rect.X);
+		rect.Height = glm::min(static_cast<int>(TILE_SIZE), static_cast<int>(g_Height) - rect.Y);
+		return rect;
+	}
+
+	static size_t GetPixelCount(uint32_t first_tile, uint32_t count)
+	{
+		size_t pixels = 0;
+
+		for (uint32_t tile = first_tile; tile < first_tile + count && tile < g_TileCount; tile++)
+		{
+			const TileRect rect = GetTileRect(tile);
+			pixels += static_cast<size_t>(rect.Width) * rect.Height;
+		}
+
+		return pixels;
+	}
+
+	template <typename T>
+	static bool SendPacket(Socket& socket, MessageType type, const T& message, const void* payload = nullptr, size_t payload_size = 0)
+	{
+		MessageHeader header;
+		header.Type = type;
+		header.Size = static_cast<uint32_t>(sizeof(T) + payload_size);
+
+		return socket.Send(&header, sizeof(header)) && socket.Send(&message, sizeof(T)) && (payload_size == 0 || socket.Send(payload, payload_size));
+	}
+
+	static bool SendDone(Socket& socket)
+	{
+		MessageHeader header;
+		header.Type = MessageType::Done;
+		return socket.Send(&header, sizeof(header));
+	}
+
+	static bool ReceiveHeader(Socket& socket, MessageHeader& header)
+	{
+		return socket.Receive(&header, sizeof(header)) && header.Magic == PROTOCOL_MAGIC;
+	}
+
+	/* Coordinator */
+
+	struct CoordinatorState
+	{
+		std::mutex Mutex;
+		std::condition_variable Condition;
+		std::deque<uint32_t> PendingJobs; // The first tile of every job that wasn't handed out (again) yet
+		uint32_t JobCount = 0;
+		uint32_t FinishedJobs = 0;
+		int ReassignedJobs = 0;
+		int ConnectedWorkers = 0; // Workers that are being served
+		std::vector<WorkerStatistics> Workers;
+	};
+
+	static void ServeWorker(Socket socket, int worker, CoordinatorState& state, const CoordinatorSettings& settings)
+	{
+		RT_PROFILE_THREAD("Coordinator Worker " + std::to_string(worker));
+
+		const auto connected = std::chrono::steady_clock::now();
+		socket.SetTimeout(settings.WorkerTimeout);
+
+		auto finish = [&](bool failed)
+		{
+			std::lock_guard<std::mutex> lock(state.Mutex);
+			state.ConnectedWorkers--;
+			state.Workers[worker].Failed = failed;
+			state.Workers[worker].ConnectedTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - connected).count();
+		};
+
+		MessageHeader header;
+		HelloMessage hello;
+
+		if (!ReceiveHeader(socket, header) || header.Type != MessageType::Hello || header.Size != sizeof(hello) || !socket.Receive(&hello, sizeof(hello)))
+		{
+			std::cout << "\nWORKER " << worker << " DIDN'T INTRODUCE ITSELF, DISCONNECTED\n";
+			finish(true);
+			return;
+		}
+
+		if (hello.Version != PROTOCOL_VERSION || hello.SceneHash != GetSceneHash())
+		{
+			std::cout << "\nWORKER " << worker << " RUNS A DIFFERENT VERSION OR SCENE, DISCONNECTED\n";
+			SendDone(socket);
+			finish(true);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(state.Mutex);
+			state.Workers[worker].Threads = static_cast<int>(hello.Threads);
+		}
+
+		JobMessage job;
+		job.SPP = static_cast<uint32_t>(settings.SPP);
+		job.FrameSeed = g_FrameSeed;
+		job.Width = g_Width;
+		job.Height = g_Height;
+
+		if (!SendPacket(socket, MessageType::Job, job))
+		{
+			finish(true);
+			return;
+		}
+
+		std::cout << "Worker " << worker << " connected (" << hello.Threads << " threads)" << std::endl;
+		std::vector<glm::vec3> pixels;
+
+		while (true)
+		{
+			TilesMessage tiles;
+
+			{
+				std::unique_lock<std::mutex> lock(state.Mutex);
+
+				// Jobs of failed workers can come back while the last ones are rendered
+				state.Condition.wait(lock, [&]() { return !state.PendingJobs.empty() || state.FinishedJobs == state.JobCount; });
+
+				if (state.PendingJobs.empty())
+				{
+					break;
+				}
+
+				tiles.FirstTile = state.PendingJobs.front();
+				tiles.Count = glm::min(static_cast<uint32_t>(settings.TilesPerJob), g_TileCount - tiles.FirstTile);
+				state.PendingJobs.pop_front();
+			}
+
+			const size_t pixel_count = GetPixelCount(tiles.FirstTile, tiles.Count);
+			ResultMessage result;
+			pixels.resize(pixel_count);
+
+			const bool received = SendPacket(socket, MessageType::Tiles, tiles) && ReceiveHeader(socket, header) && header.Type == MessageType::Result &&
+				header.Size == sizeof(result) + pixel_count * sizeof(glm::vec3) && socket.Receive(&result, sizeof(result)) &&
+				result.FirstTile == tiles.FirstTile && result.Count == tiles.Count && socket.Receive(pixels.data(), pixel_count * sizeof(glm::vec3));
+
+			if (!received)
+			{
+				std::cout << "\nWORKER " << worker << " FAILED, TILES " << tiles.FirstTile << " TO " << tiles.FirstTile + tiles.Count - 1 << " ARE REASSIGNED\n";
+
+				RenderEvent failed;
+				failed.Type = RenderEventType::JobFailed;
+				failed.Tile = tiles.FirstTile;
+				failed.Message = "A worker failed, its tiles are reassigned";
+				PostRenderEvent(failed);
+
+				{
+					std::lock_guard<std::mutex> lock(state.Mutex);
+					state.PendingJobs.push_front(tiles.FirstTile);
+					state.ReassignedJobs++;
+				}
+
+				state.Condition.notify_all();
+				finish(true);
+				return;
+			}
+
+			// Every job covers different tiles, so the workers can merge without locking
+			const glm::vec3* source = pixels.data();
+
+			for (uint32_t tile = tiles.FirstTile; tile < tiles.FirstTile + tiles.Count; tile++)
+			{
+				const TileRect rect = GetTileRect(tile);
+
+				for (int j = rect.Y; j < rect.Y + rect.Height; j++)
+				{
+					std::copy(source, source + rect.Width, g_AccumulationBuffer.begin() + j * g_Width + rect.X);
+					std::fill(g_SampleCounts.begin() + j * g_Width + rect.X, g_SampleCounts.begin() + j * g_Width + rect.X + rect.Width, job.SPP);
+					source += rect.Width;
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(state.Mutex);
+				WorkerStatistics& stats = state.Workers[worker];
+				stats.Jobs++;
+				stats.Tiles += static_cast<int>(tiles.Count);
+				stats.RenderTime += result.RenderTime;
+
+				const uint32_t previous = state.FinishedJobs * 10 / state.JobCount;
+				state.FinishedJobs++;
+
+				if (state.FinishedJobs * 10 / state.JobCount != previous)
+				{
+					std::cout << "Tiles : " << state.FinishedJobs * 100 / state.JobCount << "%" << std::endl;
+				}
+			}
+
+			state.Condition.notify_all();
+		}
+
+		finish(false);
+		SendDone(socket);
+	}
+
+	bool RunCoordinator(const CoordinatorSettings& settings, CoordinatorStatistics& stats)
+	{
+		RT_PROFILE_ZONE("RunCoordinator");
+
+		Socket listener;
+
+		if (!listener.Listen(settings.Port))
+		{
+			return false;
+		}
+
+		const uint16_t port = listener.GetPort();
+		const uint32_t tiles_per_job = static_cast<uint32_t>(glm::max(settings.TilesPerJob, 1));
+		CoordinatorSettings job_settings = settings;
+		job_settings.TilesPerJob = static_cast<int>(tiles_per_job);
+
+		CoordinatorState state;
+
+		for (uint32_t tile = 0; tile < g_TileCount; tile += tiles_per_job)
+		{
+			state.PendingJobs.push_back(tile);
+		}
+
+		state.JobCount = static_cast<uint32_t>(state.PendingJobs.size());
+
+		g_DeterministicSampling = true;
+		UpdateSceneBVH();
+		ResetAccumulation();
+
+		const auto start = std::chrono::steady_clock::now();
+		std::cout << "Coordinator listening on port " << port << ", " << g_TileCount << " tiles in " << state.JobCount << " jobs at " << settings.SPP << " spp" << std::endl;
+
+		// Each local worker runs on a thread that waits for its process
+		std::vector<std::thread> processes;
+		const int hardware_threads = static_cast<int>(glm::max(std::thread::hardware_concurrency(), 1u));
+
+		for (int w = 0; w < settings.SpawnWorkers; w++)
+		{
+			const int threads = settings.SpawnWorkerThreads > 0 ? settings.SpawnWorkerThreads : glm::max(1, hardware_threads / settings.SpawnWorkers);
+			std::string command = "\"" + settings.Executable + "\" --worker 127.0.0.1:" + std::to_string(port) + " --threads " + std::to_string(threads);
+
+			if (w == 0 && settings.SpawnFailAfter > 0)
+			{
+				command += " --exit-after " + std::to_string(settings.SpawnFailAfter);
+			}
+
+#ifdef _WIN32
+			// cmd.exe strips the outer quotes when the command starts with one
+			command = "\"" + command + "\"";
+#endif
+
+			processes.emplace_back([command]() { std::system(command.c_str()); });
+		}
+
+		std::vector<std::thread> connections;
+		auto last_connected = std::chrono::steady_clock::now();
+		bool finished = false;
+
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lock(state.Mutex);
+
+				if (state.FinishedJobs == state.JobCount)
+				{
+					finished = true;
+					break;
+				}
+
+				if (state.ConnectedWorkers > 0)
+				{
+					last_connected = std::chrono::steady_clock::now();
+				}
+
+				// Nobody would ever finish the remaining jobs
+				else if (std::chrono::steady_clock::now() - last_connected > std::chrono::duration<float>(settings.IdleTimeout))
+				{
+					std::cout << "\nNO WORKER WAS CONNECTED FOR " << settings.IdleTimeout << " SECONDS, " << state.JobCount - state.FinishedJobs << " JOBS WEREN'T RENDERED\n";
+					break;
+				}
+			}
+
+			Socket connection = listener.Accept(0.1f);
+
+			if (connection.IsValid())
+			{
+				std::lock_guard<std::mutex> lock(state.Mutex);
+				const int worker = static_cast<int>(state.Workers.size());
+				state.Workers.emplace_back();
+				state.ConnectedWorkers++;
+				connections.emplace_back(ServeWorker, std::move(connection), worker, std::ref(state), std::cref(job_settings));
+			}
+		}
+
+		for (auto& e : connections)
+		{
+			e.join();
+		}
+
+		stats.TotalTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+		listener.Close();
+
+		for (auto& e : processes)
+		{
+			e.join();
+		}
+
+		if (!finished)
+		{
+			return false;
+		}
+
+		ResolveScene();
+
+		stats.Workers = state.Workers;
+		stats.ReassignedJobs = state.ReassignedJobs;
+		stats.Concurrency = 0.0f;
+		stats.ContributingWorkers = 0;
+
+		// Workers that were rejected or failed before finishing a job didn't take part in the render
+		for (const WorkerStatistics& worker : stats.Workers)
+		{
+			if (worker.Jobs > 0)
+			{
+				stats.Concurrency += worker.RenderTime;
+				stats.ContributingWorkers++;
+			}
+		}
+
+		stats.Concurrency = stats.TotalTime > 0.0f ? stats.Concurrency / stats.TotalTime : 0.0f;
+		stats.Efficiency = stats.ContributingWorkers > 0 ? stats.Concurrency / (float)stats.ContributingWorkers : 0.0f;
+
+		return true;
+	}
+
+	/* Worker */
+
+	bool RunWorker(const WorkerSettings& settings)
+	{
+		RT_PROFILE_ZONE("RunWorker");
+
+		Socket socket;
+		const auto connect_start = std::chrono::steady_clock::now();
+
+		while (!socket.Connect(settings.Host, settings.Port))
+		{
+			if (std::chrono::duration<float>(std::chrono::steady_clock::now() - connect_start).count() > settings.ConnectTimeout)
+			{
+				std::cout << "\nCOULD NOT CONNECT TO THE COORDINATOR AT " << settings.Host << ":" << settings.Port << "\n";
+				return false;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+
+		HelloMessage hello;
+		hello.Threads = static_cast<uint32_t>(settings.Threads);
+		hello.SceneHash = GetSceneHash();
+
+		MessageHeader header;
+		JobMessage job;
+
+		if (!SendPacket(socket, MessageType::Hello, hello) || !ReceiveHeader(socket, header))
+		{
+			std::cout << "\nLOST THE CONNECTION TO THE COORDINATOR\n";
+			return false;
+		}
+
+		if (header.Type != MessageType::Job || header.Size != sizeof(job) || !socket.Receive(&job, sizeof(job)) || job.Width != g_Width || job.Height != g_Height)
+		{
+			std::cout << "\nTHE COORDINATOR RENDERS A DIFFERENT SCENE OR RESOLUTION\n";
+			return false;
+		}
+
+		g_DeterministicSampling = true;
+		g_FrameSeed = job.FrameSeed;
+		UpdateSceneBVH();
+		ResetAccumulation();
+
+		std::vector<glm::vec3> pixels;
+		int jobs = 0;
+
+		while (true)
+		{
+			TilesMessage tiles;
+
+			if (!ReceiveHeader(socket, header))
+			{
+				std::cout << "\nLOST THE CONNECTION TO THE COORDINATOR\n";
+				return false;
+			}
+
+			if (header.Type == MessageType::Done)
+			{
+				return true;
+			}
+
+			if (header.Type != MessageType::Tiles || header.Size != sizeof(tiles) || !socket.Receive(&tiles, sizeof(tiles)) || tiles.FirstTile >= g_TileCount)
+			{
+				std::cout << "\nUNEXPECTED MESSAGE FROM THE COORDINATOR\n";
+				return false;
+			}
+
+			tiles.Count = glm::min(tiles.Count, g_TileCount - tiles.FirstTile);
+
+			// Dies with a job in flight, like a crashed or unplugged machine would
+			if (settings.ExitAfterJobs > 0 && jobs >= settings.ExitAfterJobs)
+			{
+				std::cout << "Exiting after " << jobs << " jobs (--exit-after)" << std::endl;
+				return false;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			TraceTiles(static_cast<int>(tiles.FirstTile), static_cast<int>(tiles.Count), static_cast<int>(job.SPP), settings.Threads);
+			auto end = std::chrono::steady_clock::now();
+
+			pixels.resize(GetPixelCount(tiles.FirstTile, tiles.Count));
+			glm::vec3* destination = pixels.data();
+
+			for (uint32_t tile = tiles.FirstTile; tile < tiles.FirstTile + tiles.Count; tile++)
+			{
+				const TileRect rect = GetTileRect(tile);
+
+				for (int j = rect.Y; j < rect.Y + rect.Height; j++)
+				{
+					const auto row = g_AccumulationBuffer.begin() + j * g_Width + rect.X;
+					destination = std::copy(row, row + rect.Width, destination);
+				}
+			}
+
+			ResultMessage result;
+			result.FirstTile = tiles.FirstTile;
+			result.Count = tiles.Count;
+			result.RenderTime = std::chrono::duration<float>(end - start).count();
+
+			if (!SendPacket(socket, MessageType::Result, result, pixels.data(), pixels.size() * sizeof(glm::vec3)))
+			{
+				std::cout << "\nLOST THE CONNECTION TO THE COORDINATOR\n";
+				return false;
+			}
+
+			jobs++;
+		}
+	}
+}
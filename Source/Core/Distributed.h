@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Tracer.h"
+
+namespace RayTracer
+{
+	/*
+	Distributed rendering: a coordinator hands out ranges of tiles over TCP to worker processes, which trace them with
+	deterministic sampling and send back the float sums of their samples. The coordinator merges them into the accumulation
+	buffer, so the image is identical to a local TraceScene. Every process has to run the same build and scene (checked with
+	GetSceneHash), and the machines the same byte order.
+	If a worker disconnects or doesn't answer within WorkerTimeout, its tiles go back to the queue for the other workers.
+	*/
+	struct CoordinatorSettings
+	{
+		uint16_t Port = 7421;
+		int SPP = 64;
+		int TilesPerJob = 16; // Smaller jobs balance better between workers but need more round trips
+
+		float WorkerTimeout = 300.0f; // Seconds a worker may take for one job before it counts as failed
+		float IdleTimeout = 60.0f; // Seconds the coordinator waits while no worker is connected before it gives up
+
+		// Local worker processes started by the coordinator (with Executable), to test on one machine
+		int SpawnWorkers = 0;
+		int SpawnWorkerThreads = 0; // 0 splits the hardware threads between them
+		int SpawnFailAfter = 0; // If set, the first spawned worker exits after this many jobs to test the reassignment
+		std::string Executable;
+	};
+
+	struct WorkerStatistics
+	{
+		int Threads = 0;
+		int Jobs = 0;
+		int Tiles = 0;
+		bool Failed = false;
+		float RenderTime = 0.0f; // Seconds spent tracing, as reported by the worker
+		float ConnectedTime = 0.0f; // Seconds from connecting until the render finished or the worker failed
+
+		// Fraction of its connected time the worker was tracing, the rest went to the network, merging and waiting for jobs
+		inline float GetEfficiency() const { return ConnectedTime > 0.0f ? RenderTime / ConnectedTime : 0.0f; }
+	};
+
+	struct CoordinatorStatistics
+	{
+		float TotalTime = 0.0f; // Seconds
+
+		// The tracing time of all workers over the total time : how many workers were tracing at once on average. It isn't a
+		// speedup over one worker, the workers can differ in threads and a failed worker's lost job isn't counted
+		float Concurrency = 0.0f;
+		float Efficiency = 0.0f; // Concurrency over the workers that finished jobs, 1 if they never waited
+		int ContributingWorkers = 0; // Workers that finished at least one job
+		int ReassignedJobs = 0;
+		std::vector<WorkerStatistics> Workers;
+	};
+
+	// Returns once every tile was merged, the image is in the accumulation buffer and g_PixelData
+	bool RunCoordinator(const CoordinatorSettings& settings, CoordinatorStatistics& stats);
+
+	struct WorkerSettings
+	{
+		std::string Host = "127.0.0.1";
+		uint16_t Port = 7421;
+		int Threads = THREAD_SPAWN_COUNT;
+		float ConnectTimeout = 10.0f; // Seconds to keep retrying, the coordinator may not be listening yet
+		int ExitAfterJobs = 0; // Disconnects in the middle of the job after this many, to test the coordinator (0 never)
+	};
+
+	// Renders jobs until the coordinator is done, returns false if it couldn't connect or lost the connection
+	bool RunWorker(const WorkerSettings& settings);
+}
@@ -0,0 +1,271 @@
+#include "Environment.h"
+#include "ImageWriter.h"
+
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+RayTracer::EnvironmentMap g_Environment;
+
+namespace RayTracer
+{
+	static const float PI_F = 3.14159265358979f;
+
+	// Keeps the rescaled random numbers below 1
+	static const float ONE_MINUS_EPSILON = 0.99999994f;
+
+	// 2^(exponent - 136), the mantissas are 8 bit and the exponent is biased by 128
+	static const std::array<float, 256> s_ExponentScales = []()
+	{
+		std::array<float, 256> scales = {};
+
+		for (int e = 1; e < 256; e++)
+		{
+			scales[e] = std::ldexp(1.0f, e - 136);
+		}
+
+		return scales;
+	}();
+
+	static inline float GetLuminance(const glm::vec3& color)
+	{
+		return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	static uint32_t EncodeRGBE(glm::vec3 color)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			color[c] = std::isfinite(color[c]) ? glm::clamp(color[c], 0.0f, 1e30f) : 0.0f;
+		}
+
+		const float max = glm::max(color.r, glm::max(color.g, color.b));
+
+		if (max < 1e-32f)
+		{
+			return 0;
+		}
+
+		int exponent = 0;
+		const float scale = std::frexp(max, &exponent) * 256.0f / max;
+		uint32_t texel = static_cast<uint32_t>(exponent + 128) << 24;
+
+		for (int c = 0; c < 3; c++)
+		{
+			texel |= static_cast<uint32_t>(glm::min(color[c] * scale + 0.5f, 255.0f)) << (c * 8);
+		}
+
+		return texel;
+	}
+
+	inline glm::vec3 EnvironmentMap::GetTexel(uint32_t texel) const
+	{
+		const uint32_t rgbe = m_Texels[texel];
+		const float scale = s_ExponentScales[rgbe >> 24];
+		return glm::vec3((float)(rgbe & 0xFF), (float)((rgbe >> 8) & 0xFF), (float)((rgbe >> 16) & 0xFF)) * scale;
+	}
+
+	bool EnvironmentMap::Load(const std::string& path)
+	{
+		std::string extension = path.size() > 4 ? path.substr(path.size() - 4) : "";
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)std::tolower((unsigned char)c); });
+
+		uint32_t width = 0;
+		uint32_t height = 0;
+		std::vector<float> rgb;
+
+		if (extension == ".hdr")
+		{
+			if (!ReadHDR(path, width, height, rgb))
+			{
+				return false;
+			}
+		}
+
+		else if (extension == ".pfm")
+		{
+			if (!ReadPFM(path, width, height, rgb))
+			{
+				return false;
+			}
+		}
+
+		else
+		{
+			std::cout << "\nUNSUPPORTED ENVIRONMENT MAP FORMAT (" << path << "), USE .hdr OR .pfm\n";
+			return false;
+		}
+
+		Build(width, height, rgb);
+		return true;
+	}
+
+	void EnvironmentMap::Build(uint32_t width, uint32_t height, const std::vector<float>& rgb)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const uint32_t count = width * height;
+
+		m_Width = width;
+		m_Height = height;
+		m_Texels.resize(count);
+		m_Alias.clear();
+		m_InverseWeight = 0.0f;
+
+		// Luminance times the solid angle of every texel, the rows cover equal angles so the ones near the poles are smaller
+		std::vector<double> weights(count);
+		double total = 0.0;
+
+		for (uint32_t row = 0; row < height; row++)
+		{
+			const double cos_top = std::cos(PI_F * (double)row / height);
+			const double cos_bottom = std::cos(PI_F * (double)(row + 1) / height);
+			const double solid_angle = 2.0 * PI_F / width * (cos_top - cos_bottom);
+			const float* source = &rgb[static_cast<size_t>(height - 1 - row) * width * 3];
+
+			for (uint32_t x = 0; x < width; x++)
+			{
+				const uint32_t texel = row * width + x;
+				m_Texels[texel] = EncodeRGBE(glm::vec3(source[x * 3], source[x * 3 + 1], source[x * 3 + 2]));
+
+				// From the stored value, so that the density matches what Lookup returns
+				weights[texel] = GetLuminance(GetTexel(texel)) * solid_angle;
+				total += weights[texel];
+			}
+		}
+
+		uint64_t hash = 14695981039346656037ull;
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(m_Texels.data());
+
+		for (size_t i = 0; i < m_Texels.size() * sizeof(uint32_t); i++)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+
+		m_Hash = hash ^ (static_cast<uint64_t>(width) << 32 | height);
+
+		if (total > 0.0)
+		{
+			m_InverseWeight = static_cast<float>(1.0 / total);
+			m_Alias.resize(count);
+
+			// Every texel gets an equal share, the ones with a probability above the average fill up the shares of the others
+			std::vector<uint32_t> small;
+			std::vector<uint32_t> large;
+
+			for (uint32_t texel = 0; texel < count; texel++)
+			{
+				weights[texel] *= count / total;
+				(weights[texel] < 1.0 ? small : large).push_back(texel);
+			}
+
+			while (!small.empty() && !large.empty())
+			{
+				const uint32_t less = small.back();
+				const uint32_t more = large.back();
+				small.pop_back();
+
+				m_Alias[less] = { static_cast<float>(weights[less]), more };
+				weights[more] += weights[less] - 1.0;
+
+				if (weights[more] < 1.0)
+				{
+					large.pop_back();
+					small.push_back(more);
+				}
+			}
+
+			// What is left is 1 up to rounding
+			for (uint32_t texel : small) { m_Alias[texel] = { 1.0f, texel }; }
+			for (uint32_t texel : large) { m_Alias[texel] = { 1.0f, texel }; }
+		}
+
+		m_BuildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void EnvironmentMap::Clear()
+	{
+		m_Texels.clear();
+		m_Texels.shrink_to_fit();
+		m_Alias.clear();
+		m_Alias.shrink_to_fit();
+		m_Width = 0;
+		m_Height = 0;
+		m_InverseWeight = 0.0f;
+		m_Hash = 0;
+	}
+
+	glm::vec3 EnvironmentMap::Lookup(const glm::vec3& direction) const
+	{
+		float pdf;
+		return Lookup(direction, pdf);
+	}
+
+	glm::vec3 EnvironmentMap::Lookup(const glm::vec3& direction, float& pdf) const
+	{
+		if (m_Texels.empty())
+		{
+			pdf = 0.0f;
+			return glm::vec3(0.0f);
+		}
+
+		// Into the frame of the map, the direction doesn't have to be normalized
+		const float x = direction.x * m_RotationCos - direction.z * m_RotationSin;
+		const float z = direction.x * m_RotationSin + direction.z * m_RotationCos;
+		const float cos_theta = glm::clamp(direction.y / glm::length(direction), -1.0f, 1.0f);
+
+		const float u = std::atan2(x, -z) * (0.5f / PI_F) + 0.5f;
+		const float v = std::acos(cos_theta) * (1.0f / PI_F);
+		const uint32_t column = glm::min(static_cast<uint32_t>(u * m_Width), m_Width - 1);
+		const uint32_t row = glm::min(static_cast<uint32_t>(v * m_Height), m_Height - 1);
+
+		const glm::vec3 radiance = GetTexel(row * m_Width + column);
+		pdf = GetLuminance(radiance) * m_InverseWeight;
+		return radiance;
+	}
+
+	bool EnvironmentMap::Sample(float u0, float u1, float u2, EnvironmentSample& sample) const
+	{
+		if (m_Alias.empty())
+		{
+			return false;
+		}
+
+		// u1 picks between the texel and its alias and is then rescaled, to place the direction in the texel
+		const uint32_t count = static_cast<uint32_t>(m_Alias.size());
+		uint32_t texel = glm::min(static_cast<uint32_t>(u0 * count), count - 1);
+		const AliasEntry entry = m_Alias[texel];
+
+		if (u1 < entry.Threshold)
+		{
+			u1 = u1 / entry.Threshold;
+		}
+
+		else
+		{
+			u1 = (u1 - entry.Threshold) / (1.0f - entry.Threshold);
+			texel = entry.Alias;
+		}
+
+		u1 = glm::min(u1, ONE_MINUS_EPSILON);
+
+		// Uniform in the solid angle of the texel, uniform in phi and cos theta
+		const uint32_t row = texel / m_Width;
+		const uint32_t column = texel - row * m_Width;
+		const float phi = (((float)column + u1) / m_Width - 0.5f) * 2.0f * PI_F;
+		const float cos_top = std::cos(PI_F * (float)row / m_Height);
+		const float cos_bottom = std::cos(PI_F * (float)(row + 1) / m_Height);
+		const float cos_theta = glm::mix(cos_top, cos_bottom, u2);
+		const float sin_theta = std::sqrt(glm::max(1.0f - cos_theta * cos_theta, 0.0f));
+
+		const float x = sin_theta * std::sin(phi);
+		const float z = -sin_theta * std::cos(phi);
+
+		sample.Direction = glm::vec3(x * m_RotationCos + z * m_RotationSin, cos_theta, -x * m_RotationSin + z * m_RotationCos);
+		sample.Radiance = GetTexel(texel);
+		sample.Pdf = GetLuminance(sample.Radiance) * m_InverseWeight;
+		return sample.Pdf > 0.0f;
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace RayTracer
+{
+	struct EnvironmentSample
+	{
+		glm::vec3 Direction; // Normalized, towards the environment
+		float Pdf = 0.0f; // Solid angle density
+		glm::vec3 Radiance;
+	};
+
+	/*
+	A lat-long (equirectangular) HDR image around the scene, +Y is up and the center of the image is -Z.
+	Texels are kept as 4 byte RGBE so that lookups for escaped rays touch little memory, and directions are sampled in
+	proportion to luminance times solid angle with an alias table (Vose 1991), one table entry per texel. That way a small
+	bright sun is found by light samples, instead of only by the few BSDF samples that happen to hit it
+	*/
+	class EnvironmentMap
+	{
+	public:
+
+		// Reads a .hdr (Radiance RGBE) or .pfm image
+		bool Load(const std::string& path);
+
+		// rgb is interleaved with the rows in the OpenGL order (bottom first), like ReadHDR and ReadPFM return them
+		void Build(uint32_t width, uint32_t height, const std::vector<float>& rgb);
+		void Clear();
+
+		glm::vec3 Lookup(const glm::vec3& direction) const;
+
+		// Also returns the density of Sample returning direction, for multiple importance sampling
+		glm::vec3 Lookup(const glm::vec3& direction, float& pdf) const;
+
+		// Returns false if the map is black (or not loaded)
+		bool Sample(float u0, float u1, float u2, EnvironmentSample& sample) const;
+
+		// Rotation around the up axis, in degrees
+		inline void SetRotation(float degrees) { m_Rotation = degrees; m_RotationSin = glm::sin(glm::radians(degrees)); m_RotationCos = glm::cos(glm::radians(degrees)); }
+		inline float GetRotation() const { return m_Rotation; }
+
+		inline bool IsLoaded() const { return !m_Texels.empty(); }
+		inline bool CanSample() const { return !m_Alias.empty(); }
+		inline uint32_t GetWidth() const { return m_Width; }
+		inline uint32_t GetHeight() const { return m_Height; }
+		inline uint64_t GetHash() const { return m_Hash; } // Of the texels
+		inline float GetBuildTime() const { return m_BuildTime; } // In milliseconds
+
+	private:
+
+		struct AliasEntry
+		{
+			float Threshold; // The texel itself is picked below this, the alias above it
+			uint32_t Alias;
+		};
+
+		glm::vec3 GetTexel(uint32_t texel) const;
+
+		std::vector<uint32_t> m_Texels; // RGBE, rows from the top
+		std::vector<AliasEntry> m_Alias;
+
+		uint32_t m_Width = 0;
+		uint32_t m_Height = 0;
+		float m_InverseWeight = 0.0f; // 1 over the sum of luminance times solid angle, the density of a texel is its luminance times this
+		uint64_t m_Hash = 0;
+		float m_BuildTime = 0.0f;
+
+		float m_Rotation = 0.0f;
+		float m_RotationSin = 0.0f;
+		float m_RotationCos = 1.0f;
+	};
+}
+
+// The environment of the scene, escaped rays use the sky gradient if it isn't loaded
+extern RayTracer::EnvironmentMap g_Environment;
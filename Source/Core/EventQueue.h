@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace RayTracer
+{
+	/*
+	A bounded lock free queue that any number of threads can push to and one thread pops from (Vyukov's bounded queue).
+	Every slot has a sequence number : a producer claims the tail with a compare exchange once the slot's sequence says the
+	consumer has emptied it, writes the value and then publishes it by advancing the sequence, so the consumer never reads a
+	half written value. Push doesn't wait or allocate, it returns false (and counts a dropped value) when the queue is full
+	*/
+	template <typename T, size_t Capacity = 1024>
+	class EventQueue
+	{
+		static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "The capacity has to be a power of two");
+
+	public:
+
+		EventQueue()
+		{
+			for (size_t i = 0; i < Capacity; i++)
+			{
+				m_Slots[i].Sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		EventQueue(const EventQueue&) = delete;
+		EventQueue& operator=(const EventQueue&) = delete;
+
+		// Can be called from any thread
+		bool Push(const T& value)
+		{
+			size_t position = m_Tail.load(std::memory_order_relaxed);
+
+			while (true)
+			{
+				Slot& slot = m_Slots[position & (Capacity - 1)];
+				const size_t sequence = slot.Sequence.load(std::memory_order_acquire);
+				const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+				if (difference == 0)
+				{
+					if (m_Tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					{
+						slot.Value = value;
+						slot.Sequence.store(position + 1, std::memory_order_release);
+						return true;
+					}
+				}
+
+				// The consumer is a whole lap behind
+				else if (difference < 0)
+				{
+					m_Dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				// Another producer took the slot
+				else
+				{
+					position = m_Tail.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// Only called from the consumer thread, returns false if there is nothing published yet
+		bool Pop(T& value)
+		{
+			Slot& slot = m_Slots[m_Head & (Capacity - 1)];
+
+			if (slot.Sequence.load(std::memory_order_acquire) != m_Head + 1)
+			{
+				return false;
+			}
+
+			value = slot.Value;
+			slot.Sequence.store(m_Head + Capacity, std::memory_order_release);
+			m_Head++;
+			return true;
+		}
+
+		// Only called from the consumer thread
+		bool IsEmpty() const
+		{
+			return m_Slots[m_Head & (Capacity - 1)].Sequence.load(std::memory_order_acquire) != m_Head + 1;
+		}
+
+		inline uint64_t GetDroppedCount() const { return m_Dropped.load(std::memory_order_relaxed); }
+
+	private:
+
+		struct alignas(64) Slot
+		{
+			std::atomic<size_t> Sequence;
+			T Value;
+		};
+
+		Slot m_Slots[Capacity];
+
+		// On their own lines, the producers share the tail and the consumer owns the head
+		alignas(64) std::atomic<size_t> m_Tail{ 0 };
+		alignas(64) size_t m_Head = 0;
+		std::atomic<uint64_t> m_Dropped{ 0 };
+	};
+}
@@ -0,0 +1,251 @@
+#include "ImageWriter.h"
+
+#include <cmath>
+
+namespace RayTracer
+{
+	bool WritePPM(const std::string& path, uint32_t width, uint32_t height, const uint8_t* rgb)
+	{
+		std::ofstream file(path, std::ios::out | std::ios::binary);
+
+		if (!file.good())
+		{
+			std::cout << "\nCOULD NOT OPEN IMAGE FILE FOR WRITING (" << path << ")\n";
+			return false;
+		}
+
+		file << "P6\n" << width << " " << height << "\n255\n";
+
+		for (int64_t y = (int64_t)height - 1; y >= 0; y--)
+		{
+			file.write(reinterpret_cast<const char*>(rgb + y * width * 3), width * 3);
+		}
+
+		return file.good();
+	}
+
+	bool ReadPPM(const std::string& path, uint32_t& width, uint32_t& height, std::vector<uint8_t>& rgb)
+	{
+		std::ifstream file(path, std::ios::in | std::ios::binary);
+		std::string magic;
+		uint32_t max_value = 0;
+
+		if (!file.good())
+		{
+			std::cout << "\nCOULD NOT OPEN IMAGE FILE FOR READING (" << path << ")\n";
+			return false;
+		}
+
+		file >> magic >> width >> height >> max_value;
+		file.get(); // The single whitespace character after the header
+
+		if (magic != "P6" || max_value != 255 || width == 0 || height == 0)
+		{
+			std::cout << "\nUNSUPPORTED PPM FILE (" << path << ")\n";
+			return false;
+		}
+
+		rgb.resize(static_cast<size_t>(width) * height * 3);
+
+		for (int64_t y = (int64_t)height - 1; y >= 0; y--)
+		{
+			file.read(reinterpret_cast<char*>(rgb.data() + y * width * 3), width * 3);
+		}
+
+		return file.good();
+	}
+
+	bool WritePFM(const std::string& path, uint32_t width, uint32_t height, uint32_t stride, const std::vector<const float*>& channels)
+	{
+		if (channels.size() != 1 && channels.size() != 3)
+		{
+			std::cout << "\nPFM IMAGES NEED ONE OR THREE CHANNELS (" << path << ")\n";
+			return false;
+		}
+
+		std::ofstream file(path, std::ios::out | std::ios::binary);
+
+		if (!file.good())
+		{
+			std::cout << "\nCOULD NOT OPEN IMAGE FILE FOR WRITING (" << path << ")\n";
+			return false;
+		}
+
+		// A negative scale means little endian
+		file << (channels.size() == 3 ? "PF" : "Pf") << "\n" << width << " " << height << "\n-1.0\n";
+
+		std::vector<float> row(static_cast<size_t>(width) * channels.size());
+
+		for (uint32_t y = 0; y < height; y++)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				for (size_t c = 0; c < channels.size(); c++)
+				{
+					row[x * channels.size() + c] = channels[c][static_cast<size_t>(y) * stride + x];
+				}
+			}
+
+			file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+		}
+
+		return file.good();
+	}
+
+	bool ReadPFM(const std::string& path, uint32_t& width, uint32_t& height, std::vector<float>& rgb)
+	{
+		std::ifstream file(path, std::ios::in | std::ios::binary);
+		std::string magic;
+		float scale = 0.0f;
+
+		if (!file.good())
+		{
+			std::cout << "\nCOULD NOT OPEN IMAGE FILE FOR READING (" << path << ")\n";
+			return false;
+		}
+
+		file >> magic >> width >> height >> scale;
+		file.get();
+
+		const size_t channels = magic == "PF" ? 3 : 1;
+
+		// Only little endian files (negative scale) are supported
+		if ((magic != "PF" && magic != "Pf") || scale >= 0.0f || width == 0 || height == 0 || width > 65536 || height > 65536)
+		{
+			std::cout << "\nUNSUPPORTED PFM FILE (" << path << ")\n";
+			return false;
+		}
+
+		std::vector<float> data(static_cast<size_t>(width) * height * channels);
+		file.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(float));
+
+		if (!file.good())
+		{
+			std::cout << "\nTRUNCATED PFM FILE (" << path << ")\n";
+			return false;
+		}
+
+		rgb.resize(static_cast<size_t>(width) * height * 3);
+
+		for (size_t i = 0; i < static_cast<size_t>(width) * height; i++)
+		{
+			for (size_t c = 0; c < 3; c++)
+			{
+				rgb[i * 3 + c] = data[i * channels + (channels == 3 ? c : 0)];
+			}
+		}
+
+		return true;
+	}
+
+	// Radiance's shared exponent format, the mantissas are scaled by 2^(exponent - 136)
+	static inline void DecodeRGBE(const uint8_t* rgbe, float* rgb)
+	{
+		const float scale = rgbe[3] == 0 ? 0.0f : std::ldexp(1.0f, static_cast<int>(rgbe[3]) - 136);
+		rgb[0] = rgbe[0] * scale;
+		rgb[1] = rgbe[1] * scale;
+		rgb[2] = rgbe[2] * scale;
+	}
+
+	bool ReadHDR(const std::string& path, uint32_t& width, uint32_t& height, std::vector<float>& rgb)
+	{
+		std::ifstream file(path, std::ios::in | std::ios::binary);
+		std::string line;
+
+		if (!file.good())
+		{
+			std::cout << "\nCOULD NOT OPEN IMAGE FILE FOR READING (" << path << ")\n";
+			return false;
+		}
+
+		std::getline(file, line);
+
+		if (line.rfind("#?", 0) != 0)
+		{
+			std::cout << "\nUNSUPPORTED HDR FILE (" << path << ")\n";
+			return false;
+		}
+
+		// The header ends with an empty line, then comes the resolution
+		while (std::getline(file, line) && !line.empty())
+		{
+			if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")
+			{
+				std::cout << "\nUNSUPPORTED HDR PIXEL FORMAT (" << path << ")\n";
+				return false;
+			}
+		}
+
+		std::string y_axis, x_axis;
+		file >> y_axis >> height >> x_axis >> width;
+		file.get();
+
+		// Only the standard orientation, rows from the top and columns from the left
+		if (y_axis != "-Y" || x_axis != "+X" || width == 0 || height == 0 || width > 65536 || height > 65536)
+		{
+			std::cout << "\nUNSUPPORTED HDR FILE (" << path << ")\n";
+			return false;
+		}
+
+		rgb.resize(static_cast<size_t>(width) * height * 3);
+		std::vector<uint8_t> scanline(static_cast<size_t>(width) * 4);
+
+		for (uint32_t y = 0; y < height; y++)
+		{
+			uint8_t start[4] = {};
+			file.read(reinterpret_cast<char*>(start), 4);
+
+			// Run length encoded scanlines store every channel separately
+			if (width >= 8 && width < 32768 && start[0] == 2 && start[1] == 2 && ((start[2] << 8) | start[3]) == static_cast<int>(width))
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					for (uint32_t x = 0; x < width && file.good();)
+					{
+						uint8_t count = static_cast<uint8_t>(file.get());
+
+						if (count > 128)
+						{
+							count -= 128;
+							const uint8_t value = static_cast<uint8_t>(file.get());
+
+							for (uint8_t i = 0; i < count && x < width; i++, x++)
+							{
+								scanline[x * 4 + c] = value;
+							}
+						}
+
+						else
+						{
+							for (uint8_t i = 0; i < count && x < width; i++, x++)
+							{
+								scanline[x * 4 + c] = static_cast<uint8_t>(file.get());
+							}
+						}
+					}
+				}
+			}
+
+			else
+			{
+				std::copy(start, start + 4, scanline.begin());
+				file.read(reinterpret_cast<char*>(scanline.data() + 4), (width - 1) * 4);
+			}
+
+			if (!file.good())
+			{
+				std::cout << "\nTRUNCATED HDR FILE (" << path << ")\n";
+				return false;
+			}
+
+			const size_t row = static_cast<size_t>(height - 1 - y) * width;
+
+			for (uint32_t x = 0; x < width; x++)
+			{
+				DecodeRGBE(&scanline[x * 4], &rgb[(row + x) * 3]);
+			}
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <vector>
+
+namespace RayTracer
+{
+	/*
+	Writes an 8 bit binary PPM (P6) image.
+	The pixel data is expected in the OpenGL row order (bottom row first), it is flipped while writing
+	*/
+	bool WritePPM(const std::string& path, uint32_t width, uint32_t height, const uint8_t* rgb);
+
+	/*
+	Reads an 8 bit binary PPM (P6) image written by WritePPM, the rows are returned in the OpenGL order
+	*/
+	bool ReadPPM(const std::string& path, uint32_t& width, uint32_t& height, std::vector<uint8_t>& rgb);
+
+	/*
+	Writes a 32 bit float PFM image with one (grayscale) or three channels from planar buffers.
+	Rows are stride floats apart and in the OpenGL order, which is also the PFM order
+	*/
+	bool WritePFM(const std::string& path, uint32_t width, uint32_t height, uint32_t stride, const std::vector<const float*>& channels);
+
+	/*
+	Reads a float PFM image (grayscale ones are expanded to RGB) as interleaved RGB floats, rows in the OpenGL order
+	*/
+	bool ReadPFM(const std::string& path, uint32_t& width, uint32_t& height, std::vector<float>& rgb);
+
+	/*
+	Reads a Radiance HDR (RGBE) image, flat or run length encoded, as interleaved RGB floats, rows in the OpenGL order
+	*/
+	bool ReadHDR(const std::string& path, uint32_t& width, uint32_t& height, std::vector<float>& rgb);
+}
@@ -0,0 +1,358 @@
+#include "Lights.h"
+#include "BVH.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+RayTracer::LightSampler g_SceneLights;
+
+namespace RayTracer
+{
+	static const int LIGHT_TREE_BINS = 12;
+
+	// Keeps the rescaled random number of the tree traversal below 1
+	static const float ONE_MINUS_EPSILON = 0.99999994f;
+
+	/*
+	1 - cos of the half angle of the cone a sphere subtends from a point at squared distance distance2, or 0 from inside it.
+	Written with the squared sine so that it stays precise for small and distant lights, where cos is almost 1
+	*/
+	static inline float GetConeSolidAngleFactor(const Sphere& sphere, float distance2)
+	{
+		const float sin2 = sphere.Radius * sphere.Radius / distance2;
+
+		if (sin2 >= 1.0f)
+		{
+			return 0.0f;
+		}
+
+		return sin2 / (1.0f + std::sqrt(1.0f - sin2));
+	}
+
+	// Proportional to the emitted power, 4 pi^2 r^2 times the radiance
+	static inline float GetLightPower(const Sphere& sphere)
+	{
+		const glm::vec3 emission = sphere.GetEmission();
+		return (emission.r + emission.g + emission.b) * sphere.Radius * sphere.Radius;
+	}
+
+	/*
+	Conservative estimate of the light a node sends to a point with the normal, its power over the squared distance
+	times the largest cosine at the receiver that the bounds allow
+	*/
+	static float GetImportance(const LightTreeNode& node, const glm::vec3& point, const glm::vec3& normal)
+	{
+		const glm::vec3 to_center = 0.5f * (node.Min + node.Max) - point;
+		const float distance2 = glm::dot(to_center, to_center);
+		const float radius2 = 0.25f * glm::dot(node.Max - node.Min, node.Max - node.Min); // Of the sphere around the bounds
+
+		// Inside the bounds every direction is possible
+		if (distance2 <= radius2)
+		{
+			return node.Power / glm::max(radius2, 1e-12f);
+		}
+
+		const glm::vec3 direction = to_center / std::sqrt(distance2);
+		const float sin_u2 = radius2 / distance2;
+		const float sin_u = std::sqrt(sin_u2);
+		const float cos_u = std::sqrt(1.0f - sin_u2);
+
+		// The normal can be up to the angle of the bounds closer to the lights
+		const float cos_i = glm::dot(normal, direction);
+		const float sin_i = std::sqrt(glm::max(1.0f - cos_i * cos_i, 0.0f));
+		const float receiver = cos_i < cos_u ? cos_i * cos_u + sin_i * sin_u : 1.0f;
+
+		if (receiver <= 0.0f)
+		{
+			return 0.0f;
+		}
+
+		return node.Power * receiver / distance2;
+	}
+
+	void LightSampler::Build(const std::vector<Sphere>& spheres, LightSelection selection)
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		m_Selection = selection;
+		m_Lights.clear();
+		m_Nodes.clear();
+
+		for (size_t s = 0; s < spheres.size(); s++)
+		{
+			if (spheres[s].SphereMaterial == Material::Emissive && spheres[s].Radius > 0.0f)
+			{
+				m_Lights.push_back(static_cast<uint32_t>(s));
+			}
+		}
+
+		const uint32_t count = static_cast<uint32_t>(m_Lights.size());
+		m_Leaves.assign(count, 0);
+
+		if (selection == LightSelection::Tree && count > 0)
+		{
+			m_Nodes.reserve(2 * count - 1);
+			m_Nodes.emplace_back();
+			BuildNode(spheres, 0, count, UINT32_MAX, 0);
+		}
+
+		// The tree build reorders the lights
+		m_LightIndices.assign(spheres.size(), UINT32_MAX);
+
+		for (uint32_t l = 0; l < count; l++)
+		{
+			m_LightIndices[m_Lights[l]] = l;
+		}
+
+		m_BuildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Splits the lights first to first + count - 1 with binned SAH weighted by the power, so bright lights end up in small nodes
+	void LightSampler::BuildNode(const std::vector<Sphere>& spheres, uint32_t first, uint32_t count, uint32_t parent, uint32_t index)
+	{
+		LightTreeNode node;
+		AABB bounds;
+		AABB centroids;
+		node.Power = 0.0f;
+		node.Parent = parent;
+
+		for (uint32_t l = first; l < first + count; l++)
+		{
+			const Sphere& light = spheres[m_Lights[l]];
+			bounds.Grow(light.Center - glm::vec3(light.Radius));
+			bounds.Grow(light.Center + glm::vec3(light.Radius));
+			centroids.Grow(light.Center);
+			node.Power += GetLightPower(light);
+		}
+
+		node.Min = bounds.Min;
+		node.Max = bounds.Max;
+
+		if (count == 1)
+		{
+			node.LeftFirst = first;
+			node.Leaf = 1;
+			m_Nodes[index] = node;
+			m_Leaves[first] = index;
+			return;
+		}
+
+		const glm::vec3 extent = centroids.Max - centroids.Min;
+		const int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+		uint32_t middle = first + count / 2;
+
+		if (extent[axis] > 0.0f)
+		{
+			AABB bin_bounds[LIGHT_TREE_BINS];
+			float bin_power[LIGHT_TREE_BINS] = {};
+			const float scale = (float)LIGHT_TREE_BINS / extent[axis];
+
+			auto get_bin = [&](uint32_t l)
+			{
+				return glm::min(static_cast<int>((spheres[m_Lights[l]].Center[axis] - centroids.Min[axis]) * scale), LIGHT_TREE_BINS - 1);
+			};
+
+			for (uint32_t l = first; l < first + count; l++)
+			{
+				const Sphere& light = spheres[m_Lights[l]];
+				const int bin = get_bin(l);
+				bin_bounds[bin].Grow(light.Center - glm::vec3(light.Radius));
+				bin_bounds[bin].Grow(light.Center + glm::vec3(light.Radius));
+				bin_power[bin] += GetLightPower(light);
+			}
+
+			// Cost of splitting after every bin, sweeping from the right and then from the left
+			float right_cost[LIGHT_TREE_BINS] = {};
+			AABB right_bounds;
+			float right_power = 0.0f;
+
+			for (int b = LIGHT_TREE_BINS - 1; b > 0; b--)
+			{
+				right_bounds.Grow(bin_bounds[b]);
+				right_power += bin_power[b];
+				right_cost[b - 1] = right_power * right_bounds.GetSurfaceArea();
+			}
+
+			AABB left_bounds;
+			float left_power = 0.0f;
+			float best_cost = std::numeric_limits<float>::max();
+			int best_bin = -1;
+
+			for (int b = 0; b < LIGHT_TREE_BINS - 1; b++)
+			{
+				left_bounds.Grow(bin_bounds[b]);
+				left_power += bin_power[b];
+				const float cost = left_power * left_bounds.GetSurfaceArea() + right_cost[b];
+
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_bin = b;
+				}
+			}
+
+			middle = static_cast<uint32_t>(std::partition(m_Lights.begin() + first, m_Lights.begin() + first + count, [&](uint32_t light)
+			{
+				return glm::min(static_cast<int>((spheres[light].Center[axis] - centroids.Min[axis]) * scale), LIGHT_TREE_BINS - 1) <= best_bin;
+			}) - m_Lights.begin());
+		}
+
+		// All the lights fell on one side (or share their centers), split them in the middle
+		if (middle == first || middle == first + count)
+		{
+			middle = first + count / 2;
+			std::nth_element(m_Lights.begin() + first, m_Lights.begin() + middle, m_Lights.begin() + first + count, [&](uint32_t a, uint32_t b)
+			{
+				return spheres[a].Center[axis] < spheres[b].Center[axis];
+			});
+		}
+
+		const uint32_t left = static_cast<uint32_t>(m_Nodes.size());
+		m_Nodes.emplace_back();
+		m_Nodes.emplace_back();
+
+		node.LeftFirst = left;
+		node.Leaf = 0;
+		m_Nodes[index] = node;
+
+		BuildNode(spheres, first, middle - first, index, left);
+		BuildNode(spheres, middle, first + count - middle, index, left + 1);
+	}
+
+	bool LightSampler::Sample(const std::vector<Sphere>& spheres, const glm::vec3& point, const glm::vec3& normal, float u0, float u1, float u2,
+		LightSample& sample) const
+	{
+		if (m_Lights.empty())
+		{
+			return false;
+		}
+
+		uint32_t pick = 0;
+		float selection_pdf = 1.0f;
+
+		if (m_Selection == LightSelection::Uniform)
+		{
+			pick = glm::min(static_cast<uint32_t>(u0 * (float)m_Lights.size()), static_cast<uint32_t>(m_Lights.size()) - 1);
+			selection_pdf = 1.0f / (float)m_Lights.size();
+		}
+
+		else
+		{
+			// Descends into a child with the probability of its share of the importance, u0 is rescaled to be reused at every level
+			uint32_t node = 0;
+
+			while (!m_Nodes[node].IsLeaf())
+			{
+				const uint32_t left = m_Nodes[node].LeftFirst;
+				const float left_importance = GetImportance(m_Nodes[left], point, normal);
+				const float right_importance = GetImportance(m_Nodes[left + 1], point, normal);
+
+				if (left_importance + right_importance <= 0.0f)
+				{
+					return false;
+				}
+
+				const float left_probability = left_importance / (left_importance + right_importance);
+
+				if (u0 < left_probability)
+				{
+					node = left;
+					selection_pdf *= left_probability;
+					u0 = glm::min(u0 / left_probability, ONE_MINUS_EPSILON);
+				}
+
+				else
+				{
+					node = left + 1;
+					selection_pdf *= 1.0f - left_probability;
+					u0 = glm::min((u0 - left_probability) / (1.0f - left_probability), ONE_MINUS_EPSILON);
+				}
+			}
+
+			pick = m_Nodes[node].LeftFirst;
+		}
+
+		const Sphere& light = spheres[m_Lights[pick]];
+		const glm::vec3 to_light = light.Center - point;
+		const float distance2 = glm::dot(to_light, to_light);
+		const float one_minus_cos = GetConeSolidAngleFactor(light, distance2);
+
+		if (one_minus_cos <= 0.0f)
+		{
+			return false;
+		}
+
+		// Uniform in the cone, 1 - cos theta is uniform in [0, one_minus_cos]
+		const float t = u1 * one_minus_cos;
+		const float cos_theta = 1.0f - t;
+		const float sin_theta = std::sqrt(glm::max(t * (2.0f - t), 0.0f));
+		const float phi = 2.0f * (float)PI * u2;
+
+		// Orthonormal basis around the axis (Duff et al. 2017)
+		const glm::vec3 w = to_light / std::sqrt(distance2);
+		const float sign = std::copysign(1.0f, w.z);
+		const float a = -1.0f / (sign + w.z);
+		const float b = w.x * w.y * a;
+		const glm::vec3 u = glm::vec3(1.0f + sign * w.x * w.x * a, sign * b, -sign * w.x);
+		const glm::vec3 v = glm::vec3(b, sign + w.y * w.y * a, -w.y);
+
+		sample.Direction = glm::normalize(u * (sin_theta * std::cos(phi)) + v * (sin_theta * std::sin(phi)) + w * cos_theta);
+		sample.Pdf = selection_pdf / (2.0f * (float)PI * one_minus_cos);
+		sample.Sphere = static_cast<int>(m_Lights[pick]);
+
+		return true;
+	}
+
+	float LightSampler::GetSelectionPdf(const glm::vec3& point, const glm::vec3& normal, uint32_t light) const
+	{
+		if (m_Selection == LightSelection::Uniform)
+		{
+			return 1.0f / (float)m_Lights.size();
+		}
+
+		// The same probabilities as in Sample, from the leaf up
+		float pdf = 1.0f;
+
+		for (uint32_t node = m_Leaves[light]; m_Nodes[node].Parent != UINT32_MAX; node = m_Nodes[node].Parent)
+		{
+			const uint32_t left = m_Nodes[m_Nodes[node].Parent].LeftFirst;
+			const float left_importance = GetImportance(m_Nodes[left], point, normal);
+			const float right_importance = GetImportance(m_Nodes[left + 1], point, normal);
+
+			if (left_importance + right_importance <= 0.0f)
+			{
+				return 0.0f;
+			}
+
+			const float left_probability = left_importance / (left_importance + right_importance);
+			pdf *= node == left ? left_probability : 1.0f - left_probability;
+		}
+
+		return pdf;
+	}
+
+	float LightSampler::GetPdf(const std::vector<Sphere>& spheres, const glm::vec3& point, const glm::vec3& normal, int sphere) const
+	{
+		if (sphere < 0 || static_cast<size_t>(sphere) >= m_LightIndices.size() || m_LightIndices[sphere] == UINT32_MAX)
+		{
+			return 0.0f;
+		}
+
+		const Sphere& light = spheres[sphere];
+		const glm::vec3 to_light = light.Center - point;
+		const float one_minus_cos = GetConeSolidAngleFactor(light, glm::dot(to_light, to_light));
+
+		if (one_minus_cos <= 0.0f)
+		{
+			return 0.0f;
+		}
+
+		return GetSelectionPdf(point, normal, m_LightIndices[sphere]) / (2.0f * (float)PI * one_minus_cos);
+	}
+}
+
+void UpdateSceneLights()
+{
+	g_SceneLights.Build(Spheres, g_SceneLights.GetSelection());
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Tracer.h"
+
+namespace RayTracer
+{
+	struct LightSample
+	{
+		glm::vec3 Direction; // Normalized, from the shaded point towards the light
+		float Pdf = 0.0f; // Solid angle density, including the probability of picking the light
+		int Sphere = -1; // Index of the light in the spheres
+	};
+
+	enum class LightSelection
+	{
+		Uniform = 0, // Every light is as likely, the cost doesn't depend on the light count but the noise grows with it
+		Tree // Lights are picked by their estimated contribution, in a number of steps logarithmic in the light count
+	};
+
+	/*
+	Node of the light tree, every leaf is one light. The importance of a node for a shaded point is estimated from the
+	total power and the bounds of its lights (Conty Estevez and Kulla 2018). Spheres emit in every direction so the
+	emission cone of the paper never culls anything and isn't stored
+	*/
+	struct LightTreeNode
+	{
+		glm::vec3 Min;
+		uint32_t LeftFirst; // The children are at LeftFirst and LeftFirst + 1, or the index into the lights for leaves
+		glm::vec3 Max;
+		uint32_t Parent;
+		float Power;
+		uint32_t Leaf;
+
+		inline bool IsLeaf() const { return Leaf != 0; }
+	};
+
+	/*
+	The emissive spheres of the scene, for next event estimation.
+	A light is picked (uniformly or through the light tree) and then a direction in the cone it subtends is sampled,
+	Pdf is the product of both densities
+	*/
+	class LightSampler
+	{
+	public:
+
+		void Build(const std::vector<Sphere>& spheres, LightSelection selection = LightSelection::Tree);
+
+		// Returns false if there are no lights that can reach the point or the point is inside the picked light
+		bool Sample(const std::vector<Sphere>& spheres, const glm::vec3& point, const glm::vec3& normal, float u0, float u1, float u2,
+			LightSample& sample) const;
+
+		// Density of Sample returning a direction towards sphere (0 if it isn't a light), for multiple importance sampling
+		float GetPdf(const std::vector<Sphere>& spheres, const glm::vec3& point, const glm::vec3& normal, int sphere) const;
+
+		inline size_t GetLightCount() const { return m_Lights.size(); }
+		inline size_t GetNodeCount() const { return m_Nodes.size(); }
+		inline LightSelection GetSelection() const { return m_Selection; }
+		inline float GetBuildTime() const { return m_BuildTime; } // In milliseconds
+
+	private:
+
+		void BuildNode(const std::vector<Sphere>& spheres, uint32_t first, uint32_t count, uint32_t parent, uint32_t node);
+
+		// Probability of picking the light with the index light into m_Lights
+		float GetSelectionPdf(const glm::vec3& point, const glm::vec3& normal, uint32_t light) const;
+
+		std::vector<uint32_t> m_Lights; // Sphere indices, in the order of the tree leaves
+		std::vector<uint32_t> m_LightIndices; // The index into m_Lights of every sphere, UINT32_MAX for spheres that aren't lights
+		std::vector<uint32_t> m_Leaves; // The leaf node of every light
+		std::vector<LightTreeNode> m_Nodes;
+
+		LightSelection m_Selection = LightSelection::Tree;
+		float m_BuildTime = 0.0f;
+	};
+}
+
+// The lights of Spheres, updated by UpdateSceneBVH
+extern RayTracer::LightSampler g_SceneLights;
+
+void UpdateSceneLights();
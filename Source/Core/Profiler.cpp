@@ -0,0 +1,245 @@
+#include "Profiler.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace RayTracer
+{
+	namespace Profiler
+	{
+		static const uint32_t EVENT_CHUNK_SIZE = 4096;
+
+		/*
+		Events are appended to fixed size chunks that are never moved or freed while the program runs,
+		so the dumping thread can read them while the owning thread keeps writing
+		*/
+		struct EventChunk
+		{
+			ProfileEvent Events[EVENT_CHUNK_SIZE];
+			std::atomic<uint32_t> Count{ 0 };
+			std::atomic<EventChunk*> Next{ nullptr };
+		};
+
+		struct ThreadEventBuffer
+		{
+			std::unique_ptr<EventChunk> Head;
+			EventChunk* Tail = nullptr;
+			std::vector<std::unique_ptr<EventChunk>> Chunks;
+			std::string Name;
+			uint32_t ThreadID = 0;
+		};
+
+		static std::atomic<bool> s_Enabled{ false }; // Off by default, the event chunks are only freed when the program exits
+		static std::mutex s_RegistryMutex; // Only locked when a thread records its first event, renames itself or when dumping
+		static std::vector<std::unique_ptr<ThreadEventBuffer>> s_ThreadBuffers;
+		static const auto s_Epoch = std::chrono::steady_clock::now();
+
+		static ThreadEventBuffer* GetThreadBuffer()
+		{
+			thread_local ThreadEventBuffer* buffer = nullptr;
+
+			if (!buffer)
+			{
+				std::unique_ptr<ThreadEventBuffer> new_buffer(new ThreadEventBuffer);
+				new_buffer->Head.reset(new EventChunk);
+				new_buffer->Tail = new_buffer->Head.get();
+
+				std::lock_guard<std::mutex> lock(s_RegistryMutex);
+				new_buffer->ThreadID = static_cast<uint32_t>(s_ThreadBuffers.size());
+				new_buffer->Name = "Thread " + std::to_string(new_buffer->ThreadID);
+				buffer = new_buffer.get();
+				s_ThreadBuffers.push_back(std::move(new_buffer));
+			}
+
+			return buffer;
+		}
+
+		void SetEnabled(bool enabled)
+		{
+			s_Enabled.store(enabled, std::memory_order_relaxed);
+		}
+
+		bool IsEnabled()
+		{
+			return s_Enabled.load(std::memory_order_relaxed);
+		}
+
+		void SetThreadName(const std::string& name)
+		{
+			ThreadEventBuffer* buffer = GetThreadBuffer();
+			std::lock_guard<std::mutex> lock(s_RegistryMutex);
+			buffer->Name = name;
+		}
+
+		uint64_t GetTimestamp()
+		{
+			// Never returns 0, a zero start time is used to mark zones that started while the profiler was disabled
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_Epoch).count()) + 1;
+		}
+
+		uint64_t GetThreadCPUTime()
+		{
+#ifdef _WIN32
+			FILETIME creation, exit, kernel, user;
+
+			if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+			{
+				return 0;
+			}
+
+			// In units of 100 ns
+			const uint64_t kernel_time = (static_cast<uint64_t>(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+			const uint64_t user_time = (static_cast<uint64_t>(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+			return (kernel_time + user_time) * 100;
+#else
+			timespec time;
+
+			if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0)
+			{
+				return 0;
+			}
+
+			return static_cast<uint64_t>(time.tv_sec) * 1000000000ull + static_cast<uint64_t>(time.tv_nsec);
+#endif
+		}
+
+		void RecordEvent(const char* name, uint64_t start, uint64_t end, int64_t arg)
+		{
+			ThreadEventBuffer* buffer = GetThreadBuffer();
+			EventChunk* chunk = buffer->Tail;
+			uint32_t count = chunk->Count.load(std::memory_order_relaxed);
+
+			if (count == EVENT_CHUNK_SIZE)
+			{
+				EventChunk* new_chunk = new EventChunk;
+				buffer->Chunks.emplace_back(new_chunk);
+				chunk->Next.store(new_chunk, std::memory_order_release);
+				buffer->Tail = new_chunk;
+				chunk = new_chunk;
+				count = 0;
+			}
+
+			chunk->Events[count] = { name, start, end, arg };
+
+			// Publish the event to the dumping thread
+			chunk->Count.store(count + 1, std::memory_order_release);
+		}
+
+		// Escapes the quotes, backslashes and control characters, which aren't allowed in a JSON string
+		static std::string EscapeJSON(const std::string& str)
+		{
+			std::string escaped;
+			escaped.reserve(str.size());
+
+			for (char c : str)
+			{
+				switch (c)
+				{
+				case '"':
+					escaped += "\\\"";
+					break;
+
+				case '\\':
+					escaped += "\\\\";
+					break;
+
+				case '\n':
+					escaped += "\\n";
+					break;
+
+				case '\r':
+					escaped += "\\r";
+					break;
+
+				case '\t':
+					escaped += "\\t";
+					break;
+
+				default:
+					if (static_cast<unsigned char>(c) < 0x20)
+					{
+						char code[7];
+						snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(c));
+						escaped += code;
+					}
+
+					else
+					{
+						escaped += c;
+					}
+
+					break;
+				}
+			}
+
+			return escaped;
+		}
+
+		bool Dump(const std::string& path)
+		{
+			std::ofstream file(path, std::ios::out);
+
+			if (!file.good())
+			{
+				std::cout << "\nCOULD NOT OPEN PROFILE FILE FOR WRITING (" << path << ")\n";
+				return false;
+			}
+
+			std::lock_guard<std::mutex> lock(s_RegistryMutex);
+			size_t event_count = 0;
+			bool first = true;
+
+			file << std::fixed << std::setprecision(3);
+			file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+			for (auto& buffer : s_ThreadBuffers)
+			{
+				file << (first ? "" : ",\n");
+				file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer->ThreadID
+					<< ",\"args\":{\"name\":\"" << EscapeJSON(buffer->Name) << "\"}}";
+				first = false;
+
+				for (EventChunk* chunk = buffer->Head.get(); chunk; chunk = chunk->Next.load(std::memory_order_acquire))
+				{
+					uint32_t count = chunk->Count.load(std::memory_order_acquire);
+
+					for (uint32_t i = 0; i < count; i++)
+					{
+						const ProfileEvent& e = chunk->Events[i];
+
+						// Timestamps are in microseconds
+						file << ",\n{\"name\":\"" << EscapeJSON(e.Name) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->ThreadID
+							<< ",\"ts\":" << (e.Start / 1000.0) << ",\"dur\":" << ((e.End - e.Start) / 1000.0);
+
+						if (e.Arg >= 0)
+						{
+							file << ",\"args\":{\"value\":" << e.Arg << "}";
+						}
+
+						file << "}";
+						event_count++;
+					}
+				}
+			}
+
+			file << "\n]}\n";
+			std::cout << "Wrote " << event_count << " profiler events to " << path << std::endl;
+
+			return file.good();
+		}
+	}
+}
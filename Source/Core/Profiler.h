@@ -0,0 +1,94 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+/*
+Set RAYTRACER_PROFILER to 0 to compile all the profiler zones out
+*/
+#ifndef RAYTRACER_PROFILER
+#define RAYTRACER_PROFILER 1
+#endif
+
+namespace RayTracer
+{
+	namespace Profiler
+	{
+		/*
+		A single completed zone. Names must be string literals (or otherwise outlive the profiler)
+		*/
+		struct ProfileEvent
+		{
+			const char* Name;
+			uint64_t Start; // Nanoseconds since the profiler epoch
+			uint64_t End;
+			int64_t Arg; // Optional argument (eg : the tile index), -1 if unused
+		};
+
+		// Zones are only recorded while the profiler is enabled, it is disabled by default
+		void SetEnabled(bool enabled);
+		bool IsEnabled();
+
+		// Names the calling thread in the trace
+		void SetThreadName(const std::string& name);
+
+		uint64_t GetTimestamp();
+
+		// Nanoseconds of CPU time the calling thread has used, 0 if the platform can't report it
+		uint64_t GetThreadCPUTime();
+
+		// Appends an event to the calling thread's buffer. Only the owning thread writes to its buffer so no locks are needed
+		void RecordEvent(const char* name, uint64_t start, uint64_t end, int64_t arg = -1);
+
+		/*
+		Writes all the recorded events in the chrome trace event format 
+		This can be loaded in chrome://tracing or https://ui.perfetto.dev
+		*/
+		bool Dump(const std::string& path);
+
+		class ScopedZone
+		{
+		public:
+
+			ScopedZone(const char* name, int64_t arg = -1) : m_Name(name), m_Arg(arg), m_Start(0)
+			{
+				if (IsEnabled())
+				{
+					m_Start = GetTimestamp();
+				}
+			}
+
+			~ScopedZone()
+			{
+				if (m_Start != 0)
+				{
+					RecordEvent(m_Name, m_Start, GetTimestamp(), m_Arg);
+				}
+			}
+
+			ScopedZone(const ScopedZone&) = delete;
+			ScopedZone operator=(ScopedZone const&) = delete;
+
+		private:
+
+			const char* m_Name;
+			int64_t m_Arg;
+			uint64_t m_Start;
+		};
+	}
+}
+
+#define RT_PROFILER_CONCAT_IMPL(a, b) a##b
+#define RT_PROFILER_CONCAT(a, b) RT_PROFILER_CONCAT_IMPL(a, b)
+
+#if RAYTRACER_PROFILER
+#define RT_PROFILE_ZONE(name) RayTracer::Profiler::ScopedZone RT_PROFILER_CONCAT(_ProfileZone, __LINE__)(name)
+#define RT_PROFILE_ZONE_ARG(name, arg) RayTracer::Profiler::ScopedZone RT_PROFILER_CONCAT(_ProfileZone, __LINE__)(name, arg)
+#define RT_PROFILE_THREAD(name) RayTracer::Profiler::SetThreadName(name)
+#else
+#define RT_PROFILE_ZONE(name)
+#define RT_PROFILE_ZONE_ARG(name, arg)
+#define RT_PROFILE_THREAD(name)
+#endif
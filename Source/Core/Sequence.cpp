@@ -0,0 +1,206 @@
+#include "Sequence.h"
+#include "BVH.h"
+#include "ImageWriter.h"
+#include "Profiler.h"
+#include "BackgroundWriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace RayTracer
+{
+	static glm::vec3 CatmullRom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t)
+	{
+		const float t2 = t * t;
+		const float t3 = t2 * t;
+
+		return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+	}
+
+	/*
+	Finds the keyframes around frame, a and b are the keyframes of the segment and t is the position in it.
+	The keyframes are sorted and there is at least one
+	*/
+	template <typename T>
+	static void FindSegment(const std::vector<T>& keyframes, float frame, int& a, int& b, float& t)
+	{
+		const int count = static_cast<int>(keyframes.size());
+		auto next = std::upper_bound(keyframes.begin(), keyframes.end(), frame, [](float f, const T& keyframe) { return f < keyframe.Frame; });
+
+		b = glm::min(static_cast<int>(next - keyframes.begin()), count - 1);
+		a = glm::max(b - 1, 0);
+
+		const float length = keyframes[b].Frame - keyframes[a].Frame;
+		t = length > 0.0f ? glm::clamp((frame - keyframes[a].Frame) / length, 0.0f, 1.0f) : 1.0f;
+	}
+
+	template <typename T>
+	static void InsertKeyframe(std::vector<T>& keyframes, const T& keyframe)
+	{
+		auto position = std::upper_bound(keyframes.begin(), keyframes.end(), keyframe.Frame, [](float f, const T& e) { return f < e.Frame; });
+		keyframes.insert(position, keyframe);
+	}
+
+	void Sequence::AddCameraKeyframe(const CameraKeyframe& keyframe)
+	{
+		InsertKeyframe(m_CameraKeyframes, keyframe);
+	}
+
+	void Sequence::AddSphereKeyframe(int sphere, const SphereKeyframe& keyframe)
+	{
+		auto track = std::find_if(m_SphereTracks.begin(), m_SphereTracks.end(), [sphere](const SphereTrack& e) { return e.Sphere == sphere; });
+
+		if (track == m_SphereTracks.end())
+		{
+			m_SphereTracks.push_back({ sphere, {} });
+			track = m_SphereTracks.end() - 1;
+		}
+
+		InsertKeyframe(track->Keyframes, keyframe);
+	}
+
+	Camera Sequence::EvaluateCamera(float frame) const
+	{
+		if (m_CameraKeyframes.empty())
+		{
+			return g_SceneCamera;
+		}
+
+		int a = 0, b = 0;
+		float t = 0.0f;
+		FindSegment(m_CameraKeyframes, frame, a, b, t);
+
+		const int last = static_cast<int>(m_CameraKeyframes.size()) - 1;
+		const CameraKeyframe& k0 = m_CameraKeyframes[glm::max(a - 1, 0)];
+		const CameraKeyframe& k1 = m_CameraKeyframes[a];
+		const CameraKeyframe& k2 = m_CameraKeyframes[b];
+		const CameraKeyframe& k3 = m_CameraKeyframes[glm::min(b + 1, last)];
+
+		return Camera(CatmullRom(k0.LookFrom, k1.LookFrom, k2.LookFrom, k3.LookFrom, t),
+			CatmullRom(k0.LookAt, k1.LookAt, k2.LookAt, k3.LookAt, t),
+			glm::vec3(0.0f, 1.0f, 0.0f),
+			glm::mix(k1.FOV, k2.FOV, t));
+	}
+
+	void Sequence::EvaluateSpheres(float frame, std::vector<Sphere>& spheres) const
+	{
+		for (const SphereTrack& track : m_SphereTracks)
+		{
+			if (track.Sphere < 0 || track.Sphere >= static_cast<int>(spheres.size()) || track.Keyframes.empty())
+			{
+				continue;
+			}
+
+			int a = 0, b = 0;
+			float t = 0.0f;
+			FindSegment(track.Keyframes, frame, a, b, t);
+
+			const int last = static_cast<int>(track.Keyframes.size()) - 1;
+			const SphereKeyframe& k0 = track.Keyframes[glm::max(a - 1, 0)];
+			const SphereKeyframe& k1 = track.Keyframes[a];
+			const SphereKeyframe& k2 = track.Keyframes[b];
+			const SphereKeyframe& k3 = track.Keyframes[glm::min(b + 1, last)];
+
+			spheres[track.Sphere].Center = CatmullRom(k0.Center, k1.Center, k2.Center, k3.Center, t);
+			spheres[track.Sphere].Radius = glm::mix(k1.Radius, k2.Radius, t);
+		}
+	}
+
+	Sequence Sequence::Turntable(const glm::vec3& center, float distance, float height, float fov, int frame_count)
+	{
+		// 16 keyframes per turn keep the spline within a fraction of a percent of the circle.
+		// The ones before the first and after the last frame only shape the spline so that the loop is seamless
+		const int keyframes = 16;
+		Sequence sequence;
+
+		for (int k = -1; k <= keyframes + 1; k++)
+		{
+			const float angle = 2.0f * (float)PI * (float)k / (float)keyframes;
+
+			CameraKeyframe keyframe;
+			keyframe.Frame = (float)frame_count * (float)k / (float)keyframes;
+			keyframe.LookFrom = center + glm::vec3(glm::sin(angle) * distance, height, glm::cos(angle) * distance);
+			keyframe.LookAt = center;
+			keyframe.FOV = fov;
+			sequence.AddCameraKeyframe(keyframe);
+		}
+
+		return sequence;
+	}
+
+	SequenceStatistics RenderSequence(const Sequence& sequence, const SequenceSettings& settings, int thread_count)
+	{
+		RT_PROFILE_ZONE("RenderSequence");
+
+		const std::vector<Sphere> scene = Spheres;
+		const Camera scene_camera = g_SceneCamera;
+		const auto start = std::chrono::steady_clock::now();
+
+		SequenceStatistics stats;
+		std::vector<uint8_t> rgb(g_Width * g_Height * 3);
+		char path[512];
+
+		{
+			// Frame n is written while frame n + 1 is traced
+			BackgroundWriter<std::vector<uint8_t>> writer([](const std::string& path, const std::vector<uint8_t>& rgb)
+			{
+				return WritePPM(path, g_Width, g_Height, rgb.data());
+			});
+
+			for (int frame = settings.FirstFrame; frame <= settings.LastFrame; frame++)
+			{
+				const auto frame_start = std::chrono::steady_clock::now();
+
+				sequence.EvaluateSpheres((float)frame, Spheres);
+
+				if (sequence.HasCameraKeyframes())
+				{
+					g_SceneCamera = sequence.EvaluateCamera((float)frame);
+				}
+
+				const auto trace_start = std::chrono::steady_clock::now();
+				TraceScene(settings.SPP, thread_count);
+				const auto trace_end = std::chrono::steady_clock::now();
+
+				rgb.resize(g_Width * g_Height * 3);
+
+				for (uint i = 0; i < g_Width * g_Height; i++)
+				{
+					rgb[i * 3 + 0] = g_PixelData[i * 4 + 0];
+					rgb[i * 3 + 1] = g_PixelData[i * 4 + 1];
+					rgb[i * 3 + 2] = g_PixelData[i * 4 + 2];
+				}
+
+				std::snprintf(path, sizeof(path), "%s%04d.ppm", settings.OutputPrefix.c_str(), frame);
+				writer.Submit(path, rgb);
+
+				const auto frame_end = std::chrono::steady_clock::now();
+				const float trace_time = std::chrono::duration<float>(trace_end - trace_start).count();
+				const float frame_time = std::chrono::duration<float>(frame_end - frame_start).count();
+
+				stats.Frames++;
+				stats.TraceTime += trace_time;
+
+				std::cout << "Frame " << frame << " / " << settings.LastFrame << " : " << frame_time * 1000.0f << " ms ("
+					<< (frame_time - trace_time) * 1000.0f << " ms overhead)" << std::endl;
+			}
+
+			writer.Flush();
+
+			if (writer.GetFailedWrites() > 0)
+			{
+				std::cout << "\nCOULD NOT WRITE " << writer.GetFailedWrites() << " FRAMES\n";
+			}
+		}
+
+		stats.TotalTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+		stats.OverheadTime = stats.Frames > 0 ? (stats.TotalTime - stats.TraceTime) * 1000.0f / (float)stats.Frames : 0.0f;
+		stats.FramesPerHour = stats.TotalTime > 0.0f ? (float)stats.Frames * 3600.0f / stats.TotalTime : 0.0f;
+
+		Spheres = scene;
+		g_SceneCamera = scene_camera;
+
+		return stats;
+	}
+}
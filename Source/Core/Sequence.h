@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Tracer.h"
+
+namespace RayTracer
+{
+	struct CameraKeyframe
+	{
+		float Frame = 0.0f;
+		glm::vec3 LookFrom = glm::vec3(0.0f);
+		glm::vec3 LookAt = glm::vec3(0.0f, 0.0f, -1.0f);
+		float FOV = 90.0f;
+	};
+
+	// Only the center and the radius of a sphere are animated
+	struct SphereKeyframe
+	{
+		float Frame = 0.0f;
+		glm::vec3 Center = glm::vec3(0.0f);
+		float Radius = 0.5f;
+	};
+
+	/*
+	Keyframed camera and sphere animation. Positions are interpolated with Catmull-Rom splines, the FOV and the radii linearly.
+	Before the first and after the last keyframe the value of that keyframe is held
+	*/
+	class Sequence
+	{
+	public:
+
+		void AddCameraKeyframe(const CameraKeyframe& keyframe);
+
+		// sphere is an index into Spheres
+		void AddSphereKeyframe(int sphere, const SphereKeyframe& keyframe);
+
+		inline bool HasCameraKeyframes() const { return !m_CameraKeyframes.empty(); }
+		Camera EvaluateCamera(float frame) const;
+
+		// Only the animated spheres are changed
+		void EvaluateSpheres(float frame, std::vector<Sphere>& spheres) const;
+
+		// The camera circles center once in frame_count frames, the last frame leads back into the first
+		static Sequence Turntable(const glm::vec3& center, float distance, float height, float fov, int frame_count);
+
+	private:
+
+		struct SphereTrack
+		{
+			int Sphere = 0;
+			std::vector<SphereKeyframe> Keyframes;
+		};
+
+		// Sorted by frame
+		std::vector<CameraKeyframe> m_CameraKeyframes;
+		std::vector<SphereTrack> m_SphereTracks;
+	};
+
+	struct SequenceSettings
+	{
+		int FirstFrame = 0;
+		int LastFrame = 59; // Inclusive
+		int SPP = 64;
+		std::string OutputPrefix = "Frame_"; // Frame n is written to <prefix><n with 4 digits>.ppm
+	};
+
+	struct SequenceStatistics
+	{
+		int Frames = 0;
+		float TotalTime = 0.0f; // In seconds
+		float TraceTime = 0.0f; // In seconds, spent in TraceScene (including the BVH refit)
+		float OverheadTime = 0.0f; // Per frame in milliseconds, everything besides tracing: keyframes, copying the image and waiting for the writer
+		float FramesPerHour = 0.0f;
+	};
+
+	/*
+	Renders every frame of the range with TraceScene and writes it to a file while the next one is traced.
+	The render buffers and the scene BVH (which is refit) are reused between frames.
+	Don't call this while the progressive renderer runs, Spheres and g_SceneCamera are restored afterwards
+	*/
+	SequenceStatistics RenderSequence(const Sequence& sequence, const SequenceSettings& settings, int thread_count = THREAD_SPAWN_COUNT);
+}
@@ -5,7 +5,24 @@ layout (location = 0) out vec3 o_Color;
 in vec2 v_TexCoords;
 uniform sampler2D u_Texture;
 
+// Maps the screen to the area of the texture that was rendered to (dynamic resolution)
+uniform vec2 u_UVScale;
+uniform vec2 u_UVClamp;
+
+// Tile render time heatmap overlay
+uniform sampler2D u_HeatmapTexture;
+uniform bool u_ShowHeatmap;
+uniform float u_HeatmapOpacity;
+uniform vec2 u_HeatmapScale;
+
 void main()
 {
-	o_Color = texture(u_Texture, v_TexCoords).rgb;
+	vec2 TexCoords = min(v_TexCoords * u_UVScale, u_UVClamp);
+	o_Color = texture(u_Texture, TexCoords).rgb;
+
+	if (u_ShowHeatmap)
+	{
+		vec4 Heat = texture(u_HeatmapTexture, TexCoords * u_HeatmapScale);
+		o_Color = mix(o_Color, Heat.rgb, Heat.a * u_HeatmapOpacity);
+	}
 }
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "Socket.h"
+
+#include <iostream>
+#include <mutex>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+typedef SOCKET NativeSocket;
+typedef int SocketLength;
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+typedef int NativeSocket;
+typedef socklen_t SocketLength;
+#endif
+
+// Sending on a socket that was closed by the other side raises SIGPIPE on Linux
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+namespace RayTracer
+{
+	static bool InitializeSockets()
+	{
+#ifdef _WIN32
+		static std::once_flag s_Initialized;
+		static bool s_Result = false;
+
+		std::call_once(s_Initialized, []()
+		{
+			WSADATA data;
+			s_Result = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+
+			if (!s_Result)
+			{
+				std::cout << "\nCOULD NOT INITIALIZE WINSOCK\n";
+			}
+		});
+
+		return s_Result;
+#else
+		return true;
+#endif
+	}
+
+	static inline NativeSocket ToNative(intptr_t handle)
+	{
+		return static_cast<NativeSocket>(handle);
+	}
+
+	static void CloseNative(intptr_t handle)
+	{
+#ifdef _WIN32
+		closesocket(ToNative(handle));
+#else
+		close(ToNative(handle));
+#endif
+	}
+
+	// Tiles are sent as soon as they are done, waiting to fill packets only adds latency
+	static void DisableNagle(intptr_t handle)
+	{
+		int enable = 1;
+		setsockopt(ToNative(handle), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+	}
+
+	Socket::~Socket()
+	{
+		Close();
+	}
+
+	Socket::Socket(Socket&& other) noexcept : m_Handle(other.m_Handle)
+	{
+		other.m_Handle = INVALID_HANDLE;
+	}
+
+	Socket& Socket::operator=(Socket&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Close();
+			m_Handle = other.m_Handle;
+			other.m_Handle = INVALID_HANDLE;
+		}
+
+		return *this;
+	}
+
+	void Socket::Close()
+	{
+		if (IsValid())
+		{
+			CloseNative(m_Handle);
+			m_Handle = INVALID_HANDLE;
+		}
+	}
+
+	bool Socket::Listen(uint16_t port)
+	{
+		Close();
+
+		if (!InitializeSockets())
+		{
+			return false;
+		}
+
+		NativeSocket handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		m_Handle = static_cast<intptr_t>(handle);
+
+		if (!IsValid())
+		{
+			std::cout << "\nCOULD NOT CREATE SOCKET\n";
+			return false;
+		}
+
+		int reuse = 1;
+		setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		address.sin_port = htons(port);
+
+		if (bind(handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(handle, SOMAXCONN) != 0)
+		{
+			std::cout << "\nCOULD NOT LISTEN ON PORT " << port << "\n";
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	Socket Socket::Accept(float timeout)
+	{
+		fd_set sockets;
+		FD_ZERO(&sockets);
+		FD_SET(ToNative(m_Handle), &sockets);
+
+		timeval time;
+		time.tv_sec = static_cast<long>(timeout);
+		time.tv_usec = static_cast<long>((timeout - (float)time.tv_sec) * 1e6f);
+
+		if (select(static_cast<int>(ToNative(m_Handle)) + 1, &sockets, nullptr, nullptr, &time) <= 0)
+		{
+			return Socket();
+		}
+
+		Socket connection(static_cast<intptr_t>(accept(ToNative(m_Handle), nullptr, nullptr)));
+
+		if (connection.IsValid())
+		{
+			DisableNagle(connection.m_Handle);
+		}
+
+		return connection;
+	}
+
+	bool Socket::Connect(const std::string& host, uint16_t port)
+	{
+		Close();
+
+		if (!InitializeSockets())
+		{
+			return false;
+		}
+
+		addrinfo hints = {};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+		addrinfo* addresses = nullptr;
+
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+		{
+			std::cout << "\nCOULD NOT RESOLVE " << host << "\n";
+			return false;
+		}
+
+		for (addrinfo* address = addresses; address; address = address->ai_next)
+		{
+			m_Handle = static_cast<intptr_t>(socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+
+			if (IsValid() && connect(ToNative(m_Handle), address->ai_addr, static_cast<SocketLength>(address->ai_addrlen)) == 0)
+			{
+				break;
+			}
+
+			Close();
+		}
+
+		freeaddrinfo(addresses);
+
+		if (IsValid())
+		{
+			DisableNagle(m_Handle);
+		}
+
+		return IsValid();
+	}
+
+	bool Socket::Send(const void* data, size_t size)
+	{
+		const char* bytes = static_cast<const char*>(data);
+
+		while (size > 0)
+		{
+			const int chunk = static_cast<int>(size < (1u << 30) ? size : (1u << 30));
+			const int sent = static_cast<int>(send(ToNative(m_Handle), bytes, chunk, SEND_FLAGS));
+
+			if (sent <= 0)
+			{
+				return false;
+			}
+
+			bytes += sent;
+			size -= static_cast<size_t>(sent);
+		}
+
+		return true;
+	}
+
+	bool Socket::Receive(void* data, size_t size)
+	{
+		char* bytes = static_cast<char*>(data);
+
+		while (size > 0)
+		{
+			const int chunk = static_cast<int>(size < (1u << 30) ? size : (1u << 30));
+			const int received = static_cast<int>(recv(ToNative(m_Handle), bytes, chunk, 0));
+
+			if (received <= 0)
+			{
+				return false;
+			}
+
+			bytes += received;
+			size -= static_cast<size_t>(received);
+		}
+
+		return true;
+	}
+
+	void Socket::SetTimeout(float seconds)
+	{
+#ifdef _WIN32
+		DWORD time = static_cast<DWORD>(seconds * 1000.0f);
+#else
+		timeval time;
+		time.tv_sec = static_cast<long>(seconds);
+		time.tv_usec = static_cast<long>((seconds - (float)time.tv_sec) * 1e6f);
+#endif
+
+		setsockopt(ToNative(m_Handle), SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&time), sizeof(time));
+		setsockopt(ToNative(m_Handle), SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&time), sizeof(time));
+	}
+
+	uint16_t Socket::GetPort() const
+	{
+		sockaddr_in address = {};
+		SocketLength length = sizeof(address);
+
+		if (getsockname(ToNative(m_Handle), reinterpret_cast<sockaddr*>(&address), &length) != 0)
+		{
+			return 0;
+		}
+
+		return ntohs(address.sin_port);
+	}
+}
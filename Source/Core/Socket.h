@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+namespace RayTracer
+{
+	/*
+	Blocking TCP socket (Winsock or BSD sockets), closed by the destructor.
+	Send and Receive transfer the whole buffer and return false if the connection was closed, failed or timed out
+	*/
+	class Socket
+	{
+	public:
+
+		Socket() = default;
+		~Socket();
+
+		Socket(const Socket&) = delete;
+		Socket& operator=(const Socket&) = delete;
+		Socket(Socket&& other) noexcept;
+		Socket& operator=(Socket&& other) noexcept;
+
+		// Listens on every interface, port 0 picks a free port (see GetPort)
+		bool Listen(uint16_t port);
+
+		// Returns an invalid socket if nobody connected within timeout seconds
+		Socket Accept(float timeout);
+
+		bool Connect(const std::string& host, uint16_t port);
+
+		bool Send(const void* data, size_t size);
+		bool Receive(void* data, size_t size);
+
+		// For Send and Receive, 0 waits forever
+		void SetTimeout(float seconds);
+
+		uint16_t GetPort() const;
+		inline bool IsValid() const { return m_Handle != INVALID_HANDLE; }
+		void Close();
+
+	private:
+
+		static const intptr_t INVALID_HANDLE = -1;
+
+		explicit Socket(intptr_t handle) : m_Handle(handle) {}
+
+		intptr_t m_Handle = INVALID_HANDLE;
+	};
+}
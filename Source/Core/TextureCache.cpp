@@ -0,0 +1,539 @@
+#include "TextureCache.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+RayTracer::TextureCache g_TextureCache;
+
+namespace RayTracer
+{
+	struct TiledTextureHeader
+	{
+		char Magic[4];
+		uint32_t Version;
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t Levels;
+		uint32_t TileSize;
+	};
+
+	static const char TEXTURE_MAGIC[4] = { 'R', 'T', 'T', 'X' };
+	static const uint32_t TEXTURE_VERSION = 1;
+
+	// Even the smallest budget has to leave every trace thread a few tiles, or they keep evicting each other's
+	static const uint32_t MIN_TEXTURE_SLOTS = 16;
+
+	static const uint32_t MISSING_TEXEL = 0xFFFF00FF;
+
+	// Down to 1x1, every level halves the size of the previous one (rounding down)
+	static uint32_t ComputeLevelCount(uint32_t width, uint32_t height)
+	{
+		uint32_t levels = 1;
+
+		while (width > 1 || height > 1)
+		{
+			width = std::max(width / 2, 1u);
+			height = std::max(height / 2, 1u);
+			levels++;
+		}
+
+		return levels;
+	}
+
+	static inline uint32_t GetTileCount(uint32_t size)
+	{
+		return (size + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+	}
+
+	// The files can be larger than 2 GB, where long is 32 bits
+	static bool SeekFile(FILE* file, uint64_t offset)
+	{
+#ifdef _MSC_VER
+		return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+		return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+	}
+
+	bool WriteTiledTexture(const std::string& path, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgb)
+	{
+		std::ofstream file(path, std::ios::out | std::ios::binary);
+
+		if (!file.good())
+		{
+			std::cout << "\nCOULD NOT OPEN TEXTURE FILE FOR WRITING (" << path << ")\n";
+			return false;
+		}
+
+		if (width == 0 || height == 0 || rgb.size() < static_cast<size_t>(width) * height * 3)
+		{
+			std::cout << "\nINVALID TEXTURE SIZE (" << path << ")\n";
+			return false;
+		}
+
+		const TiledTextureHeader header = { { 'R', 'T', 'T', 'X' }, TEXTURE_VERSION, width, height, ComputeLevelCount(width, height), TEXTURE_TILE_SIZE };
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		// Level 0 with the rows from the top, the smaller levels are box filtered from the previous one
+		std::vector<glm::vec4> level(static_cast<size_t>(width) * height);
+
+		for (uint32_t y = 0; y < height; y++)
+		{
+			const uint8_t* row = &rgb[static_cast<size_t>(height - 1 - y) * width * 3];
+
+			for (uint32_t x = 0; x < width; x++)
+			{
+				level[static_cast<size_t>(y) * width + x] = glm::vec4(row[x * 3], row[x * 3 + 1], row[x * 3 + 2], 255.0f);
+			}
+		}
+
+		std::vector<uint32_t> tile(TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE);
+
+		for (uint32_t l = 0; l < header.Levels; l++)
+		{
+			// Edge tiles repeat the last row and column
+			for (uint32_t ty = 0; ty < GetTileCount(height); ty++)
+			{
+				for (uint32_t tx = 0; tx < GetTileCount(width); tx++)
+				{
+					for (uint32_t y = 0; y < TEXTURE_TILE_SIZE; y++)
+					{
+						for (uint32_t x = 0; x < TEXTURE_TILE_SIZE; x++)
+						{
+							const uint32_t sx = std::min(tx * TEXTURE_TILE_SIZE + x, width - 1);
+							const uint32_t sy = std::min(ty * TEXTURE_TILE_SIZE + y, height - 1);
+							const glm::vec4 texel = glm::clamp(level[static_cast<size_t>(sy) * width + sx] + 0.5f, 0.0f, 255.0f);
+
+							tile[y * TEXTURE_TILE_SIZE + x] = static_cast<uint32_t>(texel.r) | static_cast<uint32_t>(texel.g) << 8 |
+								static_cast<uint32_t>(texel.b) << 16 | static_cast<uint32_t>(texel.a) << 24;
+						}
+					}
+
+					file.write(reinterpret_cast<const char*>(tile.data()), TEXTURE_TILE_BYTES);
+				}
+			}
+
+			const uint32_t next_width = std::max(width / 2, 1u);
+			const uint32_t next_height = std::max(height / 2, 1u);
+			std::vector<glm::vec4> next(static_cast<size_t>(next_width) * next_height);
+
+			for (uint32_t y = 0; y < next_height; y++)
+			{
+				for (uint32_t x = 0; x < next_width; x++)
+				{
+					const uint32_t x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+					const uint32_t y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+
+					next[static_cast<size_t>(y) * next_width + x] = (level[static_cast<size_t>(y0) * width + x0] + level[static_cast<size_t>(y0) * width + x1] +
+						level[static_cast<size_t>(y1) * width + x0] + level[static_cast<size_t>(y1) * width + x1]) * 0.25f;
+				}
+			}
+
+			level.swap(next);
+			width = next_width;
+			height = next_height;
+		}
+
+		return file.good();
+	}
+
+	TextureCache::TextureCache(size_t budget)
+	{
+		SetBudget(budget);
+	}
+
+	TextureCache::~TextureCache()
+	{
+		for (auto& texture : m_Textures)
+		{
+			if (texture && texture->File)
+			{
+				fclose(texture->File);
+			}
+		}
+	}
+
+	int TextureCache::Open(const std::string& path)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		const size_t index = m_TextureCount.load(std::memory_order_relaxed);
+
+		if (index >= MAX_TEXTURES)
+		{
+			std::cout << "\nTOO MANY TEXTURES, AT MOST " << MAX_TEXTURES << " CAN BE OPEN\n";
+			return -1;
+		}
+
+		FILE* file = fopen(path.c_str(), "rb");
+
+		if (!file)
+		{
+			std::cout << "\nCOULD NOT OPEN TEXTURE FILE (" << path << ")\n";
+			return -1;
+		}
+
+		TiledTextureHeader header;
+
+		if (fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.Magic, TEXTURE_MAGIC, 4) != 0 || header.Version != TEXTURE_VERSION ||
+			header.TileSize != TEXTURE_TILE_SIZE || header.Width == 0 || header.Height == 0 || header.Levels != ComputeLevelCount(header.Width, header.Height))
+		{
+			std::cout << "\nNOT A TILED TEXTURE (" << path << "), CONVERT IT WITH --make-texture\n";
+			fclose(file);
+			return -1;
+		}
+
+		std::unique_ptr<Texture> texture = std::make_unique<Texture>();
+		texture->Path = path;
+		texture->File = file;
+		texture->Index = static_cast<uint32_t>(index);
+		texture->DataOffset = sizeof(header);
+		texture->Width = header.Width;
+		texture->Height = header.Height;
+		texture->LevelCount = header.Levels;
+
+		uint32_t width = header.Width;
+		uint32_t height = header.Height;
+
+		for (uint32_t l = 0; l < header.Levels; l++)
+		{
+			texture->Levels[l] = { width, height, GetTileCount(width), texture->TileCount };
+			texture->TileCount += GetTileCount(width) * GetTileCount(height);
+			width = std::max(width / 2, 1u);
+			height = std::max(height / 2, 1u);
+		}
+
+		// Checked up front, so that a truncated file fails here instead of in the middle of a render
+		if (!SeekFile(file, texture->DataOffset + static_cast<uint64_t>(texture->TileCount) * TEXTURE_TILE_BYTES - 1) || fgetc(file) == EOF)
+		{
+			std::cout << "\nTRUNCATED TEXTURE FILE (" << path << ")\n";
+			texture->File = nullptr;
+			fclose(file);
+			return -1;
+		}
+
+		texture->Entries.reset(new std::atomic<uint32_t>[texture->TileCount]);
+
+		for (uint32_t t = 0; t < texture->TileCount; t++)
+		{
+			texture->Entries[t].store(0, std::memory_order_relaxed);
+		}
+
+		m_Textures[index] = std::move(texture);
+		m_TextureCount.store(index + 1, std::memory_order_release);
+		return static_cast<int>(index);
+	}
+
+	void TextureCache::SetBudget(size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_SlotCount = static_cast<uint32_t>(std::max<size_t>(bytes / TEXTURE_TILE_BYTES, MIN_TEXTURE_SLOTS));
+		Reset();
+	}
+
+	void TextureCache::Reset()
+	{
+		for (size_t t = 0; t < m_TextureCount.load(std::memory_order_relaxed); t++)
+		{
+			for (uint32_t e = 0; e < m_Textures[t]->TileCount; e++)
+			{
+				m_Textures[t]->Entries[e].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		m_Slots.reset(new std::unique_ptr<Slot>[m_SlotCount]);
+		m_AllocatedSlots = 0;
+		m_ClockHand = 0;
+		m_ResidentTiles = 0;
+	}
+
+	uint32_t TextureCache::AcquireSlot()
+	{
+		if (m_AllocatedSlots < m_SlotCount)
+		{
+			std::unique_ptr<Slot> slot = std::make_unique<Slot>();
+			slot->Tag.store(INVALID_TAG, std::memory_order_relaxed);
+			slot->Referenced.store(0, std::memory_order_relaxed);
+			m_Slots[m_AllocatedSlots] = std::move(slot);
+			return m_AllocatedSlots++;
+		}
+
+		// Tiles that were used since the hand last passed get a second chance, two turns find one unless every slot is loading
+		for (uint32_t i = 0; i < m_SlotCount * 2; i++)
+		{
+			const uint32_t index = m_ClockHand;
+			Slot& slot = *m_Slots[index];
+			m_ClockHand = (m_ClockHand + 1) % m_SlotCount;
+
+			if (slot.Loading)
+			{
+				continue;
+			}
+
+			if (slot.Used && slot.Referenced.load(std::memory_order_relaxed))
+			{
+				slot.Referenced.store(0, std::memory_order_relaxed);
+				continue;
+			}
+
+			return index;
+		}
+
+		return UINT32_MAX;
+	}
+
+	bool TextureCache::Load(Texture& texture, uint32_t tile)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		m_Misses.fetch_add(1, std::memory_order_relaxed);
+
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		uint32_t index = UINT32_MAX;
+		bool waited = false;
+
+		for (;;)
+		{
+			const uint32_t entry = texture.Entries[tile].load(std::memory_order_relaxed);
+
+			// Another thread is reading it
+			if (entry == LOADING)
+			{
+				m_LoadedCondition.wait(lock);
+				waited = true;
+				continue;
+			}
+
+			if (entry != 0)
+			{
+				break;
+			}
+
+			index = AcquireSlot();
+
+			if (index != UINT32_MAX)
+			{
+				break;
+			}
+
+			m_LoadedCondition.wait(lock);
+			waited = true;
+		}
+
+		bool loaded = true;
+
+		if (index != UINT32_MAX)
+		{
+			Slot& slot = *m_Slots[index];
+
+			if (slot.Used)
+			{
+				m_Textures[slot.Texture]->Entries[slot.Tile].store(0, std::memory_order_relaxed);
+				m_Evictions.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			else
+			{
+				m_ResidentTiles.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			// Lookups that still found the slot through the old entry fail their second tag check from here on
+			slot.Tag.store(INVALID_TAG, std::memory_order_relaxed);
+			slot.Texture = texture.Index;
+			slot.Tile = tile;
+			slot.Used = true;
+			slot.Loading = true;
+			texture.Entries[tile].store(LOADING, std::memory_order_relaxed);
+			lock.unlock();
+
+			std::atomic_thread_fence(std::memory_order_release);
+
+			std::vector<uint32_t> texels(TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE);
+
+			{
+				std::lock_guard<std::mutex> file_lock(texture.FileMutex);
+				loaded = SeekFile(texture.File, texture.DataOffset + static_cast<uint64_t>(tile) * TEXTURE_TILE_BYTES) &&
+					fread(texels.data(), TEXTURE_TILE_BYTES, 1, texture.File) == 1;
+			}
+
+			if (loaded)
+			{
+				for (size_t t = 0; t < texels.size(); t++)
+				{
+					slot.Texels[t].store(texels[t], std::memory_order_relaxed);
+				}
+
+				slot.Tag.store(static_cast<uint64_t>(texture.Index) << 32 | tile, std::memory_order_release);
+				m_BytesRead.fetch_add(TEXTURE_TILE_BYTES, std::memory_order_relaxed);
+			}
+
+			lock.lock();
+			slot.Loading = false;
+
+			if (loaded)
+			{
+				slot.Referenced.store(1, std::memory_order_relaxed);
+				texture.Entries[tile].store(index + 1, std::memory_order_release);
+			}
+
+			else
+			{
+				slot.Used = false;
+				m_ResidentTiles.fetch_sub(1, std::memory_order_relaxed);
+				texture.Entries[tile].store(0, std::memory_order_relaxed);
+
+				if (!texture.ReadFailed)
+				{
+					std::cout << "\nCOULD NOT READ TEXTURE TILE " << tile << " (" << texture.Path << ")\n";
+					texture.ReadFailed = true;
+				}
+			}
+
+			m_LoadedCondition.notify_all();
+		}
+
+		if (index != UINT32_MAX || waited)
+		{
+			m_Stalls.fetch_add(1, std::memory_order_relaxed);
+			m_StallTime.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()),
+				std::memory_order_relaxed);
+		}
+
+		return loaded;
+	}
+
+	uint32_t TextureCache::Fetch(int texture_index, uint32_t level_index, uint32_t x, uint32_t y)
+	{
+		static thread_local const uint32_t shard = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()) % COUNTER_SHARDS);
+
+		Texture& texture = *m_Textures[texture_index];
+		const Level& level = texture.Levels[level_index];
+		const uint32_t tile = level.FirstTile + (y / TEXTURE_TILE_SIZE) * level.TilesX + x / TEXTURE_TILE_SIZE;
+		const uint32_t texel = (y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE;
+		const uint64_t tag = static_cast<uint64_t>(texture.Index) << 32 | tile;
+		bool missed = false;
+
+		for (;;)
+		{
+			const uint32_t entry = texture.Entries[tile].load(std::memory_order_acquire);
+
+			if (entry != 0 && entry != LOADING)
+			{
+				Slot& slot = *m_Slots[entry - 1];
+
+				if (slot.Tag.load(std::memory_order_acquire) == tag)
+				{
+					const uint32_t value = slot.Texels[texel].load(std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_acquire);
+
+					if (slot.Tag.load(std::memory_order_relaxed) == tag)
+					{
+						// Only written when it changes, so that hot tiles don't keep invalidating the line in the other cores
+						if (!slot.Referenced.load(std::memory_order_relaxed))
+						{
+							slot.Referenced.store(1, std::memory_order_relaxed);
+						}
+
+						if (!missed)
+						{
+							m_Hits[shard].Hits.fetch_add(1, std::memory_order_relaxed);
+						}
+
+						return value;
+					}
+				}
+			}
+
+			if (!Load(texture, tile))
+			{
+				return MISSING_TEXEL;
+			}
+
+			missed = true;
+		}
+	}
+
+	static inline glm::vec3 UnpackTexel(uint32_t texel)
+	{
+		return glm::vec3((float)(texel & 0xFF), (float)((texel >> 8) & 0xFF), (float)((texel >> 16) & 0xFF)) * (1.0f / 255.0f);
+	}
+
+	glm::vec3 TextureCache::Sample(int texture_index, float u, float v, float width)
+	{
+		const Texture& texture = *m_Textures[texture_index];
+		const float lod = std::log2(std::max(width * (float)texture.Width, 1.0f));
+		const uint32_t level_index = std::min(static_cast<uint32_t>(lod + 0.5f), texture.LevelCount - 1);
+		const Level& level = texture.Levels[level_index];
+
+		u = u - std::floor(u);
+		v = glm::clamp(v, 0.0f, 1.0f);
+
+		const float x = u * level.Width - 0.5f;
+		const float y = v * level.Height - 0.5f;
+		const float fx = x - std::floor(x);
+		const float fy = y - std::floor(y);
+
+		const int ix = static_cast<int>(std::floor(x));
+		const int iy = static_cast<int>(std::floor(y));
+		const uint32_t x0 = static_cast<uint32_t>((ix + (int)level.Width) % (int)level.Width);
+		const uint32_t x1 = (x0 + 1) % level.Width;
+		const uint32_t y0 = static_cast<uint32_t>(glm::clamp(iy, 0, (int)level.Height - 1));
+		const uint32_t y1 = static_cast<uint32_t>(glm::clamp(iy + 1, 0, (int)level.Height - 1));
+
+		const glm::vec3 top = glm::mix(UnpackTexel(Fetch(texture_index, level_index, x0, y0)), UnpackTexel(Fetch(texture_index, level_index, x1, y0)), fx);
+		const glm::vec3 bottom = glm::mix(UnpackTexel(Fetch(texture_index, level_index, x0, y1)), UnpackTexel(Fetch(texture_index, level_index, x1, y1)), fx);
+		return glm::mix(top, bottom, fy);
+	}
+
+	TextureCacheStatistics TextureCache::GetStatistics() const
+	{
+		TextureCacheStatistics stats;
+
+		for (const HitCounter& counter : m_Hits)
+		{
+			stats.Hits += counter.Hits.load(std::memory_order_relaxed);
+		}
+
+		stats.Misses = m_Misses.load(std::memory_order_relaxed);
+		stats.Evictions = m_Evictions.load(std::memory_order_relaxed);
+		stats.BytesRead = m_BytesRead.load(std::memory_order_relaxed);
+		stats.ResidentBytes = m_ResidentTiles.load(std::memory_order_relaxed) * TEXTURE_TILE_BYTES;
+		stats.Budget = static_cast<uint64_t>(m_SlotCount) * TEXTURE_TILE_BYTES;
+		stats.Stalls = m_Stalls.load(std::memory_order_relaxed);
+		stats.StallTime = (float)m_StallTime.load(std::memory_order_relaxed) / 1e6f;
+		return stats;
+	}
+
+	void TextureCache::ResetStatistics()
+	{
+		for (HitCounter& counter : m_Hits)
+		{
+			counter.Hits.store(0, std::memory_order_relaxed);
+		}
+
+		m_Misses = 0;
+		m_Evictions = 0;
+		m_BytesRead = 0;
+		m_Stalls = 0;
+		m_StallTime = 0;
+	}
+
+	uint32_t TextureCache::GetWidth(int texture) const
+	{
+		return m_Textures[texture]->Width;
+	}
+
+	uint32_t TextureCache::GetHeight(int texture) const
+	{
+		return m_Textures[texture]->Height;
+	}
+
+	uint32_t TextureCache::GetLevelCount(int texture) const
+	{
+		return m_Textures[texture]->LevelCount;
+	}
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+
+#include <glm/glm.hpp>
+
+namespace RayTracer
+{
+	/*
+	Converts an 8 bit RGB image (rows in the OpenGL order, like ReadPPM returns them) to the tiled texture format read by
+	TextureCache : a small header followed by the tiles of every mip level, each TEXTURE_TILE_SIZE² RGBA8 texels
+	*/
+	bool WriteTiledTexture(const std::string& path, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgb);
+
+	const uint32_t TEXTURE_TILE_SIZE = 64;
+	const uint32_t TEXTURE_TILE_BYTES = TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * 4;
+
+	struct TextureCacheStatistics
+	{
+		uint64_t Hits = 0;
+		uint64_t Misses = 0; // Lookups that found their tile missing or being loaded
+		uint64_t Evictions = 0;
+		uint64_t BytesRead = 0;
+		uint64_t ResidentBytes = 0;
+		uint64_t Budget = 0;
+		uint64_t Stalls = 0; // Misses that waited for a read of their own or of another thread
+		float StallTime = 0.0f; // Milliseconds the trace threads spent in those waits, summed over the threads
+
+		inline float GetHitRate() const { return Hits + Misses > 0 ? (float)Hits / (float)(Hits + Misses) : 0.0f; }
+	};
+
+	/*
+	Textures are split into tiles that are read from disk the first time they are looked up and kept in a fixed number of
+	slots (the memory budget over the tile size). When the slots are full, the least recently used tile is evicted,
+	approximated with the clock algorithm so that hits only have to set a flag.
+	Lookups don't lock : a tile's slot is found through an atomic table entry and its texels are read between two checks of
+	the slot's tag, like a sequence lock. If the slot was evicted in between, the lookup starts over. Only misses take the
+	lock, and the disk read itself happens outside of it
+	*/
+	class TextureCache
+	{
+	public:
+
+		explicit TextureCache(size_t budget = 256ull << 20);
+		~TextureCache();
+
+		TextureCache(const TextureCache&) = delete;
+		TextureCache& operator=(const TextureCache&) = delete;
+
+		// Opens a file written by WriteTiledTexture (only the header is read), returns the texture index or -1
+		int Open(const std::string& path);
+
+		// Drops every resident tile, no lookups may run at the same time
+		void SetBudget(size_t bytes);
+
+		// Bilinear lookup at the mip level where a texel covers width (a fraction of the texture width), u wraps and v is clamped
+		glm::vec3 Sample(int texture, float u, float v, float width);
+
+		// RGBA8 texel of a mip level, magenta if its tile couldn't be read
+		uint32_t Fetch(int texture, uint32_t level, uint32_t x, uint32_t y);
+
+		TextureCacheStatistics GetStatistics() const;
+		void ResetStatistics();
+
+		inline size_t GetTextureCount() const { return m_TextureCount.load(std::memory_order_acquire); }
+		uint32_t GetWidth(int texture) const;
+		uint32_t GetHeight(int texture) const;
+		uint32_t GetLevelCount(int texture) const;
+
+	private:
+
+		static const uint32_t MAX_TEXTURES = 256;
+		static const uint32_t MAX_LEVELS = 32;
+		static const uint32_t COUNTER_SHARDS = 64;
+
+		struct Level
+		{
+			uint32_t Width;
+			uint32_t Height;
+			uint32_t TilesX;
+			uint32_t FirstTile;
+		};
+
+		struct Texture
+		{
+			std::string Path;
+			uint32_t Index = 0;
+			FILE* File = nullptr;
+			std::mutex FileMutex;
+			uint64_t DataOffset = 0;
+			bool ReadFailed = false; // Reported once
+
+			uint32_t Width = 0;
+			uint32_t Height = 0;
+			uint32_t LevelCount = 0;
+			Level Levels[MAX_LEVELS];
+
+			// Per tile 0 if it isn't resident, LOADING, or its slot + 1
+			uint32_t TileCount = 0;
+			std::unique_ptr<std::atomic<uint32_t>[]> Entries;
+		};
+
+		struct alignas(64) Slot
+		{
+			std::atomic<uint64_t> Tag; // Texture and tile of the texels, INVALID_TAG while they are written
+			std::atomic<uint8_t> Referenced; // Set by hits, cleared by the clock hand
+
+			// Protected by m_Mutex
+			uint32_t Texture = 0;
+			uint32_t Tile = 0;
+			bool Used = false;
+			bool Loading = false;
+
+			std::atomic<uint32_t> Texels[TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE];
+		};
+
+		// Hits are counted on the line of the calling thread, a shared counter would bounce between the cores on every lookup
+		struct alignas(64) HitCounter
+		{
+			std::atomic<uint64_t> Hits{ 0 };
+		};
+
+		static const uint32_t LOADING = UINT32_MAX;
+		static const uint64_t INVALID_TAG = UINT64_MAX;
+
+		// Makes the tile resident, returns false if it couldn't be read
+		bool Load(Texture& texture, uint32_t tile);
+
+		// A free slot or the one picked by the clock hand, UINT32_MAX if every slot is being loaded. Called with m_Mutex held
+		uint32_t AcquireSlot();
+
+		void Reset();
+
+		std::unique_ptr<Texture> m_Textures[MAX_TEXTURES];
+		std::atomic<size_t> m_TextureCount{ 0 };
+
+		// Allocated as they are first needed, up to m_SlotCount
+		std::unique_ptr<std::unique_ptr<Slot>[]> m_Slots;
+		uint32_t m_SlotCount = 0;
+		uint32_t m_AllocatedSlots = 0;
+		uint32_t m_ClockHand = 0;
+
+		std::mutex m_Mutex;
+		std::condition_variable m_LoadedCondition;
+
+		HitCounter m_Hits[COUNTER_SHARDS];
+		std::atomic<uint64_t> m_Misses{ 0 };
+		std::atomic<uint64_t> m_Evictions{ 0 };
+		std::atomic<uint64_t> m_BytesRead{ 0 };
+		std::atomic<uint64_t> m_ResidentTiles{ 0 };
+		std::atomic<uint64_t> m_Stalls{ 0 };
+		std::atomic<uint64_t> m_StallTime{ 0 }; // Nanoseconds
+	};
+}
+
+// The textures of the scene, Sphere::Texture indexes into it
+extern RayTracer::TextureCache g_TextureCache;
@@ -0,0 +1,627 @@
+#include "ThreadPool.h"
+#include "Tracer.h"
+#include "Profiler.h"
+
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <fstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+RayTracer::ThreadPool g_ThreadPool(GetMaxThreadCount() - 1);
+
+namespace RayTracer
+{
+	// How long idle workers look for new batches before they sleep, passes follow each other much faster than this
+	static const std::chrono::microseconds WORKER_SPIN_TIME(50);
+
+	// The pool and the node of the calling thread, if it is a worker
+	static thread_local const ThreadPool* s_ThreadPool = nullptr;
+	static thread_local int s_ThreadNode = -1;
+
+	struct LogicalProcessor
+	{
+		uint32_t Id; // What the workers are pinned to
+		uint32_t Core; // Shared by SMT siblings
+		uint32_t Sibling; // Index among the logical processors of the core
+		uint32_t Node;
+	};
+
+	// The logical processors this process can run on, empty if they can't be queried
+	static std::vector<LogicalProcessor> GetLogicalProcessors()
+	{
+		std::vector<LogicalProcessor> processors;
+
+#ifdef _WIN32
+		DWORD length = 0;
+		GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+		std::vector<char> buffer(length);
+
+		if (length == 0 || !GetLogicalProcessorInformationEx(RelationAll, reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data()), &length))
+		{
+			return processors;
+		}
+
+		uint32_t core = 0;
+
+		for (DWORD offset = 0; offset < length;)
+		{
+			const auto* info = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+
+			if (info->Relationship == RelationProcessorCore)
+			{
+				uint32_t sibling = 0;
+
+				for (WORD g = 0; g < info->Processor.GroupCount; g++)
+				{
+					for (uint32_t bit = 0; bit < sizeof(KAFFINITY) * 8; bit++)
+					{
+						if (info->Processor.GroupMask[g].Mask & (static_cast<KAFFINITY>(1) << bit))
+						{
+							processors.push_back({ static_cast<uint32_t>(info->Processor.GroupMask[g].Group) << 16 | bit, core, sibling++, 0 });
+						}
+					}
+				}
+
+				core++;
+			}
+
+			offset += info->Size;
+		}
+
+		for (DWORD offset = 0; offset < length;)
+		{
+			const auto* info = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+
+			if (info->Relationship == RelationNumaNode)
+			{
+				const GROUP_AFFINITY& mask = info->NumaNode.GroupMask;
+
+				for (LogicalProcessor& processor : processors)
+				{
+					if ((processor.Id >> 16) == mask.Group && (mask.Mask & (static_cast<KAFFINITY>(1) << (processor.Id & 0xFFFF))))
+					{
+						processor.Node = info->NumaNode.NodeNumber;
+					}
+				}
+			}
+
+			offset += info->Size;
+		}
+#elif defined(__linux__)
+		cpu_set_t allowed;
+
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		{
+			return processors;
+		}
+
+		auto read_number = [](const std::string& path, uint32_t& value)
+		{
+			std::ifstream file(path);
+			return static_cast<bool>(file >> value);
+		};
+
+		std::map<uint64_t, uint32_t> cores; // Package and core id to the index of the core
+		std::map<uint32_t, uint32_t> siblings;
+
+		for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			const std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+			uint32_t package = 0;
+			uint32_t core_id = 0;
+
+			if (!CPU_ISSET(cpu, &allowed) || !read_number(topology + "physical_package_id", package) || !read_number(topology + "core_id", core_id))
+			{
+				continue;
+			}
+
+			const uint64_t key = static_cast<uint64_t>(package) << 32 | core_id;
+			const uint32_t core = cores.emplace(key, static_cast<uint32_t>(cores.size())).first->second;
+			processors.push_back({ cpu, core, siblings[core]++, 0 });
+		}
+
+		// Node directories can have gaps, a machine without NUMA only has node0 (or none)
+		for (uint32_t node = 0; node < 1024; node++)
+		{
+			std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			std::string list;
+
+			if (!(file >> list))
+			{
+				continue;
+			}
+
+			// Ranges like 0-3,8-11
+			size_t start = 0;
+
+			while (start < list.size())
+			{
+				size_t end = list.find(',', start);
+				end = end == std::string::npos ? list.size() : end;
+
+				const std::string range = list.substr(start, end - start);
+				const size_t dash = range.find('-');
+				const uint32_t first = static_cast<uint32_t>(std::stoul(range.substr(0, dash)));
+				const uint32_t last = dash == std::string::npos ? first : static_cast<uint32_t>(std::stoul(range.substr(dash + 1)));
+
+				for (LogicalProcessor& processor : processors)
+				{
+					if (processor.Id >= first && processor.Id <= last)
+					{
+						processor.Node = node;
+					}
+				}
+
+				start = end + 1;
+			}
+		}
+#endif
+
+		return processors;
+	}
+
+	static bool PinCurrentThread(uint32_t processor)
+	{
+#ifdef _WIN32
+		GROUP_AFFINITY affinity = {};
+		affinity.Group = static_cast<WORD>(processor >> 16);
+		affinity.Mask = static_cast<KAFFINITY>(1) << (processor & 0xFFFF);
+		return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(processor, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	ThreadPool::ThreadPool(int worker_count) : m_WorkerCount(std::max(worker_count, 1)), m_WorkerNodes(m_WorkerCount, 0)
+	{
+		m_NodeWorkers[0] = m_WorkerCount;
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Quit = true;
+		}
+
+		m_Condition.notify_all();
+
+		for (auto& e : m_Workers)
+		{
+			e.join();
+		}
+	}
+
+	bool ThreadPool::SetPinning(bool pin)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		if (m_Started)
+		{
+			return false;
+		}
+
+		m_Pinned = false;
+		m_WorkerProcessors.clear();
+		m_WorkerNodes.assign(m_WorkerCount, 0);
+		std::fill(m_NodeWorkers, m_NodeWorkers + MAX_NODES, 0);
+		m_NodeWorkers[0] = m_WorkerCount;
+		m_NodeCount = 1;
+		m_CoreCount = 0;
+
+		if (!pin)
+		{
+			return true;
+		}
+
+		std::vector<LogicalProcessor> processors = GetLogicalProcessors();
+
+		if (processors.empty())
+		{
+			return false;
+		}
+
+		// Within a node, the first logical processor of every core and then the SMT siblings
+		std::map<uint32_t, std::vector<LogicalProcessor>> nodes;
+
+		for (const LogicalProcessor& processor : processors)
+		{
+			nodes[processor.Node].push_back(processor);
+		}
+
+		for (auto& node : nodes)
+		{
+			std::stable_sort(node.second.begin(), node.second.end(), [](const LogicalProcessor& a, const LogicalProcessor& b)
+			{
+				return a.Sibling != b.Sibling ? a.Sibling < b.Sibling : a.Core < b.Core;
+			});
+		}
+
+		// Alternating between the nodes, so that fewer workers than processors still use every socket
+		std::vector<LogicalProcessor> order;
+
+		for (size_t i = 0; order.size() < processors.size(); i++)
+		{
+			for (const auto& node : nodes)
+			{
+				if (i < node.second.size())
+				{
+					order.push_back(node.second[i]);
+				}
+			}
+		}
+
+		// Nodes without workers get no task range
+		std::map<uint32_t, int> node_indices;
+		std::map<uint32_t, bool> used_cores;
+
+		for (int w = 0; w < m_WorkerCount; w++)
+		{
+			const LogicalProcessor& processor = order[w % order.size()];
+			const int node = node_indices.emplace(processor.Node, static_cast<int>(node_indices.size()) % MAX_NODES).first->second;
+
+			m_WorkerProcessors.push_back(processor.Id);
+			m_WorkerNodes[w] = node;
+			used_cores[processor.Core] = true;
+		}
+
+		std::fill(m_NodeWorkers, m_NodeWorkers + MAX_NODES, 0);
+
+		for (int node : m_WorkerNodes)
+		{
+			m_NodeWorkers[node]++;
+		}
+
+		m_NodeCount = std::min(static_cast<int>(node_indices.size()), MAX_NODES);
+		m_CoreCount = static_cast<int>(used_cores.size());
+		m_Pinned = true;
+		return true;
+	}
+
+	void ThreadPool::Start()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		if (m_Started)
+		{
+			return;
+		}
+
+		m_Started = true;
+
+		for (int i = 0; i < m_WorkerCount; i++)
+		{
+			m_Workers.emplace_back(&ThreadPool::WorkerFunction, this, i);
+		}
+	}
+
+	ThreadPool::BatchHandle ThreadPool::CreateBatch(int count, TaskFunction function, int thread_limit, bool local)
+	{
+		Start();
+
+		BatchHandle batch = std::make_shared<Batch>();
+		batch->Function = std::move(function);
+		batch->Count = std::max(count, 0);
+		batch->ThreadLimit = thread_limit > 0 ? thread_limit : m_WorkerCount + 1;
+		batch->RangeCount = m_NodeCount;
+		batch->Local = local && m_NodeCount > 1;
+		batch->Remaining.store(batch->Count, std::memory_order_relaxed);
+
+		// Contiguous ranges, in proportion to the workers of every node
+		int workers = 0;
+
+		for (int node = 0; node < m_NodeCount; node++)
+		{
+			batch->Ranges[node].Next.store(static_cast<int>(static_cast<int64_t>(batch->Count) * workers / m_WorkerCount), std::memory_order_relaxed);
+			workers += m_NodeWorkers[node];
+			batch->Ranges[node].End = static_cast<int>(static_cast<int64_t>(batch->Count) * workers / m_WorkerCount);
+		}
+
+		return batch;
+	}
+
+	void ThreadPool::Enqueue(const BatchHandle& batch, const std::vector<BatchHandle>& dependencies)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			for (const BatchHandle& dependency : dependencies)
+			{
+				if (dependency && !dependency->Finished.load(std::memory_order_relaxed))
+				{
+					dependency->Dependents.push_back(batch);
+					batch->PendingDependencies++;
+				}
+			}
+
+			if (batch->PendingDependencies == 0)
+			{
+				MakeReady(batch);
+			}
+		}
+
+		m_Condition.notify_all();
+	}
+
+	ThreadPool::BatchHandle ThreadPool::Submit(int count, TaskFunction function, int thread_limit, const std::vector<BatchHandle>& dependencies)
+	{
+		BatchHandle batch = CreateBatch(count, std::move(function), thread_limit, false);
+		Enqueue(batch, dependencies);
+		return batch;
+	}
+
+	ThreadPool::BatchHandle ThreadPool::SubmitLocal(int count, TaskFunction function)
+	{
+		BatchHandle batch = CreateBatch(count, std::move(function), 0, true);
+		Enqueue(batch, {});
+		return batch;
+	}
+
+	void ThreadPool::Wait(const BatchHandle& batch)
+	{
+		while (!batch->Finished.load(std::memory_order_acquire))
+		{
+			BatchHandle next;
+
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+
+				while (!batch->Finished.load(std::memory_order_relaxed) && !(next = FindBatch(batch.get())))
+				{
+					m_Condition.wait(lock);
+				}
+			}
+
+			if (next)
+			{
+				Execute(*next);
+			}
+		}
+	}
+
+	void ThreadPool::Run(int count, TaskFunction function, int thread_limit)
+	{
+		Wait(Submit(count, std::move(function), thread_limit));
+	}
+
+	bool ThreadPool::RunTask(const BatchHandle& batch, int& worker)
+	{
+		// The batch can't start before its dependencies, and a thread that doesn't join it can't take a slot for nothing
+		if (worker < 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+
+				if (batch->PendingDependencies > 0)
+				{
+					return false;
+				}
+			}
+
+			if (batch->Local || !HasUnclaimedTasks(*batch))
+			{
+				return false;
+			}
+
+			worker = batch->Threads.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		if (worker >= batch->ThreadLimit)
+		{
+			return false;
+		}
+
+		return ExecuteTask(*batch, worker);
+	}
+
+	bool ThreadPool::IsFinished(const BatchHandle& batch) const
+	{
+		return batch->Finished.load(std::memory_order_acquire);
+	}
+
+	void ThreadPool::WorkerFunction(int index)
+	{
+		RT_PROFILE_THREAD("Pool Worker " + std::to_string(index));
+
+		s_ThreadPool = this;
+		s_ThreadNode = m_WorkerNodes[index];
+
+		// Before the worker touches any memory, its stack included
+		if (m_Pinned && !PinCurrentThread(m_WorkerProcessors[index]))
+		{
+			std::cout << "\nCOULD NOT PIN POOL WORKER " << index << " TO PROCESSOR " << m_WorkerProcessors[index] << "\n";
+		}
+
+		for (;;)
+		{
+			// Spinning keeps the worker awake between passes, waking a sleeping thread takes tens of microseconds
+			auto spin_start = std::chrono::steady_clock::now();
+
+			while (m_ReadyCount.load(std::memory_order_relaxed) == 0 && std::chrono::steady_clock::now() - spin_start < WORKER_SPIN_TIME)
+			{
+				std::this_thread::yield();
+			}
+
+			BatchHandle batch;
+
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+
+				while (!m_Quit && !(batch = FindBatch(nullptr)))
+				{
+					m_Condition.wait(lock);
+				}
+
+				if (!batch)
+				{
+					return;
+				}
+			}
+
+			Execute(*batch);
+		}
+	}
+
+	int ThreadPool::GetThreadNode() const
+	{
+		return s_ThreadPool == this ? s_ThreadNode : -1;
+	}
+
+	bool ThreadPool::HasUnclaimedTasks(const Batch& batch)
+	{
+		for (int r = 0; r < batch.RangeCount; r++)
+		{
+			if (batch.Ranges[r].Next.load(std::memory_order_relaxed) < batch.Ranges[r].End)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool ThreadPool::CanTakeTask(const Batch& batch, int node) const
+	{
+		if (batch.Local)
+		{
+			return node >= 0 && batch.Ranges[node].Next.load(std::memory_order_relaxed) < batch.Ranges[node].End;
+		}
+
+		return HasUnclaimedTasks(batch);
+	}
+
+	bool ThreadPool::Execute(Batch& batch)
+	{
+		const int worker = batch.Threads.fetch_add(1, std::memory_order_relaxed);
+
+		if (worker >= batch.ThreadLimit)
+		{
+			return false;
+		}
+
+		while (ExecuteTask(batch, worker))
+		{
+		}
+
+		return true;
+	}
+
+	bool ThreadPool::ExecuteTask(Batch& batch, int worker)
+	{
+		// The range of the thread's node first, threads that aren't workers start with the first one
+		const int node = GetThreadNode();
+		const int first = std::max(node, 0);
+
+		for (int r = 0; r < batch.RangeCount; r++)
+		{
+			const int index = (first + r) % batch.RangeCount;
+			TaskRange& range = batch.Ranges[index];
+
+			if (batch.Local && index != node)
+			{
+				continue;
+			}
+
+			while (range.Next.load(std::memory_order_relaxed) < range.End)
+			{
+				const int task = range.Next.fetch_add(1, std::memory_order_relaxed);
+
+				if (task >= range.End)
+				{
+					break;
+				}
+
+				batch.Function(task, worker);
+
+				if (batch.Remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				{
+					{
+						std::lock_guard<std::mutex> lock(m_Mutex);
+						Finish(batch);
+					}
+
+					m_Condition.notify_all();
+				}
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	ThreadPool::BatchHandle ThreadPool::FindBatch(const Batch* preferred)
+	{
+		const int node = GetThreadNode();
+		BatchHandle found;
+
+		for (auto it = m_Ready.begin(); it != m_Ready.end();)
+		{
+			Batch& batch = **it;
+
+			// Every task has been claimed, the threads running them finish the batch
+			if (!HasUnclaimedTasks(batch))
+			{
+				it = m_Ready.erase(it);
+				continue;
+			}
+
+			if (batch.Threads.load(std::memory_order_relaxed) < batch.ThreadLimit && CanTakeTask(batch, node) && (!found || it->get() == preferred))
+			{
+				found = *it;
+			}
+
+			++it;
+		}
+
+		m_ReadyCount.store(static_cast<int>(m_Ready.size()), std::memory_order_relaxed);
+		return found;
+	}
+
+	void ThreadPool::MakeReady(const BatchHandle& batch)
+	{
+		if (batch->Count == 0)
+		{
+			Finish(*batch);
+			return;
+		}
+
+		m_Ready.push_back(batch);
+		m_ReadyCount.store(static_cast<int>(m_Ready.size()), std::memory_order_relaxed);
+	}
+
+	void ThreadPool::Finish(Batch& batch)
+	{
+		batch.Finished.store(true, std::memory_order_release);
+
+		// Usually FindBatch has already dropped it, once its last task was claimed
+		m_Ready.erase(std::remove_if(m_Ready.begin(), m_Ready.end(), [&batch](const BatchHandle& e) { return e.get() == &batch; }), m_Ready.end());
+		m_ReadyCount.store(static_cast<int>(m_Ready.size()), std::memory_order_relaxed);
+
+		for (const BatchHandle& dependent : batch.Dependents)
+		{
+			if (--dependent->PendingDependencies == 0)
+			{
+				MakeReady(dependent);
+			}
+		}
+
+		batch.Dependents.clear();
+	}
+}
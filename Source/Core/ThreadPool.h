@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+
+namespace RayTracer
+{
+	/*
+	Worker threads that are created once and reused by every pass, instead of spawning new threads each time.
+	Work is submitted in batches of count tasks, function(task, worker) is called once for every task and the tasks are
+	claimed one at a time with an atomic counter, so uneven tiles balance out. worker is below the batch's thread limit and
+	is never shared by two threads running the same batch at once, it can index per thread data.
+	A batch can depend on earlier batches, it only starts once they have all finished.
+	Idle workers spin for a short while (the next pass usually follows right away) and then sleep on a condition variable.
+
+	With pinning, worker i is bound to one logical processor : one per physical core first (SMT siblings only once every
+	core has a worker), alternating between the NUMA nodes. The tasks of a batch are then split into one contiguous range
+	per node, sized by its worker count, and workers take the tasks of their own node before they help the others. Tiles
+	land on the same node pass after pass, so does the memory they write if it was first touched there (see SubmitLocal)
+	*/
+	class ThreadPool
+	{
+		struct Batch;
+
+	public:
+
+		typedef std::function<void(int task, int worker)> TaskFunction;
+		typedef std::shared_ptr<Batch> BatchHandle;
+
+		static const int MAX_NODES = 8;
+
+		// The thread that waits for a batch helps with it, so worker_count is one less than the threads that can run a batch
+		explicit ThreadPool(int worker_count);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Has to be called before the workers are created, returns false if the processors can't be queried on this platform
+		bool SetPinning(bool pin);
+
+		// Creates the workers, Submit does it too if it wasn't called
+		void Start();
+
+		/*
+		thread_limit caps the number of threads that run the tasks of the batch at the same time (0 for no limit), counting
+		a thread that waits for the batch as it helps with it
+		*/
+		BatchHandle Submit(int count, TaskFunction function, int thread_limit = 0, const std::vector<BatchHandle>& dependencies = {});
+
+		/*
+		Every task only runs on a worker of the node its range belongs to, which makes it the first to touch the memory the
+		task initializes. The waiting thread doesn't help. Like Submit without pinning
+		*/
+		BatchHandle SubmitLocal(int count, TaskFunction function);
+
+		// Runs tasks of the batch (or of other batches, if it can't start yet) until it has finished
+		void Wait(const BatchHandle& batch);
+
+		// Submit and Wait
+		void Run(int count, TaskFunction function, int thread_limit = 0);
+
+		/*
+		Runs a single task of the batch on the calling thread, so that a thread with work of its own can help in between.
+		worker has to start at -1, the first call joins the batch (it counts towards the thread limit) and keeps the index
+		in it for the following calls. Returns false if every task has been claimed or the batch had its thread limit
+		*/
+		bool RunTask(const BatchHandle& batch, int& worker);
+
+		bool IsFinished(const BatchHandle& batch) const;
+
+		inline int GetWorkerCount() const { return m_WorkerCount; }
+		inline bool IsPinned() const { return m_Pinned; }
+
+		// NUMA nodes that have workers, 1 without pinning
+		inline int GetNodeCount() const { return m_NodeCount; }
+
+		// Physical cores the workers are pinned to, 0 without pinning
+		inline int GetCoreCount() const { return m_CoreCount; }
+
+	private:
+
+		struct alignas(64) TaskRange
+		{
+			std::atomic<int> Next{ 0 };
+			int End = 0;
+		};
+
+		struct Batch
+		{
+			TaskFunction Function;
+			int Count = 0;
+			int ThreadLimit = 0;
+			bool Local = false;
+
+			TaskRange Ranges[MAX_NODES]; // One per node, tasks are claimed from them
+			int RangeCount = 1;
+
+			std::atomic<int> Threads{ 0 }; // Threads that joined the batch, their index is the worker argument
+			std::atomic<int> Remaining{ 0 }; // Tasks that haven't finished
+			std::atomic<bool> Finished{ false };
+
+			// Protected by m_Mutex
+			int PendingDependencies = 0;
+			std::vector<BatchHandle> Dependents;
+		};
+
+		BatchHandle CreateBatch(int count, TaskFunction function, int thread_limit, bool local);
+		void Enqueue(const BatchHandle& batch, const std::vector<BatchHandle>& dependencies);
+
+		void WorkerFunction(int index);
+
+		// Node of the calling thread, -1 if it isn't one of the workers
+		int GetThreadNode() const;
+
+		static bool HasUnclaimedTasks(const Batch& batch);
+
+		// Whether the calling thread could claim a task of the batch
+		bool CanTakeTask(const Batch& batch, int node) const;
+
+		// Runs tasks of the batch until it can't claim more, returns false if the batch already had its thread limit
+		bool Execute(Batch& batch);
+
+		// Claims and runs one task, from the range of the thread's node first. Returns false if every task was claimed
+		bool ExecuteTask(Batch& batch, int worker);
+
+		// A ready batch that the calling thread can help with, prefers preferred. Called with m_Mutex held
+		BatchHandle FindBatch(const Batch* preferred);
+
+		// Called with m_Mutex held
+		void MakeReady(const BatchHandle& batch);
+		void Finish(Batch& batch);
+
+		int m_WorkerCount = 0;
+		std::vector<std::thread> m_Workers;
+
+		bool m_Pinned = false;
+		std::vector<uint32_t> m_WorkerProcessors; // Logical processor of every worker when pinned, the group in the high 16 bits on Windows
+		std::vector<int> m_WorkerNodes; // Node of every worker, all 0 without pinning
+		int m_NodeWorkers[MAX_NODES] = {}; // Workers per node
+		int m_NodeCount = 1;
+		int m_CoreCount = 0;
+
+		mutable std::mutex m_Mutex;
+		std::condition_variable m_Condition; // Batches were submitted or finished
+		std::deque<BatchHandle> m_Ready; // Batches whose dependencies have finished, until all of their tasks were claimed
+		std::atomic<int> m_ReadyCount{ 0 }; // m_Ready.size(), for the spinning workers
+		bool m_Started = false;
+		bool m_Quit = false;
+	};
+}
+
+// Shared by the trace passes and ParallelFor, created on first use
+extern RayTracer::ThreadPool g_ThreadPool;
@@ -0,0 +1,238 @@
+#include "Tonemap.h"
+#include "Tracer.h"
+#include "Profiler.h"
+
+#include <chrono>
+#include <cmath>
+
+// Four pixels are converted at once with SSE2, the sRGB encoding is a table lookup
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RAYTRACER_TONEMAP_SSE 1
+#else
+#define RAYTRACER_TONEMAP_SSE 0
+#endif
+
+namespace RayTracer
+{
+	// Maps [0, 255] in SRGB_LUT_SIZE steps to the 8 bit sRGB encoded value, fine enough for an error below 0.25 near black
+	static const int SRGB_LUT_SIZE = 16384;
+	static const float SRGB_LUT_SCALE = (float)(SRGB_LUT_SIZE - 1) / 255.0f;
+
+	static const uint8_t* GetSRGBTable()
+	{
+		static uint8_t table[SRGB_LUT_SIZE];
+		static bool initialized = [&]()
+		{
+			for (int i = 0; i < SRGB_LUT_SIZE; i++)
+			{
+				const double linear = (double)i / (double)(SRGB_LUT_SIZE - 1);
+				const double encoded = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+				table[i] = static_cast<uint8_t>(glm::clamp(encoded * 255.0 + 0.5, 0.0, 255.0));
+			}
+
+			return true;
+		}();
+
+		(void)initialized;
+		return table;
+	}
+
+	// x is in [0, 1] units, the result is clamped later
+	static inline float ApplyOperator(TonemapOperator op, float x)
+	{
+		if (op == TonemapOperator::Reinhard)
+		{
+			return x / (1.0f + x);
+		}
+
+		return (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+	}
+
+	static inline uint8_t EncodeChannel(const TonemapSettings& settings, const uint8_t* table, float value)
+	{
+		value = glm::clamp(value, 0.0f, 255.0f);
+		return settings.SRGB ? table[static_cast<int>(value * SRGB_LUT_SCALE + 0.5f)] : static_cast<uint8_t>(value);
+	}
+
+	static inline void TonemapPixel(const TonemapSettings& settings, const uint8_t* table, float scale, const glm::vec3& sum, uint32_t count, uint8_t* rgba)
+	{
+		glm::vec3 color = sum / (float)count;
+		color *= scale;
+
+		if (settings.Operator != TonemapOperator::None)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				color[c] = ApplyOperator(settings.Operator, color[c] / 255.0f) * 255.0f;
+			}
+		}
+
+		rgba[0] = EncodeChannel(settings, table, color.r);
+		rgba[1] = EncodeChannel(settings, table, color.g);
+		rgba[2] = EncodeChannel(settings, table, color.b);
+		rgba[3] = 255;
+	}
+
+#if RAYTRACER_TONEMAP_SSE
+	static inline __m128 ApplyOperatorSSE(TonemapOperator op, __m128 x)
+	{
+		x = _mm_mul_ps(x, _mm_set1_ps(1.0f / 255.0f));
+
+		if (op == TonemapOperator::Reinhard)
+		{
+			x = _mm_div_ps(x, _mm_add_ps(x, _mm_set1_ps(1.0f)));
+		}
+
+		else
+		{
+			const __m128 numerator = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(2.51f)), _mm_set1_ps(0.03f)));
+			const __m128 denominator = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(2.43f)), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+			x = _mm_div_ps(numerator, denominator);
+		}
+
+		return _mm_mul_ps(x, _mm_set1_ps(255.0f));
+	}
+
+	// Converts pixels [0, count) of a row, count has to be a multiple of 4
+	static void TonemapRowSSE(const TonemapSettings& settings, const uint8_t* table, float scale, const glm::vec3* accumulation, 
+		const uint32_t* counts, uint8_t* rgba, int count)
+	{
+		const __m128 scale4 = _mm_set1_ps(scale);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 max = _mm_set1_ps(255.0f);
+		const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+		alignas(16) int32_t indices[12];
+
+		for (int i = 0; i < count; i += 4)
+		{
+			// Four tightly packed vec3s, r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3
+			const float* source = &accumulation[i].x;
+			const __m128 a0 = _mm_loadu_ps(source);
+			const __m128 a1 = _mm_loadu_ps(source + 4);
+			const __m128 a2 = _mm_loadu_ps(source + 8);
+
+			// To planar r0 r1 r2 r3, g0 g1 g2 g3 and b0 b1 b2 b3
+			__m128 r = _mm_shuffle_ps(_mm_shuffle_ps(a0, a0, _MM_SHUFFLE(0, 3, 0, 0)), _mm_shuffle_ps(a1, a2, _MM_SHUFFLE(0, 1, 0, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 g = _mm_shuffle_ps(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(0, 0, 0, 1)), _mm_shuffle_ps(a1, a2, _MM_SHUFFLE(0, 2, 0, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 b = _mm_shuffle_ps(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(0, 1, 0, 2)), _mm_shuffle_ps(a2, a2, _MM_SHUFFLE(0, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+
+			// A real division so that the result matches sum / count exactly
+			__m128i keep = _mm_setzero_si128();
+
+			if (counts)
+			{
+				const __m128i n = _mm_loadu_si128(reinterpret_cast<const __m128i*>(counts + i));
+				keep = _mm_cmpeq_epi32(n, _mm_setzero_si128());
+
+				if (_mm_movemask_epi8(keep) == 0xFFFF)
+				{
+					continue;
+				}
+
+				// Empty pixels are divided by 1 and then masked out
+				const __m128 divisor = _mm_cvtepi32_ps(_mm_sub_epi32(n, keep));
+				r = _mm_div_ps(r, divisor);
+				g = _mm_div_ps(g, divisor);
+				b = _mm_div_ps(b, divisor);
+			}
+
+			r = _mm_mul_ps(r, scale4);
+			g = _mm_mul_ps(g, scale4);
+			b = _mm_mul_ps(b, scale4);
+
+			if (settings.Operator != TonemapOperator::None)
+			{
+				r = ApplyOperatorSSE(settings.Operator, r);
+				g = ApplyOperatorSSE(settings.Operator, g);
+				b = ApplyOperatorSSE(settings.Operator, b);
+			}
+
+			r = _mm_min_ps(_mm_max_ps(r, zero), max);
+			g = _mm_min_ps(_mm_max_ps(g, zero), max);
+			b = _mm_min_ps(_mm_max_ps(b, zero), max);
+
+			__m128i ri, gi, bi;
+
+			if (settings.SRGB)
+			{
+				const __m128 lut_scale = _mm_set1_ps(SRGB_LUT_SCALE);
+				const __m128 half = _mm_set1_ps(0.5f);
+				_mm_store_si128(reinterpret_cast<__m128i*>(indices + 0), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(r, lut_scale), half)));
+				_mm_store_si128(reinterpret_cast<__m128i*>(indices + 4), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(g, lut_scale), half)));
+				_mm_store_si128(reinterpret_cast<__m128i*>(indices + 8), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, lut_scale), half)));
+
+				ri = _mm_setr_epi32(table[indices[0]], table[indices[1]], table[indices[2]], table[indices[3]]);
+				gi = _mm_setr_epi32(table[indices[4]], table[indices[5]], table[indices[6]], table[indices[7]]);
+				bi = _mm_setr_epi32(table[indices[8]], table[indices[9]], table[indices[10]], table[indices[11]]);
+			}
+
+			else
+			{
+				// Truncates like ToRGB
+				ri = _mm_cvttps_epi32(r);
+				gi = _mm_cvttps_epi32(g);
+				bi = _mm_cvttps_epi32(b);
+			}
+
+			// Every 32 bit lane is one RGBA8 pixel
+			__m128i pixels = _mm_or_si128(_mm_or_si128(ri, _mm_slli_epi32(gi, 8)), _mm_or_si128(_mm_slli_epi32(bi, 16), alpha));
+			__m128i* destination = reinterpret_cast<__m128i*>(rgba + i * 4);
+
+			pixels = _mm_or_si128(_mm_and_si128(keep, _mm_loadu_si128(destination)), _mm_andnot_si128(keep, pixels));
+			_mm_storeu_si128(destination, pixels);
+		}
+	}
+#endif
+
+	void TonemapRect(const TonemapSettings& settings, const glm::vec3* accumulation, const uint32_t* counts, uint8_t* rgba,
+		int stride, int x, int y, int width, int height)
+	{
+		const uint8_t* table = GetSRGBTable();
+		const float scale = std::exp2(settings.Exposure);
+
+		for (int j = y; j < y + height; j++)
+		{
+			const size_t row = static_cast<size_t>(j) * stride + x;
+			int i = 0;
+
+#if RAYTRACER_TONEMAP_SSE
+			i = width & ~3;
+			TonemapRowSSE(settings, table, scale, accumulation + row, counts ? counts + row : nullptr, rgba + row * 4, i);
+#endif
+
+			for (; i < width; i++)
+			{
+				const uint32_t count = counts ? counts[row + i] : 1;
+
+				if (count > 0)
+				{
+					TonemapPixel(settings, table, scale, accumulation[row + i], count, rgba + (row + i) * 4);
+				}
+			}
+		}
+	}
+
+	float Tonemap(const TonemapSettings& settings, const glm::vec3* accumulation, const uint32_t* counts, uint8_t* rgba,
+		int stride, int width, int height, int thread_count)
+	{
+		RT_PROFILE_ZONE("Tonemap");
+
+		auto start = std::chrono::steady_clock::now();
+
+		// Wider than the trace tiles since a tile is only a few microseconds of work here
+		const int tile_width = 256;
+		const int tile_height = 32;
+		const int tiles_x = (width + tile_width - 1) / tile_width;
+		const int tiles_y = (height + tile_height - 1) / tile_height;
+
+		ParallelFor(tiles_x * tiles_y, thread_count, [&](int tile)
+		{
+			const int x = (tile % tiles_x) * tile_width;
+			const int y = (tile / tiles_x) * tile_height;
+			TonemapRect(settings, accumulation, counts, rgba, stride, x, y, glm::min(tile_width, width - x), glm::min(tile_height, height - y));
+		});
+
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace RayTracer
+{
+	enum class TonemapOperator
+	{
+		None, // Clamps, the same as ToRGB
+		Reinhard,
+		ACES // Narkowicz's fit of the ACES filmic curve
+	};
+
+	struct TonemapSettings
+	{
+		float Exposure = 0.0f; // In stops
+		TonemapOperator Operator = TonemapOperator::None;
+		bool SRGB = false; // Encodes with the sRGB transfer function, the scene colors are authored for direct display so this is off by default
+	};
+
+	/*
+	Converts the average of accumulated samples (sum / count, in the [0, 255] range) to RGBA8 with exposure, a tonemap operator and sRGB encoding.
+	The buffers are row major and stride pixels wide, only the rectangle (x, y, width, height) is converted.
+	Pixels with a count of zero are left unchanged, counts can be null if the colors are already averaged.
+	With the default settings the output matches ToRGB exactly
+	*/
+	void TonemapRect(const TonemapSettings& settings, const glm::vec3* accumulation, const uint32_t* counts, uint8_t* rgba, 
+		int stride, int x, int y, int width, int height);
+
+	// Converts the rectangle (0, 0, width, height) split in tiles between thread_count threads, returns the time taken in milliseconds
+	float Tonemap(const TonemapSettings& settings, const glm::vec3* accumulation, const uint32_t* counts, uint8_t* rgba,
+		int stride, int width, int height, int thread_count);
+}
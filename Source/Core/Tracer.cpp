@@ -0,0 +1,1751 @@
+#include "Tracer.h"
+#include "Profiler.h"
+#include "Denoiser.h"
+#include "ImageWriter.h"
+#include "BVH.h"
+#include "Lights.h"
+#include "Environment.h"
+#include "TextureCache.h"
+#include "BackgroundWriter.h"
+#include "DisplayBuffers.h"
+
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Statically allocated so that it is valid during static initialization, its pages are only placed once InitializeFramebuffer fills it
+byte g_PixelData[g_Width * g_Height * 4];
+
+// Render time of every tile and the total busy time of every trace thread (in milliseconds)
+// A negative tile time means that the tile hasn't finished rendering yet
+std::vector<std::atomic<float>> g_TileRenderTimes(g_TileCount);
+std::vector<std::atomic<float>> g_ThreadRenderTimes(GetMaxThreadCount());
+
+std::vector<Sphere> Spheres = 
+{ 
+	Sphere(glm::vec3(-1.0, 0.0, -1.0), glm::vec3(0.8f, 0.6f, 0.2f), 0.5f, Material::Metal, 0.65f),
+	Sphere(glm::vec3(0.0, 0.0, -1.0), glm::vec3(255, 0, 0), 0.5f, Material::Diffuse),
+	Sphere(glm::vec3(1.0, 0.0, -1.0), glm::vec3(0.8f, 0.8f, 0.8f), 0.5f, Material::Metal, 0.0f),
+	Sphere(glm::vec3(0.0f, -100.5f, -1.0f), glm::vec3(255, 215, 10), 100.0f, Material::Diffuse)
+};
+
+bool IntersectSceneSpheres(const Ray& ray, float tmin, float tmax, RayHitRecord& closest_hit_rec, Sphere& sphere)
+{
+	const Sphere* closest = nullptr;
+	float ClosestDistance = tmax;
+
+	for (auto& e : Spheres)
+	{
+		// T is the distance of ray origin to the sphere's center
+		// RaySphereIntersectionTest(e, ray, 0.0f, _INFINITY);
+		float t;
+
+		if (RaySphereIntersectionDistance(e, ray, tmin, ClosestDistance, t))
+		{
+			ClosestDistance = t;
+			closest = &e;
+		}
+	}
+
+	if (!closest)
+	{
+		return false;
+	}
+
+	GetSphereHitRecord(*closest, ray, ClosestDistance, closest_hit_rec);
+	sphere = *closest;
+	return true;
+}
+
+bool IntersectScene(const Ray& ray, float tmin, float tmax, RayHitRecord& closest_hit_rec, int& index)
+{
+	// The BVH is only used once it was built for the current spheres
+	if (g_SceneBVH.GetPrimitiveCount() == Spheres.size())
+	{
+		return g_SceneBVH.Intersect(Spheres, ray, tmin, tmax, closest_hit_rec, index);
+	}
+
+	int closest = -1;
+
+	for (size_t s = 0; s < Spheres.size(); s++)
+	{
+		float t;
+
+		if (RaySphereIntersectionDistance(Spheres[s], ray, tmin, tmax, t))
+		{
+			tmax = t;
+			closest = static_cast<int>(s);
+		}
+	}
+
+	if (closest < 0)
+	{
+		return false;
+	}
+
+	GetSphereHitRecord(Spheres[closest], ray, tmax, closest_hit_rec);
+	index = closest;
+	return true;
+}
+
+bool IntersectSceneAny(const Ray& ray, float tmin, float tmax)
+{
+	if (g_SceneBVH.GetPrimitiveCount() == Spheres.size())
+	{
+		return g_SceneBVH.IntersectAny(Spheres, ray, tmin, tmax);
+	}
+
+	for (const Sphere& sphere : Spheres)
+	{
+		float t;
+
+		if (RaySphereIntersectionDistance(sphere, ray, tmin, tmax, t))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Texture footprints are estimated with a cone around the ray (Amanatides 1984), rough bounces widen it to at least this angle
+static const float ROUGH_CONE_SPREAD = 0.2f;
+
+// The color of the sphere at a point, times its texture (looked up at the mip level of a footprint cone_width wide)
+static glm::vec3 GetSurfaceColor(const Sphere& sphere, const glm::vec3& color, const glm::vec3& point, float cone_width)
+{
+	if (sphere.Texture < 0)
+	{
+		return color;
+	}
+
+	const glm::vec3 normal = (point - sphere.Center) / sphere.Radius;
+	const float u = std::atan2(normal.x, -normal.z) * (0.5f / (float)PI) + 0.5f;
+	const float v = std::acos(glm::clamp(normal.y, -1.0f, 1.0f)) / (float)PI;
+
+	// The width of the texture goes around the circumference
+	return color * g_TextureCache.Sample(sphere.Texture, u, v, cone_width / (2.0f * (float)PI * sphere.Radius));
+}
+
+RGB GetRayColor(const Ray& ray, int ray_depth, FirstHit* first_hit)
+{
+	if (ray_depth <= 0)
+	{
+		return RGB(0, 0, 0);
+	}
+
+	RayHitRecord ClosestSphere;
+	int hit_index = -1;
+
+	if (IntersectScene(ray, 0.001f, (float)_INFINITY, ClosestSphere, hit_index))
+	{
+		const Sphere& hit_sphere = Spheres[hit_index];
+
+		// Only camera rays keep the pixel footprint, the recursion doesn't track the length of the path
+		const float spread = ray_depth == RAY_DEPTH ? g_SceneCamera.GetPixelSpread(g_Height) : ROUGH_CONE_SPREAD;
+		const float cone_width = ClosestSphere.T * glm::length(ray.GetDirection()) * spread;
+		const glm::vec3 surface_color = GetSurfaceColor(hit_sphere, hit_sphere.Color, ClosestSphere.Point, cone_width);
+
+		if (first_hit)
+		{
+			first_hit->Albedo = GetSurfaceColor(hit_sphere, hit_sphere.GetAlbedo(), ClosestSphere.Point, cone_width);
+			first_hit->Normal = ClosestSphere.Normal;
+			first_hit->Depth = glm::distance(g_SceneCamera.GetOrigin(), ClosestSphere.Point);
+			first_hit->Object = hit_index;
+		}
+
+		if (hit_sphere.SphereMaterial == Material::Diffuse)
+		{
+			glm::vec3 S = ClosestSphere.Normal + GeneratePointInUnitSphere();
+			Ray new_ray(ClosestSphere.Point, S);
+
+			RGB Ray_Color = GetRayColor(new_ray, ray_depth - 1);
+			Ray_Color.r = Ray_Color.r / 2;
+			Ray_Color.g = Ray_Color.g / 2;
+			Ray_Color.b = Ray_Color.b / 2;
+
+			glm::vec3 Color = { Ray_Color.r, Ray_Color.g, Ray_Color.b };
+			glm::vec3 FinalColor = surface_color * Color;
+			//glm::vec3 FinalColor = glm::mix(hit_sphere.Color, Color, 0.4f);
+
+			return ToRGB(FinalColor);
+		}
+
+		else if (hit_sphere.SphereMaterial == Material::Metal)
+		{
+			glm::vec3 ReflectedRayDirection = glm::reflect(ray.GetDirection(), ClosestSphere.Normal);
+			ReflectedRayDirection += hit_sphere.FuzzLevel * GeneratePointInUnitSphere();
+			Ray new_ray(ClosestSphere.Point, ReflectedRayDirection);
+
+			RGB Ray_Color = GetRayColor(new_ray, ray_depth - 1);
+			glm::vec3 Color = { Ray_Color.r, Ray_Color.g, Ray_Color.b };
+			glm::vec3 FinalColor = surface_color * Color;
+
+			return ToRGB(FinalColor);
+		}
+
+		else if (hit_sphere.SphereMaterial == Material::Emissive)
+		{
+			return ToRGB(hit_sphere.Color * 255.0f);
+		}
+
+		return RGB(255, 255, 255);
+	}
+
+	if (g_Environment.IsLoaded())
+	{
+		return ToRGB(g_Environment.Lookup(ray.GetDirection()) * (g_SkyIntensity * 255.0f));
+	}
+
+	return GetGradientColorAtRay(ray);
+}
+
+// Fuzz levels below this reflect like a mirror
+static const float MIN_FUZZ = 1e-3f;
+static const float GLASS_IOR = 1.5f;
+
+// Shadow rays towards a light end this much before it, so that the light itself doesn't count as an occluder
+static const float SHADOW_RAY_END = 0.9999f;
+
+// Power heuristic with an exponent of 2 (Veach 1997), the weight of a sample taken with density pdf
+static inline float PowerHeuristic(float pdf, float other_pdf)
+{
+	const float a = pdf * pdf;
+	const float b = other_pdf * other_pdf;
+	return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
+
+static inline glm::vec3 GenerateUnitVector()
+{
+	const float z = RandomFloat(-1.0f, 1.0f);
+	const float phi = 2.0f * (float)PI * (float)RandomFloat();
+	const float r = glm::sqrt(glm::max(1.0f - z * z, 0.0f));
+	return glm::vec3(r * glm::cos(phi), r * glm::sin(phi), z);
+}
+
+/*
+Solid angle density of the scattered direction of a diffuse or fuzzy metal surface.
+Diffuse surfaces scatter to normal + a unit vector, which is cosine distributed. Fuzzy metals scatter to the mirror direction
+plus a point in a ball of radius fuzz, the density of a direction is the part of the ball along it (from where it enters to
+where it leaves the ball). Both are sampled exactly, so the BSDF times the cosine is the albedo times this density
+*/
+static float GetScatterPdf(bool diffuse, const glm::vec3& normal, const glm::vec3& reflected, float fuzz, const glm::vec3& direction)
+{
+	if (glm::dot(direction, normal) <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	if (diffuse)
+	{
+		return glm::dot(direction, normal) / (float)PI;
+	}
+
+	const float b = glm::dot(direction, reflected);
+	const float discriminant = b * b - 1.0f + fuzz * fuzz;
+
+	if (discriminant <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	const float root = glm::sqrt(discriminant);
+	const float t_far = b + root;
+	const float t_near = glm::max(b - root, 0.0f);
+
+	if (t_far <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	return (t_far * t_far * t_far - t_near * t_near * t_near) / (4.0f * (float)PI * fuzz * fuzz * fuzz);
+}
+
+glm::vec3 GetRayRadiance(const Ray& ray, int ray_depth, bool sample_lights, FirstHit* first_hit)
+{
+	glm::vec3 radiance = glm::vec3(0.0f);
+	glm::vec3 throughput = glm::vec3(1.0f);
+	glm::vec3 origin = ray.GetOrigin();
+	glm::vec3 direction = glm::normalize(ray.GetDirection());
+
+	// Of the last scattering, emission that was hit is weighted against the light sample taken there
+	float scatter_pdf = 0.0f;
+	glm::vec3 scatter_normal = glm::vec3(0.0f);
+	bool specular = true; // Camera rays and mirror or glass reflections can't be light sampled
+
+	// Width of the ray cone at the current hit and the angle it grows with, for the texture lookups
+	float cone_width = 0.0f;
+	float cone_spread = g_SceneCamera.GetPixelSpread(g_Height);
+
+	// Light samples go to the environment map with this probability and to the emissive spheres otherwise
+	const bool sample_spheres = sample_lights && g_SceneLights.GetLightCount() > 0;
+	const bool sample_environment = sample_lights && g_Environment.CanSample() && g_SkyIntensity > 0.0f;
+	const float environment_probability = sample_environment ? (sample_spheres ? 0.5f : 1.0f) : 0.0f;
+	sample_lights = sample_spheres || sample_environment;
+
+	for (int depth = 0; depth < ray_depth; depth++)
+	{
+		RayHitRecord record;
+		int index = -1;
+
+		if (!IntersectScene(Ray(origin, direction), 0.001f, (float)_INFINITY, record, index))
+		{
+			if (g_Environment.IsLoaded())
+			{
+				float pdf = 0.0f;
+				const glm::vec3 sky = g_Environment.Lookup(direction, pdf);
+				const float weight = sample_environment && !specular ? PowerHeuristic(scatter_pdf, environment_probability * pdf) : 1.0f;
+				radiance += throughput * sky * (g_SkyIntensity * weight);
+			}
+
+			else
+			{
+				const RGB sky = GetGradientColorAtRay(Ray(origin, direction));
+				radiance += throughput * glm::vec3(sky.r, sky.g, sky.b) * (g_SkyIntensity / 255.0f);
+			}
+
+			break;
+		}
+
+		const Sphere& sphere = Spheres[index];
+
+		if (depth == 0 && first_hit)
+		{
+			first_hit->Albedo = GetSurfaceColor(sphere, sphere.GetAlbedo(), record.Point, cone_spread * record.T);
+			first_hit->Normal = record.Normal;
+			first_hit->Depth = glm::distance(g_SceneCamera.GetOrigin(), record.Point);
+			first_hit->Object = index;
+		}
+
+		if (sphere.SphereMaterial == Material::Emissive)
+		{
+			// Lights only emit outwards
+			if (!record.Inside)
+			{
+				const float light_pdf = sample_spheres && !specular ? (1.0f - environment_probability) * g_SceneLights.GetPdf(Spheres, origin, scatter_normal, index) : 0.0f;
+				const float weight = sample_spheres && !specular ? PowerHeuristic(scatter_pdf, light_pdf) : 1.0f;
+				radiance += throughput * sphere.Color * weight;
+			}
+
+			break;
+		}
+
+		cone_width += cone_spread * record.T;
+		const glm::vec3 albedo = GetSurfaceColor(sphere, sphere.GetAlbedo(), record.Point, cone_width);
+		origin = record.Point;
+
+		if (sphere.SphereMaterial == Material::Glass)
+		{
+			// Refracts or reflects with the Fresnel reflectance (Schlick's approximation)
+			const float eta = record.Inside ? GLASS_IOR : 1.0f / GLASS_IOR;
+			const float cos_theta = glm::min(-glm::dot(direction, record.Normal), 1.0f);
+			const float r0 = (1.0f - eta) / (1.0f + eta);
+			const float reflectance = r0 * r0 + (1.0f - r0 * r0) * glm::pow(1.0f - cos_theta, 5.0f);
+
+			if (eta * eta * (1.0f - cos_theta * cos_theta) > 1.0f || reflectance > (float)RandomFloat())
+			{
+				direction = glm::reflect(direction, record.Normal);
+			}
+
+			else
+			{
+				direction = glm::normalize(glm::refract(direction, record.Normal, eta));
+			}
+
+			throughput *= albedo;
+			specular = true;
+			continue;
+		}
+
+		const bool diffuse = sphere.SphereMaterial == Material::Diffuse;
+		const bool mirror = !diffuse && sphere.FuzzLevel < MIN_FUZZ;
+		const glm::vec3 reflected = glm::reflect(direction, record.Normal);
+
+		if (sample_lights && !mirror)
+		{
+			// Only draws the extra random number when there are both kinds of lights
+			const bool pick_environment = environment_probability >= 1.0f || (environment_probability > 0.0f && (float)RandomFloat() < environment_probability);
+			const float u0 = (float)RandomFloat();
+			const float u1 = (float)RandomFloat();
+			const float u2 = (float)RandomFloat();
+
+			if (pick_environment)
+			{
+				RayTracer::EnvironmentSample light;
+
+				if (g_Environment.Sample(u0, u1, u2, light))
+				{
+					const float pdf = GetScatterPdf(diffuse, record.Normal, reflected, sphere.FuzzLevel, light.Direction);
+					const float light_pdf = environment_probability * light.Pdf;
+					if (pdf > 0.0f && !IntersectSceneAny(Ray(origin, light.Direction), 0.001f, (float)_INFINITY))
+					{
+						radiance += throughput * albedo * light.Radiance * (g_SkyIntensity * pdf * PowerHeuristic(light_pdf, pdf) / light_pdf);
+					}
+				}
+			}
+
+			else
+			{
+				RayTracer::LightSample light;
+
+				if (g_SceneLights.Sample(Spheres, origin, record.Normal, u0, u1, u2, light))
+				{
+					const float pdf = GetScatterPdf(diffuse, record.Normal, reflected, sphere.FuzzLevel, light.Direction);
+					const float light_pdf = (1.0f - environment_probability) * light.Pdf;
+					const Ray shadow(origin, light.Direction);
+					float light_distance;
+
+					// Visible if nothing is hit before the light, which is tested without computing the hit records
+					if (pdf > 0.0f && RaySphereIntersectionDistance(Spheres[light.Sphere], shadow, 0.001f, (float)_INFINITY, light_distance) &&
+						!IntersectSceneAny(shadow, 0.001f, light_distance * SHADOW_RAY_END))
+					{
+						radiance += throughput * albedo * Spheres[light.Sphere].Color * (pdf * PowerHeuristic(light_pdf, pdf) / light_pdf);
+					}
+				}
+			}
+		}
+
+		glm::vec3 scattered = mirror ? reflected : diffuse ? record.Normal + GenerateUnitVector() : reflected + sphere.FuzzLevel * GeneratePointInUnitSphere();
+
+		// Fuzzy reflections below the surface are absorbed
+		if (glm::dot(scattered, record.Normal) <= 0.0f)
+		{
+			break;
+		}
+
+		direction = glm::normalize(scattered);
+		scatter_pdf = mirror ? 0.0f : GetScatterPdf(diffuse, record.Normal, reflected, sphere.FuzzLevel, direction);
+		scatter_normal = record.Normal;
+		specular = mirror;
+		throughput *= albedo;
+
+		if (!mirror)
+		{
+			cone_spread = glm::max(cone_spread, (diffuse ? 1.0f : sphere.FuzzLevel) * ROUGH_CONE_SPREAD);
+		}
+	}
+
+	return radiance;
+}
+
+/*Camera g_SceneCamera(glm::vec3(-2.0f, 2.0f, 1.0f),
+	glm::vec3(0.0f, 0.0f, -1.0f),
+	glm::vec3(0.0f, 1.0f, 0.0f),
+	90.0f);*/ 
+
+Camera g_SceneCamera(glm::vec3(0.0f),
+	glm::vec3(0.0f, 0.0f, -1.0f),
+	glm::vec3(0.0f, 1.0f, 0.0f),
+	90.0f);
+
+std::atomic<bool> g_DeterministicSampling{ true };
+uint32_t g_FrameSeed = 0;
+Integrator g_Integrator = Integrator::RandomWalk;
+float g_SkyIntensity = 1.0f;
+
+// Sum of the samples and the sample count of every pixel
+FramebufferVector<glm::vec3> g_AccumulationBuffer(g_Width * g_Height);
+FramebufferVector<uint32_t> g_SampleCounts(g_Width * g_Height);
+AOVBuffers g_AOVs(g_Width * g_Height);
+std::atomic<bool> g_TemporalReprojection{ true };
+std::atomic<bool> g_RecordAOVs{ false };
+std::atomic<uint32_t> g_RenderGeneration{ 0 };
+std::atomic<bool> g_PixelsUpdated{ false };
+static std::atomic<RenderEventCallback> s_RenderEventCallback{ nullptr };
+std::atomic<uint> g_RenderWidth{ g_Width };
+std::atomic<uint> g_RenderHeight{ g_Height };
+
+// Progressive renderer state
+static std::thread s_RendererThread;
+static std::mutex s_RendererMutex;
+static std::condition_variable s_RendererCondition;
+static bool s_RendererQuit = false;
+static bool s_CameraPending = false;
+static Camera s_PendingCamera = g_SceneCamera;
+static Integrator s_Integrator = g_Integrator; // The requested integrator, g_Integrator is changed by the renderer thread
+static bool s_IntegratorPending = false;
+static int s_TargetSPP = SPP;
+static std::atomic<uint32_t> s_RenderedSamples{ 0 };
+static std::atomic<uint32_t> s_RenderedPasses{ 0 };
+static std::atomic<float> s_LastPassTime{ 0.0f };
+static std::atomic<uint32_t> s_FirstTileGeneration{ UINT32_MAX };
+static std::atomic<int64_t> s_FirstTileTime{ 0 };
+
+// Dynamic resolution state, the settings are protected by s_RendererMutex
+static DynamicResolutionSettings s_DynamicResolution;
+static float s_RenderScale = 1.0f;
+static float s_MovingScale = 1.0f; // The scale used while the camera moves, adjusted from the measured pass times
+static std::atomic<float> s_DisplayedScale{ 1.0f };
+static std::chrono::steady_clock::time_point s_LastCameraChange;
+
+// The low resolution image needs this many samples before the resolution is increased again
+static const uint32_t RAMP_UP_SAMPLES = 4;
+
+// The previous view, kept so that its samples can be reprojected after a camera change
+static std::vector<glm::vec3> s_HistoryColor;
+static std::vector<uint32_t> s_HistoryCounts;
+static std::vector<glm::vec3> s_HistoryNormals;
+static std::vector<float> s_HistoryDepths;
+static std::atomic<float> s_ReprojectedFraction{ 0.0f };
+static std::atomic<float> s_ReprojectionTime{ 0.0f };
+
+// Denoiser and display state, the settings are protected by s_RendererMutex
+static RayTracer::DenoiserSettings s_DenoiserSettings;
+static DisplayChannel s_DisplayChannel = DisplayChannel::Beauty;
+static bool s_ResolvePending = false; // The settings changed, the current image has to be denoised (or resolved) again
+static std::string s_AOVExportPath; // Set when an export was requested
+static bool s_PassDeterministicSampling = true; // g_DeterministicSampling when the pass started, so that every tile of a pass samples the same way
+static bool s_PassRecordAOVs = false; // Whether the tiles of the pass record g_AOVs, set when the pass starts
+static bool s_AOVsValid = false; // Renderer thread : g_AOVs hold the first hits of the current view
+static std::atomic<bool> s_TilesWritePixels{ true }; // The trace tasks tonemap their own tile, off while the progressive renderer resolves them
+static std::atomic<float> s_DenoiseTime{ 0.0f };
+
+// s_TonemapSettings is protected by s_RendererMutex, s_ActiveTonemap is the copy used by the trace threads and only changes between passes
+static RayTracer::TonemapSettings s_TonemapSettings;
+static RayTracer::TonemapSettings s_ActiveTonemap;
+static std::atomic<float> s_TonemapTime{ 0.0f };
+
+/*
+The progressive renderer is a pipeline of three stages with a buffer each : the pool traces tiles into the accumulation
+buffer, the renderer thread resolves the finished tiles into g_PixelData and publishes them to s_DisplayBuffers, and the
+main thread uploads the newest published image. Every buffer has a single writer, so no stage reads pixels that are still
+being written and no stage waits for the next one
+*/
+static RayTracer::DisplayBuffers s_DisplayBuffers(g_Width, g_Height, TILE_SIZE);
+static std::atomic<uint8_t> s_TracedTiles[g_TileCount]; // Set by the trace tasks, cleared once the tile was resolved
+static std::mutex s_ResolveMutex;
+static std::condition_variable s_ResolveCondition;
+static int s_FinishedTasks = 0; // Tasks of the current pass that returned, protected by s_ResolveMutex
+
+// Reprojected pixels count as at most this many samples so that the new samples quickly replace any lag
+static const uint32_t MAX_REPROJECTED_SAMPLES = 16;
+
+// Disocclusion tests, the relative depth difference and the minimum cosine between the normals
+static const float REPROJECTION_DEPTH_TOLERANCE = 0.05f;
+static const float REPROJECTION_NORMAL_TOLERANCE = 0.9f;
+
+static inline void StoreAOVs(uint pixel, const FirstHit& hit)
+{
+	g_AOVs.AlbedoR[pixel] = hit.Albedo.r;
+	g_AOVs.AlbedoG[pixel] = hit.Albedo.g;
+	g_AOVs.AlbedoB[pixel] = hit.Albedo.b;
+	g_AOVs.NormalX[pixel] = hit.Normal.x;
+	g_AOVs.NormalY[pixel] = hit.Normal.y;
+	g_AOVs.NormalZ[pixel] = hit.Normal.z;
+	g_AOVs.Depth[pixel] = hit.Depth;
+	g_AOVs.ObjectID[pixel] = static_cast<float>(hit.Object);
+}
+
+bool TraceTile(int xstart, int ystart, int xsize, int ysize, int samples, uint32_t generation)
+{
+	const float width = static_cast<float>(g_RenderWidth.load(std::memory_order_relaxed));
+	const float height = static_cast<float>(g_RenderHeight.load(std::memory_order_relaxed));
+
+	for (int i = xstart; i < xstart + xsize; i++)
+	{
+		// The camera moved, the rest of the tile would be thrown away
+		if (g_RenderGeneration.load(std::memory_order_relaxed) != generation)
+		{
+			return false;
+		}
+
+		for (int j = ystart; j < ystart + ysize; j++)
+		{
+			const uint pixel = j * g_Width + i;
+			const uint first_sample = g_SampleCounts[pixel];
+			glm::vec3 FinalColor = glm::vec3(0.0f);
+
+			// The AOVs come from the first sample of the pixel since the last reset
+			FirstHit first_hit;
+			FirstHit* record = s_PassRecordAOVs && first_sample == 0 ? &first_hit : nullptr;
+
+			for (int s = 0; s < samples; s++)
+			{
+				if (s_PassDeterministicSampling)
+				{
+					SeedRandomForSample(pixel, first_sample + s, g_FrameSeed);
+				}
+
+				// Calculate the UV Coordinates
+
+				float u = ((float)i + RandomFloat()) / width;
+				float v = ((float)j + RandomFloat()) / height;
+
+				Ray ray = g_SceneCamera.GetRay(u, v);
+
+				if (g_Integrator == Integrator::RandomWalk)
+				{
+					RGB ray_color = GetRayColor(ray, RAY_DEPTH, record);
+
+					FinalColor.r += ray_color.r;
+					FinalColor.g += ray_color.g;
+					FinalColor.b += ray_color.b;
+				}
+
+				else
+				{
+					FinalColor += GetRayRadiance(ray, RAY_DEPTH, g_Integrator == Integrator::LightSampling, record) * 255.0f;
+				}
+
+				record = nullptr;
+			}
+
+			if (s_PassRecordAOVs && first_sample == 0)
+			{
+				StoreAOVs(pixel, first_hit);
+			}
+
+			g_AccumulationBuffer[pixel] += FinalColor;
+			g_SampleCounts[pixel] = first_sample + samples;
+		}
+	}
+
+	if (s_TilesWritePixels.load(std::memory_order_relaxed))
+	{
+		RayTracer::TonemapRect(s_ActiveTonemap, g_AccumulationBuffer.data(), g_SampleCounts.data(), g_PixelData, g_Width, xstart, ystart, xsize, ysize);
+	}
+
+	return true;
+}
+
+void SetRenderEventCallback(RenderEventCallback callback)
+{
+	s_RenderEventCallback.store(callback, std::memory_order_release);
+}
+
+void PostRenderEvent(const RenderEvent& e)
+{
+	RenderEventCallback callback = s_RenderEventCallback.load(std::memory_order_acquire);
+
+	if (callback)
+	{
+		callback(e);
+	}
+}
+
+void MarkPixelsUpdated(uint32_t tile)
+{
+	if (!g_PixelsUpdated.exchange(true, std::memory_order_acq_rel))
+	{
+		RenderEvent e;
+		e.Type = RenderEventType::TileFinished;
+		e.Tile = tile;
+		e.Generation = g_RenderGeneration.load(std::memory_order_relaxed);
+		PostRenderEvent(e);
+	}
+}
+
+// One task of a pass, the pool hands the tiles out as threads become free. worker indexes g_ThreadRenderTimes
+bool TraceTileTask(uint tile, int worker, int samples, uint32_t generation)
+{
+	// The rest of a cancelled pass is skipped
+	if (g_RenderGeneration.load(std::memory_order_relaxed) != generation)
+	{
+		return false;
+	}
+
+	// Only used when the sampling isn't deterministic
+	SeedRandom((static_cast<uint64_t>(g_FrameSeed) << 32) | s_RenderedSamples.load(), static_cast<uint64_t>(tile) + 1);
+
+	const int width = static_cast<int>(g_RenderWidth.load(std::memory_order_relaxed));
+	const int height = static_cast<int>(g_RenderHeight.load(std::memory_order_relaxed));
+
+	const int x = (tile % g_TileCountX) * TILE_SIZE;
+	const int y = (tile / g_TileCountX) * TILE_SIZE;
+	const int sizex = glm::min(static_cast<int>(TILE_SIZE), width - x);
+	const int sizey = glm::min(static_cast<int>(TILE_SIZE), height - y);
+	bool finished = false;
+
+	// Outside of the (dynamic resolution) render area
+	if (sizex <= 0 || sizey <= 0)
+	{
+		return false;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	{
+		RT_PROFILE_ZONE_ARG("Tile", tile);
+		finished = TraceTile(x, y, sizex, sizey, samples, generation);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	if (!finished)
+	{
+		return false;
+	}
+
+	// The first finished tile after a reset is used to measure the input latency
+	uint32_t first_generation = s_FirstTileGeneration.load(std::memory_order_relaxed);
+
+	if (first_generation != generation && s_FirstTileGeneration.compare_exchange_strong(first_generation, generation))
+	{
+		s_FirstTileTime.store(end.time_since_epoch().count());
+	}
+
+	// Tile times are summed over all the passes since the last reset
+	float time = std::chrono::duration<float, std::milli>(end - start).count();
+	g_TileRenderTimes[tile].store(glm::max(g_TileRenderTimes[tile].load(std::memory_order_relaxed), 0.0f) + time, std::memory_order_relaxed);
+	g_ThreadRenderTimes[worker].store(g_ThreadRenderTimes[worker].load(std::memory_order_relaxed) + time, 
+		std::memory_order_relaxed);
+
+	return true;
+}
+
+// Counts the pass unless it was cancelled
+static bool FinishPass(int samples, uint32_t generation, std::chrono::steady_clock::time_point start)
+{
+	if (g_RenderGeneration.load() != generation)
+	{
+		return false;
+	}
+
+	s_RenderedSamples.store(s_RenderedSamples.load() + samples);
+	s_RenderedPasses.store(s_RenderedPasses.load() + 1);
+	s_LastPassTime.store(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+	RenderEvent e;
+	e.Type = RenderEventType::PassFinished;
+	e.Samples = s_RenderedSamples.load();
+	e.Generation = generation;
+	PostRenderEvent(e);
+
+	return true;
+}
+
+bool TracePass(int samples, int thread_count, uint32_t generation)
+{
+	RT_PROFILE_ZONE("TracePass");
+
+	auto start = std::chrono::steady_clock::now();
+	s_PassDeterministicSampling = g_DeterministicSampling.load();
+	s_PassRecordAOVs = g_RecordAOVs.load();
+
+	g_ThreadPool.Run(static_cast<int>(g_TileCount), [samples, generation](int tile, int worker)
+	{
+		TraceTileTask(static_cast<uint>(tile), worker, samples, generation);
+	}, glm::clamp(thread_count, 1, GetMaxThreadCount()));
+
+	return FinishPass(samples, generation, start);
+}
+
+const byte* AcquireDisplayImage(uint& render_width, uint& render_height)
+{
+	return s_DisplayBuffers.Acquire(render_width, render_height);
+}
+
+// Hands all of g_PixelData to the upload stage, only called from the renderer thread (the only one that writes it while it runs)
+static void PublishPixels()
+{
+	s_DisplayBuffers.MarkAll();
+	s_DisplayBuffers.Publish(g_PixelData, g_RenderWidth.load(), g_RenderHeight.load());
+	MarkPixelsUpdated();
+}
+
+// Resolve stage : tonemaps the tiles that were traced since the last call into g_PixelData and publishes them
+static void ResolveTracedTiles()
+{
+	RT_PROFILE_ZONE("Resolve Tiles");
+
+	const int width = static_cast<int>(g_RenderWidth.load(std::memory_order_relaxed));
+	const int height = static_cast<int>(g_RenderHeight.load(std::memory_order_relaxed));
+	uint32_t last_tile = UINT32_MAX;
+
+	for (uint tile = 0; tile < g_TileCount; tile++)
+	{
+		if (!s_TracedTiles[tile].exchange(0, std::memory_order_acquire))
+		{
+			continue;
+		}
+
+		const int x = (tile % g_TileCountX) * TILE_SIZE;
+		const int y = (tile / g_TileCountX) * TILE_SIZE;
+
+		RayTracer::TonemapRect(s_ActiveTonemap, g_AccumulationBuffer.data(), g_SampleCounts.data(), g_PixelData, g_Width, x, y,
+			glm::min(static_cast<int>(TILE_SIZE), width - x), glm::min(static_cast<int>(TILE_SIZE), height - y));
+
+		s_DisplayBuffers.MarkTile(tile);
+		last_tile = tile;
+	}
+
+	if (last_tile != UINT32_MAX)
+	{
+		s_DisplayBuffers.Publish(g_PixelData, static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+		MarkPixelsUpdated(last_tile);
+	}
+}
+
+/*
+A pass of the progressive renderer. The tiles are traced on the pool while this thread resolves the ones that finished
+(and traces tiles itself in between), so the resolve and the upload of a tile overlap with the tracing of the rest. The next pass only waits for the last few
+tiles to be resolved, and the upload of the pass continues while it is traced.
+Without resolve_tiles (an AOV is shown, or the denoiser after the first pass) the image is resolved by the caller once the pass has finished.
+With record_aovs the tiles record g_AOVs, not only when g_RecordAOVs is set
+*/
+static bool TracePipelinedPass(int samples, int thread_count, uint32_t generation, bool resolve_tiles, bool record_aovs)
+{
+	RT_PROFILE_ZONE("TracePass");
+
+	auto start = std::chrono::steady_clock::now();
+	const int count = static_cast<int>(g_TileCount);
+	s_PassDeterministicSampling = g_DeterministicSampling.load();
+	s_PassRecordAOVs = record_aovs;
+
+	{
+		std::lock_guard<std::mutex> lock(s_ResolveMutex);
+		s_FinishedTasks = 0;
+	}
+
+	RayTracer::ThreadPool::BatchHandle pass = g_ThreadPool.Submit(count, [samples, generation, resolve_tiles](int tile, int worker)
+	{
+		if (TraceTileTask(static_cast<uint>(tile), worker, samples, generation) && resolve_tiles)
+		{
+			s_TracedTiles[tile].store(1, std::memory_order_release);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(s_ResolveMutex);
+			s_FinishedTasks++;
+		}
+
+		s_ResolveCondition.notify_one();
+	}, glm::clamp(thread_count, 1, GetMaxThreadCount()));
+
+	int finished_tasks = 0;
+	int worker = -1;
+
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(s_ResolveMutex);
+			finished_tasks = s_FinishedTasks;
+		}
+
+		if (resolve_tiles)
+		{
+			ResolveTracedTiles();
+		}
+
+		if (finished_tasks == count)
+		{
+			break;
+		}
+
+		// This thread traces tiles too (it is one of the thread_count threads), one at a time so that it resolves in between.
+		// Once every tile has been claimed, it waits for the ones that are still being traced
+		if (!g_ThreadPool.RunTask(pass, worker))
+		{
+			std::unique_lock<std::mutex> lock(s_ResolveMutex);
+			s_ResolveCondition.wait(lock, [finished_tasks]() { return s_FinishedTasks != finished_tasks; });
+		}
+	}
+
+	// Every task has returned, this only waits for the pool to retire the batch
+	g_ThreadPool.Wait(pass);
+
+	return FinishPass(samples, generation, start);
+}
+
+// Clears the accumulation, or fills g_PixelData with white. Tiles are split between the NUMA nodes like in the passes, so the
+// first clear places the rows of a tile where it is rendered
+static void ClearTiles(bool pixels)
+{
+	g_ThreadPool.Wait(g_ThreadPool.SubmitLocal(static_cast<int>(g_TileCount), [pixels](int tile, int)
+	{
+		const int x = (tile % g_TileCountX) * TILE_SIZE;
+		const int y = (tile / g_TileCountX) * TILE_SIZE;
+		const int sizex = glm::min(static_cast<int>(TILE_SIZE), static_cast<int>(g_Width) - x);
+		const int sizey = glm::min(static_cast<int>(TILE_SIZE), static_cast<int>(g_Height) - y);
+
+		for (int j = y; j < y + sizey; j++)
+		{
+			if (pixels)
+			{
+				memset(&g_PixelData[(j * g_Width + x) * 4], 255, sizex * 4);
+				continue;
+			}
+
+			std::fill(g_AccumulationBuffer.begin() + j * g_Width + x, g_AccumulationBuffer.begin() + j * g_Width + x + sizex, glm::vec3(0.0f));
+			std::fill(g_SampleCounts.begin() + j * g_Width + x, g_SampleCounts.begin() + j * g_Width + x + sizex, 0u);
+		}
+	}));
+}
+
+void InitializeFramebuffer()
+{
+	ClearTiles(true);
+	ResetAccumulation();
+}
+
+void ResetAccumulation()
+{
+	ClearTiles(false);
+	s_RenderedSamples.store(0);
+	s_RenderedPasses.store(0);
+
+	for (auto& e : g_TileRenderTimes)
+	{
+		e.store(-1.0f, std::memory_order_relaxed);
+	}
+
+	for (auto& e : g_ThreadRenderTimes)
+	{
+		e.store(0.0f, std::memory_order_relaxed);
+	}
+}
+
+// Writes the AOVs of the ray through the center of a pixel and returns its first hit position
+static glm::vec3 TraceAOVPixel(const Camera& camera, int i, int j, float width, float height)
+{
+	const uint pixel = j * g_Width + i;
+	Ray ray = camera.GetRay(((float)i + 0.5f) / width, ((float)j + 0.5f) / height);
+	RayHitRecord closest;
+	int object = -1;
+	FirstHit hit;
+
+	if (!IntersectScene(ray, 0.001f, (float)_INFINITY, closest, object))
+	{
+		StoreAOVs(pixel, hit);
+
+		// A point far along the ray so that the sky can be reprojected too
+		return camera.GetOrigin() + glm::normalize(ray.GetDirection()) * 10000.0f;
+	}
+
+	const float cone_width = closest.T * glm::length(ray.GetDirection()) * camera.GetPixelSpread((uint)height);
+	hit.Albedo = GetSurfaceColor(Spheres[object], Spheres[object].GetAlbedo(), closest.Point, cone_width);
+	hit.Normal = closest.Normal;
+	hit.Depth = glm::distance(camera.GetOrigin(), closest.Point);
+	hit.Object = object;
+	StoreAOVs(pixel, hit);
+
+	return closest.Point;
+}
+
+/*
+Traces the first hit AOVs of the current camera for the render area, for when they are needed but the pixels already have
+samples that didn't record them (the recording was off since the last reset)
+*/
+static void TraceAOVs(int thread_count)
+{
+	RT_PROFILE_ZONE("TraceAOVs");
+
+	const int width = static_cast<int>(g_RenderWidth.load());
+	const int height = static_cast<int>(g_RenderHeight.load());
+
+	ParallelForRows(height, thread_count, [width, height](int j)
+	{
+		for (int i = 0; i < width; i++)
+		{
+			TraceAOVPixel(g_SceneCamera, i, j, (float)width, (float)height);
+		}
+	});
+}
+
+/*
+Resets the accumulation and then fills it with the samples of the previous view (previous camera and render size).
+Every pixel's first hit is projected into the previous view and the nearest pixel there is reused if its depth and
+normal agree, otherwise the pixel was disoccluded and starts from zero samples.
+Reprojecting to a higher resolution reuses less samples since the upscaled pixels are blocky.
+Only call this while no trace threads are running, g_SceneCamera and the render size have to be set to the new view
+*/
+static void ReprojectAccumulation(const Camera& previous_camera, int previous_width, int previous_height, int thread_count)
+{
+	RT_PROFILE_ZONE("Reproject");
+
+	auto start = std::chrono::steady_clock::now();
+
+	// The history is only valid inside the previous render area
+	s_HistoryColor.resize(g_AccumulationBuffer.size());
+	s_HistoryCounts.assign(g_SampleCounts.begin(), g_SampleCounts.end());
+	s_HistoryDepths.assign(g_AOVs.Depth.begin(), g_AOVs.Depth.end());
+	s_HistoryNormals.resize(g_AccumulationBuffer.size());
+
+	for (size_t i = 0; i < s_HistoryColor.size(); i++)
+	{
+		s_HistoryColor[i] = s_HistoryCounts[i] > 0 ? g_AccumulationBuffer[i] / (float)s_HistoryCounts[i] : glm::vec3(0.0f);
+		s_HistoryNormals[i] = g_AOVs.GetNormal(static_cast<uint>(i));
+	}
+
+	ResetAccumulation();
+
+	const int width = static_cast<int>(g_RenderWidth.load());
+	const int height = static_cast<int>(g_RenderHeight.load());
+	const float density = glm::min(static_cast<float>(previous_width * previous_height) / static_cast<float>(width * height), 1.0f);
+	const uint32_t max_samples = glm::max(static_cast<uint32_t>(MAX_REPROJECTED_SAMPLES * density * density), 1u);
+	std::atomic<uint32_t> reprojected{ 0 };
+
+	ParallelForRows(height, thread_count, [&](int j)
+	{
+		uint32_t row_reprojected = 0;
+
+		for (int i = 0; i < width; i++)
+		{
+			const uint pixel = j * g_Width + i;
+			const glm::vec3 position = TraceAOVPixel(g_SceneCamera, i, j, (float)width, (float)height);
+
+			glm::vec2 uv;
+
+			if (!previous_camera.Project(position, uv) || uv.x < 0.0f || uv.y < 0.0f || uv.x >= 1.0f || uv.y >= 1.0f)
+			{
+				continue;
+			}
+
+			const int x = glm::min(static_cast<int>(uv.x * previous_width), previous_width - 1);
+			const int y = glm::min(static_cast<int>(uv.y * previous_height), previous_height - 1);
+			const uint history = y * g_Width + x;
+
+			if (s_HistoryCounts[history] == 0)
+			{
+				continue;
+			}
+
+			const float depth = g_AOVs.Depth[pixel];
+			const float history_depth = s_HistoryDepths[history];
+
+			// Sky pixels can only be reprojected onto sky pixels
+			if (std::isinf(depth) || std::isinf(history_depth))
+			{
+				if (!(std::isinf(depth) && std::isinf(history_depth)))
+				{
+					continue;
+				}
+			}
+
+			else
+			{
+				// The depth the point would have had in the previous view
+				const float expected_depth = glm::distance(previous_camera.GetOrigin(), position);
+
+				if (glm::abs(expected_depth - history_depth) > REPROJECTION_DEPTH_TOLERANCE * expected_depth ||
+					glm::dot(g_AOVs.GetNormal(pixel), s_HistoryNormals[history]) < REPROJECTION_NORMAL_TOLERANCE)
+				{
+					continue;
+				}
+			}
+
+			const uint32_t count = glm::min(s_HistoryCounts[history], max_samples);
+			g_AccumulationBuffer[pixel] = s_HistoryColor[history] * (float)count;
+			g_SampleCounts[pixel] = count;
+			row_reprojected++;
+		}
+
+		reprojected.fetch_add(row_reprojected, std::memory_order_relaxed);
+	});
+
+	s_ReprojectedFraction.store(static_cast<float>(reprojected.load()) / static_cast<float>(width * height));
+	s_ReprojectionTime.store(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+	// The disoccluded pixels keep their old color until they are traced
+	RayTracer::Tonemap(s_ActiveTonemap, g_AccumulationBuffer.data(), g_SampleCounts.data(), g_PixelData, g_Width, width, height, thread_count);
+}
+
+// Writes the tonemapped average of the accumulated samples of the render area to g_PixelData
+static void ResolveAccumulation(int thread_count)
+{
+	s_TonemapTime.store(RayTracer::Tonemap(s_ActiveTonemap, g_AccumulationBuffer.data(), g_SampleCounts.data(), g_PixelData, g_Width,
+		static_cast<int>(g_RenderWidth.load()), static_cast<int>(g_RenderHeight.load()), thread_count));
+}
+
+static void DenoiseAccumulation(const RayTracer::DenoiserSettings& settings, int thread_count)
+{
+	s_DenoiseTime.store(RayTracer::Denoise(settings, s_ActiveTonemap, static_cast<int>(g_RenderWidth.load()), static_cast<int>(g_RenderHeight.load()), thread_count));
+}
+
+// Distinct colors for neighbouring object ids
+static glm::vec3 GetObjectIDColor(int id)
+{
+	uint32_t hash = static_cast<uint32_t>(id) * 747796405u + 2891336453u;
+	hash = ((hash >> ((hash >> 28u) + 4u)) ^ hash) * 277803737u;
+	hash = (hash >> 22u) ^ hash;
+	return glm::vec3(hash & 0xFF, (hash >> 8) & 0xFF, (hash >> 16) & 0xFF);
+}
+
+// Writes a visualization of an AOV to g_PixelData
+static void ShowAOV(DisplayChannel channel, int thread_count)
+{
+	const int width = static_cast<int>(g_RenderWidth.load());
+	const int height = static_cast<int>(g_RenderHeight.load());
+
+	// Depth is shown from the nearest (white) to the farthest (black) hit
+	float min_depth = static_cast<float>(_INFINITY);
+	float max_depth = 0.0f;
+
+	if (channel == DisplayChannel::Depth)
+	{
+		for (int j = 0; j < height; j++)
+		{
+			for (int i = 0; i < width; i++)
+			{
+				const float depth = g_AOVs.Depth[j * g_Width + i];
+
+				if (!std::isinf(depth))
+				{
+					min_depth = glm::min(min_depth, depth);
+					max_depth = glm::max(max_depth, depth);
+				}
+			}
+		}
+	}
+
+	ParallelForRows(height, thread_count, [&](int j)
+	{
+		for (int i = 0; i < width; i++)
+		{
+			const uint pixel = j * g_Width + i;
+			const bool miss = g_AOVs.ObjectID[pixel] < 0.0f;
+			glm::vec3 color = glm::vec3(0.0f);
+
+			if (channel == DisplayChannel::Albedo)
+			{
+				color = g_AOVs.GetAlbedo(pixel) * 255.0f;
+			}
+
+			else if (channel == DisplayChannel::Normal && !miss)
+			{
+				color = (g_AOVs.GetNormal(pixel) * 0.5f + 0.5f) * 255.0f;
+			}
+
+			else if (channel == DisplayChannel::Depth && !miss)
+			{
+				color = glm::vec3(255.0f * (1.0f - (g_AOVs.Depth[pixel] - min_depth) / glm::max(max_depth - min_depth, 1e-4f)));
+			}
+
+			else if (channel == DisplayChannel::ObjectID && !miss)
+			{
+				color = GetObjectIDColor(static_cast<int>(g_AOVs.ObjectID[pixel]));
+			}
+
+			PutPixel(glm::ivec2(i, j), ToRGB(color));
+		}
+	});
+}
+
+// Updates and publishes g_PixelData after a pass (or a settings change) when the tiles aren't resolved as they finish
+static void ResolveOutput(DisplayChannel channel, const RayTracer::DenoiserSettings& denoiser, int thread_count)
+{
+	if (channel != DisplayChannel::Beauty)
+	{
+		ShowAOV(channel, thread_count);
+	}
+
+	else if (denoiser.Enabled)
+	{
+		DenoiseAccumulation(denoiser, thread_count);
+	}
+
+	else
+	{
+		ResolveAccumulation(thread_count);
+	}
+
+	PublishPixels();
+}
+
+static void WriteAOVs(const std::string& path_prefix)
+{
+	const uint32_t width = g_RenderWidth.load();
+	const uint32_t height = g_RenderHeight.load();
+
+	bool success = RayTracer::WritePFM(path_prefix + "Albedo.pfm", width, height, g_Width, { g_AOVs.AlbedoR.data(), g_AOVs.AlbedoG.data(), g_AOVs.AlbedoB.data() });
+	success &= RayTracer::WritePFM(path_prefix + "Normal.pfm", width, height, g_Width, { g_AOVs.NormalX.data(), g_AOVs.NormalY.data(), g_AOVs.NormalZ.data() });
+	success &= RayTracer::WritePFM(path_prefix + "Depth.pfm", width, height, g_Width, { g_AOVs.Depth.data() });
+	success &= RayTracer::WritePFM(path_prefix + "ObjectID.pfm", width, height, g_Width, { g_AOVs.ObjectID.data() });
+
+	if (success)
+	{
+		std::cout << "\nWrote the AOVs to " << path_prefix << "*.pfm\n";
+		return;
+	}
+
+	RenderEvent e;
+	e.Type = RenderEventType::JobFailed;
+	e.Message = "Could not export the AOVs";
+	PostRenderEvent(e);
+}
+
+// The first pass is 1 spp so that a reset shows up quickly, the passes then double in size
+static int GetPassSamples(uint32_t rendered, int target)
+{
+	int samples = glm::clamp(static_cast<int>(rendered), 1, 16);
+	return glm::min(samples, target - static_cast<int>(rendered));
+}
+
+// Only call this while no trace threads are running
+static void SetRenderScale(float scale)
+{
+	s_RenderScale = scale;
+	s_DisplayedScale.store(scale);
+	g_RenderWidth.store(glm::clamp(static_cast<uint>(g_Width * scale + 0.5f), 1u, g_Width));
+	g_RenderHeight.store(glm::clamp(static_cast<uint>(g_Height * scale + 0.5f), 1u, g_Height));
+}
+
+static void BeginTraceScene()
+{
+	UpdateSceneBVH();
+	SetRenderScale(1.0f);
+	ResetAccumulation();
+}
+
+void TraceScene(int spp, int thread_count)
+{
+	RT_PROFILE_ZONE("TraceScene");
+
+	BeginTraceScene();
+	const uint32_t generation = g_RenderGeneration.load();
+
+	while (static_cast<int>(s_RenderedSamples.load()) < spp)
+	{
+		TracePass(GetPassSamples(s_RenderedSamples.load(), spp), thread_count, generation);
+	}
+}
+
+// FNV-1a over everything that changes the accumulated samples besides the sampling
+uint64_t GetSceneHash()
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	auto add = [&hash](const void* data, size_t size)
+	{
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 1099511628211ull;
+		}
+	};
+
+	for (const Sphere& sphere : Spheres)
+	{
+		add(&sphere.Center, sizeof(sphere.Center));
+		add(&sphere.Color, sizeof(sphere.Color));
+		add(&sphere.Radius, sizeof(sphere.Radius));
+		add(&sphere.SphereMaterial, sizeof(sphere.SphereMaterial));
+		add(&sphere.FuzzLevel, sizeof(sphere.FuzzLevel));
+		add(&sphere.Texture, sizeof(sphere.Texture));
+	}
+
+	add(&g_Integrator, sizeof(g_Integrator));
+	add(&g_SkyIntensity, sizeof(g_SkyIntensity));
+
+	const uint64_t environment = g_Environment.GetHash();
+	const float environment_rotation = g_Environment.GetRotation();
+	add(&environment, sizeof(environment));
+	add(&environment_rotation, sizeof(environment_rotation));
+
+	// The rays through the corners pin down the camera
+	for (int corner = 0; corner < 4; corner++)
+	{
+		const Ray ray = g_SceneCamera.GetRay((float)(corner & 1), (float)(corner >> 1));
+		const glm::vec3 origin = ray.GetOrigin();
+		const glm::vec3 direction = ray.GetDirection();
+		add(&origin, sizeof(origin));
+		add(&direction, sizeof(direction));
+	}
+
+	return hash;
+}
+
+static void CaptureCheckpoint(RayTracer::RenderCheckpoint& checkpoint, int spp)
+{
+	RT_PROFILE_ZONE("Capture Checkpoint");
+
+	checkpoint.Width = g_Width;
+	checkpoint.Height = g_Height;
+	checkpoint.TargetSamples = static_cast<uint32_t>(spp);
+	checkpoint.Samples = s_RenderedSamples.load();
+	checkpoint.Passes = s_RenderedPasses.load();
+	checkpoint.FrameSeed = g_FrameSeed;
+	checkpoint.DeterministicSampling = g_DeterministicSampling.load() ? 1 : 0;
+	checkpoint.SceneHash = GetSceneHash();
+	checkpoint.Accumulation.assign(g_AccumulationBuffer.begin(), g_AccumulationBuffer.end());
+	checkpoint.SampleCounts.assign(g_SampleCounts.begin(), g_SampleCounts.end());
+}
+
+static bool RestoreCheckpoint(const RayTracer::RenderCheckpoint& checkpoint, int spp)
+{
+	if (checkpoint.Width != g_Width || checkpoint.Height != g_Height || checkpoint.SceneHash != GetSceneHash())
+	{
+		std::cout << "\nTHE CHECKPOINT IS OF A DIFFERENT SCENE OR RESOLUTION, STARTING OVER\n";
+		return false;
+	}
+
+	if (checkpoint.TargetSamples != static_cast<uint32_t>(spp))
+	{
+		std::cout << "\nTHE CHECKPOINT WAS RENDERING " << checkpoint.TargetSamples << " SPP, THE RESULT WON'T BE IDENTICAL TO AN UNINTERRUPTED RENDER\n";
+	}
+
+	std::copy(checkpoint.Accumulation.begin(), checkpoint.Accumulation.end(), g_AccumulationBuffer.begin());
+	std::copy(checkpoint.SampleCounts.begin(), checkpoint.SampleCounts.end(), g_SampleCounts.begin());
+	s_RenderedSamples.store(checkpoint.Samples);
+	s_RenderedPasses.store(checkpoint.Passes);
+	g_FrameSeed = checkpoint.FrameSeed;
+	g_DeterministicSampling = checkpoint.DeterministicSampling != 0;
+
+	return true;
+}
+
+bool TraceSceneCheckpointed(int spp, const RayTracer::CheckpointSettings& settings, int thread_count)
+{
+	RT_PROFILE_ZONE("TraceSceneCheckpointed");
+
+	BeginTraceScene();
+
+	if (settings.Resume && !settings.Path.empty())
+	{
+		RayTracer::RenderCheckpoint checkpoint;
+
+		if (RayTracer::ReadCheckpoint(settings.Path, checkpoint) && RestoreCheckpoint(checkpoint, spp))
+		{
+			std::cout << "Resumed from " << settings.Path << " at " << checkpoint.Samples << " spp" << std::endl;
+			ResolveAccumulation(thread_count);
+
+			// The restored pixels already have samples, so the passes won't record their AOVs
+			if (g_RecordAOVs.load())
+			{
+				TraceAOVs(thread_count);
+			}
+		}
+	}
+
+	const uint32_t generation = g_RenderGeneration.load();
+	const auto start = std::chrono::steady_clock::now();
+	auto last_checkpoint = start;
+
+	RayTracer::RenderCheckpoint snapshot;
+	RayTracer::BackgroundWriter<RayTracer::RenderCheckpoint> writer(RayTracer::WriteCheckpoint);
+	bool finished = true;
+
+	while (static_cast<int>(s_RenderedSamples.load()) < spp)
+	{
+		TracePass(GetPassSamples(s_RenderedSamples.load(), spp), thread_count, generation);
+
+		if (settings.Path.empty())
+		{
+			continue;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		const bool out_of_time = settings.TimeLimit > 0.0f && std::chrono::duration<float>(now - start).count() >= settings.TimeLimit;
+
+		if (out_of_time && static_cast<int>(s_RenderedSamples.load()) < spp)
+		{
+			finished = false;
+			break;
+		}
+
+		// A checkpoint that is still being written is not waited for, the next pass tries again
+		if (std::chrono::duration<float>(now - last_checkpoint).count() >= settings.Interval && !writer.IsBusy())
+		{
+			CaptureCheckpoint(snapshot, spp);
+			writer.Submit(settings.Path, snapshot);
+			last_checkpoint = now;
+		}
+	}
+
+	// The last checkpoint allows resuming after a time limit, or continuing to more samples
+	if (!settings.Path.empty())
+	{
+		CaptureCheckpoint(snapshot, spp);
+		writer.Submit(settings.Path, snapshot);
+		writer.Flush();
+	}
+
+	return finished;
+}
+
+void TraceTiles(int first_tile, int count, int spp, int thread_count)
+{
+	RT_PROFILE_ZONE("TraceTiles");
+
+	SetRenderScale(1.0f);
+	const uint32_t generation = g_RenderGeneration.load();
+	s_PassDeterministicSampling = g_DeterministicSampling.load();
+	s_PassRecordAOVs = false;
+
+	ParallelFor(count, glm::max(1, glm::min(thread_count, count)), [&](int t)
+	{
+		const uint tile = static_cast<uint>(first_tile + t);
+
+		if (tile >= g_TileCount)
+		{
+			return;
+		}
+
+		const int x = (tile % g_TileCountX) * TILE_SIZE;
+		const int y = (tile / g_TileCountX) * TILE_SIZE;
+		const int sizex = glm::min(static_cast<int>(TILE_SIZE), static_cast<int>(g_Width) - x);
+		const int sizey = glm::min(static_cast<int>(TILE_SIZE), static_cast<int>(g_Height) - y);
+
+		for (int j = y; j < y + sizey; j++)
+		{
+			std::fill(g_AccumulationBuffer.begin() + j * g_Width + x, g_AccumulationBuffer.begin() + j * g_Width + x + sizex, glm::vec3(0.0f));
+			std::fill(g_SampleCounts.begin() + j * g_Width + x, g_SampleCounts.begin() + j * g_Width + x + sizex, 0u);
+		}
+
+		for (int rendered = 0; rendered < spp;)
+		{
+			const int samples = GetPassSamples(static_cast<uint32_t>(rendered), spp);
+			TraceTile(x, y, sizex, sizey, samples, generation);
+			rendered += samples;
+		}
+	});
+}
+
+void ResolveScene(int thread_count)
+{
+	ResolveAccumulation(thread_count);
+}
+
+static void ProgressiveRendererFunction()
+{
+	RT_PROFILE_THREAD("Renderer Thread");
+
+	// This thread resolves the tiles (see TracePipelinedPass)
+	s_TilesWritePixels.store(false);
+	s_AOVsValid = false;
+
+	while (true)
+	{
+		uint32_t generation = 0;
+		bool first_pass = false;
+		float target_frame_time = 0.0f;
+		bool resolve = false;
+		bool resolve_tiles = false;
+		bool reprojection = false;
+		bool record_aovs = false;
+		std::string export_path;
+		RayTracer::DenoiserSettings denoiser;
+		DisplayChannel channel = DisplayChannel::Beauty;
+
+		// The view that was rendered before a reset, reprojected into the new one unless the samples are of another integrator
+		bool reset = false;
+		bool clear = false;
+		Camera previous_camera = g_SceneCamera;
+		int previous_width = static_cast<int>(g_RenderWidth.load());
+		int previous_height = static_cast<int>(g_RenderHeight.load());
+
+		{
+			std::unique_lock<std::mutex> lock(s_RendererMutex);
+
+			// No trace threads are running here, so the camera and the render scale can be changed safely
+			while (true)
+			{
+				if (s_RendererQuit)
+				{
+					return;
+				}
+
+				if (s_ResolvePending || !s_AOVExportPath.empty())
+				{
+					s_ResolvePending = false;
+					export_path.swap(s_AOVExportPath);
+					resolve = true;
+					break;
+				}
+
+				if (s_IntegratorPending)
+				{
+					g_Integrator = s_Integrator;
+					s_IntegratorPending = false;
+					reset = true;
+					clear = true;
+					break;
+				}
+
+				if (s_CameraPending)
+				{
+					g_SceneCamera = s_PendingCamera;
+					s_CameraPending = false;
+					s_LastCameraChange = std::chrono::steady_clock::now();
+					SetRenderScale(s_DynamicResolution.Enabled ? s_MovingScale : 1.0f);
+					reset = true;
+					break;
+				}
+
+				// Once the camera has been idle for a while, step the resolution back up to the full size
+				const bool idle = std::chrono::steady_clock::now() - s_LastCameraChange > std::chrono::duration<float>(s_DynamicResolution.IdleDelay);
+
+				if (s_RenderScale < 1.0f && idle && s_RenderedSamples.load() >= RAMP_UP_SAMPLES)
+				{
+					SetRenderScale(s_DynamicResolution.Enabled ? glm::min(s_RenderScale * 1.5f, 1.0f) : 1.0f);
+					g_RenderGeneration++;
+					reset = true;
+					break;
+				}
+
+				if (static_cast<int>(s_RenderedSamples.load()) < s_TargetSPP)
+				{
+					break;
+				}
+
+				// Sleep once the target sample count is reached, but wake up to check the idle time
+				s_RendererCondition.wait_for(lock, std::chrono::milliseconds(50));
+			}
+
+			generation = g_RenderGeneration.load();
+			first_pass = reset || s_RenderedSamples.load() == 0;
+			target_frame_time = s_DynamicResolution.TargetFrameTime;
+			denoiser = s_DenoiserSettings;
+			channel = s_DisplayChannel;
+			s_ActiveTonemap = s_TonemapSettings;
+
+			// The denoised image is only shown once a pass has finished, a first pass shows its noisy tiles until then. The camera
+			// cancels the passes while it moves, so they are all first passes and the display follows it instead of freezing
+			resolve_tiles = channel == DisplayChannel::Beauty && (!denoiser.Enabled || first_pass);
+
+			// The passes record the AOVs whenever something reads them
+			reprojection = g_TemporalReprojection.load();
+			record_aovs = g_RecordAOVs.load() || reprojection || denoiser.Enabled || channel != DisplayChannel::Beauty;
+		}
+
+		// Only the displayed image has to be updated
+		if (resolve)
+		{
+			// The AOVs are read now but the passes since the last reset didn't record them
+			if ((record_aovs || !export_path.empty()) && !s_AOVsValid)
+			{
+				TraceAOVs(THREAD_SPAWN_COUNT);
+				s_AOVsValid = true;
+			}
+
+			if (!export_path.empty())
+			{
+				WriteAOVs(export_path);
+			}
+
+			ResolveOutput(channel, denoiser, THREAD_SPAWN_COUNT);
+			continue;
+		}
+
+		// Done unlocked so that SetSceneCamera doesn't block the main thread, a camera change in the meantime cancels the pass below
+		const bool reproject = reset && !clear && reprojection;
+
+		if (reproject)
+		{
+			// Traces the AOVs of the new view
+			ReprojectAccumulation(previous_camera, previous_width, previous_height, THREAD_SPAWN_COUNT);
+			PublishPixels();
+			s_AOVsValid = true;
+		}
+
+		else if (reset)
+		{
+			// Every pixel starts over, so the pass records all the AOVs. A clear keeps the view and its AOVs
+			ResetAccumulation();
+			s_AOVsValid = record_aovs || (clear && s_AOVsValid);
+		}
+
+		// They were turned on since the last reset, the pixels that already have samples won't record them
+		if (record_aovs && !s_AOVsValid)
+		{
+			if (s_RenderedSamples.load() > 0)
+			{
+				TraceAOVs(THREAD_SPAWN_COUNT);
+			}
+
+			s_AOVsValid = true;
+		}
+
+		// The reprojection already traced the AOVs of the new view, there is no need to wait for the pass
+		if (reproject && channel != DisplayChannel::Beauty)
+		{
+			ShowAOV(channel, THREAD_SPAWN_COUNT);
+			PublishPixels();
+		}
+
+		bool finished = TracePipelinedPass(GetPassSamples(s_RenderedSamples.load(), s_TargetSPP), THREAD_SPAWN_COUNT, generation, resolve_tiles, record_aovs);
+
+		if (finished && (!resolve_tiles || denoiser.Enabled))
+		{
+			ResolveOutput(channel, denoiser, THREAD_SPAWN_COUNT);
+		}
+
+		// A cancelled pass shows the AOVs it recorded, so that an AOV channel follows a moving camera
+		else if (!finished && channel != DisplayChannel::Beauty)
+		{
+			ShowAOV(channel, THREAD_SPAWN_COUNT);
+			PublishPixels();
+		}
+
+		if (finished && static_cast<int>(s_RenderedSamples.load()) >= s_TargetSPP)
+		{
+			RenderEvent e;
+			e.Type = RenderEventType::RenderFinished;
+			e.Samples = s_RenderedSamples.load();
+			e.Generation = generation;
+			PostRenderEvent(e);
+		}
+
+		/*
+		The first pass after a camera change is the one that has to fit in the frame time budget.
+		Its cost is proportional to the pixel count, so the scale that would have hit the target is scale * sqrt(target / time)
+		*/
+		if (finished && first_pass)
+		{
+			std::lock_guard<std::mutex> lock(s_RendererMutex);
+			const float time = glm::max(s_LastPassTime.load(), 0.01f);
+			const float ideal_scale = s_RenderScale * glm::sqrt(target_frame_time / time);
+
+			s_MovingScale = glm::clamp(glm::mix(s_MovingScale, ideal_scale, 0.5f), s_DynamicResolution.MinScale, 1.0f);
+		}
+	}
+}
+
+void StartProgressiveRenderer(int target_spp)
+{
+	s_TargetSPP = target_spp;
+	s_LastCameraChange = std::chrono::steady_clock::now();
+	UpdateSceneBVH();
+	g_ThreadPool.Start();
+	s_RendererThread = std::thread(ProgressiveRendererFunction);
+}
+
+void StopProgressiveRenderer()
+{
+	{
+		std::lock_guard<std::mutex> lock(s_RendererMutex);
+		s_RendererQuit = true;
+		g_RenderGeneration++;
+	}
+
+	s_RendererCondition.notify_all();
+
+	if (s_RendererThread.joinable())
+	{
+		s_RendererThread.join();
+	}
+
+	s_TilesWritePixels.store(true);
+}
+
+uint32_t SetSceneCamera(const Camera& camera)
+{
+	uint32_t generation = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(s_RendererMutex);
+		s_PendingCamera = camera;
+		s_CameraPending = true;
+
+		// Cancels the tiles that are being rendered
+		generation = ++g_RenderGeneration;
+	}
+
+	s_RendererCondition.notify_all();
+	return generation;
+}
+
+RenderStatistics GetRenderStatistics()
+{
+	RenderStatistics stats;
+	stats.Generation = g_RenderGeneration.load();
+	stats.Samples = s_RenderedSamples.load();
+	stats.Passes = s_RenderedPasses.load();
+	stats.TargetSamples = s_TargetSPP;
+	stats.LastPassTime = s_LastPassTime.load();
+	stats.FirstTileGeneration = s_FirstTileGeneration.load();
+	stats.FirstTileTime = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(s_FirstTileTime.load()));
+	stats.RenderScale = s_DisplayedScale.load();
+	stats.RenderWidth = g_RenderWidth.load();
+	stats.RenderHeight = g_RenderHeight.load();
+	stats.ReprojectedFraction = s_ReprojectedFraction.load();
+	stats.ReprojectionTime = s_ReprojectionTime.load();
+	stats.DenoiseTime = s_DenoiseTime.load();
+	stats.TonemapTime = s_TonemapTime.load();
+	return stats;
+}
+
+void SetDynamicResolution(const DynamicResolutionSettings& settings)
+{
+	std::lock_guard<std::mutex> lock(s_RendererMutex);
+	s_DynamicResolution = settings;
+	s_MovingScale = glm::clamp(s_MovingScale, settings.MinScale, 1.0f);
+}
+
+DynamicResolutionSettings GetDynamicResolution()
+{
+	std::lock_guard<std::mutex> lock(s_RendererMutex);
+	return s_DynamicResolution;
+}
+
+void SetDenoiserSettings(const RayTracer::DenoiserSettings& settings)
+{
+	{
+		std::lock_guard<std::mutex> lock(s_RendererMutex);
+		s_DenoiserSettings = settings;
+		s_ResolvePending = true;
+	}
+
+	s_RendererCondition.notify_all();
+}
+
+RayTracer::DenoiserSettings GetDenoiserSettings()
+{
+	std::lock_guard<std::mutex> lock(s_RendererMutex);
+	return s_DenoiserSettings;
+}
+
+void SetTonemapSettings(const RayTracer::TonemapSettings& settings)
+{
+	{
+		std::lock_guard<std::mutex> lock(s_RendererMutex);
+		s_TonemapSettings = settings;
+		s_ResolvePending = true;
+	}
+
+	s_RendererCondition.notify_all();
+}
+
+RayTracer::TonemapSettings GetTonemapSettings()
+{
+	std::lock_guard<std::mutex> lock(s_RendererMutex);
+	return s_TonemapSettings;
+}
+
+void SetIntegrator(Integrator integrator)
+{
+	{
+		std::lock_guard<std::mutex> lock(s_RendererMutex);
+		s_Integrator = integrator;
+		s_IntegratorPending = true;
+
+		// Cancels the tiles that are being rendered
+		++g_RenderGeneration;
+	}
+
+	s_RendererCondition.notify_all();
+}
+
+Integrator GetIntegrator()
+{
+	std::lock_guard<std::mutex> lock(s_RendererMutex);
+	return s_Integrator;
+}
+
+void SetDisplayChannel(DisplayChannel channel)
+{
+	{
+		std::lock_guard<std::mutex> lock(s_RendererMutex);
+		s_DisplayChannel = channel;
+		s_ResolvePending = true;
+	}
+
+	s_RendererCondition.notify_all();
+}
+
+DisplayChannel GetDisplayChannel()
+{
+	std::lock_guard<std::mutex> lock(s_RendererMutex);
+	return s_DisplayChannel;
+}
+
+void ExportAOVs(const std::string& path_prefix)
+{
+	{
+		std::lock_guard<std::mutex> lock(s_RendererMutex);
+		s_AOVExportPath = path_prefix;
+	}
+
+	s_RendererCondition.notify_all();
+}
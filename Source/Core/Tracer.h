@@ -0,0 +1,803 @@
+#pragma once
+
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <glm/glm.hpp>
+
+#include "Denoiser.h"
+#include "Tonemap.h"
+#include "Checkpoint.h"
+#include "ThreadPool.h"
+
+#define THREAD_SPAWN_COUNT 4
+
+// Threads that can run a pass : the pool's workers and the thread that waits for it. Passes use THREAD_SPAWN_COUNT by default
+inline int GetMaxThreadCount()
+{
+	return std::max(static_cast<int>(std::thread::hardware_concurrency()), THREAD_SPAWN_COUNT);
+}
+
+typedef uint32_t uint;
+typedef unsigned char byte;
+typedef double floatp; // float precision
+
+// Helpers
+struct i8vec2
+{
+	uint8_t x, y;
+};
+
+struct i16vec2
+{
+	uint16_t x, y;
+};
+
+class RGB
+{
+	public :
+	
+	RGB(byte R, byte G, byte B)
+	{
+		r = R;
+		g = G;
+		b = B;
+	}
+
+	RGB() : r(0), g(0), b(0)
+	{}
+
+	byte r;
+	byte g;
+	byte b;
+};
+
+struct RayHitRecord
+{
+	glm::vec3 Point;
+	glm::vec3 Normal;
+	float T = 0.0f; 
+	bool Inside = false;
+};
+
+// Needs to be 16:9 aspect ratio
+// 1024, 576
+const uint g_Width = 1024;
+const uint g_Height = 576;
+extern byte g_PixelData[g_Width * g_Height * 4]; // RGBA8, the alpha is always 255
+
+// Tiles are the unit of work handed to the trace threads
+const uint TILE_SIZE = 32;
+const uint g_TileCountX = (g_Width + TILE_SIZE - 1) / TILE_SIZE;
+const uint g_TileCountY = (g_Height + TILE_SIZE - 1) / TILE_SIZE;
+const uint g_TileCount = g_TileCountX * g_TileCountY;
+
+// Render time of every tile and the total busy time of every trace thread (in milliseconds)
+// A negative tile time means that the tile hasn't finished rendering yet
+extern std::vector<std::atomic<float>> g_TileRenderTimes;
+extern std::vector<std::atomic<float>> g_ThreadRenderTimes;
+
+// Utility 
+const double _INFINITY = std::numeric_limits<double>::infinity();
+const double PI = 3.14159265354;
+
+/*
+A PCG32 generator (https://www.pcg-random.org/). 
+Every thread has its own generator so that the trace threads don't race on the generator state
+*/
+struct RandomState
+{
+	uint64_t State = 0x853c49e6748fea9bULL;
+	uint64_t Increment = 0xda3e39cb94b95bdbULL;
+};
+
+inline RandomState& GetRandomState()
+{
+	thread_local RandomState state;
+	return state;
+}
+
+inline uint32_t RandomUint()
+{
+	RandomState& rng = GetRandomState();
+	uint64_t old = rng.State;
+	rng.State = old * 6364136223846793005ULL + rng.Increment;
+
+	uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+	uint32_t rot = static_cast<uint32_t>(old >> 59u);
+	return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+}
+
+inline void SeedRandom(uint64_t seed, uint64_t sequence = 0)
+{
+	RandomState& rng = GetRandomState();
+	rng.State = 0;
+	rng.Increment = (sequence << 1u) | 1u;
+	RandomUint();
+	rng.State += seed;
+	RandomUint();
+}
+
+/*
+Seeds the calling thread's generator from the pixel and the sample index.
+The sample sequence of a pixel then doesn't depend on the thread that renders it or on the order the tiles are rendered in
+*/
+inline void SeedRandomForSample(uint32_t pixel, uint32_t sample, uint32_t frame_seed)
+{
+	SeedRandom((static_cast<uint64_t>(frame_seed) << 32) | sample, pixel);
+}
+
+// Returns a float in [0, 1)
+inline double RandomFloat() 
+{
+	return (RandomUint() >> 8) * (1.0f / 16777216.0f);
+}
+
+inline float RandomFloat(float min, float max)
+{
+	return min + (max - min) * RandomFloat();
+}
+
+/* Functions */
+
+inline RGB ToRGB(const glm::ivec3& v)
+{
+	RGB rgb;
+	glm::ivec3 val = v;
+
+	val.r = glm::clamp(val.r, 0, 255);
+	val.g = glm::clamp(val.g, 0, 255);
+	val.b = glm::clamp(val.b, 0, 255);
+
+	rgb.r = static_cast<byte>(val.r);
+	rgb.g = static_cast<byte>(val.g);
+	rgb.b = static_cast<byte>(val.b);
+
+	return rgb;
+}
+
+inline RGB ToRGB(const glm::vec3& v)
+{
+	glm::vec3 val = v;
+	RGB rgb;
+
+	glm::ivec3 _col = val;
+
+	_col.r = glm::clamp(_col.r, 0, 255);
+	_col.g = glm::clamp(_col.g, 0, 255);
+	_col.b = glm::clamp(_col.b, 0, 255);
+
+	rgb.r = static_cast<byte>(_col.r);
+	rgb.g = static_cast<byte>(_col.g);
+	rgb.b = static_cast<byte>(_col.b);
+
+	return rgb;
+}
+
+inline RGB ToRGBVec3_01(const glm::vec3& v)
+{
+	glm::vec3 val = v;
+	RGB rgb;
+
+	val.x = v.x * 255.0f;
+	val.y = v.y * 255.0f;
+	val.z = v.z * 255.0f;
+
+	glm::ivec3 _col = val;
+
+	_col.r = glm::clamp(_col.r, 0, 255);
+	_col.g = glm::clamp(_col.g, 0, 255);
+	_col.b = glm::clamp(_col.b, 0, 255);
+
+	rgb.r = static_cast<byte>(_col.r);
+	rgb.g = static_cast<byte>(_col.g);
+	rgb.b = static_cast<byte>(_col.b);
+
+	return rgb;
+}
+
+inline glm::vec3 Lerp(const glm::vec3& v1, const glm::vec3& v2, float t)
+{
+	return (1.0f - t) * v1 + t * v2;
+}
+
+inline glm::vec3 ConvertTo0_1Range(const glm::vec3& v)
+{
+	return 0.5f * (v + 1.0f);
+}
+
+/* Pixel putter and getter functions */
+
+inline void PutPixel(const glm::ivec2& loc, const RGB& col) noexcept
+{
+	if (loc.x >= g_Width || loc.y >= g_Height) { return; }
+
+	uint _loc = (loc.x + loc.y * g_Width) * 4;
+	g_PixelData[_loc + 0] = col.r;
+	g_PixelData[_loc + 1] = col.g;
+	g_PixelData[_loc + 2] = col.b;
+	g_PixelData[_loc + 3] = 255;
+}
+
+inline RGB GetPixel(const glm::ivec2& loc)
+{
+	RGB col;
+	uint _loc = (loc.x + loc.y * g_Width) * 4;
+
+	col.r = g_PixelData[_loc + 0];
+	col.g = g_PixelData[_loc + 1];
+	col.b = g_PixelData[_loc + 2];
+
+	return col;
+}
+
+// g_PixelData without the alpha channel (for the image writers)
+inline std::vector<byte> GetPixelDataRGB()
+{
+	std::vector<byte> rgb(g_Width * g_Height * 3);
+
+	for (uint i = 0; i < g_Width * g_Height; i++)
+	{
+		rgb[i * 3 + 0] = g_PixelData[i * 4 + 0];
+		rgb[i * 3 + 1] = g_PixelData[i * 4 + 1];
+		rgb[i * 3 + 2] = g_PixelData[i * 4 + 2];
+	}
+
+	return rgb;
+}
+
+/* Ray Tracing and Rendering Stuff Begins Here */
+
+// Ray Tracing Constants
+
+/* Helper Classes */
+
+class Ray
+{
+public:
+
+	Ray(const glm::vec3& origin, const glm::vec3& direction) :
+		m_Origin(origin), m_Direction(direction) 
+	{
+		//
+	}
+
+	const glm::vec3& GetOrigin() const noexcept
+	{
+		return m_Origin;
+	}
+
+	const glm::vec3& GetDirection() const noexcept
+	{
+		return m_Direction;
+	}
+
+	glm::vec3 GetAt(floatp scale) const noexcept
+	{
+		return m_Origin + (m_Direction * glm::vec3(scale));
+	}
+
+private:
+
+	glm::vec3 m_Origin;
+	glm::vec3 m_Direction;
+};
+
+enum class Material
+{
+	Glass = 0,
+	Diffuse,
+	Metal,
+	FuzzyMetal,
+	Emissive // Only emits, Color is the radiance and can be above 1 (the sky is at most 1)
+};
+
+class Sphere
+{
+public :
+
+	glm::vec3 Center;
+	glm::vec3 Color;
+	float Radius;
+	Material SphereMaterial;
+	float FuzzLevel;
+	int Texture = -1; // Index into g_TextureCache, multiplies the color. Mapped in latitude and longitude around the center
+
+	Sphere(const glm::vec3& center, const glm::vec3& color, float radius, Material mat, float fuzz = 0.0f) :
+		Center(center),
+		Color(color),
+		Radius(radius),
+		SphereMaterial(mat),
+		FuzzLevel(fuzz)
+	{
+
+	}
+
+	Sphere() :
+		Center(glm::vec3(0.0f)),
+		Color(glm::vec3(0.0f)),
+		Radius(0.0f),
+		SphereMaterial(Material::Diffuse),
+		FuzzLevel(0.0f)
+	{
+
+	}
+	// The color in the [0, 1] range, some of the scene colors are specified in the [0, 255] range
+	inline glm::vec3 GetAlbedo() const
+	{
+		const bool byte_range = Color.r > 1.0f || Color.g > 1.0f || Color.b > 1.0f;
+		return glm::clamp(byte_range ? Color / 255.0f : Color, glm::vec3(0.0f), glm::vec3(1.0f));
+	}
+
+	inline glm::vec3 GetEmission() const
+	{
+		return SphereMaterial == Material::Emissive ? Color : glm::vec3(0.0f);
+	}
+};
+
+inline bool PointIsInSphere(const glm::vec3& point, float radius)
+{
+	return ((point.x * point.x) + (point.y * point.y) + (point.z * point.z)) < (radius * radius);
+}
+
+inline glm::vec3 GeneratePointInUnitSphere()
+{
+	glm::vec3 ReturnVal;
+
+	ReturnVal.x = RandomFloat(-1.0f, 1.0f);
+	ReturnVal.y = RandomFloat(-1.0f, 1.0f);
+	ReturnVal.z = RandomFloat(-1.0f, 1.0f);
+
+	while (!PointIsInSphere(ReturnVal, 1.0f))
+	{
+		ReturnVal.x = RandomFloat(-1.0f, 1.0f);
+		ReturnVal.y = RandomFloat(-1.0f, 1.0f);
+		ReturnVal.z = RandomFloat(-1.0f, 1.0f);
+	}
+
+	return ReturnVal;
+}
+
+class Camera
+{
+public:
+
+	Camera(const glm::vec3& lookfrom, const glm::vec3& lookat, const glm::vec3& up, 
+		float fov) : m_FOV(fov)
+	{
+		float theta = glm::radians(fov);
+		float H = glm::tan(theta / 2.0f);
+
+		m_ViewportHeight = 2.0f * H;
+		m_ViewportWidth = m_ViewportHeight * m_AspectRatio;
+
+		auto w = glm::normalize(lookfrom - lookat);
+		auto u = glm::normalize(glm::cross(up, w));
+		auto v = glm::cross(w, u);
+
+		m_Origin = lookfrom;
+		m_Horizontal = m_ViewportWidth * u;
+		m_Vertical = m_ViewportHeight * v;
+		m_BottomLeft = m_Origin - (m_Horizontal / 2.0f) - (m_Vertical / 2.0f) - w;
+
+		// Maps (u, v, 1) to the ray direction of GetRay, the inverse is used to project points back to the screen
+		m_Projection = glm::mat3(m_Horizontal, m_Vertical, m_BottomLeft - m_Origin);
+		m_InverseProjection = glm::inverse(m_Projection);
+	}
+
+	inline Ray GetRay(float u, float v) const 
+	{
+		Ray ray(m_Origin, m_BottomLeft + (m_Horizontal * u) + (v * m_Vertical) - m_Origin);
+		return ray;
+	}
+
+	// Returns false if the point is behind the camera, uv is in the [0, 1] range when the point is on the screen
+	inline bool Project(const glm::vec3& point, glm::vec2& uv) const
+	{
+		glm::vec3 p = m_InverseProjection * (point - m_Origin);
+
+		if (p.z <= 0.0f)
+		{
+			return false;
+		}
+
+		uv = glm::vec2(p.x, p.y) / p.z;
+		return true;
+	}
+
+	inline const glm::vec3& GetOrigin() const { return m_Origin; }
+
+	// Angle between the rays of neighbouring pixels at the center of an image of this height
+	inline float GetPixelSpread(uint height) const { return m_ViewportHeight / (float)height; }
+
+private :
+	glm::vec3 m_Origin = glm::vec3(0.0f);
+	float m_AspectRatio = 16.0f / 9.0f; // Window aspect ratio. Easier to keep it as 16:9
+	float m_FocalLength = 1.0f;
+
+	// Viewport stuff
+	float m_ViewportHeight;
+	float m_ViewportWidth;
+	glm::vec3 m_Horizontal;
+	glm::vec3 m_Vertical;
+	glm::vec3 m_BottomLeft;
+	glm::mat3 m_Projection;
+	glm::mat3 m_InverseProjection;
+
+	float m_FOV;
+};
+
+inline RGB GetGradientColorAtRay(const Ray& ray)
+{
+	const glm::vec3 ray_direction = ray.GetDirection();
+	glm::vec3 v = Lerp(glm::vec3(255.0f, 255.0f, 255.0f), glm::vec3(128.0f, 178.0f, 255.0f), ray_direction.y * 1.8f);
+
+	return ToRGB(glm::ivec3(v));
+}
+
+// Only finds the distance T of the hit, the point and normal are computed with GetSphereHitRecord once the closest hit is known
+inline bool RaySphereIntersectionDistance(const Sphere& sphere, const Ray& ray, float tmin, float tmax, float& t)
+{
+	// p(t) = t²b⋅b+2tb⋅(A−C)+(A−C)⋅(A−C)−r² = 0
+	// The discriminant of this equation tells us the number of possible solutions
+	// we calculate that discriminant of the equation 
+
+	glm::vec3 oc = ray.GetOrigin() - sphere.Center;
+	float A = glm::dot(ray.GetDirection(), ray.GetDirection());
+	float B = 2.0 * glm::dot(oc, ray.GetDirection());
+	float C = dot(oc, oc) - sphere.Radius * sphere.Radius;
+	float Discriminant = B * B - 4 * A * C;
+	
+	if (Discriminant < 0)
+	{
+		return false;
+	}
+
+	else
+	{
+		// Solve the quadratic equation and
+		// find t (T is the distance from the ray origin to the center of the sphere)
+		float root = (-B - glm::sqrt(Discriminant)) / (2.0f * A); // T
+
+		if (root < tmin || root > tmax)
+		{
+			root = (-B + glm::sqrt(Discriminant)) / (2.0f * A);
+
+			if (root < tmin || root > tmax)
+			{
+				return false;
+			}
+		}
+
+		// The root was found successfully 
+		t = root;
+		return true;
+	}
+}
+
+inline void GetSphereHitRecord(const Sphere& sphere, const Ray& ray, float t, RayHitRecord& hit_record)
+{
+	hit_record.T = t;
+	hit_record.Point = ray.GetAt(t);
+
+	// TODO ! : CHECK THIS! 
+	// SHOULD THE RADIUS BE MULTIPLIED HERE?
+	hit_record.Normal = (hit_record.Point - sphere.Center) / sphere.Radius;
+	hit_record.Inside = false;
+	
+	if (glm::dot(ray.GetDirection(), hit_record.Normal) > 0.0f)
+	{
+		hit_record.Normal = -hit_record.Normal;
+		hit_record.Inside = true;
+	}
+}
+
+inline bool RaySphereIntersectionTest(const Sphere& sphere, const Ray& ray, float tmin, float tmax, RayHitRecord& hit_record) 
+{
+	float t;
+
+	if (!RaySphereIntersectionDistance(sphere, ray, tmin, tmax, t))
+	{
+		return false;
+	}
+
+	GetSphereHitRecord(sphere, ray, t, hit_record);
+	return true;
+}
+
+extern std::vector<Sphere> Spheres;
+extern Camera g_SceneCamera;
+
+// When set, every sample is seeded from its pixel and sample index so that renders are reproducible. Read when a pass starts
+extern std::atomic<bool> g_DeterministicSampling;
+extern uint32_t g_FrameSeed;
+
+const int SPP = 100;
+const int RAY_DEPTH = 10;
+
+// Tests every sphere, the reference for IntersectScene
+bool IntersectSceneSpheres(const Ray& ray, float tmin, float tmax, RayHitRecord& closest_hit_rec, Sphere& sphere);
+
+// Closest hit through the scene BVH (see UpdateSceneBVH), index is the index of the hit sphere in Spheres
+bool IntersectScene(const Ray& ray, float tmin, float tmax, RayHitRecord& closest_hit_rec, int& index);
+
+// Whether anything is hit between tmin and tmax, stops at the first hit it finds. For shadow and visibility rays
+bool IntersectSceneAny(const Ray& ray, float tmin, float tmax);
+
+// The first surface a camera ray hit, for the AOVs. The defaults are those of a ray that missed
+struct FirstHit
+{
+	glm::vec3 Albedo = glm::vec3(1.0f);
+	glm::vec3 Normal = glm::vec3(0.0f);
+	float Depth = static_cast<float>(_INFINITY); // Distance from the camera origin
+	int Object = -1;
+};
+
+// first_hit, when given, is filled with the hit of ray itself
+RGB GetRayColor(const Ray& ray, int ray_depth, FirstHit* first_hit = nullptr);
+
+/*
+Radiance along a ray without clamping between bounces, in the range of GetAlbedo (a white surface under the sky is at most 1).
+With sample_lights, every diffuse and glossy vertex also samples a light (see Lights.h) and the light and the BSDF samples
+are weighted with the power heuristic, otherwise lights only contribute when a path happens to hit them.
+first_hit, when given, is filled with the hit of ray itself
+*/
+glm::vec3 GetRayRadiance(const Ray& ray, int ray_depth, bool sample_lights, FirstHit* first_hit = nullptr);
+
+enum class Integrator
+{
+	RandomWalk = 0, // GetRayColor
+	BSDFSampling, // GetRayRadiance without light sampling
+	LightSampling // GetRayRadiance with next event estimation and multiple importance sampling
+};
+
+// Only change it while nothing is rendering, SetIntegrator changes it for the progressive renderer
+extern Integrator g_Integrator;
+
+// Scales the sky in GetRayRadiance, 0 leaves only the emissive spheres (only change it while nothing is rendering)
+extern float g_SkyIntensity;
+
+/*
+Leaves the elements of a vector unconstructed (they have to be trivial), so that the pages of a large buffer are only
+placed once it is first written, on the NUMA node of the thread that writes them
+*/
+template <typename T>
+struct FirstTouchAllocator : std::allocator<T>
+{
+	template <typename U>
+	struct rebind { typedef FirstTouchAllocator<U> other; };
+
+	FirstTouchAllocator() = default;
+
+	template <typename U>
+	FirstTouchAllocator(const FirstTouchAllocator<U>&) {}
+
+	template <typename U>
+	void construct(U*)
+	{
+		static_assert(std::is_trivially_copyable<U>::value && std::is_trivially_destructible<U>::value, "FirstTouchAllocator needs trivial elements");
+	}
+
+	template <typename U, typename... Args>
+	void construct(U* p, Args&&... args)
+	{
+		::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+	}
+};
+
+template <typename T>
+using FramebufferVector = std::vector<T, FirstTouchAllocator<T>>;
+
+// Sum of the samples and the sample count of every pixel, ResetAccumulation (or InitializeFramebuffer) writes them first
+extern FramebufferVector<glm::vec3> g_AccumulationBuffer;
+extern FramebufferVector<uint32_t> g_SampleCounts;
+
+/*
+First hit AOVs (arbitrary output variables) of every pixel, recorded by the tracer from the first sample of the pixel
+after a reset (see g_RecordAOVs), not per sample. Every channel is a separate plane with the same layout as
+g_AccumulationBuffer. A ray that missed has a depth of _INFINITY, a zero normal, a white albedo and an object id of -1
+*/
+struct AOVBuffers
+{
+	std::vector<float> AlbedoR, AlbedoG, AlbedoB;
+	std::vector<float> NormalX, NormalY, NormalZ;
+	std::vector<float> Depth; // Distance from the camera origin
+	std::vector<float> ObjectID; // Index into Spheres
+
+	AOVBuffers(size_t size) : AlbedoR(size, 1.0f), AlbedoG(size, 1.0f), AlbedoB(size, 1.0f), NormalX(size), NormalY(size), NormalZ(size),
+		Depth(size, static_cast<float>(_INFINITY)), ObjectID(size, -1.0f)
+	{
+
+	}
+
+	inline glm::vec3 GetAlbedo(uint pixel) const { return glm::vec3(AlbedoR[pixel], AlbedoG[pixel], AlbedoB[pixel]); }
+	inline glm::vec3 GetNormal(uint pixel) const { return glm::vec3(NormalX[pixel], NormalY[pixel], NormalZ[pixel]); }
+};
+
+extern AOVBuffers g_AOVs;
+
+// What is shown in g_PixelData
+enum class DisplayChannel
+{
+	Beauty,
+	Albedo,
+	Normal,
+	Depth,
+	ObjectID
+};
+
+// When set, the accumulated samples of the previous view are reprojected into the new one when the camera moves
+extern std::atomic<bool> g_TemporalReprojection;
+
+/*
+When set, the passes record g_AOVs. Read when a pass starts. The progressive renderer also records them while the denoiser,
+temporal reprojection or an AOV display channel needs them
+*/
+extern std::atomic<bool> g_RecordAOVs;
+
+// Incremented whenever the accumulated image becomes invalid (eg : the camera moved), tiles of older generations are cancelled
+extern std::atomic<uint32_t> g_RenderGeneration;
+
+// Set by the progressive renderer whenever it published a new image (see AcquireDisplayImage), cleared by the thread that uploads it
+extern std::atomic<bool> g_PixelsUpdated;
+
+/*
+The newest image published by the progressive renderer, nullptr if nothing was published since the last call. It is a copy
+of g_PixelData that isn't written until the next call, so it can be uploaded while the next tiles are traced and resolved.
+render_width x render_height is the render area of that image, g_RenderWidth and g_RenderHeight may already have changed.
+Only call it from the thread that uploads
+*/
+const byte* AcquireDisplayImage(uint& render_width, uint& render_height);
+
+enum class RenderEventType
+{
+	TileFinished, // Posted when g_PixelsUpdated gets set, so there is one per upload instead of one per tile
+	PassFinished,
+	RenderFinished, // The progressive renderer reached its target sample count
+	JobFailed
+};
+
+struct RenderEvent
+{
+	RenderEventType Type;
+	uint32_t Tile = UINT32_MAX; // UINT32_MAX when the whole image was written at once
+	uint32_t Samples = 0;
+	uint32_t Generation = 0;
+	const char* Message = nullptr; // For JobFailed, a string literal
+};
+
+// Called from the render threads (and from the thread pool) as the render progresses, it has to be thread safe and quick
+typedef void (*RenderEventCallback)(const RenderEvent& e);
+void SetRenderEventCallback(RenderEventCallback callback);
+void PostRenderEvent(const RenderEvent& e);
+
+// Sets g_PixelsUpdated and posts a TileFinished event if it wasn't set yet
+void MarkPixelsUpdated(uint32_t tile = UINT32_MAX);
+
+// The area of g_PixelData that is rendered to (from the bottom left corner), smaller than the image with dynamic resolution
+extern std::atomic<uint> g_RenderWidth;
+extern std::atomic<uint> g_RenderHeight;
+
+/*
+While the camera moves the image is rendered at a fraction of the full size so that a 1 spp pass fits in TargetFrameTime.
+The scale is adjusted from the measured pass times and stepped back up to 1 once the camera has been idle for IdleDelay seconds
+*/
+struct DynamicResolutionSettings
+{
+	bool Enabled = true;
+	float TargetFrameTime = 16.0f; // In milliseconds
+	float MinScale = 0.25f;
+	float IdleDelay = 0.25f;
+};
+
+struct RenderStatistics
+{
+	uint32_t Generation = 0;
+	uint32_t Samples = 0; // Samples per pixel accumulated since the last reset
+	uint32_t Passes = 0;
+	int TargetSamples = 0;
+	float LastPassTime = 0.0f; // In milliseconds
+
+	// When the first tile of the generation FirstTileGeneration was finished
+	uint32_t FirstTileGeneration = 0;
+	std::chrono::steady_clock::time_point FirstTileTime;
+
+	float RenderScale = 1.0f;
+	uint32_t RenderWidth = 0;
+	uint32_t RenderHeight = 0;
+
+	// Of the last reset (camera or render scale change)
+	float ReprojectedFraction = 0.0f;
+	float ReprojectionTime = 0.0f; // In milliseconds
+
+	float DenoiseTime = 0.0f; // Of the last denoised pass, in milliseconds
+	float TonemapTime = 0.0f; // Of the last full frame conversion to g_PixelData, in milliseconds
+};
+
+// Adds `samples` samples to every pixel of the tile, returns false if the tile was cancelled
+bool TraceTile(int xstart, int ystart, int xsize, int ysize, int samples, uint32_t generation);
+
+// Returns false if the tile is outside of the render area or was cancelled
+bool TraceTileTask(uint tile, int worker, int samples, uint32_t generation);
+
+// Adds `samples` samples to every pixel, returns false if the pass was cancelled
+bool TracePass(int samples, int thread_count, uint32_t generation);
+
+// Zeroes the sums and the sample counts, every tile on the NUMA node whose workers render it (see ThreadPool)
+void ResetAccumulation();
+
+// Fills g_PixelData with white and resets the accumulation, first writing every tile from the node that renders it
+void InitializeFramebuffer();
+
+// Renders a full frame into g_PixelData, returns once every trace thread has finished
+// thread_count can be lowered (down to 1) to check that the output doesn't depend on the thread count
+void TraceScene(int spp = SPP, int thread_count = THREAD_SPAWN_COUNT);
+
+/*
+Like TraceScene, but saves the accumulation to settings.Path between passes every settings.Interval seconds.
+The checkpoints are written on a background thread, the trace threads only wait for the copy of the buffers.
+With settings.Resume the render continues from a checkpoint of the same scene and the result is identical to an uninterrupted one
+(the pass sizes only depend on the sample count, as long as spp and the thread count are the same).
+Returns false if it stopped at settings.TimeLimit before reaching spp
+*/
+bool TraceSceneCheckpointed(int spp, const RayTracer::CheckpointSettings& settings, int thread_count = THREAD_SPAWN_COUNT);
+
+/*
+Renders tiles first_tile to first_tile + count - 1 at full resolution with spp samples, replacing what was accumulated there.
+The tiles go through the same passes as in TraceScene, so with deterministic sampling the result is identical.
+Call UpdateSceneBVH first, and don't mix it with the progressive renderer
+*/
+void TraceTiles(int first_tile, int count, int spp, int thread_count = THREAD_SPAWN_COUNT);
+
+// Tonemaps the accumulation into g_PixelData, for accumulations that were filled without TracePass (restored or merged)
+void ResolveScene(int thread_count = THREAD_SPAWN_COUNT);
+
+// Hash of the spheres and the camera, to check that two renderers see the same scene
+uint64_t GetSceneHash();
+
+/*
+The progressive renderer keeps adding passes on a background thread until target_spp samples are accumulated.
+SetSceneCamera can be called from any thread, it cancels the current pass and restarts the accumulation at 1 spp.
+It returns the generation of the new accumulation.
+*/
+void StartProgressiveRenderer(int target_spp = SPP);
+void StopProgressiveRenderer();
+uint32_t SetSceneCamera(const Camera& camera);
+RenderStatistics GetRenderStatistics();
+void SetDynamicResolution(const DynamicResolutionSettings& settings);
+DynamicResolutionSettings GetDynamicResolution();
+void SetDenoiserSettings(const RayTracer::DenoiserSettings& settings);
+RayTracer::DenoiserSettings GetDenoiserSettings();
+void SetTonemapSettings(const RayTracer::TonemapSettings& settings);
+RayTracer::TonemapSettings GetTonemapSettings();
+void SetIntegrator(Integrator integrator); // Restarts the accumulation
+Integrator GetIntegrator();
+void SetDisplayChannel(DisplayChannel channel);
+DisplayChannel GetDisplayChannel();
+
+// Writes every AOV of the current view as a float PFM image (path_prefix + "Albedo.pfm"...) from the renderer thread
+void ExportAOVs(const std::string& path_prefix);
+
+// Calls function(0) to function(count - 1) on the thread pool, with at most thread_count threads (the calling one included)
+template <typename T>
+void ParallelFor(int count, int thread_count, const T& function)
+{
+	g_ThreadPool.Run(count, [&function](int i, int) { function(i); }, glm::max(thread_count, 1));
+}
+
+// Splits the rows of the render area between thread_count threads
+template <typename T>
+void ParallelForRows(int height, int thread_count, const T& function)
+{
+	ParallelFor(height, thread_count, function);
+}
\ No newline at end of file
@@ -0,0 +1,1327 @@
+/*
+Microbenchmarks for the core ray tracing kernels
+
+Usage : Ray-Tracer-Benchmark [--repetitions <n>] [--filter <name>] [--json <output.json>] [--compare <baseline.json>] [--pin-threads]
+
+Every benchmark is repeated and reports the mean, standard deviation and range of the time per operation.
+The json output is written one benchmark per line in a fixed order so that runs from different commits can be diffed,
+--compare prints the relative change against a previous json output.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <cstdio>
+
+#include "../Core/Tracer.h"
+#include "../Core/BVH.h"
+#include "../Core/Lights.h"
+#include "../Core/Environment.h"
+#include "../Core/TextureCache.h"
+#include "../Core/EventQueue.h"
+
+struct BenchmarkResult
+{
+	std::string Name;
+	uint64_t Operations = 0; // Operations per repetition
+	int Repetitions = 0;
+	double MeanNs = 0.0; // Nanoseconds per operation
+	double StdDevNs = 0.0;
+	double MinNs = 0.0;
+	double MaxNs = 0.0;
+
+	double GetThroughput() const
+	{
+		return MeanNs > 0.0 ? 1e9 / MeanNs : 0.0;
+	}
+};
+
+// Results are accumulated here so that the compiler can't remove the benchmarked code
+static volatile float s_Sink = 0.0f;
+
+static int s_Repetitions = 10;
+static std::string s_Filter;
+static std::vector<BenchmarkResult> s_Results;
+
+static bool IsSelected(const std::string& name)
+{
+	return s_Filter.empty() || name.find(s_Filter) != std::string::npos;
+}
+
+static void RunBenchmark(const std::string& name, uint64_t operations, const std::function<void()>& function, int repetitions = 0)
+{
+	if (!IsSelected(name))
+	{
+		return;
+	}
+
+	repetitions = repetitions > 0 ? repetitions : s_Repetitions;
+
+	// Warm up the caches and the branch predictors
+	function();
+
+	std::vector<double> times;
+
+	for (int r = 0; r < repetitions; r++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		function();
+		auto end = std::chrono::steady_clock::now();
+
+		times.push_back(std::chrono::duration<double, std::nano>(end - start).count() / (double)operations);
+	}
+
+	BenchmarkResult result;
+	result.Name = name;
+	result.Operations = operations;
+	result.Repetitions = repetitions;
+	result.MinNs = times[0];
+	result.MaxNs = times[0];
+
+	for (double t : times)
+	{
+		result.MeanNs += t;
+		result.MinNs = std::min(result.MinNs, t);
+		result.MaxNs = std::max(result.MaxNs, t);
+	}
+
+	result.MeanNs /= (double)repetitions;
+
+	for (double t : times)
+	{
+		result.StdDevNs += (t - result.MeanNs) * (t - result.MeanNs);
+	}
+
+	result.StdDevNs = std::sqrt(result.StdDevNs / (double)repetitions);
+
+	std::cout << std::left << std::setw(40) << name << std::right << std::fixed << std::setprecision(2)
+		<< std::setw(12) << result.MeanNs << " ns/op  +- " << std::setw(6) << (result.MeanNs > 0.0 ? 100.0 * result.StdDevNs / result.MeanNs : 0.0) << "%"
+		<< "  [" << result.MinNs << ", " << result.MaxNs << "]  "
+		<< std::setprecision(3) << result.GetThroughput() / 1e6 << " Mop/s\n";
+
+	s_Results.push_back(result);
+}
+
+/* Input generation */
+
+static std::vector<Ray> GenerateRays(size_t count)
+{
+	std::vector<Ray> rays;
+	SeedRandom(1234);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		glm::vec3 origin = glm::vec3(RandomFloat(-0.5f, 0.5f), RandomFloat(-0.5f, 0.5f), RandomFloat(0.0f, 1.0f));
+		glm::vec3 target = glm::vec3(RandomFloat(-2.0f, 2.0f), RandomFloat(-1.5f, 1.0f), -1.0f);
+		rays.emplace_back(origin, target - origin);
+	}
+
+	return rays;
+}
+
+static std::vector<Sphere> GenerateSpheres(size_t count)
+{
+	std::vector<Sphere> spheres;
+	SeedRandom(5678);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		glm::vec3 center = glm::vec3(RandomFloat(-4.0f, 4.0f), RandomFloat(-2.0f, 2.0f), RandomFloat(-8.0f, -1.0f));
+		spheres.emplace_back(center, glm::vec3(0.5f), RandomFloat(0.05f, 0.3f), Material::Diffuse);
+	}
+
+	return spheres;
+}
+
+/* Benchmarks */
+
+static void BenchmarkIntersection()
+{
+	const std::vector<Ray> rays = GenerateRays(4096);
+	const Sphere sphere(glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.5f), 0.5f, Material::Diffuse);
+
+	RunBenchmark("RaySphereIntersectionTest", rays.size() * 64, [&]()
+	{
+		RayHitRecord record;
+		float sum = 0.0f;
+
+		for (int i = 0; i < 64; i++)
+		{
+			for (auto& ray : rays)
+			{
+				sum += RaySphereIntersectionTest(sphere, ray, 0.001f, (float)_INFINITY, record) ? record.T : 0.0f;
+			}
+		}
+
+		s_Sink = s_Sink + sum;
+	});
+
+	const std::vector<Sphere> scene = Spheres;
+
+	for (size_t count : { 4, 16, 64, 256, 1024 })
+	{
+		Spheres = GenerateSpheres(count);
+		const int iterations = (int)std::max<size_t>(1, 1024 / count);
+
+		RunBenchmark("IntersectSceneSpheres/" + std::to_string(count), rays.size() * iterations, [&]()
+		{
+			RayHitRecord record;
+			Sphere hit_sphere;
+			float sum = 0.0f;
+
+			for (int i = 0; i < iterations; i++)
+			{
+				for (auto& ray : rays)
+				{
+					sum += IntersectSceneSpheres(ray, 0.001f, (float)_INFINITY, record, hit_sphere) ? record.T : 0.0f;
+				}
+			}
+
+			s_Sink = s_Sink + sum;
+		});
+
+		UpdateSceneBVH();
+
+		RunBenchmark("IntersectScene/" + std::to_string(count), rays.size() * iterations, [&]()
+		{
+			RayHitRecord record;
+			int index = -1;
+			float sum = 0.0f;
+
+			for (int i = 0; i < iterations; i++)
+			{
+				for (auto& ray : rays)
+				{
+					sum += IntersectScene(ray, 0.001f, (float)_INFINITY, record, index) ? record.T : 0.0f;
+				}
+			}
+
+			s_Sink = s_Sink + sum;
+		});
+
+		// The same rays as occlusion queries, as shadow rays were traced before with IntersectScene
+		RunBenchmark("IntersectSceneAny/" + std::to_string(count), rays.size() * iterations, [&]()
+		{
+			int hits = 0;
+
+			for (int i = 0; i < iterations; i++)
+			{
+				for (auto& ray : rays)
+				{
+					hits += IntersectSceneAny(ray, 0.001f, (float)_INFINITY) ? 1 : 0;
+				}
+			}
+
+			s_Sink = s_Sink + (float)hits;
+		});
+
+		// Shadow rays from points on the spheres to a light in the middle of them, with the closest hit as the shadow rays
+		// were traced before and with the occlusion query, which can also stop at the light
+		// The directions reach the light at T = 1
+		std::vector<Ray> shadow_rays;
+		const glm::vec3 light = glm::vec3(0.0f, 0.0f, -4.5f);
+
+		for (size_t r = 0; r < rays.size(); r++)
+		{
+			const Sphere& from = Spheres[r % Spheres.size()];
+			const glm::vec3 point = from.Center + glm::normalize(light - from.Center) * from.Radius * 1.001f;
+			shadow_rays.emplace_back(point, light - point);
+		}
+
+		RunBenchmark("ShadowRay/IntersectScene/" + std::to_string(count), shadow_rays.size() * iterations, [&]()
+		{
+			RayHitRecord record;
+			int index = -1;
+			int hits = 0;
+
+			for (int i = 0; i < iterations; i++)
+			{
+				for (auto& ray : shadow_rays)
+				{
+					hits += IntersectScene(ray, 0.001f, (float)_INFINITY, record, index) && record.T < 1.0f ? 1 : 0;
+				}
+			}
+
+			s_Sink = s_Sink + (float)hits;
+		});
+
+		RunBenchmark("ShadowRay/IntersectSceneAny/" + std::to_string(count), shadow_rays.size() * iterations, [&]()
+		{
+			int hits = 0;
+
+			for (int i = 0; i < iterations; i++)
+			{
+				for (auto& ray : shadow_rays)
+				{
+					hits += IntersectSceneAny(ray, 0.001f, 1.0f) ? 1 : 0;
+				}
+			}
+
+			s_Sink = s_Sink + (float)hits;
+		});
+	}
+
+	Spheres = scene;
+	UpdateSceneBVH();
+}
+
+/*
+Build, refit and per frame update of 100k spheres that move a little every frame, the time per operation is per sphere
+so Mop/s is millions of spheres per second. The build is also timed with 1M spheres and with different bin counts
+*/
+static void BenchmarkBVH()
+{
+	const size_t count = 100000;
+
+	if (IsSelected("BVH/Build/1M"))
+	{
+		std::vector<Sphere> spheres = GenerateSpheres(1000000);
+		RayTracer::BVH bvh;
+
+		RunBenchmark("BVH/Build/1M", spheres.size(), [&]()
+		{
+			bvh.Build(spheres, RayTracer::BVHSettings(), THREAD_SPAWN_COUNT);
+		}, 3);
+	}
+
+	std::vector<Sphere> spheres = GenerateSpheres(count);
+	std::vector<glm::vec3> velocities(count);
+
+	for (auto& e : velocities)
+	{
+		e = glm::vec3(RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f)) * 0.01f;
+	}
+
+	RayTracer::BVH bvh;
+
+	RunBenchmark("BVH/Build/100k", count, [&]()
+	{
+		bvh.Build(spheres, RayTracer::BVHSettings(), THREAD_SPAWN_COUNT);
+	}, 5);
+
+	RunBenchmark("BVH/Build/100k/1 Thread", count, [&]()
+	{
+		bvh.Build(spheres);
+	}, 5);
+
+	// Build time against tree quality, the SAH cost estimates the trace time relative to the default settings
+	for (int bins : { 4, 8, 32 })
+	{
+		const std::string name = "BVH/Build/100k/" + std::to_string(bins) + " Bins";
+		RayTracer::BVHSettings settings;
+		settings.Bins = bins;
+
+		RunBenchmark(name, count, [&]()
+		{
+			bvh.Build(spheres, settings, THREAD_SPAWN_COUNT);
+		}, 5);
+
+		if (IsSelected(name))
+		{
+			const float cost = bvh.GetBuildCost();
+			bvh.Build(spheres, RayTracer::BVHSettings(), THREAD_SPAWN_COUNT);
+			std::cout << std::fixed << std::setprecision(3) << name << " : SAH cost " << cost / bvh.GetBuildCost() << "x of 16 bins\n";
+		}
+	}
+
+	RunBenchmark("BVH/Refit/100k", count, [&]()
+	{
+		bvh.Refit(spheres, THREAD_SPAWN_COUNT);
+	});
+
+	// A frame of an animation, the spheres move and the BVH is refit (or rebuilt once it became too slow)
+	int frames = 0;
+	int rebuilds = 0;
+	float cost_ratio = 1.0f;
+	bvh.Build(spheres, RayTracer::BVHSettings(), THREAD_SPAWN_COUNT);
+
+	RunBenchmark("BVH/Update/100k", count, [&]()
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			spheres[i].Center += velocities[i];
+		}
+
+		RayTracer::BVHUpdateStatistics stats = bvh.Update(spheres, THREAD_SPAWN_COUNT);
+		rebuilds += stats.Rebuilt ? 1 : 0;
+		cost_ratio = stats.CostRatio;
+		frames++;
+	}, 100);
+
+	if (frames == 0)
+	{
+		return;
+	}
+
+	std::cout << "BVH/Update/100k : " << rebuilds << " rebuilds in " << frames << " frames (rebuild threshold " 
+		<< bvh.GetSettings().RebuildThreshold << "), last SAH cost ratio " << std::setprecision(3) << cost_ratio << "\n";
+}
+
+static void BenchmarkSampling()
+{
+	const uint64_t count = 1 << 20;
+	SeedRandom(42);
+
+	RunBenchmark("RandomFloat", count, [&]()
+	{
+		float sum = 0.0f;
+
+		for (uint64_t i = 0; i < count; i++)
+		{
+			sum += (float)RandomFloat();
+		}
+
+		s_Sink = s_Sink + sum;
+	});
+
+	RunBenchmark("GeneratePointInUnitSphere", count, [&]()
+	{
+		glm::vec3 sum = glm::vec3(0.0f);
+
+		for (uint64_t i = 0; i < count; i++)
+		{
+			sum += GeneratePointInUnitSphere();
+		}
+
+		s_Sink = s_Sink + sum.x + sum.y + sum.z;
+	});
+
+	RunBenchmark("Camera::GetRay", count, [&]()
+	{
+		glm::vec3 sum = glm::vec3(0.0f);
+
+		for (uint64_t i = 0; i < count; i++)
+		{
+			float u = (float)(i % g_Width) / (float)g_Width;
+			float v = (float)((i / g_Width) % g_Height) / (float)g_Height;
+			sum += g_SceneCamera.GetRay(u, v).GetDirection();
+		}
+
+		s_Sink = s_Sink + sum.x + sum.y + sum.z;
+	});
+}
+
+static void BenchmarkConversion()
+{
+	const uint64_t count = 1 << 20;
+	std::vector<glm::vec3> colors(4096);
+	SeedRandom(99);
+
+	for (auto& e : colors)
+	{
+		e = glm::vec3(RandomFloat(-0.1f, 1.1f), RandomFloat(-0.1f, 1.1f), RandomFloat(-0.1f, 1.1f));
+	}
+
+	RunBenchmark("ToRGB(ivec3)", count, [&]()
+	{
+		uint32_t sum = 0;
+
+		for (uint64_t i = 0; i < count; i++)
+		{
+			RGB rgb = ToRGB(glm::ivec3(colors[i & 4095] * 255.0f));
+			sum += rgb.r + rgb.g + rgb.b;
+		}
+
+		s_Sink = s_Sink + (float)sum;
+	});
+
+	RunBenchmark("ToRGB(vec3)", count, [&]()
+	{
+		uint32_t sum = 0;
+
+		for (uint64_t i = 0; i < count; i++)
+		{
+			RGB rgb = ToRGB(colors[i & 4095] * 255.0f);
+			sum += rgb.r + rgb.g + rgb.b;
+		}
+
+		s_Sink = s_Sink + (float)sum;
+	});
+
+	RunBenchmark("ToRGBVec3_01", count, [&]()
+	{
+		uint32_t sum = 0;
+
+		for (uint64_t i = 0; i < count; i++)
+		{
+			RGB rgb = ToRGBVec3_01(colors[i & 4095]);
+			sum += rgb.r + rgb.g + rgb.b;
+		}
+
+		s_Sink = s_Sink + (float)sum;
+	});
+}
+
+/*
+The fixed cost of a pass with no work in its tiles : spawning and joining THREAD_SPAWN_COUNT threads (what the passes did
+before the thread pool), handing the tiles to the pool, and a pass followed by two batches that depend on it
+*/
+static void BenchmarkThreadPool()
+{
+	const int tiles = static_cast<int>(g_TileCount);
+	std::atomic<int> counter{ 0 };
+
+	RunBenchmark("ThreadPool/Pass/Spawn Threads", 100, [&]()
+	{
+		for (int pass = 0; pass < 100; pass++)
+		{
+			std::vector<std::thread> threads;
+
+			for (int t = 0; t < THREAD_SPAWN_COUNT; t++)
+			{
+				threads.emplace_back([&counter, t, tiles]()
+				{
+					for (int tile = t; tile < tiles; tile += THREAD_SPAWN_COUNT)
+					{
+						counter.fetch_add(1, std::memory_order_relaxed);
+					}
+				});
+			}
+
+			for (auto& e : threads)
+			{
+				e.join();
+			}
+		}
+	});
+
+	RunBenchmark("ThreadPool/Pass/Pool", 1000, [&]()
+	{
+		for (int pass = 0; pass < 1000; pass++)
+		{
+			g_ThreadPool.Run(tiles, [&counter](int, int) { counter.fetch_add(1, std::memory_order_relaxed); }, THREAD_SPAWN_COUNT);
+		}
+	});
+
+	RunBenchmark("ThreadPool/Pass/Pool/Dependent Batches", 1000, [&]()
+	{
+		for (int pass = 0; pass < 1000; pass++)
+		{
+			auto trace = g_ThreadPool.Submit(tiles, [&counter](int, int) { counter.fetch_add(1, std::memory_order_relaxed); }, THREAD_SPAWN_COUNT);
+			auto resolve = g_ThreadPool.Submit(THREAD_SPAWN_COUNT, [&counter](int, int) { counter.fetch_add(1, std::memory_order_relaxed); }, 0, { trace });
+			g_ThreadPool.Wait(g_ThreadPool.Submit(1, [&counter](int, int) { counter.fetch_add(1, std::memory_order_relaxed); }, 0, { resolve }));
+		}
+	});
+
+	s_Sink = s_Sink + static_cast<float>(counter.load());
+}
+
+struct BenchmarkEvent
+{
+	uint32_t Tile;
+	uint32_t Samples;
+	uint32_t Generation;
+	const char* Message;
+};
+
+static void BenchmarkEventQueue()
+{
+	const int count = 1 << 20;
+	std::unique_ptr<RayTracer::EventQueue<BenchmarkEvent>> queue(new RayTracer::EventQueue<BenchmarkEvent>);
+
+	RunBenchmark("EventQueue/Push+Pop", count, [&]()
+	{
+		BenchmarkEvent e = {};
+
+		for (int i = 0; i < count; i++)
+		{
+			e.Tile = static_cast<uint32_t>(i);
+			queue->Push(e);
+			queue->Pop(e);
+		}
+
+		s_Sink = s_Sink + static_cast<float>(e.Tile);
+	});
+
+	// Every trace thread posts while the consumer drains the queue, like the tiles of a pass finishing on the main thread's queue
+	const int producers = THREAD_SPAWN_COUNT;
+
+	RunBenchmark("EventQueue/Producers/" + std::to_string(producers), (uint64_t)count, [&]()
+	{
+		std::atomic<int> finished{ 0 };
+		std::vector<std::thread> threads;
+
+		for (int t = 0; t < producers; t++)
+		{
+			threads.emplace_back([&, t]()
+			{
+				BenchmarkEvent e = {};
+
+				for (int i = t; i < count; i += producers)
+				{
+					e.Tile = static_cast<uint32_t>(i);
+
+					while (!queue->Push(e))
+					{
+						std::this_thread::yield();
+					}
+				}
+
+				finished.fetch_add(1, std::memory_order_release);
+			});
+		}
+
+		BenchmarkEvent e;
+		int popped = 0;
+
+		while (popped < count)
+		{
+			if (queue->Pop(e))
+			{
+				popped++;
+			}
+
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+
+		s_Sink = s_Sink + static_cast<float>(popped + finished.load());
+	});
+}
+
+static void BenchmarkFrame()
+{
+	// The trace threads use fixed seeds, so every repetition renders exactly the same frame
+	const int spp = 4;
+
+	RunBenchmark("TraceScene/" + std::to_string(spp) + "spp", (uint64_t)g_Width * g_Height * spp, [&]()
+	{
+		TraceScene(spp);
+	}, 3);
+}
+
+/*
+The same frame on 1, 2, 4... threads up to every hardware thread, run with --pin-threads to see what pinning and NUMA
+local tiles change. The efficiency is the speedup over one thread divided by the thread count
+*/
+static void BenchmarkScaling()
+{
+	const int spp = 4;
+	std::vector<int> thread_counts;
+
+	for (int threads = 1; threads < GetMaxThreadCount(); threads *= 2)
+	{
+		thread_counts.push_back(threads);
+	}
+
+	thread_counts.push_back(GetMaxThreadCount());
+	double single_thread = 0.0;
+
+	for (int threads : thread_counts)
+	{
+		const std::string name = "TraceScene/" + std::to_string(spp) + "spp/Threads/" + std::to_string(threads);
+
+		if (!IsSelected(name))
+		{
+			continue;
+		}
+
+		RunBenchmark(name, (uint64_t)g_Width * g_Height * spp, [&]()
+		{
+			TraceScene(spp, threads);
+		}, 3);
+
+		const double time = s_Results.back().MeanNs;
+		single_thread = threads == 1 ? time : single_thread;
+
+		if (single_thread > 0.0)
+		{
+			std::cout << std::fixed << std::setprecision(2) << name << " : " << single_thread / time << "x speedup, "
+				<< 100.0 * single_thread / time / threads << "% efficiency\n";
+		}
+	}
+}
+
+static double GetPSNR(const std::vector<byte>& a, const std::vector<byte>& b)
+{
+	double error = 0.0;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		error += ((double)a[i] - (double)b[i]) * ((double)a[i] - (double)b[i]);
+	}
+
+	error /= (double)a.size();
+	return error > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / error) : 99.0;
+}
+
+// Times the denoiser on a low sample count frame (ns per pixel is also ms per megapixel) and compares it against a converged frame
+static void BenchmarkDenoiser()
+{
+	const int spp = 8;
+	const std::string name = "Denoise/" + std::to_string(spp) + "spp";
+
+	if (!IsSelected(name))
+	{
+		return;
+	}
+
+	RayTracer::DenoiserSettings settings;
+	settings.Enabled = true;
+
+	// The denoiser is guided by the AOVs of the noisy frame
+	g_RecordAOVs.store(true);
+	TraceScene(SPP);
+	std::vector<byte> reference = GetPixelDataRGB();
+
+	TraceScene(spp);
+	std::vector<byte> noisy = GetPixelDataRGB();
+	g_RecordAOVs.store(false);
+
+	RunBenchmark(name, (uint64_t)g_Width * g_Height, [&]()
+	{
+		RayTracer::Denoise(settings, RayTracer::TonemapSettings(), g_Width, g_Height, THREAD_SPAWN_COUNT);
+	});
+
+	std::vector<byte> denoised = GetPixelDataRGB();
+
+	std::cout << std::fixed << std::setprecision(2) << "PSNR against " << SPP << " spp : " << GetPSNR(noisy, reference) << " dB noisy, "
+		<< GetPSNR(denoised, reference) << " dB denoised\n";
+}
+
+// Radiance of a grid of pixels of the scene camera, averaged over spp samples seeded with frame_seed
+static std::vector<glm::vec3> RenderRadiance(int width, int height, int spp, bool sample_lights, uint32_t frame_seed)
+{
+	std::vector<glm::vec3> image(width * height);
+
+	ParallelFor(height, THREAD_SPAWN_COUNT, [&](int j)
+	{
+		for (int i = 0; i < width; i++)
+		{
+			const uint32_t pixel = static_cast<uint32_t>(j * width + i);
+			glm::vec3 sum = glm::vec3(0.0f);
+
+			for (int s = 0; s < spp; s++)
+			{
+				SeedRandomForSample(pixel, static_cast<uint32_t>(s), frame_seed);
+				const Ray ray = g_SceneCamera.GetRay(((float)i + (float)RandomFloat()) / width, ((float)j + (float)RandomFloat()) / height);
+				sum += GetRayRadiance(ray, RAY_DEPTH, sample_lights);
+			}
+
+			image[pixel] = sum / (float)spp;
+		}
+	});
+
+	return image;
+}
+
+static double GetRMSE(const std::vector<glm::vec3>& a, const std::vector<glm::vec3>& b)
+{
+	double error = 0.0;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		const glm::vec3 difference = a[i] - b[i];
+		error += glm::dot(difference, difference) / 3.0;
+	}
+
+	return std::sqrt(error / (double)a.size());
+}
+
+/*
+The built in scene at night, only lit by a small light, traced with and without light sampling.
+Time per path, and the error against a converged image at the same sample count. The error falls with the square root of
+the sample count, so the squared ratio of the errors is how many times fewer samples light sampling needs for the same error.
+The mirror gets a little fuzz, a perfect mirror shows the light as a highlight smaller than a pixel which only more samples per pixel help with
+*/
+static void BenchmarkLightSampling()
+{
+	const int width = 64;
+	const int height = 36;
+	const int spp = 16;
+	const std::string bsdf_name = "GetRayRadiance/BSDF Sampling";
+	const std::string lights_name = "GetRayRadiance/Light Sampling";
+
+	if (!IsSelected(bsdf_name) && !IsSelected(lights_name))
+	{
+		return;
+	}
+
+	const std::vector<Sphere> scene = Spheres;
+	Spheres.emplace_back(glm::vec3(0.3f, 1.2f, -0.8f), glm::vec3(300.0f), 0.05f, Material::Emissive);
+	Spheres[2].FuzzLevel = 0.1f;
+	g_SkyIntensity = 0.0f;
+	UpdateSceneBVH();
+
+	const std::vector<glm::vec3> reference = RenderRadiance(width, height, 2048, true, 1);
+	std::vector<glm::vec3> bsdf, lights;
+
+	RunBenchmark(bsdf_name, (uint64_t)width * height * spp, [&]()
+	{
+		bsdf = RenderRadiance(width, height, spp, false, 2);
+	}, 3);
+
+	RunBenchmark(lights_name, (uint64_t)width * height * spp, [&]()
+	{
+		lights = RenderRadiance(width, height, spp, true, 2);
+	}, 3);
+
+	if (!bsdf.empty() && !lights.empty())
+	{
+		const double bsdf_error = GetRMSE(bsdf, reference);
+		const double lights_error = GetRMSE(lights, reference);
+
+		std::cout << std::fixed << std::setprecision(4) << "Small light, RMSE at " << spp << " spp : " << bsdf_error << " BSDF sampling, "
+			<< lights_error << " light sampling (" << std::setprecision(1) << (bsdf_error * bsdf_error) / (lights_error * lights_error)
+			<< "x fewer samples for the same error)\n";
+	}
+
+	Spheres = scene;
+	g_SkyIntensity = 1.0f;
+	UpdateSceneBVH();
+}
+
+/*
+Procedural lat-long sky of width x height with a small sun: a dim gradient from the horizon to the zenith and a disk of
+about 2 degrees, tens of thousands of times brighter, which gives most of the light
+*/
+static std::vector<float> GenerateSunSky(uint32_t width, uint32_t height, const glm::vec3& sun)
+{
+	const float sun_cos = std::cos(glm::radians(1.0f));
+	std::vector<float> rgb(static_cast<size_t>(width) * height * 3);
+
+	for (uint32_t y = 0; y < height; y++)
+	{
+		// Rows are bottom first, like the image readers return them
+		const float theta = (1.0f - (y + 0.5f) / height) * 3.14159265f;
+
+		for (uint32_t x = 0; x < width; x++)
+		{
+			const float phi = ((x + 0.5f) / width - 0.5f) * 2.0f * 3.14159265f;
+			const glm::vec3 direction = glm::vec3(std::sin(theta) * std::sin(phi), std::cos(theta), -std::sin(theta) * std::cos(phi));
+			const float up = glm::max(direction.y, 0.0f);
+			glm::vec3 color = glm::mix(glm::vec3(0.5f, 0.55f, 0.6f), glm::vec3(0.15f, 0.3f, 0.7f), up) * (direction.y > 0.0f ? 1.0f : 0.3f);
+
+			if (glm::dot(direction, sun) > sun_cos)
+			{
+				color = glm::vec3(3000.0f, 2800.0f, 2500.0f);
+			}
+
+			for (int c = 0; c < 3; c++)
+			{
+				rgb[(static_cast<size_t>(y) * width + x) * 3 + c] = color[c];
+			}
+		}
+	}
+
+	return rgb;
+}
+
+/*
+The default scene under a sun and sky environment map, at equal samples with BSDF sampling (escaped rays look the
+environment up) and with the environment importance sampled. Also times the lookups, the samples and the alias table build
+*/
+static void BenchmarkEnvironment()
+{
+	const uint32_t map_width = 512;
+	const uint32_t map_height = 256;
+	const glm::vec3 sun = glm::normalize(glm::vec3(-0.6f, 0.7f, 0.4f));
+	const std::vector<float> sky = GenerateSunSky(map_width, map_height, sun);
+
+	if (IsSelected("Environment/Build/512x256"))
+	{
+		RayTracer::EnvironmentMap map;
+
+		RunBenchmark("Environment/Build/512x256", (uint64_t)map_width * map_height, [&]()
+		{
+			map.Build(map_width, map_height, sky);
+		}, 3);
+	}
+
+	if (IsSelected("Environment/Build/2048x1024"))
+	{
+		const std::vector<float> large = GenerateSunSky(2048, 1024, sun);
+		RayTracer::EnvironmentMap map;
+
+		RunBenchmark("Environment/Build/2048x1024", 2048ull * 1024, [&]()
+		{
+			map.Build(2048, 1024, large);
+		}, 3);
+	}
+
+	g_Environment.Build(map_width, map_height, sky);
+
+	const int count = 1 << 16;
+	std::vector<glm::vec3> directions(count);
+	SeedRandom(1357);
+
+	for (auto& e : directions)
+	{
+		e = GeneratePointInUnitSphere();
+	}
+
+	RunBenchmark("Environment/Lookup", count, [&]()
+	{
+		float sum = 0.0f;
+
+		for (const glm::vec3& direction : directions)
+		{
+			float pdf;
+			sum += g_Environment.Lookup(direction, pdf).g + pdf;
+		}
+
+		s_Sink = s_Sink + sum;
+	});
+
+	RunBenchmark("Environment/Sample", count, [&]()
+	{
+		RayTracer::EnvironmentSample sample;
+		float sum = 0.0f;
+
+		for (int i = 0; i < count; i++)
+		{
+			g_Environment.Sample((float)RandomFloat(), (float)RandomFloat(), (float)RandomFloat(), sample);
+			sum += sample.Pdf;
+		}
+
+		s_Sink = s_Sink + sum;
+	});
+
+	const int width = 64;
+	const int height = 36;
+	const int spp = 16;
+	const std::string bsdf_name = "GetRayRadiance/Environment/BSDF Sampling";
+	const std::string environment_name = "GetRayRadiance/Environment/Importance Sampling";
+
+	if (IsSelected(bsdf_name) || IsSelected(environment_name))
+	{
+		const std::vector<Sphere> scene = Spheres;
+		Spheres[2].FuzzLevel = 0.1f;
+		UpdateSceneBVH();
+
+		const std::vector<glm::vec3> reference = RenderRadiance(width, height, 2048, true, 1);
+		std::vector<glm::vec3> bsdf, environment;
+
+		RunBenchmark(bsdf_name, (uint64_t)width * height * spp, [&]()
+		{
+			bsdf = RenderRadiance(width, height, spp, false, 2);
+		}, 3);
+
+		RunBenchmark(environment_name, (uint64_t)width * height * spp, [&]()
+		{
+			environment = RenderRadiance(width, height, spp, true, 2);
+		}, 3);
+
+		if (!bsdf.empty() && !environment.empty())
+		{
+			const double bsdf_error = GetRMSE(bsdf, reference);
+			const double environment_error = GetRMSE(environment, reference);
+
+			std::cout << std::fixed << std::setprecision(4) << "Sun and sky, RMSE at " << spp << " spp : " << bsdf_error << " BSDF sampling, "
+				<< environment_error << " environment sampling (" << std::setprecision(1) << bsdf_error / environment_error
+				<< "x lower, " << (bsdf_error * bsdf_error) / (environment_error * environment_error) << "x fewer samples for the same error)\n";
+		}
+
+		Spheres = scene;
+		UpdateSceneBVH();
+	}
+
+	g_Environment.Clear();
+}
+
+/*
+Texture lookups through the tile cache, with a set of four 1024x1024 textures written to the working directory.
+Resident : every tile is in memory, the time of the lock free path, on one and on all trace threads.
+Over budget : random lookups into the whole set with a budget of a fifth of it, most of them miss and evict a tile
+*/
+static void BenchmarkTextureCache()
+{
+	const uint32_t size = 1024;
+	const int texture_count = 4;
+	const int count = 1 << 16;
+
+	if (!IsSelected("TextureCache/Fetch/Resident") && !IsSelected("TextureCache/Fetch/Resident/Threads") &&
+		!IsSelected("TextureCache/Sample/Coherent") && !IsSelected("TextureCache/Fetch/Over Budget"))
+	{
+		return;
+	}
+
+	std::vector<uint8_t> rgb(size * size * 3);
+	std::vector<std::string> paths;
+
+	for (int t = 0; t < texture_count; t++)
+	{
+		for (size_t i = 0; i < rgb.size(); i++)
+		{
+			rgb[i] = static_cast<uint8_t>(i * (t + 3) / 7);
+		}
+
+		paths.push_back("BenchmarkTexture" + std::to_string(t) + ".rtt");
+
+		if (!RayTracer::WriteTiledTexture(paths.back(), size, size, rgb))
+		{
+			return;
+		}
+	}
+
+	std::unique_ptr<RayTracer::TextureCache> cache = std::make_unique<RayTracer::TextureCache>();
+
+	for (const std::string& path : paths)
+	{
+		cache->Open(path);
+	}
+
+	std::vector<glm::uvec3> texels(count);
+	SeedRandom(97531);
+
+	for (auto& e : texels)
+	{
+		e = glm::uvec3(glm::vec3(RandomFloat(), RandomFloat(), RandomFloat()) * glm::vec3((float)texture_count, (float)size, (float)size));
+	}
+
+	auto fetch = [&](int first, int end)
+	{
+		uint32_t sum = 0;
+
+		for (int i = first; i < end; i++)
+		{
+			sum += cache->Fetch(static_cast<int>(texels[i].x), 0, texels[i].y, texels[i].z);
+		}
+
+		s_Sink = s_Sink + (float)sum;
+	};
+
+	// Loads every tile the lookups touch
+	fetch(0, count);
+
+	RunBenchmark("TextureCache/Fetch/Resident", count, [&]() { fetch(0, count); });
+
+	RunBenchmark("TextureCache/Fetch/Resident/Threads", (uint64_t)count * THREAD_SPAWN_COUNT, [&]()
+	{
+		ParallelFor(THREAD_SPAWN_COUNT, THREAD_SPAWN_COUNT, [&](int) { fetch(0, count); });
+	});
+
+	RunBenchmark("TextureCache/Sample/Coherent", count, [&]()
+	{
+		glm::vec3 sum = glm::vec3(0.0f);
+
+		for (int i = 0; i < count; i++)
+		{
+			sum += cache->Sample(0, (float)(i % 256) / 256.0f, (float)(i / 256) / 256.0f, 1.0f / 256.0f);
+		}
+
+		s_Sink = s_Sink + sum.x + sum.y + sum.z;
+	});
+
+	if (IsSelected("TextureCache/Fetch/Over Budget"))
+	{
+		const size_t set_size = (size_t)texture_count * size * size * 4;
+		cache->SetBudget(set_size / 5);
+		cache->ResetStatistics();
+
+		RunBenchmark("TextureCache/Fetch/Over Budget", count, [&]() { fetch(0, count); }, 3);
+
+		const RayTracer::TextureCacheStatistics stats = cache->GetStatistics();
+		std::cout << std::fixed << std::setprecision(1) << "Texture cache over budget : " << stats.GetHitRate() * 100.0f << "% hits, "
+			<< stats.ResidentBytes / 1048576.0 << " of " << set_size / 1048576.0 << " MB resident, " << stats.BytesRead / 1048576.0 << " MB read, "
+			<< std::setprecision(2) << stats.StallTime * 1e6f / (float)std::max<uint64_t>(stats.Stalls, 1) << " ns per stall\n";
+	}
+
+	cache.reset();
+
+	for (const std::string& path : paths)
+	{
+		std::remove(path.c_str());
+	}
+}
+
+/*
+Light selection with 1 to 100k small lights spread over a city sized area, seen from points on the ground.
+Times LightSampler::Sample with the light tree and with uniform selection, and prints how much more variance the selection
+adds than picking lights exactly in proportion to their unoccluded contribution (1 is ideal, the variance of a light sample
+is proportional to this for many lights)
+*/
+static void BenchmarkLightSelection()
+{
+	const int points = 32;
+	const int samples = 1 << 16;
+
+	for (int count : { 1, 10, 100, 1000, 10000, 100000 })
+	{
+		const std::string tree_name = "LightSampler/Tree/" + std::to_string(count);
+		const std::string uniform_name = "LightSampler/Uniform/" + std::to_string(count);
+
+		if (!IsSelected(tree_name) && !IsSelected(uniform_name))
+		{
+			continue;
+		}
+
+		std::vector<Sphere> lights;
+		SeedRandom(2468);
+
+		for (int l = 0; l < count; l++)
+		{
+			const glm::vec3 center = glm::vec3(RandomFloat(-50.0f, 50.0f), RandomFloat(0.5f, 10.0f), RandomFloat(-50.0f, 50.0f));
+			lights.emplace_back(center, glm::vec3(RandomFloat(10.0f, 100.0f)), 0.05f, Material::Emissive);
+		}
+
+		std::vector<glm::vec3> shading_points(points);
+
+		for (auto& e : shading_points)
+		{
+			e = glm::vec3(RandomFloat(-50.0f, 50.0f), 0.0f, RandomFloat(-50.0f, 50.0f));
+		}
+
+		const glm::vec3 normal = glm::vec3(0.0f, 1.0f, 0.0f);
+		RayTracer::LightSampler tree;
+		RayTracer::LightSampler uniform;
+		uniform.Build(lights, RayTracer::LightSelection::Uniform);
+
+		if (count == 100000)
+		{
+			RunBenchmark("LightSampler/Build/100k", count, [&]()
+			{
+				tree.Build(lights, RayTracer::LightSelection::Tree);
+			}, 3);
+		}
+
+		tree.Build(lights, RayTracer::LightSelection::Tree);
+
+		auto run = [&](const RayTracer::LightSampler& sampler)
+		{
+			RayTracer::LightSample sample;
+			float sum = 0.0f;
+
+			for (int i = 0; i < samples; i++)
+			{
+				sampler.Sample(lights, shading_points[i % points], normal, (float)RandomFloat(), (float)RandomFloat(), (float)RandomFloat(), sample);
+				sum += sample.Pdf;
+			}
+
+			s_Sink = s_Sink + sum;
+		};
+
+		RunBenchmark(tree_name, samples, [&]() { run(tree); });
+		RunBenchmark(uniform_name, samples, [&]() { run(uniform); });
+
+		// Sum of contribution^2 / selection probability, relative to the ideal (sum of contributions)^2
+		double tree_variance = 0.0;
+		double uniform_variance = 0.0;
+
+		for (const glm::vec3& point : shading_points)
+		{
+			double total = 0.0;
+			double tree_moment = 0.0;
+			double uniform_moment = 0.0;
+
+			for (int l = 0; l < count; l++)
+			{
+				const glm::vec3 to_light = lights[l].Center - point;
+				const float distance2 = glm::dot(to_light, to_light);
+				const double contribution = lights[l].Color.r * glm::max(glm::dot(normal, to_light), 0.0f) / (distance2 * glm::sqrt(distance2));
+
+				if (contribution <= 0.0)
+				{
+					continue;
+				}
+
+				// GetPdf is the selection probability times the density of the direction in the light's cone, which cancels out
+				const double cone = uniform.GetPdf(lights, point, normal, l) * count;
+				total += contribution;
+				tree_moment += contribution * contribution / (tree.GetPdf(lights, point, normal, l) / cone);
+				uniform_moment += contribution * contribution * count;
+			}
+
+			tree_variance += total > 0.0 ? tree_moment / (total * total) : 1.0;
+			uniform_variance += total > 0.0 ? uniform_moment / (total * total) : 1.0;
+		}
+
+		std::cout << std::fixed << std::setprecision(2) << "LightSampler/" << count << " : " << tree.GetNodeCount() << " nodes, variance x"
+			<< tree_variance / points << " of the ideal selection with the tree, x" << uniform_variance / points << " uniform\n";
+	}
+}
+
+// Converts a 4K frame, ns per pixel, so 1000 / ns is gigapixels per second
+static void BenchmarkTonemap()
+{
+	const int width = 3840;
+	const int height = 2160;
+	const size_t count = (size_t)width * height;
+
+	std::vector<glm::vec3> accumulation(count);
+	std::vector<uint32_t> counts(count);
+	std::vector<uint8_t> rgba(count * 4);
+
+	SeedRandom(4321);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		counts[i] = 1 + (RandomUint() & 15);
+		accumulation[i] = glm::vec3(RandomFloat(0.0f, 300.0f), RandomFloat(0.0f, 300.0f), RandomFloat(0.0f, 300.0f)) * (float)counts[i];
+	}
+
+	RayTracer::TonemapSettings settings;
+
+	RunBenchmark("Tonemap/None/4K", count, [&]()
+	{
+		RayTracer::Tonemap(settings, accumulation.data(), counts.data(), rgba.data(), width, width, height, THREAD_SPAWN_COUNT);
+		s_Sink = s_Sink + rgba[count / 2];
+	});
+
+	settings.Operator = RayTracer::TonemapOperator::ACES;
+	settings.SRGB = true;
+
+	RunBenchmark("Tonemap/ACES+sRGB/4K", count, [&]()
+	{
+		RayTracer::Tonemap(settings, accumulation.data(), counts.data(), rgba.data(), width, width, height, THREAD_SPAWN_COUNT);
+		s_Sink = s_Sink + rgba[count / 2];
+	});
+}
+
+/* Output */
+
+static bool WriteJSON(const std::string& path)
+{
+	std::ofstream file(path);
+
+	if (!file.good())
+	{
+		std::cout << "\nCOULD NOT OPEN BENCHMARK FILE FOR WRITING (" << path << ")\n";
+		return false;
+	}
+
+	file << std::fixed << std::setprecision(3);
+	file << "{\n\"threads\": " << THREAD_SPAWN_COUNT << ",\n\"benchmarks\": [\n";
+
+	for (size_t i = 0; i < s_Results.size(); i++)
+	{
+		const BenchmarkResult& e = s_Results[i];
+
+		file << "{\"name\": \"" << e.Name << "\", \"operations\": " << e.Operations << ", \"repetitions\": " << e.Repetitions
+			<< ", \"ns_per_op\": " << e.MeanNs << ", \"stddev_ns\": " << e.StdDevNs << ", \"min_ns\": " << e.MinNs
+			<< ", \"max_ns\": " << e.MaxNs << ", \"ops_per_second\": " << e.GetThroughput() << "}"
+			<< (i + 1 < s_Results.size() ? "," : "") << "\n";
+	}
+
+	file << "]\n}\n";
+	std::cout << "\nWrote " << s_Results.size() << " results to " << path << "\n";
+
+	return file.good();
+}
+
+// Reads the name and ns_per_op of every benchmark from a json file written by WriteJSON
+static std::map<std::string, double> ReadJSON(const std::string& path)
+{
+	std::map<std::string, double> results;
+	std::ifstream file(path);
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		size_t name = line.find("\"name\": \"");
+		size_t time = line.find("\"ns_per_op\": ");
+
+		if (name == std::string::npos || time == std::string::npos)
+		{
+			continue;
+		}
+
+		name += strlen("\"name\": \"");
+		time += strlen("\"ns_per_op\": ");
+		results[line.substr(name, line.find('"', name) - name)] = std::stod(line.substr(time));
+	}
+
+	return results;
+}
+
+static void Compare(const std::string& path)
+{
+	std::map<std::string, double> baseline = ReadJSON(path);
+
+	if (baseline.empty())
+	{
+		std::cout << "\nNO BASELINE RESULTS FOUND IN (" << path << ")\n";
+		return;
+	}
+
+	std::cout << "\nComparison against " << path << " (negative is faster) :\n";
+
+	for (auto& e : s_Results)
+	{
+		auto it = baseline.find(e.Name);
+
+		if (it == baseline.end() || it->second <= 0.0)
+		{
+			continue;
+		}
+
+		double change = 100.0 * (e.MeanNs - it->second) / it->second;
+		std::cout << std::left << std::setw(40) << e.Name << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(12) << it->second << " -> " << std::setw(12) << e.MeanNs << " ns/op  "
+			<< std::showpos << change << std::noshowpos << "%\n";
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string json_path;
+	std::string compare_path;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--json" && has_value) { json_path = argv[++i]; }
+		else if (arg == "--compare" && has_value) { compare_path = argv[++i]; }
+		else if (arg == "--filter" && has_value) { s_Filter = argv[++i]; }
+		else if (arg == "--repetitions" && has_value) { s_Repetitions = std::max(1, std::atoi(argv[++i])); }
+		else if (arg == "--pin-threads")
+		{
+			if (!g_ThreadPool.SetPinning(true))
+			{
+				std::cout << "\nCOULD NOT QUERY THE PROCESSOR TOPOLOGY, THE WORKERS ARE NOT PINNED\n";
+			}
+		}
+		else
+		{
+			std::cout << "Usage : " << argv[0] << " [--repetitions <n>] [--filter <name>] [--json <output.json>] [--compare <baseline.json>] [--pin-threads]\n";
+			return 1;
+		}
+	}
+
+	std::cout << "-----------  Ray Tracer Benchmarks -----------\n";
+
+	BenchmarkIntersection();
+	BenchmarkSampling();
+	BenchmarkConversion();
+	BenchmarkBVH();
+	BenchmarkThreadPool();
+	BenchmarkEventQueue();
+	BenchmarkFrame();
+	BenchmarkScaling();
+	BenchmarkDenoiser();
+	BenchmarkLightSampling();
+	BenchmarkLightSelection();
+	BenchmarkEnvironment();
+	BenchmarkTextureCache();
+	BenchmarkTonemap();
+
+	if (!compare_path.empty())
+	{
+		Compare(compare_path);
+	}
+
+	if (!json_path.empty() && !WriteJSON(json_path))
+	{
+		return 1;
+	}
+
+	return 0;
+}
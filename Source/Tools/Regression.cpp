@@ -0,0 +1,346 @@
+/*
+Reference image regression harness
+
+Usage : Ray-Tracer-Regression [--update] [--references <directory>] [--output <directory>]
+
+Renders the built in scene with deterministic sampling and compares it to the stored reference.
+The render is done twice, with one thread and with THREAD_SPAWN_COUNT threads, and both have to match exactly.
+A render that is stopped after its first pass and resumed from its checkpoint has to match exactly as well.
+--update replaces the reference with the current render, only do that after checking the new image.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+
+#include "../Core/Tracer.h"
+#include "../Core/ImageWriter.h"
+
+using namespace RayTracer;
+
+static const int REGRESSION_SPP = 8;
+
+// Thresholds, the renders from different compilers differ slightly because of floating point differences
+static const double MIN_PSNR = 40.0;
+static const double MAX_FLIP_ERROR = 0.005;
+
+struct ImageErrors
+{
+	double RMSE = 0.0; // In the 0 - 1 range
+	double PSNR = 0.0; // In dB
+	double FLIP = 0.0; // Mean FLIP style error, 0 is identical
+	double MaxFLIP = 0.0;
+	uint32_t DifferentPixels = 0;
+};
+
+/* FLIP style colour error */
+
+static glm::vec3 SRGBToLinear(const glm::vec3& c)
+{
+	glm::vec3 r;
+
+	for (int i = 0; i < 3; i++)
+	{
+		r[i] = c[i] <= 0.04045f ? c[i] / 12.92f : std::pow((c[i] + 0.055f) / 1.055f, 2.4f);
+	}
+
+	return r;
+}
+
+static glm::vec3 LinearToXYZ(const glm::vec3& c)
+{
+	return glm::vec3(
+		0.4124564f * c.r + 0.3575761f * c.g + 0.1804375f * c.b,
+		0.2126729f * c.r + 0.7151522f * c.g + 0.0721750f * c.b,
+		0.0193339f * c.r + 0.1191920f * c.g + 0.9503041f * c.b);
+}
+
+static glm::vec3 XYZToLinear(const glm::vec3& c)
+{
+	return glm::vec3(
+		3.2404542f * c.x - 1.5371385f * c.y - 0.4985314f * c.z,
+		-0.9692660f * c.x + 1.8760108f * c.y + 0.0415560f * c.z,
+		0.0556434f * c.x - 0.2040259f * c.y + 1.0572252f * c.z);
+}
+
+static const glm::vec3 D65 = glm::vec3(0.950428545f, 1.0f, 1.088900371f);
+
+static glm::vec3 XYZToYCxCz(const glm::vec3& c)
+{
+	glm::vec3 n = c / D65;
+	return glm::vec3(116.0f * n.y - 16.0f, 500.0f * (n.x - n.y), 200.0f * (n.y - n.z));
+}
+
+static glm::vec3 YCxCzToXYZ(const glm::vec3& c)
+{
+	float y = (c.x + 16.0f) / 116.0f;
+	return glm::vec3(c.y / 500.0f + y, y, y - c.z / 200.0f) * D65;
+}
+
+static glm::vec3 XYZToLab(const glm::vec3& c)
+{
+	auto f = [](float t) { return t > 0.008856f ? std::cbrt(t) : 7.787f * t + 16.0f / 116.0f; };
+	glm::vec3 n = c / D65;
+	return glm::vec3(116.0f * f(n.y) - 16.0f, 500.0f * (f(n.x) - f(n.y)), 200.0f * (f(n.y) - f(n.z)));
+}
+
+static float HyAB(const glm::vec3& a, const glm::vec3& b)
+{
+	glm::vec3 d = a - b;
+	return std::abs(d.x) + std::sqrt(d.y * d.y + d.z * d.z);
+}
+
+// Separable gaussian blur of one channel of an opponent colour image
+static void Blur(std::vector<glm::vec3>& image, uint32_t width, uint32_t height, int channel, float sigma)
+{
+	const int radius = static_cast<int>(std::ceil(3.0f * sigma));
+	std::vector<float> kernel(radius * 2 + 1);
+	std::vector<glm::vec3> temp = image;
+	float sum = 0.0f;
+
+	for (int i = -radius; i <= radius; i++)
+	{
+		kernel[i + radius] = std::exp(-(i * i) / (2.0f * sigma * sigma));
+		sum += kernel[i + radius];
+	}
+
+	for (auto& e : kernel)
+	{
+		e /= sum;
+	}
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		std::vector<glm::vec3>& src = pass == 0 ? image : temp;
+		std::vector<glm::vec3>& dst = pass == 0 ? temp : image;
+
+		for (int y = 0; y < (int)height; y++)
+		{
+			for (int x = 0; x < (int)width; x++)
+			{
+				float value = 0.0f;
+
+				for (int k = -radius; k <= radius; k++)
+				{
+					int sx = pass == 0 ? glm::clamp(x + k, 0, (int)width - 1) : x;
+					int sy = pass == 1 ? glm::clamp(y + k, 0, (int)height - 1) : y;
+					value += kernel[k + radius] * src[sy * width + sx][channel];
+				}
+
+				dst[y * width + x][channel] = value;
+			}
+		}
+	}
+}
+
+/*
+The colour pipeline of FLIP (Andersson et al. 2020) : both images are moved to an opponent space, filtered with
+approximations of the contrast sensitivity functions and compared in L*a*b* with the HyAB distance.
+The edge and point feature term of FLIP is not included.
+*/
+static std::vector<float> ComputeFLIPError(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, uint32_t width, uint32_t height)
+{
+	std::vector<glm::vec3> images[2];
+	const std::vector<uint8_t>* sources[2] = { &a, &b };
+
+	for (int i = 0; i < 2; i++)
+	{
+		images[i].resize(width * height);
+
+		for (uint32_t p = 0; p < width * height; p++)
+		{
+			glm::vec3 c = glm::vec3((*sources[i])[p * 3 + 0], (*sources[i])[p * 3 + 1], (*sources[i])[p * 3 + 2]) / 255.0f;
+			images[i][p] = XYZToYCxCz(LinearToXYZ(SRGBToLinear(c)));
+		}
+
+		// The chromatic channels are blurred more since the eye is less sensitive to chromatic detail
+		Blur(images[i], width, height, 0, 0.8f);
+		Blur(images[i], width, height, 1, 1.6f);
+		Blur(images[i], width, height, 2, 1.6f);
+
+		for (auto& e : images[i])
+		{
+			e = XYZToLab(LinearToXYZ(glm::clamp(XYZToLinear(YCxCzToXYZ(e)), 0.0f, 1.0f)));
+		}
+	}
+
+	// Normalize by the largest possible difference (pure green against pure blue), raised to FLIP's 0.7 power
+	const float max_error = std::pow(HyAB(XYZToLab(LinearToXYZ(glm::vec3(0.0f, 1.0f, 0.0f))), XYZToLab(LinearToXYZ(glm::vec3(0.0f, 0.0f, 1.0f)))), 0.7f);
+	std::vector<float> errors(width * height);
+
+	for (uint32_t p = 0; p < width * height; p++)
+	{
+		errors[p] = glm::min(std::pow(HyAB(images[0][p], images[1][p]), 0.7f) / max_error, 1.0f);
+	}
+
+	return errors;
+}
+
+static ImageErrors CompareImages(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, uint32_t width, uint32_t height, std::vector<float>& flip)
+{
+	ImageErrors errors;
+	double squared = 0.0;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		double d = ((double)a[i] - (double)b[i]) / 255.0;
+		squared += d * d;
+	}
+
+	for (uint32_t p = 0; p < width * height; p++)
+	{
+		if (a[p * 3] != b[p * 3] || a[p * 3 + 1] != b[p * 3 + 1] || a[p * 3 + 2] != b[p * 3 + 2])
+		{
+			errors.DifferentPixels++;
+		}
+	}
+
+	errors.RMSE = std::sqrt(squared / (double)a.size());
+	errors.PSNR = errors.RMSE > 0.0 ? 20.0 * std::log10(1.0 / errors.RMSE) : std::numeric_limits<double>::infinity();
+
+	flip = ComputeFLIPError(a, b, width, height);
+
+	for (float e : flip)
+	{
+		errors.FLIP += e;
+		errors.MaxFLIP = glm::max(errors.MaxFLIP, (double)e);
+	}
+
+	errors.FLIP /= (double)flip.size();
+
+	return errors;
+}
+
+static std::vector<uint8_t> Render(int thread_count)
+{
+	auto start = std::chrono::steady_clock::now();
+	TraceScene(REGRESSION_SPP, thread_count);
+	auto end = std::chrono::steady_clock::now();
+
+	std::cout << "Rendered " << g_Width << "x" << g_Height << " at " << REGRESSION_SPP << " spp with " << thread_count << " thread(s) in "
+		<< std::chrono::duration<double>(end - start).count() << " s\n";
+
+	return GetPixelDataRGB();
+}
+
+// Stops after the first pass (the time limit is always exceeded) and resumes from the checkpoint written then
+static std::vector<uint8_t> RenderResumed(const std::string& checkpoint_path)
+{
+	CheckpointSettings settings;
+	settings.Path = checkpoint_path;
+	settings.TimeLimit = 1e-6f;
+
+	if (TraceSceneCheckpointed(REGRESSION_SPP, settings))
+	{
+		std::cout << "FAILED : The render wasn't stopped by its time limit\n";
+		return {};
+	}
+
+	settings.TimeLimit = 0.0f;
+	settings.Resume = true;
+	TraceSceneCheckpointed(REGRESSION_SPP, settings);
+	std::remove(checkpoint_path.c_str());
+
+	return GetPixelDataRGB();
+}
+
+int main(int argc, char** argv)
+{
+	std::string reference_directory = "Tools/References";
+	std::string output_directory = ".";
+	bool update = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--update") { update = true; }
+		else if (arg == "--references" && has_value) { reference_directory = argv[++i]; }
+		else if (arg == "--output" && has_value) { output_directory = argv[++i]; }
+		else
+		{
+			std::cout << "Usage : " << argv[0] << " [--update] [--references <directory>] [--output <directory>]\n";
+			return 1;
+		}
+	}
+
+	const std::string reference_path = reference_directory + "/BuiltinScene.ppm";
+	bool passed = true;
+
+	std::cout << "-----------  Ray Tracer Regression Test -----------\n";
+
+	g_DeterministicSampling = true;
+	g_FrameSeed = 0;
+
+	std::vector<uint8_t> image = Render(THREAD_SPAWN_COUNT);
+	std::vector<uint8_t> single_threaded = Render(1);
+
+	// The sampling is deterministic, so the thread count must not change a single bit
+	if (image != single_threaded)
+	{
+		std::cout << "FAILED : The render depends on the thread count\n";
+		passed = false;
+	}
+
+	if (image != RenderResumed(output_directory + "/RegressionCheckpoint.bin"))
+	{
+		std::cout << "FAILED : The render resumed from a checkpoint differs from the uninterrupted one\n";
+		passed = false;
+	}
+
+	WritePPM(output_directory + "/RegressionRender.ppm", g_Width, g_Height, image.data());
+
+	if (update)
+	{
+		if (!WritePPM(reference_path, g_Width, g_Height, image.data()))
+		{
+			return 1;
+		}
+
+		std::cout << "Updated the reference (" << reference_path << ")\n";
+		return passed ? 0 : 1;
+	}
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> reference;
+
+	if (!ReadPPM(reference_path, width, height, reference) || width != g_Width || height != g_Height)
+	{
+		std::cout << "FAILED : Could not load a " << g_Width << "x" << g_Height << " reference from " << reference_path << "\n";
+		return 1;
+	}
+
+	std::vector<float> flip;
+	ImageErrors errors = CompareImages(image, reference, width, height, flip);
+
+	std::cout << std::fixed << std::setprecision(4);
+	std::cout << "Different Pixels : " << errors.DifferentPixels << " / " << width * height << "\n";
+	std::cout << "RMSE : " << errors.RMSE << "\n";
+	std::cout << "PSNR : " << std::setprecision(2) << errors.PSNR << " dB (minimum " << MIN_PSNR << ")\n";
+	std::cout << "FLIP : " << std::setprecision(4) << errors.FLIP << " mean, " << errors.MaxFLIP << " max (maximum mean " << MAX_FLIP_ERROR << ")\n";
+
+	if (errors.PSNR < MIN_PSNR || errors.FLIP > MAX_FLIP_ERROR)
+	{
+		passed = false;
+	}
+
+	// Error map, black is identical and white is the largest error
+	std::vector<uint8_t> error_map(width * height * 3);
+
+	for (uint32_t p = 0; p < width * height; p++)
+	{
+		uint8_t value = static_cast<uint8_t>(glm::clamp(flip[p] * 255.0f, 0.0f, 255.0f));
+		error_map[p * 3 + 0] = error_map[p * 3 + 1] = error_map[p * 3 + 2] = value;
+	}
+
+	WritePPM(output_directory + "/RegressionError.ppm", width, height, error_map.data());
+
+	std::cout << (passed ? "PASSED" : "FAILED") << "\n";
+	return passed ? 0 : 1;
+}
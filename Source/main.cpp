@@ -4,8 +4,6 @@ Reference : https://raytracing.github.io/books/RayTracingInOneWeekend.html
 By : Samuel Wesley Rasquinha (@swr06) 
 */
 
-#define THREAD_SPAWN_COUNT 4
-
 #include <stdio.h>
 #include <iostream>
 #include <array>
@@ -15,6 +13,8 @@ By : Samuel Wesley Rasquinha (@swr06)
 #include <vector>
 #include <chrono>
 #include <memory>
+#include <atomic>
+#include <algorithm>
 
 #include <glad/glad.h>          
 #include <GLFW/glfw3.h>
@@ -25,143 +25,123 @@ By : Samuel Wesley Rasquinha (@swr06)
 #include "Core/VertexBuffer.h"
 #include "Core/VertexArray.h"
 #include "Core/Shader.h"
+#include "Core/ImageWriter.h"
+#include "Core/Profiler.h"
+#include "Core/Tracer.h"
+#include "Core/BVH.h"
+#include "Core/Lights.h"
+#include "Core/Environment.h"
+#include "Core/TextureCache.h"
+#include "Core/Sequence.h"
+#include "Core/Distributed.h"
 
 using namespace RayTracer;
-typedef uint32_t uint;
-typedef unsigned char byte;
-typedef double floatp; // float precision
-
-// Helpers
-struct i8vec2
-{
-	uint8_t x, y;
-};
-
-struct i16vec2
-{
-	uint16_t x, y;
-};
-
-class RGB
-{
-	public :
-	
-	RGB(byte R, byte G, byte B)
-	{
-		r = R;
-		g = G;
-		b = B;
-	}
 
-	RGB() : r(0), g(0), b(0)
-	{}
-
-	byte r;
-	byte g;
-	byte b;
-};
-
-struct RayHitRecord
-{
-	glm::vec3 Point;
-	glm::vec3 Normal;
-	float T = 0.0f; 
-	bool Inside = false;
-};
-
-// Needs to be 16:9 aspect ratio
-// 1024, 576
-const uint g_Width = 1024;
-const uint g_Height = 576;
-GLubyte* const g_PixelData = new GLubyte[g_Width * g_Height * 3];
 GLuint g_Texture = 0;
+GLuint g_HeatmapTexture = 0;
+uint g_TextureRenderWidth = g_Width; // Render area of the image in g_Texture
+uint g_TextureRenderHeight = g_Height;
+bool g_ShowHeatmap = false;
+float g_HeatmapOpacity = 0.65f;
 
 std::unique_ptr<GLClasses::VertexBuffer> g_VBO;
 std::unique_ptr<GLClasses::VertexArray> g_VAO;
 std::unique_ptr<GLClasses::Shader> g_RenderShader;
 
-// Utility 
-const double _INFINITY = std::numeric_limits<double>::infinity();
-const double PI = 3.14159265354;
+void BufferTextureData();
 
-inline double RandomFloat() 
-{
-	static std::uniform_real_distribution<float> distribution(0.0, 1.0);
-	static std::mt19937 generator;
-	return distribution(generator);
-}
+/* Tile render time heatmap */
 
-inline float RandomFloat(float min, float max)
+// Maps t (0 - 1) to a blue -> cyan -> green -> yellow -> red false colour gradient
+glm::vec3 GetHeatmapColor(float t)
 {
-	return min + (max - min) * RandomFloat();
-}
+	const glm::vec3 Stops[5] =
+	{
+		glm::vec3(0.0f, 0.0f, 1.0f),
+		glm::vec3(0.0f, 1.0f, 1.0f),
+		glm::vec3(0.0f, 1.0f, 0.0f),
+		glm::vec3(1.0f, 1.0f, 0.0f),
+		glm::vec3(1.0f, 0.0f, 0.0f)
+	};
 
-/* Functions */
+	t = glm::clamp(t, 0.0f, 1.0f) * 4.0f;
+	int stop = glm::min(static_cast<int>(t), 3);
 
-RGB ToRGB(const glm::ivec3& v)
-{
-	RGB rgb;
-	glm::ivec3 val = v;
+	return Lerp(Stops[stop], Stops[stop + 1], t - static_cast<float>(stop));
+}
 
-	val.r = glm::clamp(val.r, 0, 255);
-	val.g = glm::clamp(val.g, 0, 255);
-	val.b = glm::clamp(val.b, 0, 255);
+float GetMaxTileRenderTime()
+{
+	float max_time = 0.0f;
 
-	rgb.r = static_cast<byte>(val.r);
-	rgb.g = static_cast<byte>(val.g);
-	rgb.b = static_cast<byte>(val.b);
+	for (auto& e : g_TileRenderTimes)
+	{
+		max_time = glm::max(max_time, e.load(std::memory_order_relaxed));
+	}
 
-	return rgb;
+	return max_time;
 }
 
-RGB ToRGB(const glm::vec3& v)
+// Creates a rgba image with one texel per tile, tiles that haven't finished are transparent
+void GetTileHeatmap(std::vector<GLubyte>& heatmap)
 {
-	glm::vec3 val = v;
-	RGB rgb;
+	const float max_time = GetMaxTileRenderTime();
+	heatmap.assign(g_TileCount * 4, 0);
 
-	glm::ivec3 _col = val;
-
-	_col.r = glm::clamp(_col.r, 0, 255);
-	_col.g = glm::clamp(_col.g, 0, 255);
-	_col.b = glm::clamp(_col.b, 0, 255);
+	for (uint i = 0; i < g_TileCount; i++)
+	{
+		float time = g_TileRenderTimes[i].load(std::memory_order_relaxed);
 
-	rgb.r = static_cast<byte>(_col.r);
-	rgb.g = static_cast<byte>(_col.g);
-	rgb.b = static_cast<byte>(_col.b);
+		if (time < 0.0f || max_time <= 0.0f)
+		{
+			continue;
+		}
 
-	return rgb;
+		RGB col = ToRGBVec3_01(GetHeatmapColor(time / max_time));
+		heatmap[i * 4 + 0] = col.r;
+		heatmap[i * 4 + 1] = col.g;
+		heatmap[i * 4 + 2] = col.b;
+		heatmap[i * 4 + 3] = 255;
+	}
 }
 
-RGB ToRGBVec3_01(const glm::vec3& v)
+void UpdateHeatmapTexture()
 {
-	glm::vec3 val = v;
-	RGB rgb;
+	RT_PROFILE_ZONE("Heatmap Upload");
 
-	val.x = v.x * 255.0f;
-	val.y = v.y * 255.0f;
-	val.z = v.z * 255.0f;
+	std::vector<GLubyte> heatmap;
+	GetTileHeatmap(heatmap);
 
-	glm::ivec3 _col = val;
-
-	_col.r = glm::clamp(_col.r, 0, 255);
-	_col.g = glm::clamp(_col.g, 0, 255);
-	_col.b = glm::clamp(_col.b, 0, 255);
-
-	rgb.r = static_cast<byte>(_col.r);
-	rgb.g = static_cast<byte>(_col.g);
-	rgb.b = static_cast<byte>(_col.b);
-
-	return rgb;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTextureSubImage2D(g_HeatmapTexture, 0, 0, 0, g_TileCountX, g_TileCountY, GL_RGBA, GL_UNSIGNED_BYTE, heatmap.data());
 }
 
-glm::vec3 Lerp(const glm::vec3& v1, const glm::vec3& v2, float t)
+// Writes the heatmap blended over the current render, the same way it is displayed
+void ExportTileHeatmap(const std::string& path)
 {
-	return (1.0f - t) * v1 + t * v2;
-}
+	std::vector<GLubyte> heatmap;
+	std::vector<GLubyte> image = GetPixelDataRGB();
+	GetTileHeatmap(heatmap);
 
-glm::vec3 ConvertTo0_1Range(const glm::vec3& v)
-{
-	return 0.5f * (v + 1.0f);
+	for (uint j = 0; j < g_Height; j++)
+	{
+		for (uint i = 0; i < g_Width; i++)
+		{
+			const GLubyte* texel = &heatmap[((j / TILE_SIZE) * g_TileCountX + (i / TILE_SIZE)) * 4];
+			float alpha = g_HeatmapOpacity * (texel[3] / 255.0f);
+			GLubyte* pixel = &image[(i + j * g_Width) * 3];
+
+			const glm::vec3 color = glm::mix(glm::vec3(pixel[0], pixel[1], pixel[2]), glm::vec3(texel[0], texel[1], texel[2]), alpha);
+			pixel[0] = static_cast<GLubyte>(color.r);
+			pixel[1] = static_cast<GLubyte>(color.g);
+			pixel[2] = static_cast<GLubyte>(color.b);
+		}
+	}
+
+	if (WritePPM(path, g_Width, g_Height, image.data()))
+	{
+		std::cout << "Wrote tile heatmap to " << path << std::endl;
+	}
 }
 
 class RayTracerApp : public Application
@@ -172,7 +152,6 @@ public:
 	{
 		m_Width = g_Width;
 		m_Height = g_Height;
-		memset(g_PixelData, 255, g_Width * g_Height * 3);
 	}
 
 	void OnUserCreate(double ts) override
@@ -182,7 +161,57 @@ public:
 
 	void OnUserUpdate(double ts) override
 	{
+		// Clamped, the first frame after the loop waited for events would otherwise move the camera by the whole idle time
+		const float dt = m_LastUpdateTime > 0.0 ? glm::min(static_cast<float>(ts - m_LastUpdateTime), 0.1f) : 0.0f;
+		m_LastUpdateTime = ts;
 
+		if (!ImGui::GetIO().WantCaptureKeyboard)
+		{
+			const glm::vec3 front = GetCameraFront();
+			const glm::vec3 right = glm::normalize(glm::cross(front, glm::vec3(0.0f, 1.0f, 0.0f)));
+			const float speed = m_CameraSpeed * dt * (m_KeysDown[GLFW_KEY_LEFT_SHIFT] ? 4.0f : 1.0f);
+			glm::vec3 movement = glm::vec3(0.0f);
+
+			if (m_KeysDown[GLFW_KEY_W]) { movement += front; }
+			if (m_KeysDown[GLFW_KEY_S]) { movement -= front; }
+			if (m_KeysDown[GLFW_KEY_D]) { movement += right; }
+			if (m_KeysDown[GLFW_KEY_A]) { movement -= right; }
+			if (m_KeysDown[GLFW_KEY_SPACE]) { movement.y += 1.0f; }
+			if (m_KeysDown[GLFW_KEY_LEFT_CONTROL]) { movement.y -= 1.0f; }
+
+			if (glm::dot(movement, movement) > 0.0f)
+			{
+				m_CameraPosition += glm::normalize(movement) * speed;
+				m_CameraChanged = true;
+			}
+		}
+
+		if (m_CameraChanged)
+		{
+			m_CameraChanged = false;
+			uint32_t generation = SetSceneCamera(Camera(m_CameraPosition, m_CameraPosition + GetCameraFront(), glm::vec3(0.0f, 1.0f, 0.0f), m_CameraFOV));
+
+			// The latency is measured from the first input that hasn't been displayed yet
+			if (!m_LatencyPending)
+			{
+				m_LatencyPending = true;
+				m_InputTime = std::chrono::steady_clock::now();
+				m_LatencyGeneration = generation;
+			}
+		}
+	}
+
+	// Called after a published image was uploaded, finishes the latency measurement once the new camera is on screen
+	void OnPixelsUploaded()
+	{
+		RenderStatistics stats = GetRenderStatistics();
+
+		if (m_LatencyPending && static_cast<int32_t>(stats.FirstTileGeneration - m_LatencyGeneration) >= 0 && stats.FirstTileGeneration != UINT32_MAX)
+		{
+			m_LatencyPending = false;
+			m_LastLatency = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_InputTime).count();
+			m_AverageLatency = m_AverageLatency == 0.0f ? m_LastLatency : glm::mix(m_AverageLatency, m_LastLatency, 0.1f);
+		}
 	}
 
 	void OnImguiRender(double ts) override
@@ -192,7 +221,222 @@ public:
 		if (ImGui::Begin("Settings"))
 		{
 			ImGui::Text("Simple Ray Tracer v01 :)");
+			ImGui::Separator();
+
+			RenderStatistics stats = GetRenderStatistics();
+			ImGui::Text("Samples : %u / %d (%u passes, last pass %.1f ms)%s", stats.Samples, stats.TargetSamples, stats.Passes, stats.LastPassTime,
+				m_RenderFinished ? ", finished" : "");
+			ImGui::Text("Input Latency : %.1f ms (average %.1f ms)", m_LastLatency, m_AverageLatency);
+			ImGui::Text("Present Loop : %.1f%% CPU, %.0f frames/s", GetLoopCPUUsage(), GetFrameRate());
+			ImGui::Text("Scene BVH : %zu nodes, built in %.2f ms (%.2f M spheres/s)", g_SceneBVH.GetNodeCount(), g_SceneBVH.GetBuildTime(),
+				g_SceneBVH.GetBuildTime() > 0.0f ? (float)g_SceneBVH.GetPrimitiveCount() / (g_SceneBVH.GetBuildTime() * 1000.0f) : 0.0f);
+			ImGui::Text("Hold the right mouse button to look around, WASD to move");
+
+			if (m_LastError)
+			{
+				ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "Error : %s", m_LastError);
+			}
+
+			if (GetDroppedEventCount() > 0)
+			{
+				ImGui::Text("Dropped Events : %llu", (unsigned long long)GetDroppedEventCount());
+			}
+
+
+			if (ImGui::SliderFloat("FOV", &m_CameraFOV, 20.0f, 120.0f))
+			{
+				m_CameraChanged = true;
+			}
+
+			ImGui::SliderFloat("Camera Speed", &m_CameraSpeed, 0.1f, 10.0f);
+			ImGui::Separator();
+
+			DynamicResolutionSettings resolution = GetDynamicResolution();
+			bool resolution_changed = ImGui::Checkbox("Dynamic Resolution", &resolution.Enabled);
+			resolution_changed |= ImGui::SliderFloat("Target Frame Time (ms)", &resolution.TargetFrameTime, 4.0f, 100.0f);
+			resolution_changed |= ImGui::SliderFloat("Minimum Scale", &resolution.MinScale, 0.1f, 1.0f);
+
+			if (resolution_changed)
+			{
+				SetDynamicResolution(resolution);
+			}
+
+			ImGui::Text("Render Resolution : %ux%u (%.0f%%)", stats.RenderWidth, stats.RenderHeight, stats.RenderScale * 100.0f);
+			ImGui::Separator();
+
+			bool reprojection = g_TemporalReprojection.load();
+
+			if (ImGui::Checkbox("Temporal Reprojection", &reprojection))
+			{
+				g_TemporalReprojection.store(reprojection);
+			}
+
+			ImGui::Text("Reprojected : %.1f%% of the pixels in %.2f ms", stats.ReprojectedFraction * 100.0f, stats.ReprojectionTime);
+			ImGui::Separator();
+
+			DenoiserSettings denoiser = GetDenoiserSettings();
+			bool denoiser_changed = ImGui::Checkbox("Denoiser", &denoiser.Enabled);
+			denoiser_changed |= ImGui::SliderInt("Denoiser Iterations", &denoiser.Iterations, 1, 8);
+			denoiser_changed |= ImGui::SliderFloat("Color Phi", &denoiser.ColorPhi, 0.1f, 20.0f);
+			denoiser_changed |= ImGui::SliderFloat("Normal Phi", &denoiser.NormalPhi, 1.0f, 256.0f);
+			denoiser_changed |= ImGui::SliderFloat("Depth Phi", &denoiser.DepthPhi, 0.1f, 10.0f);
+
+			if (denoiser_changed)
+			{
+				SetDenoiserSettings(denoiser);
+			}
+
+			const float megapixels = (float)(stats.RenderWidth * stats.RenderHeight) / 1e6f;
+			ImGui::Text("Denoise Time : %.2f ms (%.2f ms per megapixel)", stats.DenoiseTime, megapixels > 0.0f ? stats.DenoiseTime / megapixels : 0.0f);
+			ImGui::Separator();
+
+			TonemapSettings tonemap = GetTonemapSettings();
+			const char* operators[] = { "None", "Reinhard", "ACES" };
+			int tonemap_operator = static_cast<int>(tonemap.Operator);
+			bool tonemap_changed = ImGui::SliderFloat("Exposure (EV)", &tonemap.Exposure, -5.0f, 5.0f);
+			tonemap_changed |= ImGui::Combo("Tonemap", &tonemap_operator, operators, IM_ARRAYSIZE(operators));
+			tonemap_changed |= ImGui::Checkbox("sRGB Encoding", &tonemap.SRGB);
+
+			if (tonemap_changed)
+			{
+				tonemap.Operator = static_cast<TonemapOperator>(tonemap_operator);
+				SetTonemapSettings(tonemap);
+			}
+
+			ImGui::Text("Tonemap Time : %.2f ms", stats.TonemapTime);
+			ImGui::Separator();
+
+			const char* integrators[] = { "Random Walk", "BSDF Sampling", "Light Sampling (NEE + MIS)" };
+			int integrator = static_cast<int>(GetIntegrator());
+
+			if (ImGui::Combo("Integrator", &integrator, integrators, IM_ARRAYSIZE(integrators)))
+			{
+				SetIntegrator(static_cast<Integrator>(integrator));
+			}
+
+			ImGui::Text("Lights : %zu (light tree of %zu nodes built in %.2f ms)", g_SceneLights.GetLightCount(), g_SceneLights.GetNodeCount(),
+				g_SceneLights.GetBuildTime());
+
+			if (g_Environment.IsLoaded())
+			{
+				ImGui::Text("Environment : %ux%u (alias table built in %.2f ms)", g_Environment.GetWidth(), g_Environment.GetHeight(), g_Environment.GetBuildTime());
+			}
+
+			if (g_TextureCache.GetTextureCount() > 0)
+			{
+				const TextureCacheStatistics textures = g_TextureCache.GetStatistics();
+				ImGui::Text("Textures : %.1f / %.1f MB resident, %.2f%% hits, %llu stalls (%.1f ms)", textures.ResidentBytes / 1048576.0, textures.Budget / 1048576.0,
+					textures.GetHitRate() * 100.0f, (unsigned long long)textures.Stalls, textures.StallTime);
+			}
+
+			ImGui::Separator();
+
+			const char* channels[] = { "Beauty", "Albedo", "Normal", "Depth", "Object ID" };
+			int channel = static_cast<int>(GetDisplayChannel());
+
+			if (ImGui::Combo("Display", &channel, channels, IM_ARRAYSIZE(channels)))
+			{
+				SetDisplayChannel(static_cast<DisplayChannel>(channel));
+			}
+
+			bool record_aovs = g_RecordAOVs.load();
+
+			if (ImGui::Checkbox("Record AOVs", &record_aovs))
+			{
+				g_RecordAOVs.store(record_aovs);
+			}
+
+			ImGui::SameLine();
+
+			if (ImGui::Button("Export AOVs"))
+			{
+				ExportAOVs("AOV_");
+			}
+
+			ImGui::Separator();
+
+			bool deterministic = g_DeterministicSampling.load();
+
+			if (ImGui::Checkbox("Deterministic Sampling", &deterministic))
+			{
+				g_DeterministicSampling.store(deterministic);
+			}
+
+			if (ImGui::Checkbox("Show Tile Heatmap", &g_ShowHeatmap) && g_ShowHeatmap)
+			{
+				UpdateHeatmapTexture();
+			}
+
+			ImGui::SliderFloat("Heatmap Opacity", &g_HeatmapOpacity, 0.0f, 1.0f);
+
+			if (ImGui::Button("Export Heatmap"))
+			{
+				ExportTileHeatmap("TileHeatmap.ppm");
+			}
+
+#if RAYTRACER_PROFILER
+			bool profiler_enabled = Profiler::IsEnabled();
+
+			if (ImGui::Checkbox("Enable Profiler", &profiler_enabled))
+			{
+				Profiler::SetEnabled(profiler_enabled);
+			}
+
+			ImGui::SameLine();
+			ImGui::Text("(F9 to dump the trace)");
+#endif
+
+			// Tile statistics, used to tune the tile size and to spot expensive regions
+			uint finished = 0;
+			float min_time = std::numeric_limits<float>::max();
+			float max_time = 0.0f;
+			float total_time = 0.0f;
+
+			for (auto& e : g_TileRenderTimes)
+			{
+				float time = e.load(std::memory_order_relaxed);
+
+				if (time >= 0.0f)
+				{
+					finished++;
+					min_time = glm::min(min_time, time);
+					max_time = glm::max(max_time, time);
+					total_time += time;
+				}
+			}
+
+			ImGui::Text("Tiles : %u / %u (%ux%u px)", finished, g_TileCount, TILE_SIZE, TILE_SIZE);
 
+			if (finished > 0)
+			{
+				ImGui::Text("Tile Time : min %.2f ms, avg %.2f ms, max %.2f ms", min_time, total_time / finished, max_time);
+			}
+
+			float thread_max = 0.0f;
+			float thread_total = 0.0f;
+			int active_threads = 0;
+
+			// Every worker of the pool (and the thread that runs the pass), the ones the passes didn't use are skipped
+			for (size_t t = 0; t < g_ThreadRenderTimes.size(); t++)
+			{
+				float time = g_ThreadRenderTimes[t].load(std::memory_order_relaxed);
+
+				if (time <= 0.0f)
+				{
+					continue;
+				}
+
+				thread_max = glm::max(thread_max, time);
+				thread_total += time;
+				active_threads++;
+				ImGui::Text("Thread %d : %.1f ms", static_cast<int>(t), time);
+			}
+
+			if (thread_total > 0.0f)
+			{
+				// 1.0 means that every thread did the same amount of work
+				ImGui::Text("Load Imbalance : %.2fx over %d threads", thread_max / (thread_total / active_threads), active_threads);
+			}
 		}
 
 		ImGui::End();
@@ -200,13 +444,157 @@ public:
 
 	void OnEvent(Event e) override
 	{
+#if RAYTRACER_PROFILER
+		if (e.type == EventTypes::KeyPress && e.key == GLFW_KEY_F9)
+		{
+			Profiler::Dump("RayTracerProfile.json");
+		}
+#endif
+
+		if ((e.type == EventTypes::KeyPress || e.type == EventTypes::KeyRelease) && e.key >= 0 && e.key <= GLFW_KEY_LAST)
+		{
+			m_KeysDown[e.key] = e.type == EventTypes::KeyPress;
+		}
+
+		if (e.type == EventTypes::MousePress && e.button == GLFW_MOUSE_BUTTON_RIGHT && !ImGui::GetIO().WantCaptureMouse)
+		{
+			m_MouseLook = true;
+			m_FirstMouseMove = true;
+			SetCursorLocked(true);
+		}
+
+		if (e.type == EventTypes::MouseRelease && e.button == GLFW_MOUSE_BUTTON_RIGHT)
+		{
+			m_MouseLook = false;
+			SetCursorLocked(false);
+		}
+
+		if (e.type == EventTypes::MouseMove && m_MouseLook)
+		{
+			if (!m_FirstMouseMove)
+			{
+				m_CameraYaw += static_cast<float>(e.mx - m_LastMouse.x) * m_MouseSensitivity;
+				m_CameraPitch -= static_cast<float>(e.my - m_LastMouse.y) * m_MouseSensitivity;
+				m_CameraPitch = glm::clamp(m_CameraPitch, -89.0f, 89.0f);
+				m_CameraChanged = true;
+			}
+
+			m_FirstMouseMove = false;
+			m_LastMouse = glm::dvec2(e.mx, e.my);
+		}
+
+		// Render progress, posted by the trace threads
+		if (e.type == EventTypes::TileFinished)
+		{
+			// Cleared before the upload, so that a tile finishing during it queues the next one
+			g_PixelsUpdated.store(false, std::memory_order_release);
+			BufferTextureData();
+			OnPixelsUploaded();
+		}
+
+		if (e.type == EventTypes::PassFinished)
+		{
+			m_RenderFinished = false;
+
+			if (g_ShowHeatmap)
+			{
+				UpdateHeatmapTexture();
+			}
+		}
+
+		if (e.type == EventTypes::RenderFinished)
+		{
+			m_RenderFinished = true;
+		}
+
+		if (e.type == EventTypes::JobFailed)
+		{
+			std::cout << "\nRENDER JOB FAILED : " << e.message << "\n";
+			m_LastError = e.message;
+		}
+	}
+
+	bool WantsRedraw() override
+	{
+		// Held movement keys move the camera every frame without sending new events
+		const int movement_keys[] = { GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_A, GLFW_KEY_SPACE, GLFW_KEY_LEFT_CONTROL };
+
+		for (int key : movement_keys)
+		{
+			if (m_KeysDown[key])
+			{
+				return true;
+			}
+		}
 
+		return m_CameraChanged;
 	}
 
+private:
+
+	glm::vec3 GetCameraFront() const
+	{
+		const float yaw = glm::radians(m_CameraYaw);
+		const float pitch = glm::radians(m_CameraPitch);
+		return glm::normalize(glm::vec3(glm::cos(yaw) * glm::cos(pitch), glm::sin(pitch), glm::sin(yaw) * glm::cos(pitch)));
+	}
+
+	// Free flying camera, the tracer's camera is rebuilt from it whenever it changes
+	// A yaw of -90 degrees looks down -z, like the initial scene camera
+	glm::vec3 m_CameraPosition = glm::vec3(0.0f);
+	float m_CameraYaw = -90.0f;
+	float m_CameraPitch = 0.0f;
+	float m_CameraFOV = 90.0f;
+	float m_CameraSpeed = 1.5f;
+	float m_MouseSensitivity = 0.1f;
+	bool m_CameraChanged = false;
+
+	std::array<bool, GLFW_KEY_LAST + 1> m_KeysDown = {};
+	bool m_MouseLook = false;
+	bool m_FirstMouseMove = true;
+	glm::dvec2 m_LastMouse = glm::dvec2(0.0);
+	double m_LastUpdateTime = 0.0;
+
+	// Latency from a camera input to the first tile of the new view being uploaded
+	bool m_LatencyPending = false;
+	uint32_t m_LatencyGeneration = 0;
+	std::chrono::steady_clock::time_point m_InputTime;
+	float m_LastLatency = 0.0f;
+	float m_AverageLatency = 0.0f;
+
+	bool m_RenderFinished = false;
+	const char* m_LastError = nullptr;
 };
 
 RayTracerApp g_App;
 
+// Called on the trace threads, forwards the render progress to the event queue of the window
+void PostRenderProgress(const RenderEvent& render_event)
+{
+	Event e = {};
+	e.type = EventTypes::Undefined;
+	e.window = g_App.GetWindow();
+	e.ts = glfwGetTime();
+	e.tile = render_event.Tile;
+	e.samples = render_event.Samples;
+	e.generation = render_event.Generation;
+	e.message = render_event.Message;
+
+	switch (render_event.Type)
+	{
+		case RenderEventType::TileFinished: e.type = EventTypes::TileFinished; break;
+		case RenderEventType::PassFinished: e.type = EventTypes::PassFinished; break;
+		case RenderEventType::RenderFinished: e.type = EventTypes::RenderFinished; break;
+		case RenderEventType::JobFailed: e.type = EventTypes::JobFailed; break;
+	}
+
+	// Only one TileFinished is queued at a time, if it was dropped the next finished tile has to post it again
+	if (!g_App.PostEvent(e) && e.type == EventTypes::TileFinished)
+	{
+		g_PixelsUpdated.store(false, std::memory_order_release);
+	}
+}
+
 /* Creating the ray traced texture */
 void InitializeForRender()
 {
@@ -236,23 +624,42 @@ void CreateRenderTexture()
 {
 	glCreateTextures(GL_TEXTURE_2D, 1, &g_Texture);
 	glBindTexture(GL_TEXTURE_2D, g_Texture);
-	glTextureStorage2D(g_Texture, 1, GL_RGB8, g_Width, g_Height);
+	glTextureStorage2D(g_Texture, 1, GL_RGBA8, g_Width, g_Height);
 	glTextureParameteri(g_Texture, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTextureParameteri(g_Texture, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTextureParameteri(g_Texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTextureParameteri(g_Texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTextureParameteri(g_Texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // Upscales the dynamic resolution image
+	glTextureParameteri(g_Texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glGenerateMipmap(GL_TEXTURE_2D);
+
+	glCreateTextures(GL_TEXTURE_2D, 1, &g_HeatmapTexture);
+	glTextureStorage2D(g_HeatmapTexture, 1, GL_RGBA8, g_TileCountX, g_TileCountY);
+	glTextureParameteri(g_HeatmapTexture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(g_HeatmapTexture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(g_HeatmapTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTextureParameteri(g_HeatmapTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 }
 
+// Upload stage : the renderer doesn't write the published image while it is uploaded, so tracing and resolving continue meanwhile
 void BufferTextureData()
 {
+	const byte* image = AcquireDisplayImage(g_TextureRenderWidth, g_TextureRenderHeight);
+
+	if (!image)
+	{
+		return;
+	}
+
+	RT_PROFILE_ZONE("Upload");
+
 	glBindTexture(GL_TEXTURE_2D, g_Texture);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTextureSubImage2D(g_Texture, 0, 0, 0, g_Width, g_Height, GL_RGB, GL_UNSIGNED_BYTE, g_PixelData);
+	glTextureSubImage2D(g_Texture, 0, 0, 0, g_Width, g_Height, GL_RGBA, GL_UNSIGNED_BYTE, image);
 }
 
 void Render()
 {
+	RT_PROFILE_ZONE("Present");
+
 	glDisable(GL_CULL_FACE);
 	glDisable(GL_DEPTH_TEST);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -260,37 +667,31 @@ void Render()
 	g_RenderShader->Use();
 	g_RenderShader->SetInteger("u_Texture", 0);
 
+	// Only the bottom left render area of the texture is valid when the image is rendered at a lower resolution. It is the area
+	// of the uploaded image, the renderer may already be using another resolution for the next one
+	const float render_width = static_cast<float>(g_TextureRenderWidth);
+	const float render_height = static_cast<float>(g_TextureRenderHeight);
+	g_RenderShader->SetVector2f("u_UVScale", render_width / g_Width, render_height / g_Height);
+	g_RenderShader->SetVector2f("u_UVClamp", (render_width - 0.5f) / g_Width, (render_height - 0.5f) / g_Height);
+	g_RenderShader->SetInteger("u_HeatmapTexture", 1);
+	g_RenderShader->SetBool("u_ShowHeatmap", g_ShowHeatmap);
+	g_RenderShader->SetFloat("u_HeatmapOpacity", g_HeatmapOpacity);
+
+	// The tile grid can be slightly larger than the image if the size isn't a multiple of the tile size
+	g_RenderShader->SetVector2f("u_HeatmapScale", (float)g_Width / (float)(g_TileCountX * TILE_SIZE),
+		(float)g_Height / (float)(g_TileCountY * TILE_SIZE));
+
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, g_Texture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, g_HeatmapTexture);
 
 	g_VAO->Bind();
 	glDrawArrays(GL_TRIANGLES, 0, 6);
 	g_VAO->Unbind();
 }
 
-/* Pixel putter and getter functions */
-
-inline void PutPixel(const glm::ivec2& loc, const RGB& col) noexcept
-{
-	if (loc.x >= g_Width || loc.y >= g_Height) { return; }
-
-	uint _loc = (loc.x + loc.y * g_Width) * 3;
-	g_PixelData[_loc + 0] = col.r;
-	g_PixelData[_loc + 1] = col.g;
-	g_PixelData[_loc + 2] = col.b;
-}
-
-RGB GetPixel(const glm::ivec2& loc)
-{
-	RGB col;
-	uint _loc = (loc.x + loc.y * g_Width) * 3;
-
-	col.r = g_PixelData[_loc + 0];
-	col.g = g_PixelData[_loc + 1];
-	col.b = g_PixelData[_loc + 2];
-
-	return col;
-}
+const double IDLE_TIMEOUT = 0.5;
 
 /* Render Method */
 void DoRenderLoop()
@@ -299,11 +700,12 @@ void DoRenderLoop()
 
 	while (!glfwWindowShouldClose(g_App.GetWindow()))
 	{
-		if (m_CurrentFrame % 15 == 0)
-		{
-			BufferTextureData();
-		}
+		// Nothing is redrawn while the render and the input are idle, the statistics are still refreshed every IDLE_TIMEOUT seconds
+		g_App.WaitForEvents(IDLE_TIMEOUT);
+
+		RT_PROFILE_ZONE("Frame");
 
+		// The texture and the heatmap are uploaded by OnEvent, as the trace threads post their progress
 		glViewport(0, 0, g_Width, g_Height);
 
 		g_App.OnUpdate();
@@ -314,366 +716,326 @@ void DoRenderLoop()
 	}
 }
 
-/* Ray Tracing and Rendering Stuff Begins Here */
-
-// Ray Tracing Constants
+void WritePixelData()
+{
+	std::cout << std::endl << "Writing Pixel Data.." << std::endl;
+	std::cout << "Ray Tracing.." << std::endl;
 
-/* Helper Classes */
+	// Passes are added on a background thread until SPP samples are accumulated, moving the camera restarts it
+	StartProgressiveRenderer(SPP);
+}
 
-class Ray
+/*
+Renders a turntable of the built in scene without opening a window, the middle sphere bounces twice per turn.
+Usage : --sequence <frames> [--range <first> <last>] [--spp <n>] [--output <prefix>]
+*/
+int RunSequence(int argc, char** argv)
 {
-public:
+	int frames = 60;
+	SequenceSettings settings;
+	settings.LastFrame = -1;
 
-	Ray(const glm::vec3& origin, const glm::vec3& direction) :
-		m_Origin(origin), m_Direction(direction) 
+	for (int i = 1; i < argc; i++)
 	{
-		//
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--sequence" && has_value) { frames = std::max(1, std::atoi(argv[++i])); }
+		else if (arg == "--range" && i + 2 < argc) { settings.FirstFrame = std::atoi(argv[++i]); settings.LastFrame = std::atoi(argv[++i]); }
+		else if (arg == "--spp" && has_value) { settings.SPP = std::max(1, std::atoi(argv[++i])); }
+		else if (arg == "--output" && has_value) { settings.OutputPrefix = argv[++i]; }
+		else
+		{
+			std::cout << "Usage : " << argv[0] << " --sequence <frames> [--range <first> <last>] [--spp <n>] [--output <prefix>]\n";
+			return 1;
+		}
 	}
 
-	const glm::vec3& GetOrigin() const noexcept
+	if (settings.LastFrame < 0)
 	{
-		return m_Origin;
+		settings.LastFrame = frames - 1;
 	}
 
-	const glm::vec3& GetDirection() const noexcept
-	{
-		return m_Direction;
-	}
+	Sequence sequence = Sequence::Turntable(glm::vec3(0.0f, 0.0f, -1.0f), 2.5f, 0.75f, 60.0f, frames);
+	const Sphere& bouncing = Spheres[1];
 
-	glm::vec3 GetAt(floatp scale) const noexcept
+	for (int k = 0; k <= 4; k++)
 	{
-		return m_Origin + (m_Direction * glm::vec3(scale));
+		SphereKeyframe keyframe;
+		keyframe.Frame = (float)frames * (float)k / 4.0f;
+		keyframe.Center = bouncing.Center + glm::vec3(0.0f, (k % 2) ? 0.5f : 0.0f, 0.0f);
+		keyframe.Radius = bouncing.Radius;
+		sequence.AddSphereKeyframe(1, keyframe);
 	}
 
-private:
+	std::cout << "Rendering frames " << settings.FirstFrame << " to " << settings.LastFrame << " at " << settings.SPP << " spp.." << std::endl;
 
-	glm::vec3 m_Origin;
-	glm::vec3 m_Direction;
-};
+	SequenceStatistics stats = RenderSequence(sequence, settings);
 
-enum class Material
-{
-	Glass = 0,
-	Diffuse,
-	Metal,
-	FuzzyMetal
-};
+	std::cout << "\n" << stats.Frames << " frames in " << stats.TotalTime << " s, " << stats.FramesPerHour << " frames per hour ("
+		<< stats.OverheadTime << " ms overhead per frame)" << std::endl;
 
-class Sphere
-{
-public :
+	return 0;
+}
 
-	glm::vec3 Center;
-	glm::vec3 Color;
-	float Radius;
-	Material SphereMaterial;
-	float FuzzLevel;
+/*
+Renders the built in scene without opening a window, for long renders at high sample counts.
+Usage : --render <spp> [--output <image.ppm>] [--checkpoint <path>] [--checkpoint-interval <seconds>] [--time-limit <seconds>] [--resume]
+	[--integrator <random-walk|bsdf|lights>] [--light <x> <y> <z> <radius> <radiance>]... [--sky <intensity>]
+	[--environment <image.hdr|image.pfm>] [--environment-rotation <degrees>] [--texture <sphere> <texture.rtt>]... [--texture-budget <MB>]
+*/
+int RunRender(int argc, char** argv)
+{
+	int spp = SPP;
+	std::string output = "Render.ppm";
+	CheckpointSettings checkpoint;
+	std::string environment;
+	int threads = THREAD_SPAWN_COUNT;
 
-	Sphere(const glm::vec3& center, const glm::vec3& color, float radius, Material mat, float fuzz = 0.0f) :
-		Center(center),
-		Color(color),
-		Radius(radius),
-		SphereMaterial(mat),
-		FuzzLevel(fuzz)
+	for (int i = 1; i < argc; i++)
 	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--render" && has_value) { spp = std::max(1, std::atoi(argv[++i])); }
+		else if (arg == "--threads" && has_value) { threads = glm::clamp(std::atoi(argv[++i]), 1, GetMaxThreadCount()); }
+		else if (arg == "--output" && has_value) { output = argv[++i]; }
+		else if (arg == "--checkpoint" && has_value) { checkpoint.Path = argv[++i]; }
+		else if (arg == "--checkpoint-interval" && has_value) { checkpoint.Interval = std::max(0.0f, (float)std::atof(argv[++i])); }
+		else if (arg == "--time-limit" && has_value) { checkpoint.TimeLimit = std::max(0.0f, (float)std::atof(argv[++i])); }
+		else if (arg == "--resume") { checkpoint.Resume = true; }
+		else if (arg == "--integrator" && has_value && std::string(argv[i + 1]) == "random-walk") { g_Integrator = Integrator::RandomWalk; i++; }
+		else if (arg == "--integrator" && has_value && std::string(argv[i + 1]) == "bsdf") { g_Integrator = Integrator::BSDFSampling; i++; }
+		else if (arg == "--integrator" && has_value && std::string(argv[i + 1]) == "lights") { g_Integrator = Integrator::LightSampling; i++; }
+		else if (arg == "--sky" && has_value) { g_SkyIntensity = std::max(0.0f, (float)std::atof(argv[++i])); }
+		else if (arg == "--environment" && has_value) { environment = argv[++i]; }
+		else if (arg == "--environment-rotation" && has_value) { g_Environment.SetRotation((float)std::atof(argv[++i])); }
+		else if (arg == "--texture-budget" && has_value) { g_TextureCache.SetBudget(static_cast<size_t>(std::max(0.0, std::atof(argv[++i])) * 1048576.0)); }
+		else if (arg == "--texture" && i + 2 < argc)
+		{
+			const int sphere = std::atoi(argv[i + 1]);
+			const int texture = g_TextureCache.Open(argv[i + 2]);
+			i += 2;
+
+			if (texture < 0 || sphere < 0 || sphere >= (int)Spheres.size())
+			{
+				std::cout << "Could not texture sphere " << sphere << std::endl;
+				return 1;
+			}
+
+			Spheres[sphere].Texture = texture;
+		}
+		else if (arg == "--light" && i + 5 < argc)
+		{
+			const glm::vec3 center = glm::vec3(std::atof(argv[i + 1]), std::atof(argv[i + 2]), std::atof(argv[i + 3]));
+			Spheres.emplace_back(center, glm::vec3((float)std::atof(argv[i + 5])), (float)std::atof(argv[i + 4]), Material::Emissive);
+			i += 5;
+		}
 
+		else
+		{
+			std::cout << "Usage : " << argv[0] << " --render <spp> [--threads <n>] [--output <image.ppm>] [--checkpoint <path>] [--checkpoint-interval <seconds>] "
+				"[--time-limit <seconds>] [--resume] [--integrator <random-walk|bsdf|lights>] [--light <x> <y> <z> <radius> <radiance>]... [--sky <intensity>] "
+				"[--environment <image.hdr|image.pfm>] [--environment-rotation <degrees>] [--texture <sphere> <texture.rtt>]... [--texture-budget <MB>]\n";
+			return 1;
+		}
 	}
 
-	Sphere() :
-		Center(glm::vec3(0.0f)),
-		Color(glm::vec3(0.0f)),
-		Radius(0.0f),
-		SphereMaterial(Material::Diffuse),
-		FuzzLevel(0.0f)
+	if (!environment.empty())
 	{
+		if (!g_Environment.Load(environment))
+		{
+			return 1;
+		}
 
+		std::cout << "Environment map " << g_Environment.GetWidth() << "x" << g_Environment.GetHeight() << ", alias table built in "
+			<< g_Environment.GetBuildTime() << " ms" << std::endl;
 	}
-};
 
-inline bool PointIsInSphere(const glm::vec3& point, float radius)
-{
-	return ((point.x * point.x) + (point.y * point.y) + (point.z * point.z)) < (radius * radius);
-}
+	std::cout << "Rendering at " << spp << " spp on " << threads << " threads.." << std::endl;
+	auto start = std::chrono::steady_clock::now();
 
-inline glm::vec3 GeneratePointInUnitSphere()
-{
-	glm::vec3 ReturnVal;
+	if (!TraceSceneCheckpointed(spp, checkpoint, threads))
+	{
+		std::cout << "Stopped at the time limit, continue with --resume (" << checkpoint.Path << ")" << std::endl;
+		return 0;
+	}
 
-	ReturnVal.x = RandomFloat(-1.0f, 1.0f);
-	ReturnVal.y = RandomFloat(-1.0f, 1.0f);
-	ReturnVal.z = RandomFloat(-1.0f, 1.0f);
+	std::cout << "Rendered in " << std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
 
-	while (!PointIsInSphere(ReturnVal, 1.0f))
+	if (g_TextureCache.GetTextureCount() > 0)
 	{
-		ReturnVal.x = RandomFloat(-1.0f, 1.0f);
-		ReturnVal.y = RandomFloat(-1.0f, 1.0f);
-		ReturnVal.z = RandomFloat(-1.0f, 1.0f);
+		const TextureCacheStatistics textures = g_TextureCache.GetStatistics();
+		std::cout << "Textures : " << textures.GetHitRate() * 100.0f << "% hits, " << textures.Misses << " misses, " << textures.Evictions << " evictions, "
+			<< textures.BytesRead / 1048576 << " MB read, " << textures.ResidentBytes / 1048576 << " of " << textures.Budget / 1048576 << " MB resident, "
+			<< textures.Stalls << " stalls (" << textures.StallTime << " ms)" << std::endl;
 	}
 
-	return ReturnVal;
+	return WritePPM(output, g_Width, g_Height, GetPixelDataRGB().data()) ? 0 : 1;
 }
 
-class Camera
+/*
+Renders the built in scene on worker processes (see Core/Distributed.h).
+Usage : --coordinator <port> [--render <spp>] [--output <image.ppm>] [--tiles-per-job <n>] [--worker-timeout <seconds>]
+	[--idle-timeout <seconds>] [--spawn <workers>] [--spawn-threads <n>] [--spawn-fail-after <jobs>]
+*/
+int RunCoordinator(int argc, char** argv)
 {
-public:
+	CoordinatorSettings settings;
+	settings.Executable = argv[0];
+	std::string output = "Render.ppm";
 
-	Camera(const glm::vec3& lookfrom, const glm::vec3& lookat, const glm::vec3& up, 
-		float fov) : m_FOV(fov)
+	for (int i = 1; i < argc; i++)
 	{
-		float theta = glm::radians(fov);
-		float H = glm::tan(theta / 2.0f);
-
-		m_ViewportHeight = 2.0f * H;
-		m_ViewportWidth = m_ViewportHeight * m_AspectRatio;
-
-		auto w = glm::normalize(lookfrom - lookat);
-		auto u = glm::normalize(glm::cross(up, w));
-		auto v = glm::cross(w, u);
-
-		m_Origin = lookfrom;
-		m_Horizontal = m_ViewportWidth * u;
-		m_Vertical = m_ViewportHeight * v;
-		m_BottomLeft = m_Origin - (m_Horizontal / 2.0f) - (m_Vertical / 2.0f) - w;
-
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--coordinator" && has_value) { settings.Port = static_cast<uint16_t>(std::atoi(argv[++i])); }
+		else if (arg == "--render" && has_value) { settings.SPP = std::max(1, std::atoi(argv[++i])); }
+		else if (arg == "--output" && has_value) { output = argv[++i]; }
+		else if (arg == "--tiles-per-job" && has_value) { settings.TilesPerJob = std::max(1, std::atoi(argv[++i])); }
+		else if (arg == "--worker-timeout" && has_value) { settings.WorkerTimeout = std::max(0.0f, (float)std::atof(argv[++i])); }
+		else if (arg == "--idle-timeout" && has_value) { settings.IdleTimeout = std::max(0.0f, (float)std::atof(argv[++i])); }
+		else if (arg == "--spawn" && has_value) { settings.SpawnWorkers = std::max(0, std::atoi(argv[++i])); }
+		else if (arg == "--spawn-threads" && has_value) { settings.SpawnWorkerThreads = std::max(0, std::atoi(argv[++i])); }
+		else if (arg == "--spawn-fail-after" && has_value) { settings.SpawnFailAfter = std::max(0, std::atoi(argv[++i])); }
+		else
+		{
+			std::cout << "Usage : " << argv[0] << " --coordinator <port> [--render <spp>] [--output <image.ppm>] [--tiles-per-job <n>] "
+				"[--worker-timeout <seconds>] [--idle-timeout <seconds>] [--spawn <workers>] [--spawn-threads <n>] [--spawn-fail-after <jobs>]\n";
+			return 1;
+		}
 	}
 
-	inline Ray GetRay(float u, float v) const 
+	CoordinatorStatistics stats;
+
+	if (!RayTracer::RunCoordinator(settings, stats))
 	{
-		Ray ray(m_Origin, m_BottomLeft + (m_Horizontal * u) + (v * m_Vertical) - m_Origin);
-		return ray;
+		return 1;
 	}
 
-private :
-	glm::vec3 m_Origin = glm::vec3(0.0f);
-	const float m_AspectRatio = 16.0f / 9.0f; // Window aspect ratio. Easier to keep it as 16:9
-	const float m_FocalLength = 1.0f;
-
-	// Viewport stuff
-	float m_ViewportHeight;
-	float m_ViewportWidth;
-	glm::vec3 m_Horizontal;
-	glm::vec3 m_Vertical;
-	glm::vec3 m_BottomLeft;
+	std::cout << "\nRendered in " << stats.TotalTime << " s, " << stats.Concurrency << " of " << stats.ContributingWorkers
+		<< " workers tracing on average (" << stats.Efficiency * 100.0f << "% efficiency, " << stats.ReassignedJobs << " jobs reassigned)" << std::endl;
 
-	float m_FOV;
-};
-
-inline RGB GetGradientColorAtRay(const Ray& ray)
-{
-	const glm::vec3 ray_direction = ray.GetDirection();
-	glm::vec3 v = Lerp(glm::vec3(255.0f, 255.0f, 255.0f), glm::vec3(128.0f, 178.0f, 255.0f), ray_direction.y * 1.8f);
+	for (size_t w = 0; w < stats.Workers.size(); w++)
+	{
+		const WorkerStatistics& worker = stats.Workers[w];
+		std::cout << "Worker " << w << " : " << worker.Threads << " threads, " << worker.Tiles << " tiles in " << worker.Jobs << " jobs, "
+			<< worker.RenderTime << " s tracing, efficiency " << worker.GetEfficiency() * 100.0f << "%" << (worker.Failed ? " (failed)" : "") << std::endl;
+	}
 
-	return ToRGB(glm::ivec3(v));
+	return WritePPM(output, g_Width, g_Height, GetPixelDataRGB().data()) ? 0 : 1;
 }
 
-inline bool RaySphereIntersectionTest(const Sphere& sphere, const Ray& ray, float tmin, float tmax, RayHitRecord& hit_record) 
+// Usage : --worker <host:port> [--threads <n>] [--exit-after <jobs>]
+int RunWorker(int argc, char** argv)
 {
-	// p(t) = t²b⋅b+2tb⋅(A−C)+(A−C)⋅(A−C)−r² = 0
-	// The discriminant of this equation tells us the number of possible solutions
-	// we calculate that discriminant of the equation 
+	WorkerSettings settings;
 
-	glm::vec3 oc = ray.GetOrigin() - sphere.Center;
-	float A = glm::dot(ray.GetDirection(), ray.GetDirection());
-	float B = 2.0 * glm::dot(oc, ray.GetDirection());
-	float C = dot(oc, oc) - sphere.Radius * sphere.Radius;
-	float Discriminant = B * B - 4 * A * C;
-	
-	if (Discriminant < 0)
+	for (int i = 1; i < argc; i++)
 	{
-		return false;
-	}
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
 
-	else
-	{
-		// Solve the quadratic equation and
-		// find t (T is the distance from the ray origin to the center of the sphere)
-		float root = (-B - glm::sqrt(Discriminant)) / (2.0f * A); // T
-
-		if (root < tmin || root > tmax)
+		if (arg == "--worker" && has_value)
 		{
-			root = (-B + glm::sqrt(Discriminant)) / (2.0f * A);
-
-			if (root < tmin || root > tmax)
-			{
-				return false;
-			}
+			std::string address = argv[++i];
+			size_t colon = address.rfind(':');
+			settings.Host = address.substr(0, colon);
+			settings.Port = colon == std::string::npos ? settings.Port : static_cast<uint16_t>(std::atoi(address.c_str() + colon + 1));
 		}
 
-		// The root was found successfully 
-		hit_record.T = root;
-		hit_record.Point = ray.GetAt(root);
-
-		// TODO ! : CHECK THIS! 
-		// SHOULD THE RADIUS BE MULTIPLIED HERE?
-		hit_record.Normal = (hit_record.Point - sphere.Center) / sphere.Radius;
-		
-		if (glm::dot(ray.GetDirection(), hit_record.Normal) > 0.0f)
-		{
-			hit_record.Normal = -hit_record.Normal;
-			hit_record.Inside = true;
-		}
-		
-		return true;
-	}
-}
-
-std::vector<Sphere> Spheres = 
-{ 
-	Sphere(glm::vec3(-1.0, 0.0, -1.0), glm::vec3(0.8f, 0.6f, 0.2f), 0.5f, Material::Metal, 0.65f),
-	Sphere(glm::vec3(0.0, 0.0, -1.0), glm::vec3(255, 0, 0), 0.5f, Material::Diffuse),
-	Sphere(glm::vec3(1.0, 0.0, -1.0), glm::vec3(0.8f, 0.8f, 0.8f), 0.5f, Material::Metal, 0.0f),
-	Sphere(glm::vec3(0.0f, -100.5f, -1.0f), glm::vec3(255, 215, 10), 100.0f, Material::Diffuse)
-};
-
-bool IntersectSceneSpheres(const Ray& ray, float tmin, float tmax, RayHitRecord& closest_hit_rec, Sphere& sphere)
-{
-	RayHitRecord TempRecord;
-	bool HitAnything = false;
-	float ClosestDistance = tmax;
-
-	for (auto& e : Spheres)
-	{
-		// T is the distance of ray origin to the sphere's center
-		// RaySphereIntersectionTest(e, ray, 0.0f, _INFINITY);
-
-		if (RaySphereIntersectionTest(e, ray, tmin, ClosestDistance, TempRecord))
+		else if (arg == "--threads" && has_value) { settings.Threads = std::max(1, std::atoi(argv[++i])); }
+		else if (arg == "--exit-after" && has_value) { settings.ExitAfterJobs = std::max(0, std::atoi(argv[++i])); }
+		else
 		{
-			HitAnything = true;
-			ClosestDistance = TempRecord.T;
-			closest_hit_rec = TempRecord;
-			sphere = e;
+			std::cout << "Usage : " << argv[0] << " --worker <host:port> [--threads <n>] [--exit-after <jobs>]\n";
+			return 1;
 		}
 	}
 
-	return HitAnything;
+	return RayTracer::RunWorker(settings) ? 0 : 1;
 }
 
-RGB GetRayColor(const Ray& ray, int ray_depth)
+// Usage : --make-texture <image.ppm> <output.rtt>, converts an image to the tiled and mipmapped format of the texture cache
+int RunMakeTexture(int argc, char** argv)
 {
-	Sphere hit_sphere;
-
-	if (ray_depth <= 0)
+	if (argc != 4)
 	{
-		return RGB(0, 0, 0);
+		std::cout << "Usage : " << argv[0] << " --make-texture <image.ppm> <output.rtt>\n";
+		return 1;
 	}
 
-	RayHitRecord ClosestSphere;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> rgb;
 
-	if (IntersectSceneSpheres(ray, 0.001f, _INFINITY, ClosestSphere, hit_sphere))
+	if (!ReadPPM(argv[2], width, height, rgb) || !WriteTiledTexture(argv[3], width, height, rgb))
 	{
-		if (hit_sphere.SphereMaterial == Material::Diffuse)
-		{
-			glm::vec3 S = ClosestSphere.Normal + GeneratePointInUnitSphere();
-			Ray new_ray(ClosestSphere.Point, S);
-
-			RGB Ray_Color = GetRayColor(new_ray, ray_depth - 1);
-			Ray_Color.r = Ray_Color.r / 2;
-			Ray_Color.g = Ray_Color.g / 2;
-			Ray_Color.b = Ray_Color.b / 2;
-
-			glm::vec3 Color = { Ray_Color.r, Ray_Color.g, Ray_Color.b };
-			glm::vec3 FinalColor = hit_sphere.Color * Color;
-			//glm::vec3 FinalColor = glm::mix(hit_sphere.Color, Color, 0.4f);
-
-			return ToRGB(FinalColor);
-		}
-
-		else if (hit_sphere.SphereMaterial == Material::Metal)
-		{
-			glm::vec3 ReflectedRayDirection = glm::reflect(ray.GetDirection(), ClosestSphere.Normal);
-			ReflectedRayDirection += hit_sphere.FuzzLevel * GeneratePointInUnitSphere();
-			Ray new_ray(ClosestSphere.Point, ReflectedRayDirection);
-
-			RGB Ray_Color = GetRayColor(new_ray, ray_depth - 1);
-			glm::vec3 Color = { Ray_Color.r, Ray_Color.g, Ray_Color.b };
-			glm::vec3 FinalColor = hit_sphere.Color * Color;
-
-			return ToRGB(FinalColor);
-		}
-
-		return RGB(255, 255, 255);
+		return 1;
 	}
 
-	return GetGradientColorAtRay(ray);
+	std::cout << "Wrote " << argv[3] << " (" << width << "x" << height << ")" << std::endl;
+	return 0;
 }
 
-/*Camera g_SceneCamera(glm::vec3(-2.0f, 2.0f, 1.0f),
-	glm::vec3(0.0f, 0.0f, -1.0f),
-	glm::vec3(0.0f, 1.0f, 0.0f),
-	90.0f);*/ 
-
-Camera g_SceneCamera(glm::vec3(0.0f),
-	glm::vec3(0.0f, 0.0f, -1.0f),
-	glm::vec3(0.0f, 1.0f, 0.0f),
-	90.0f);
-
-const int SPP = 100;
-const int RAY_DEPTH = 10;
-
-void TraceThreadFunction(int xstart, int ystart, int xsize, int ysize)
+int main(int argc, char** argv)
 {
-	for (int i = xstart; i < xstart + xsize; i++)
-	{
-		//std::this_thread::sleep_for(std::chrono::microseconds(8));
+	RT_PROFILE_THREAD("Main Thread");
 
-		for (int j = ystart; j < ystart + ysize; j++)
+	// --pin-threads can be added to any mode (or be the only argument), it pins the pool workers before they start
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) != "--pin-threads")
 		{
-			glm::ivec3 FinalColor;
-
-			for (int s = 0; s < SPP; s++)
-			{
-				// Calculate the UV Coordinates
-
-				float u = ((float)i + RandomFloat()) / (float)g_Width;
-				float v = ((float)j + RandomFloat()) / (float)g_Height;
-
-				Ray ray = g_SceneCamera.GetRay(u, v);
-				RGB ray_color = GetRayColor(ray, RAY_DEPTH);
+			continue;
+		}
 
-				FinalColor.r += ray_color.r;
-				FinalColor.g += ray_color.g;
-				FinalColor.b += ray_color.b;
-			}
-			
-			FinalColor.r = (FinalColor.r / SPP);
-			FinalColor.g = (FinalColor.g / SPP);
-			FinalColor.b = (FinalColor.b / SPP);
+		std::copy(argv + i + 1, argv + argc, argv + i);
+		argc--;
 
-			PutPixel(glm::ivec2(i, j), ToRGB(FinalColor));
+		if (!g_ThreadPool.SetPinning(true))
+		{
+			std::cout << "\nCOULD NOT QUERY THE PROCESSOR TOPOLOGY, THE WORKERS ARE NOT PINNED\n";
+			break;
 		}
+
+		std::cout << "Pinned " << g_ThreadPool.GetWorkerCount() << " workers to " << g_ThreadPool.GetCoreCount() << " cores on "
+			<< g_ThreadPool.GetNodeCount() << " NUMA nodes\n";
+		break;
 	}
-}
 
-void TraceScene()
-{
-	const int sizex = g_Width / THREAD_SPAWN_COUNT;
-	const int sizey = g_Height;
+	// Before anything else writes the framebuffer, so that its pages are placed on the nodes that render them
+	InitializeFramebuffer();
 
-	for (int t = 0; t < THREAD_SPAWN_COUNT; t++)
+	if (argc > 1)
 	{
-		std::thread thread(TraceThreadFunction, sizex * t, 0, sizex, sizey);
-		thread.detach();
+		const std::string mode = argv[1];
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(5));
-	}
-}
+		if (mode == "--render") { return RunRender(argc, argv); }
+		if (mode == "--coordinator") { return RunCoordinator(argc, argv); }
+		if (mode == "--worker") { return RunWorker(argc, argv); }
+		if (mode == "--make-texture") { return RunMakeTexture(argc, argv); }
 
-void WritePixelData()
-{
-	std::cout << std::endl << "Writing Pixel Data.." << std::endl;
-	std::cout << "Ray Tracing.." << std::endl;
-	TraceScene();
-}
+		return RunSequence(argc, argv);
+	}
 
-int main()
-{
 	g_App.Initialize();
 	InitializeForRender();
 
 	CreateRenderTexture();
+	SetRenderEventCallback(PostRenderProgress);
 	WritePixelData();
 
 	DoRenderLoop();
+	StopProgressiveRenderer();
+
+#if RAYTRACER_PROFILER
+	if (Profiler::IsEnabled())
+	{
+		Profiler::Dump("RayTracerProfile.json");
+	}
+#endif
 
 	return 0;
 }